@@ -0,0 +1,111 @@
+#include "../client/async_client.h"
+#include "../util/latency_histogram.h"
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t KEYS_COUNT = 1000;
+
+struct Results {
+    std::mutex mutex;
+    LatencyHistogram latencies;
+    size_t errors = 0;
+};
+
+// One of many concurrent lookups: gets random keys one after another until the end
+boost::asio::awaitable<void> lookups(AsyncClient& client, Clock::time_point end, uint32_t seed, Results& results) {
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<size_t> key_dist(0, KEYS_COUNT - 1);
+    LatencyHistogram latencies;
+    size_t errors = 0;
+    while (Clock::now() < end) {
+        auto begin = Clock::now();
+        boost::system::error_code error;
+        auto response = co_await client.async_get("key_" + std::to_string(key_dist(gen)),
+            boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        if (error || !response.ok) {
+            ++errors;
+            continue;
+        }
+        latencies.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count());
+    }
+    std::lock_guard lock(results.mutex);
+    results.latencies.merge(latencies);
+    results.errors += errors;
+}
+
+}
+
+// Gets from many coroutines sharing one AsyncClient, driven by a few threads:
+// throughput and latency against the number of requests in flight
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <host> <port> [threads] [connections] [duration_s] [--binary]" << std::endl;
+        return 1;
+    }
+    std::string host = argv[1];
+    uint16_t port = std::stoi(argv[2]);
+    size_t threads_count = argc > 3 ? std::stoul(argv[3]) : 2;
+    AsyncClientOptions options;
+    options.connections = argc > 4 ? std::stoul(argv[4]) : 4;
+    double duration_s = argc > 5 ? std::stod(argv[5]) : 5;
+    if (argc > 6 && std::string(argv[6]) == "--binary") {
+        options.protocol = Client::Protocol::BINARY;
+    }
+
+    boost::asio::io_context io_context;
+    AsyncClient client(io_context, host, port, options);
+    auto work = boost::asio::make_work_guard(io_context);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < threads_count; ++i) {
+        threads.emplace_back([&io_context] {
+            io_context.run();
+        });
+    }
+    // Let the connections come up, so that the first requests don't wait for them
+    auto connect_deadline = Clock::now() + options.connect_timeout;
+    while (client.connected_count() < options.connections && Clock::now() < connect_deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    std::cout << "in_flight\trequests_per_sec\tmean_us\tp99_us\terrors" << std::endl;
+    for (size_t in_flight = 1; in_flight <= 4096; in_flight *= 4) {
+        Results results;
+        auto begin = Clock::now();
+        auto end = begin + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(duration_s));
+        std::atomic<size_t> running = in_flight;
+        for (size_t i = 0; i < in_flight; ++i) {
+            boost::asio::co_spawn(io_context, lookups(client, end, i, results), [&running](std::exception_ptr) {
+                --running;
+            });
+        }
+        while (running > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        double elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+        std::cout << in_flight << "\t" << results.latencies.count() / elapsed << "\t" << results.latencies.mean() / 1000
+            << "\t" << results.latencies.percentile(99) / 1000.0 << "\t" << results.errors << std::endl;
+    }
+
+    work.reset();
+    io_context.stop();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return 0;
+}
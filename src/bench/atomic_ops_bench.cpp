@@ -0,0 +1,162 @@
+#include "../client/client.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class Mode {
+    // Server-side increment, one round trip
+    INCR,
+    // get, add on the client, set: two round trips, concurrent updates overwrite each other
+    GET_SET,
+    // get, add on the client, cas; repeated until the cas applies
+    GET_CAS,
+};
+
+struct Result {
+    double ops_per_sec = 0;
+    // Increments that were acknowledged
+    size_t ops = 0;
+    // Round trips per acknowledged increment
+    double round_trips_per_op = 0;
+    size_t retries = 0;
+    // Acknowledged increments missing from the counters
+    int64_t lost_updates = 0;
+    size_t errors = 0;
+};
+
+int64_t parse_counter(const std::string& value) {
+    int64_t number = 0;
+    std::from_chars(value.data(), value.data() + value.size(), number);
+    return number;
+}
+
+std::string counter_key(const std::string& mode_name, size_t index) {
+    return "counter_" + mode_name + "_" + std::to_string(index);
+}
+
+// Threads increment counters_count counters picked at random for duration, each thread over a connection of its own
+Result run(const std::string& host, uint16_t port, Client::Protocol protocol, Mode mode, const std::string& mode_name,
+        size_t threads_count, size_t counters_count, std::chrono::milliseconds duration) {
+    {
+        Client client(host, port, protocol);
+        for (size_t i = 0; i < counters_count; ++i) {
+            client.set(counter_key(mode_name, i), "0");
+        }
+    }
+
+    std::atomic<size_t> ops = 0;
+    std::atomic<size_t> round_trips = 0;
+    std::atomic<size_t> retries = 0;
+    std::atomic<size_t> errors = 0;
+    auto end = Clock::now() + duration;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threads_count; ++t) {
+        threads.emplace_back([&, t] {
+            Client client(host, port, protocol);
+            std::mt19937 gen(t);
+            std::uniform_int_distribution<size_t> counter_dist(0, counters_count - 1);
+            size_t thread_ops = 0;
+            size_t thread_round_trips = 0;
+            size_t thread_retries = 0;
+            size_t thread_errors = 0;
+            while (Clock::now() < end) {
+                auto key = counter_key(mode_name, counter_dist(gen));
+                bool done = false;
+                if (mode == Mode::INCR) {
+                    auto [response, sent] = client.incr(key);
+                    ++thread_round_trips;
+                    done = sent && response.ok && response.applied;
+                } else {
+                    for (bool first = true; !done; first = false) {
+                        if (!first) {
+                            ++thread_retries;
+                        }
+                        auto [current, got] = client.get(key);
+                        ++thread_round_trips;
+                        if (!got || !current.ok) {
+                            break;
+                        }
+                        auto next = std::to_string(parse_counter(current.value) + 1);
+                        auto [response, sent] = mode == Mode::GET_SET ? client.set(key, next) : client.cas(key, current.value, next);
+                        ++thread_round_trips;
+                        if (!sent || !response.ok) {
+                            break;
+                        }
+                        done = mode == Mode::GET_SET || response.applied;
+                    }
+                }
+                if (done) {
+                    ++thread_ops;
+                    continue;
+                }
+                ++thread_errors;
+                // A request that failed to send closed the connection
+                client.connect();
+            }
+            ops += thread_ops;
+            round_trips += thread_round_trips;
+            retries += thread_retries;
+            errors += thread_errors;
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    Client client(host, port, protocol);
+    int64_t total = 0;
+    for (size_t i = 0; i < counters_count; ++i) {
+        total += parse_counter(client.get(counter_key(mode_name, i)).first.value);
+    }
+
+    Result result;
+    result.ops = ops;
+    result.ops_per_sec = ops / std::chrono::duration<double>(duration).count();
+    result.round_trips_per_op = double(round_trips) / std::max<size_t>(ops, 1);
+    result.retries = retries;
+    result.lost_updates = int64_t(ops) - total;
+    result.errors = errors;
+    return result;
+}
+
+}
+
+// Concurrent increments of a few hot counters: server-side incr against the client-side get+set
+// and get+cas loops. Counters start at 0, so increments that were acknowledged but are not in
+// the counters at the end were lost to races.
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <host> <port> [threads] [counters] [duration_s] [--binary]" << std::endl;
+        return 1;
+    }
+    std::string host = argv[1];
+    uint16_t port = std::stoi(argv[2]);
+    size_t threads_count = argc > 3 ? std::stoul(argv[3]) : 8;
+    size_t counters_count = argc > 4 ? std::max(1ul, std::stoul(argv[4])) : 4;
+    auto duration = std::chrono::milliseconds(static_cast<int64_t>((argc > 5 ? std::stod(argv[5]) : 5) * 1000));
+    auto protocol = argc > 6 && std::string(argv[6]) == "--binary" ? Client::Protocol::BINARY : Client::Protocol::JSON;
+
+    std::cout << "mode\tops_per_sec\tround_trips_per_op\tretries\tlost_updates\terrors" << std::endl;
+    for (auto [mode, name] : {std::pair(Mode::INCR, "incr"), std::pair(Mode::GET_SET, "get_set"), std::pair(Mode::GET_CAS, "get_cas")}) {
+        auto result = run(host, port, protocol, mode, name, threads_count, counters_count, duration);
+        std::cout << name
+            << "\t" << result.ops_per_sec
+            << "\t" << result.round_trips_per_op
+            << "\t" << result.retries
+            << "\t" << result.lost_updates
+            << "\t" << result.errors << std::endl;
+    }
+    return 0;
+}
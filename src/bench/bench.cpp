@@ -0,0 +1,616 @@
+#include "bench_storage.h"
+
+#include "../client/client.h"
+#include "../server/io_context_pool.h"
+#include "../server/request_processor.h"
+#include "../server/server.h"
+#include "../server/storage.h"
+#include "../util/binary_protocol.h"
+#include "../util/log.h"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+
+
+// Allocations of the calling thread, for the check that gets don't allocate in steady state
+thread_local size_t allocations_count = 0;
+
+void* operator new(size_t size) {
+    ++allocations_count;
+    if (void* p = std::malloc(size > 0 ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+using bench::VALUE_SIZE;
+using bench::make_key;
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t BATCH_SIZE = 64;
+// Requests of a thread go to keys picked in advance, so that making keys stays out of the timing
+constexpr size_t SAMPLE_SIZE = 4096;
+
+struct Options {
+    // Only benchmarks with the substring in their names run
+    std::string filter;
+    // Smaller dictionaries and fewer operations, for a check that takes seconds
+    bool quick = false;
+    size_t repetitions = 5;
+    // Results of a previous run to compare with
+    std::string baseline_path;
+    // A benchmark slower than in the baseline by more than this is a regression
+    double threshold_percent = 10;
+};
+
+// Operations done in one repetition of a benchmark and the time they took, setup excluded
+struct Measurement {
+    size_t ops = 0;
+    double seconds = 0;
+};
+
+struct Result {
+    std::string name;
+    // Median over the repetitions
+    double ns_per_op = 0;
+    double min_ns_per_op = 0;
+};
+
+template <class F>
+Measurement timed(size_t ops, F&& f) {
+    auto start = Clock::now();
+    f();
+    return {ops, std::chrono::duration<double>(Clock::now() - start).count()};
+}
+
+// Runs benchmarks and prints a line of tab-separated results for every one of them
+class Suite {
+public:
+    explicit Suite(const Options& options)
+        : options_(options) {
+    }
+
+    const Options& options() const {
+        return options_;
+    }
+
+    bool selected(std::string_view name) const {
+        return name.find(options_.filter) != std::string_view::npos;
+    }
+
+    // Groups check their names before building dictionaries for them
+    bool any_selected(const std::vector<std::string>& names) const {
+        return std::any_of(names.begin(), names.end(), [this](const std::string& name) {
+            return selected(name);
+        });
+    }
+
+    // repetition is called once to warm up and then options.repetitions times
+    void run(const std::string& name, const std::function<Measurement()>& repetition) {
+        if (!selected(name)) {
+            return;
+        }
+        repetition();
+        std::vector<double> ns_per_op;
+        for (size_t i = 0; i < options_.repetitions; ++i) {
+            auto measurement = repetition();
+            ns_per_op.push_back(measurement.seconds * 1e9 / std::max<size_t>(measurement.ops, 1));
+        }
+        std::sort(ns_per_op.begin(), ns_per_op.end());
+        Result result{name, ns_per_op[ns_per_op.size() / 2], ns_per_op.front()};
+        std::cout << result.name << "\t" << result.ns_per_op << "\t" << 1e9 / result.ns_per_op
+            << "\t" << result.min_ns_per_op << std::endl;
+        results_.push_back(std::move(result));
+    }
+
+    const std::vector<Result>& results() const {
+        return results_;
+    }
+
+    // A check of a benchmark failed, the run ends with an error
+    void fail(const std::string& message) {
+        std::cerr << message << std::endl;
+        failed_ = true;
+    }
+
+    bool failed() const {
+        return failed_;
+    }
+
+private:
+    const Options options_;
+    std::vector<Result> results_;
+    bool failed_ = false;
+};
+
+std::vector<std::string> sample_keys(size_t keys_count, uint32_t seed) {
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<size_t> key_dist(0, keys_count - 1);
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < SAMPLE_SIZE; ++i) {
+        keys.push_back(make_key(key_dist(gen)));
+    }
+    return keys;
+}
+
+// 1, 2, 4, ... up to the hardware concurrency, which is always included
+std::vector<size_t> thread_counts() {
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(max_threads);
+    return counts;
+}
+
+template <class F>
+void run_threads(size_t threads_count, F&& f) {
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threads_count; ++t) {
+        threads.emplace_back([&f, t] {
+            f(t);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// Storage::get and Storage::set of existing keys, ns_per_op is the wall time of all threads per operation.
+// The cost should stay flat as the dictionary grows. The memory of the values goes to stderr.
+void storage_benchmarks(Suite& suite, const bench::TempDir& dir) {
+    bool quick = suite.options().quick;
+    size_t ops = quick ? 200000 : 1000000;
+    auto threads_counts = thread_counts();
+    std::vector<size_t> keys_counts = quick ? std::vector<size_t>{10000, 100000} : std::vector<size_t>{1000, 10000, 100000, 1000000};
+    for (size_t keys_count : keys_counts) {
+        auto name = [&](std::string_view operation, size_t threads) {
+            return "storage/" + std::string(operation) + "/keys=" + std::to_string(keys_count) + "/threads=" + std::to_string(threads);
+        };
+        std::vector<std::string> names;
+        for (size_t threads : threads_counts) {
+            names.push_back(name("get", threads));
+            names.push_back(name("set", threads));
+        }
+        if (!suite.any_selected(names)) {
+            continue;
+        }
+
+        auto storage = bench::make_storage(dir / "storage.txt", keys_count);
+        std::vector<std::vector<std::string>> samples;
+        for (size_t t = 0; t < threads_counts.back(); ++t) {
+            samples.push_back(sample_keys(keys_count, t));
+        }
+        std::string value(VALUE_SIZE, 'w');
+
+        for (size_t threads : threads_counts) {
+            suite.run(name("get", threads), [&] {
+                return timed(ops, [&] {
+                    run_threads(threads, [&](size_t t) {
+                        const auto& keys = samples[t];
+                        for (size_t i = 0; i < ops / threads; ++i) {
+                            auto [found, stat] = storage->get(keys[i % keys.size()]);
+                            if (!found) {
+                                std::cerr << "Key " << keys[i % keys.size()] << " is missing" << std::endl;
+                                exit(1);
+                            }
+                        }
+                    });
+                });
+            });
+            suite.run(name("set", threads), [&] {
+                return timed(ops, [&] {
+                    run_threads(threads, [&](size_t t) {
+                        const auto& keys = samples[t];
+                        for (size_t i = 0; i < ops / threads; ++i) {
+                            storage->set(keys[i % keys.size()], value);
+                        }
+                    });
+                });
+            });
+        }
+        auto memory = storage->get_memory_stats();
+        std::cerr << "storage/keys=" << keys_count << "\tlive_bytes=" << memory.live_bytes
+            << "\tallocated_bytes=" << memory.allocated_bytes << std::endl;
+    }
+}
+
+void append_json_frame(std::string& out, std::string_view body) {
+    uint32_t len = htonl(body.size());
+    out.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    out.append(body);
+}
+
+// Pipelined chunks of BATCH_SIZE requests, as a connection reads them. append(out, key) adds a request.
+template <class F>
+std::vector<std::string> make_batches(size_t requests, size_t keys_count, F&& append) {
+    auto keys = sample_keys(keys_count, 42);
+    std::vector<std::string> batches;
+    for (size_t i = 0; i < requests; i += BATCH_SIZE) {
+        std::string batch;
+        for (size_t j = i; j < std::min(requests, i + BATCH_SIZE); ++j) {
+            append(batch, keys[j % keys.size()]);
+        }
+        batches.push_back(std::move(batch));
+    }
+    return batches;
+}
+
+// Requests fed straight into RequestProcessor: parsing, execution and serialization of responses
+// without the network. ns_per_op is per request, an mget request carries BATCH_SIZE keys.
+// Sizes of requests and responses and allocations per request go to stderr.
+// Gets of present keys must not allocate once the buffers of the processor are warm.
+void protocol_benchmarks(Suite& suite, const bench::TempDir& dir) {
+    using Protocol = Client::Protocol;
+    size_t keys_count = 100000;
+    size_t requests = suite.options().quick ? 50000 : 200000;
+    std::vector<std::string> names = {
+        "protocol/json/get", "protocol/binary/get",
+        "protocol/json/set", "protocol/binary/set",
+        "protocol/json/parse",
+        "protocol/json/mget64", "protocol/binary/mget64",
+    };
+    if (!suite.any_selected(names)) {
+        return;
+    }
+
+    std::shared_ptr<Storage> storage = bench::make_storage(dir / "protocol.txt", keys_count);
+    std::string value(VALUE_SIZE, 'w');
+
+    auto measure = [&](const std::string& name, Protocol protocol, size_t requests_count, const std::vector<std::string>& batches,
+            bool check_allocations = false) {
+        RequestProcessor processor(storage);
+        std::string output;
+        if (protocol == Protocol::BINARY) {
+            processor.process(binary_protocol::MAGIC, output);
+        }
+        // Of the last repetition, the first one warms up
+        size_t allocations = 0;
+        size_t response_bytes = 0;
+        suite.run(name, [&] {
+            size_t allocations_before = allocations_count;
+            response_bytes = 0;
+            auto measurement = timed(requests_count, [&] {
+                for (const auto& batch : batches) {
+                    auto consumed = processor.process(batch, output);
+                    if (!consumed || *consumed != batch.size()) {
+                        std::cerr << "Batch of " << name << " was not fully processed" << std::endl;
+                        exit(1);
+                    }
+                    response_bytes += output.size();
+                    output.clear();
+                }
+            });
+            allocations = allocations_count - allocations_before;
+            return measurement;
+        });
+        size_t request_bytes = 0;
+        for (const auto& batch : batches) {
+            request_bytes += batch.size();
+        }
+        std::cerr << name << "\trequest_bytes=" << request_bytes / requests_count << "\tresponse_bytes="
+            << response_bytes / requests_count << "\tallocations_per_request=" << double(allocations) / requests_count << std::endl;
+        if (check_allocations && allocations > 0) {
+            suite.fail(name + ": " + std::to_string(allocations) + " allocations in steady state");
+        }
+    };
+
+    for (auto [protocol, protocol_name] : {std::pair(Protocol::JSON, "json"), std::pair(Protocol::BINARY, "binary")}) {
+        std::string prefix = std::string("protocol/") + protocol_name;
+        if (suite.selected(prefix + "/get")) {
+            measure(prefix + "/get", protocol, requests, make_batches(requests, keys_count, [&](std::string& out, const std::string& key) {
+                Client::append_request(protocol, {Client::Request::Type::GET, key, {}}, out);
+            }), true);
+        }
+        if (suite.selected(prefix + "/set")) {
+            measure(prefix + "/set", protocol, requests, make_batches(requests, keys_count, [&](std::string& out, const std::string& key) {
+                Client::append_request(protocol, {Client::Request::Type::SET, key, value}, out);
+            }));
+        }
+        if (suite.selected(prefix + "/mget64")) {
+            size_t mget_requests = requests / BATCH_SIZE;
+            auto keys = sample_keys(keys_count, 42);
+            std::vector<std::string> batches;
+            for (size_t i = 0; i < mget_requests; ++i) {
+                std::vector<std::string> batch_keys;
+                for (size_t j = 0; j < BATCH_SIZE; ++j) {
+                    batch_keys.push_back(keys[(i * BATCH_SIZE + j) % keys.size()]);
+                }
+                batches.push_back(Client::make_batch_request(protocol, batch_keys, {}, false));
+            }
+            measure(prefix + "/mget64", protocol, mget_requests, batches);
+        }
+    }
+    // A command the server does not know: a JSON request is parsed, and the response is a bare ERROR
+    if (suite.selected("protocol/json/parse")) {
+        measure("protocol/json/parse", Protocol::JSON, requests, make_batches(requests, keys_count, [](std::string& out, const std::string& key) {
+            append_json_frame(out, "{\"command\":\"noop\",\"key\":\"" + key + "\"}");
+        }));
+    }
+}
+
+// dump_to_file of a whole dictionary and the load of the dump by a new Storage, ns_per_op is per key
+void snapshot_benchmarks(Suite& suite, const bench::TempDir& dir) {
+    size_t keys_count = suite.options().quick ? 100000 : 1000000;
+    auto threads_counts = thread_counts();
+    std::string value(VALUE_SIZE, 'w');
+    for (auto [format, format_name] : {std::pair(SnapshotFormat::JSON, "json"), std::pair(SnapshotFormat::BINARY, "binary")}) {
+        std::string dump_name = std::string("dump/") + format_name + "/keys=" + std::to_string(keys_count);
+        auto load_name = [&](size_t threads) {
+            return std::string("startup/") + format_name + "/keys=" + std::to_string(keys_count) + "/threads=" + std::to_string(threads);
+        };
+        // The JSON loader is single-threaded
+        std::vector<size_t> load_threads = format == SnapshotFormat::JSON ? std::vector<size_t>{1} : threads_counts;
+        std::vector<std::string> names = {dump_name};
+        for (size_t threads : load_threads) {
+            names.push_back(load_name(threads));
+        }
+        if (!suite.any_selected(names)) {
+            continue;
+        }
+
+        auto path = dir / (std::string("snapshot_") + format_name + ".txt");
+        auto options = bench::storage_options();
+        options.snapshot_format = format;
+        // Every dump writes the whole dictionary
+        options.incremental_dumps = false;
+        {
+            auto storage = bench::make_storage(path, keys_count, options);
+            // A set makes the storage dirty, otherwise the dump is skipped
+            suite.run(dump_name, [&] {
+                storage->set(make_key(0), value);
+                return timed(keys_count, [&] {
+                    storage->dump_to_file();
+                });
+            });
+            // Dumped on destruction if the dump benchmark did not run
+        }
+
+        for (size_t threads : load_threads) {
+            suite.run(load_name(threads), [&] {
+                auto load_options = options;
+                load_options.load_threads = threads;
+                std::unique_ptr<Storage> storage;
+                auto measurement = timed(keys_count, [&] {
+                    storage = std::make_unique<Storage>(path.string(), load_options);
+                });
+                if (storage->size() != keys_count) {
+                    std::cerr << "Loaded " << storage->size() << " keys instead of " << keys_count << std::endl;
+                    exit(1);
+                }
+                return measurement;
+            });
+        }
+    }
+}
+
+// A free port for the server: the kernel picks one for a socket that is closed right away
+uint16_t free_port() {
+    boost::asio::io_context io_context;
+    boost::asio::ip::tcp::acceptor acceptor(io_context, {boost::asio::ip::address_v4::loopback(), 0});
+    return acceptor.local_endpoint().port();
+}
+
+// Requests to a server running in the same process, over loopback TCP: single round trips
+// and pipelines of BATCH_SIZE gets. ns_per_op is per request.
+void end_to_end_benchmarks(Suite& suite, const bench::TempDir& dir) {
+    using Protocol = Client::Protocol;
+    size_t keys_count = 100000;
+    size_t round_trips = suite.options().quick ? 5000 : 20000;
+    size_t pipelined_requests = suite.options().quick ? 50000 : 200000;
+    std::vector<std::string> names = {"e2e/json/get", "e2e/binary/get", "e2e/json/pipeline64", "e2e/binary/pipeline64"};
+    if (!suite.any_selected(names)) {
+        return;
+    }
+
+    ServerOptions options;
+    options.storage_path = (dir / "e2e.txt").string();
+    options.storage = bench::storage_options();
+    options.port = free_port();
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+    // The storage is dumped on destruction, and the server loads the dump
+    bench::make_storage(options.storage_path, keys_count, options.storage);
+
+    IoContextPool io_contexts(options.threads, false, false);
+    Server server(io_contexts, options);
+    server.run();
+    std::thread io_thread([&io_contexts] {
+        io_contexts.run();
+    });
+
+    auto keys = sample_keys(keys_count, 42);
+    for (auto [protocol, protocol_name] : {std::pair(Protocol::JSON, "json"), std::pair(Protocol::BINARY, "binary")}) {
+        std::string prefix = std::string("e2e/") + protocol_name;
+        if (!suite.any_selected({prefix + "/get", prefix + "/pipeline64"})) {
+            continue;
+        }
+        Client client("127.0.0.1", options.port, protocol);
+        auto check = [&](bool sent, const Client::Response& response) {
+            if (!sent || !response.ok || !response.found) {
+                std::cerr << "Request to the server failed" << std::endl;
+                exit(1);
+            }
+        };
+
+        suite.run(prefix + "/get", [&] {
+            return timed(round_trips, [&] {
+                for (size_t i = 0; i < round_trips; ++i) {
+                    auto [response, sent] = client.get(keys[i % keys.size()]);
+                    check(sent, response);
+                }
+            });
+        });
+
+        std::vector<Client::Request> pipeline;
+        for (size_t i = 0; i < BATCH_SIZE; ++i) {
+            pipeline.push_back({Client::Request::Type::GET, keys[i], {}});
+        }
+        suite.run(prefix + "/pipeline64", [&] {
+            size_t pipelines = pipelined_requests / BATCH_SIZE;
+            return timed(pipelines * BATCH_SIZE, [&] {
+                for (size_t i = 0; i < pipelines; ++i) {
+                    auto [responses, sent] = client.pipeline(pipeline);
+                    check(sent && responses.size() == BATCH_SIZE, responses.empty() ? Client::Response() : responses.back());
+                }
+            });
+        });
+    }
+
+    io_contexts.stop();
+    io_thread.join();
+}
+
+// Results printed by a previous run: benchmark name -> ns_per_op
+std::unordered_map<std::string, double> read_results(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Can't open baseline " + path);
+    }
+    std::unordered_map<std::string, double> results;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        double ns_per_op = 0;
+        if (std::getline(fields, name, '\t') && fields >> ns_per_op) {
+            results[name] = ns_per_op;
+        }
+    }
+    return results;
+}
+
+// Prints the change of every benchmark that is in the baseline, returns the number of regressions
+size_t compare(const std::vector<Result>& results, const std::unordered_map<std::string, double>& baseline, double threshold_percent) {
+    size_t regressions = 0;
+    std::cerr << "benchmark\tbaseline_ns_per_op\tns_per_op\tchange_percent" << std::endl;
+    for (const auto& result : results) {
+        auto it = baseline.find(result.name);
+        if (it == baseline.end()) {
+            std::cerr << result.name << "\t-\t" << result.ns_per_op << "\tnew" << std::endl;
+            continue;
+        }
+        double change = (result.ns_per_op / it->second - 1) * 100;
+        bool regression = change > threshold_percent;
+        regressions += regression;
+        std::cerr << result.name << "\t" << it->second << "\t" << result.ns_per_op << "\t" << change
+            << (regression ? "\tREGRESSION" : "") << std::endl;
+    }
+    return regressions;
+}
+
+double parse_number(std::string_view name, std::string_view value) {
+    double res = 0;
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), res);
+    if (ec != std::errc() || end != value.data() + value.size() || res < 0) {
+        throw std::invalid_argument("Option --" + std::string(name) + " expects a non-negative number");
+    }
+    return res;
+}
+
+Options parse_options(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        auto eq = arg.find('=');
+        std::string_view name = arg.substr(0, eq);
+        std::string_view value = eq == std::string_view::npos ? std::string_view() : arg.substr(eq + 1);
+        if (name == "--filter") {
+            options.filter = value;
+        } else if (name == "--quick") {
+            options.quick = true;
+        } else if (name == "--repetitions") {
+            options.repetitions = parse_number(name.substr(2), value);
+            if (options.repetitions == 0) {
+                throw std::invalid_argument("Option --repetitions must be positive");
+            }
+        } else if (name == "--baseline") {
+            options.baseline_path = value;
+        } else if (name == "--threshold") {
+            options.threshold_percent = parse_number(name.substr(2), value);
+        } else {
+            throw std::invalid_argument("Unexpected argument " + std::string(arg));
+        }
+    }
+    return options;
+}
+
+}
+
+// Microbenchmarks of the storage, the request processor, dumps and loads, and requests to an in-process server.
+// Results go to stdout as tab-separated lines, the median of the repetitions is the one that counts.
+// Saved output is a baseline for later runs: with --baseline the changes go to stderr, and the exit code is 2
+// if any benchmark got slower by more than the threshold.
+//
+//     ./dictionary_bench > baseline.tsv
+//     ./dictionary_bench --baseline=baseline.tsv > current.tsv
+int main(int argc, char** argv) {
+    Options options;
+    std::unordered_map<std::string, double> baseline;
+    try {
+        options = parse_options(argc, argv);
+        if (!options.baseline_path.empty()) {
+            baseline = read_results(options.baseline_path);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << "Usage: " << argv[0]
+            << " [--filter=SUBSTRING] [--quick] [--repetitions=N] [--baseline=FILE] [--threshold=PERCENT]" << std::endl;
+        return 1;
+    }
+    // The in-process server reports its stats every few seconds
+    logging::set_level(logging::Level::WARNING);
+
+    bench::TempDir dir("dictionary_bench");
+
+    Suite suite(options);
+    std::cout << "benchmark\tns_per_op\tops_per_sec\tmin_ns_per_op" << std::endl;
+    storage_benchmarks(suite, dir);
+    protocol_benchmarks(suite, dir);
+    snapshot_benchmarks(suite, dir);
+    end_to_end_benchmarks(suite, dir);
+    if (suite.failed()) {
+        return 1;
+    }
+
+    if (!options.baseline_path.empty()) {
+        size_t regressions = compare(suite.results(), baseline, options.threshold_percent);
+        if (regressions > 0) {
+            std::cerr << regressions << " benchmarks regressed by more than " << options.threshold_percent << "%" << std::endl;
+            return 2;
+        }
+    }
+    return 0;
+}
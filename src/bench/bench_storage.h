@@ -0,0 +1,65 @@
+#pragma once
+
+#include "../server/storage.h"
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <system_error>
+
+// Setup shared by the benchmarks that run a Storage in their own process
+namespace bench {
+
+constexpr size_t VALUE_SIZE = 100;
+
+inline std::string make_key(size_t i) {
+    return "key_" + std::to_string(i);
+}
+
+// An empty directory under the system temp directory, removed with everything in it on destruction.
+// Storages in it must be destroyed first, they dump on destruction.
+class TempDir {
+public:
+    explicit TempDir(const std::string& name)
+        : path_(std::filesystem::temp_directory_path() / name) {
+        std::filesystem::remove_all(path_);
+        std::filesystem::create_directories(path_);
+    }
+
+    ~TempDir() {
+        std::error_code error;
+        std::filesystem::remove_all(path_, error);
+    }
+
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+
+    std::filesystem::path operator/(const std::string& name) const {
+        return path_ / name;
+    }
+
+private:
+    const std::filesystem::path path_;
+};
+
+// Without the WAL, whose cost dictionary_wal_bench measures on its own
+inline StorageOptions storage_options() {
+    StorageOptions options;
+    options.wal.reset();
+    return options;
+}
+
+// A storage on an empty dictionary at path with keys make_key(0) ... make_key(keys_count - 1)
+inline std::unique_ptr<Storage> make_storage(const std::filesystem::path& path, size_t keys_count,
+        const StorageOptions& options = storage_options(), size_t value_size = VALUE_SIZE) {
+    std::ofstream(path) << "{}";
+    auto storage = std::make_unique<Storage>(path.string(), options);
+    std::string value(value_size, 'v');
+    for (size_t i = 0; i < keys_count; ++i) {
+        storage->set(make_key(i), value);
+    }
+    return storage;
+}
+
+}
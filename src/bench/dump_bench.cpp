@@ -0,0 +1,106 @@
+#include "bench_storage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+using bench::VALUE_SIZE;
+
+std::vector<size_t> parse_rates(const std::string& list) {
+    std::vector<size_t> rates;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        rates.push_back(std::stoul(item));
+    }
+    return rates;
+}
+
+struct Result {
+    double sets_per_sec = 0;
+    double bytes_per_sec = 0;
+    size_t full_dumps = 0;
+    size_t deltas = 0;
+};
+
+// Sets random keys at rate per second for duration while the dictionary is dumped every dump_interval,
+// the way the server's dump thread does it
+Result run(bool incremental, size_t keys_count, size_t rate, std::chrono::milliseconds duration, std::chrono::milliseconds dump_interval) {
+    bench::TempDir dir("dictionary_dump_bench");
+    // WAL writes are the same in both modes
+    auto options = bench::storage_options();
+    options.incremental_dumps = incremental;
+    auto storage = bench::make_storage(dir / "config.txt", keys_count, options);
+    std::string value(VALUE_SIZE, 'v');
+    // The base the deltas are written against
+    storage->dump_to_file();
+    auto before = storage->get_snapshot_stats();
+
+    std::atomic_bool stopped = false;
+    size_t sets = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::thread writer([&] {
+        std::mt19937_64 gen(42);
+        std::uniform_int_distribution<size_t> key_index(0, keys_count - 1);
+        while (!stopped) {
+            auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            size_t due = elapsed * rate;
+            if (sets >= due) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            for (; sets < due; ++sets) {
+                value[sets % VALUE_SIZE] = 'a' + sets % 26;
+                storage->set(bench::make_key(key_index(gen)), value);
+            }
+        }
+    });
+    while (std::chrono::steady_clock::now() - start < duration) {
+        std::this_thread::sleep_for(dump_interval);
+        storage->dump_to_file();
+    }
+    stopped = true;
+    writer.join();
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    auto after = storage->get_snapshot_stats();
+    Result result;
+    result.sets_per_sec = sets / seconds;
+    result.bytes_per_sec = (after.bytes_written - before.bytes_written) / seconds;
+    result.full_dumps = after.snapshots_count - before.snapshots_count;
+    result.deltas = after.deltas_count - before.deltas_count;
+    return result;
+}
+
+}
+
+// Measures bytes written to disk by dumps per second against the rate of sets, for full and incremental dumps
+int main(int argc, char** argv) {
+    size_t keys_count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    auto rates = parse_rates(argc > 2 ? argv[2] : "100,1000,10000,100000");
+    auto duration = std::chrono::milliseconds(argc > 3 ? std::stoul(argv[3]) : 20000);
+    auto dump_interval = std::chrono::milliseconds(argc > 4 ? std::stoul(argv[4]) : 1000);
+
+    std::cout << "mode\tsets_per_sec\tdump_bytes_per_sec\tbytes_per_set\tfull_dumps\tdeltas" << std::endl;
+    for (size_t rate : rates) {
+        for (bool incremental : {false, true}) {
+            auto result = run(incremental, keys_count, rate, duration, dump_interval);
+            std::cout << (incremental ? "incremental" : "full")
+                << "\t" << result.sets_per_sec
+                << "\t" << result.bytes_per_sec
+                << "\t" << result.bytes_per_sec / std::max(result.sets_per_sec, 1.0)
+                << "\t" << result.full_dumps
+                << "\t" << result.deltas << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include "bench_storage.h"
+
+#include "../server/storage.h"
+#include "../util/latency_histogram.h"
+#include "../util/log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t KEYS_COUNT = 100000;
+
+enum class Mode {
+    // No messages, the baseline
+    QUIET,
+    // Every disconnect is written to std::cerr with std::endl, as the server used to do
+    STDERR,
+    // Every disconnect goes through LOG_WARNING, most of them are suppressed by the rate limit
+    LOG,
+    // Every disconnect is queued, as if the rate limit were off
+    LOG_UNLIMITED,
+};
+
+void log_disconnect(Mode mode) {
+    switch (mode) {
+        case Mode::QUIET:
+            break;
+        case Mode::STDERR:
+            std::cerr << "Error reading data: Connection reset by peer" << std::endl;
+            break;
+        case Mode::LOG:
+            LOG_WARNING("Error reading data: Connection reset by peer");
+            break;
+        case Mode::LOG_UNLIMITED:
+            logging::Message(logging::Level::WARNING, 0).stream() << "Error reading data: Connection reset by peer";
+            break;
+    }
+}
+
+struct Results {
+    std::mutex mutex;
+    LatencyHistogram latencies;
+};
+
+// Threads serve gets from the storage, and every disconnect_every requests one of their connections drops.
+// A request is timed together with the logging the thread does before it, so logging that blocks
+// shows up in the tail of the latencies.
+void run(const std::string& name, Mode mode, Storage& storage, size_t threads_count, double duration_s, size_t disconnect_every) {
+    Results results;
+    auto end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(duration_s));
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threads_count; ++t) {
+        threads.emplace_back([&, t] {
+            std::mt19937 gen(t);
+            std::uniform_int_distribution<size_t> key_dist(0, KEYS_COUNT - 1);
+            std::vector<std::string> keys;
+            for (size_t i = 0; i < 1024; ++i) {
+                keys.push_back(bench::make_key(key_dist(gen)));
+            }
+            LatencyHistogram latencies;
+            size_t found = 0;
+            for (size_t i = 0; Clock::now() < end; ++i) {
+                auto begin = Clock::now();
+                if (i % disconnect_every == 0) {
+                    log_disconnect(mode);
+                }
+                storage.visit_value(keys[i % keys.size()], [&](std::optional<std::string_view> value, Storage::Stat) {
+                    found += value.has_value();
+                });
+                latencies.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count());
+            }
+            std::lock_guard lock(results.mutex);
+            results.latencies.merge(latencies);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    logging::flush();
+
+    const auto& latencies = results.latencies;
+    std::cout << name << "\t" << latencies.count() / duration_s << "\t" << latencies.percentile(50) / 1000.0
+        << "\t" << latencies.percentile(99) / 1000.0 << "\t" << latencies.percentile(99.9) / 1000.0
+        << "\t" << latencies.percentile(99.99) / 1000.0 << std::endl;
+}
+
+}
+
+// Request latency during a disconnect storm, with the messages about disconnects going to std::cerr directly
+// and through the logger. Run with stderr redirected to a file: ./dictionary_log_bench 2> log.txt
+int main(int argc, char** argv) {
+    size_t threads_count = argc > 1 ? std::stoul(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    double duration_s = argc > 2 ? std::stod(argv[2]) : 3;
+    size_t disconnect_every = argc > 3 ? std::stoul(argv[3]) : 100;
+
+    bench::TempDir dir("dictionary_log_bench");
+    auto storage = bench::make_storage(dir / "config.txt", KEYS_COUNT);
+
+    std::cout << "mode\trequests_per_sec\tp50_us\tp99_us\tp999_us\tp9999_us" << std::endl;
+    run("quiet", Mode::QUIET, *storage, threads_count, duration_s, disconnect_every);
+    run("stderr", Mode::STDERR, *storage, threads_count, duration_s, disconnect_every);
+    run("log", Mode::LOG, *storage, threads_count, duration_s, disconnect_every);
+    run("log_unlimited", Mode::LOG_UNLIMITED, *storage, threads_count, duration_s, disconnect_every);
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "bench_storage.h"
+
+#include "../server/metrics.h"
+#include "../server/request_processor.h"
+#include "../server/storage.h"
+#include "../util/binary_protocol.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+
+
+namespace {
+
+constexpr size_t BATCH_SIZE = 64;
+constexpr size_t ROUNDS = 10;
+
+void append_json_request(std::string& out, bool is_set, const std::string& key, const std::string& value) {
+    std::string body = is_set
+        ? "{\"command\":\"set\",\"key\":\"" + key + "\",\"value\":\"" + value + "\"}"
+        : "{\"command\":\"get\",\"key\":\"" + key + "\"}";
+    uint32_t len = htonl(body.size());
+    out.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    out.append(body);
+}
+
+// Pipelined chunks of BATCH_SIZE requests, 1% sets, some of the gets miss
+std::vector<std::string> make_batches(size_t n_requests, size_t dictionary_size, bool binary) {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<size_t> key_dist(0, dictionary_size + dictionary_size / 10);
+    std::uniform_int_distribution<int> command_dist(0, 99);
+    std::string value(100, 'v');
+
+    std::vector<std::string> batches;
+    for (size_t i = 0; i < n_requests; i += BATCH_SIZE) {
+        std::string batch;
+        for (size_t j = i; j < std::min(n_requests, i + BATCH_SIZE); ++j) {
+            std::string key = bench::make_key(key_dist(gen));
+            bool is_set = command_dist(gen) == 0;
+            if (binary) {
+                binary_protocol::append_request(batch,
+                    is_set ? binary_protocol::Opcode::SET : binary_protocol::Opcode::GET, key, is_set ? value : std::string());
+            } else {
+                append_json_request(batch, is_set, key, value);
+            }
+        }
+        batches.push_back(std::move(batch));
+    }
+    return batches;
+}
+
+double run(RequestProcessor& processor, const std::vector<std::string>& batches, std::string& output) {
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& batch : batches) {
+        auto consumed = processor.process(batch, output);
+        if (!consumed || *consumed != batch.size()) {
+            std::cerr << "Batch was not fully processed" << std::endl;
+            exit(1);
+        }
+        output.clear();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Rounds with metrics off and on alternate, so that both see the same state of the machine,
+// and the best round of each counts
+void measure(const std::string& name, std::shared_ptr<Storage> storage, std::string_view handshake, size_t n_requests,
+        size_t dictionary_size) {
+    auto batches = make_batches(n_requests, dictionary_size, !handshake.empty());
+    RequestProcessor processor(storage);
+    std::string output;
+    processor.process(handshake, output);
+    output.clear();
+    run(processor, batches, output);
+
+    double best_off = 0;
+    double best_on = 0;
+    for (size_t round = 0; round < ROUNDS; ++round) {
+        metrics::set_enabled(false);
+        double off = run(processor, batches, output);
+        metrics::set_enabled(true);
+        double on = run(processor, batches, output);
+        best_off = round == 0 ? off : std::min(best_off, off);
+        best_on = round == 0 ? on : std::min(best_on, on);
+    }
+    metrics::set_enabled(false);
+    std::cout << name << "\t" << n_requests / best_off << "\t" << n_requests / best_on
+        << "\t" << (best_on / best_off - 1) * 100 << std::endl;
+}
+
+}
+
+// Cost of metrics in the request path: the same pipelined requests are fed straight into RequestProcessor
+// with metrics disabled and enabled. Connection-level metrics are recorded once per socket read or write
+// and are not measured here.
+int main(int argc, char** argv) {
+    size_t n_requests = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    size_t dictionary_size = argc > 2 ? std::stoul(argv[2]) : 100000;
+
+    bench::TempDir dir("dictionary_metrics_bench");
+    std::shared_ptr<Storage> storage = bench::make_storage(dir / "config.txt", dictionary_size);
+
+    std::cout << "protocol\trequests_per_sec_off\trequests_per_sec_on\toverhead_percent" << std::endl;
+    measure("json", storage, {}, n_requests, dictionary_size);
+    measure("binary", storage, binary_protocol::MAGIC, n_requests, dictionary_size);
+
+    storage.reset();
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include "bench_storage.h"
+
+#include "../server/storage.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+constexpr size_t KEYS_COUNT = 100000;
+constexpr size_t SHARDS_COUNT = 64;
+constexpr int SET_PERCENT = 1;
+
+// The read path as it was before lookups became lock-free: every get takes the shared lock of its shard
+class LockedReads {
+public:
+    template <class F>
+    void visit_value(Storage& storage, const std::string& key, F&& f) {
+        std::shared_lock lock(mutexes_[std::hash<std::string>{}(key) % SHARDS_COUNT]);
+        storage.visit_value(key, f);
+    }
+
+    void set(Storage& storage, const std::string& key, const std::string& value) {
+        std::unique_lock lock(mutexes_[std::hash<std::string>{}(key) % SHARDS_COUNT]);
+        storage.set(key, value);
+    }
+
+private:
+    std::shared_mutex mutexes_[SHARDS_COUNT];
+};
+
+// Every thread mixes SET_PERCENT sets into its gets, returns gets per second of all threads.
+// get returns the size of the value, so that the values are actually read.
+template <class Get, class Set>
+double run_threads(size_t threads_count, size_t ops_per_thread, Get&& get, Set&& set) {
+    std::vector<std::thread> threads;
+    std::atomic_bool start = false;
+    std::atomic<size_t> gets_count = 0;
+    std::atomic<size_t> bytes_read = 0;
+    for (size_t t = 0; t < threads_count; ++t) {
+        threads.emplace_back([&, t] {
+            std::mt19937 gen(t);
+            std::uniform_int_distribution<size_t> key_dist(0, KEYS_COUNT - 1);
+            std::uniform_int_distribution<int> command_dist(0, 99);
+            std::vector<std::pair<std::string, bool>> commands;
+            for (size_t i = 0; i < 4096; ++i) {
+                commands.emplace_back(bench::make_key(key_dist(gen)), command_dist(gen) < SET_PERCENT);
+            }
+            std::string value(100, 'a' + t % 26);
+            while (!start.load()) {
+            }
+
+            size_t gets = 0;
+            size_t bytes = 0;
+            for (size_t i = 0; i < ops_per_thread; ++i) {
+                const auto& [key, is_set] = commands[i % commands.size()];
+                if (is_set) {
+                    set(key, value);
+                } else {
+                    bytes += get(key);
+                    ++gets;
+                }
+            }
+            gets_count.fetch_add(gets);
+            bytes_read.fetch_add(bytes);
+        });
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    start.store(true);
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return gets_count.load() / std::chrono::duration<double>(end - begin).count();
+}
+
+}
+
+// Get throughput against the number of threads with 1% of concurrent sets, through the lock-free
+// read path of the storage and with a shared lock per get on top of it, like the reads used to be
+int main(int argc, char** argv) {
+    size_t max_threads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+    size_t ops_per_thread = argc > 2 ? std::stoul(argv[2]) : 1000000;
+
+    bench::TempDir dir("dictionary_read_scaling_bench");
+    {
+        auto options = bench::storage_options();
+        options.shards_count = SHARDS_COUNT;
+        auto storage_ptr = bench::make_storage(dir / "config.txt", KEYS_COUNT, options);
+        auto& storage = *storage_ptr;
+        LockedReads locked_reads;
+
+        auto lock_free_get = [&](const std::string& key) {
+            size_t size = 0;
+            storage.visit_value(key, [&](std::optional<std::string_view> value, Storage::Stat) {
+                size = value ? value->size() : 0;
+            });
+            return size;
+        };
+        auto locked_get = [&](const std::string& key) {
+            size_t size = 0;
+            locked_reads.visit_value(storage, key, [&](std::optional<std::string_view> value, Storage::Stat) {
+                size = value ? value->size() : 0;
+            });
+            return size;
+        };
+
+        double single_thread = 0;
+        std::cout << "threads\tlocked_gets_per_sec\tlock_free_gets_per_sec\tlock_free_speedup" << std::endl;
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            auto locked = run_threads(threads, ops_per_thread, locked_get, [&](const std::string& key, const std::string& value) {
+                locked_reads.set(storage, key, value);
+            });
+            auto lock_free = run_threads(threads, ops_per_thread, lock_free_get, [&](const std::string& key, const std::string& value) {
+                storage.set(key, value);
+            });
+            if (threads == 1) {
+                single_thread = lock_free;
+            }
+            std::cout << threads << "\t" << locked << "\t" << lock_free << "\t" << lock_free / single_thread << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include "bench_storage.h"
+
+#include "../server/storage.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+namespace {
+
+constexpr size_t KEYS_COUNT = 10000;
+
+// Per-key statistics as they were kept before they moved into the storage entries:
+// a map guarded by a shared_mutex, looked up separately from the dictionary
+class LegacyKeyStats {
+public:
+    Storage::Stat inc_get(const std::string& key) {
+        auto& stat = get_key_stats(key);
+        stat.get_count.fetch_add(1);
+        return {stats_per_key_[key].get_count.load(), stats_per_key_[key].set_count.load()};
+    }
+
+private:
+    struct AtomicStat {
+        std::atomic<size_t> get_count = 0;
+        std::atomic<size_t> set_count = 0;
+    };
+
+    AtomicStat& get_key_stats(const std::string& key) {
+        std::shared_lock stats_lock(stats_mutex_);
+        if (!stats_per_key_.contains(key)) [[unlikely]] {
+            stats_lock.unlock();
+            {
+                std::unique_lock insert_stats_lock(stats_mutex_);
+                stats_per_key_[key];
+            }
+            stats_lock.lock();
+        }
+        return stats_per_key_[key];
+    }
+
+    std::unordered_map<std::string, AtomicStat> stats_per_key_;
+    std::shared_mutex stats_mutex_;
+};
+
+template <class F>
+double run_threads(size_t threads_count, size_t ops_per_thread, F&& f) {
+    std::vector<std::thread> threads;
+    std::atomic_bool start = false;
+    for (size_t t = 0; t < threads_count; ++t) {
+        threads.emplace_back([&, t] {
+            std::mt19937 gen(t);
+            std::uniform_int_distribution<size_t> key_dist(0, KEYS_COUNT - 1);
+            std::vector<std::string> keys;
+            for (size_t i = 0; i < 1024; ++i) {
+                keys.push_back(bench::make_key(key_dist(gen)));
+            }
+            while (!start.load()) {
+            }
+            for (size_t i = 0; i < ops_per_thread; ++i) {
+                f(keys[i % keys.size()]);
+            }
+        });
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    start.store(true);
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return threads_count * ops_per_thread / std::chrono::duration<double>(end - begin).count();
+}
+
+}
+
+// Compares get throughput with the legacy per-key statistics map against
+// the counters stored inline in the dictionary entries
+int main(int argc, char** argv) {
+    size_t max_threads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+    size_t ops_per_thread = argc > 2 ? std::stoul(argv[2]) : 1000000;
+
+    bench::TempDir dir("dictionary_stats_contention_bench");
+    {
+        auto storage_ptr = bench::make_storage(dir / "config.txt", KEYS_COUNT);
+        auto& storage = *storage_ptr;
+        LegacyKeyStats legacy_stats;
+
+        std::cout << "threads\tlegacy_ops_per_sec\tinline_ops_per_sec" << std::endl;
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            auto legacy = run_threads(threads, ops_per_thread, [&](const std::string& key) {
+                legacy_stats.inc_get(key);
+                storage.get(key);
+            });
+            auto inline_stats = run_threads(threads, ops_per_thread, [&](const std::string& key) {
+                storage.get(key);
+            });
+            std::cout << threads << "\t" << legacy << "\t" << inline_stats << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include "bench_storage.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+constexpr size_t KEYS_COUNT = 1000;
+
+struct Mode {
+    std::string name;
+    std::optional<WriteAheadLog::Options> wal;
+};
+
+std::optional<WriteAheadLog::Options> make_wal_options(WriteAheadLog::SyncMode mode) {
+    WriteAheadLog::Options options;
+    options.mode = mode;
+    return options;
+}
+
+}
+
+// Measures set throughput and latency of Storage for every WAL mode
+int main(int argc, char** argv) {
+    size_t threads_count = argc > 1 ? std::stoul(argv[1]) : 4;
+    size_t sets_per_thread = argc > 2 ? std::stoul(argv[2]) : 2000;
+
+    std::vector<Mode> modes = {
+        {"off", std::nullopt},
+        {"no-sync", make_wal_options(WriteAheadLog::SyncMode::NO_SYNC)},
+        {"group-commit", make_wal_options(WriteAheadLog::SyncMode::GROUP_COMMIT)},
+        {"sync", make_wal_options(WriteAheadLog::SyncMode::SYNC_PER_WRITE)},
+    };
+
+    std::cout << "mode\tsets_per_sec\tmean_latency_us" << std::endl;
+    for (const auto& mode : modes) {
+        bench::TempDir dir("dictionary_wal_bench");
+        StorageOptions options;
+        options.wal = mode.wal;
+        auto storage = bench::make_storage(dir / "config.txt", 0, options);
+
+        std::atomic<size_t> total_latency_ns = 0;
+        std::string value(64, 'v');
+        std::vector<std::thread> threads;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t t = 0; t < threads_count; ++t) {
+            threads.emplace_back([&, t] {
+                for (size_t i = 0; i < sets_per_thread; ++i) {
+                    auto key = bench::make_key((t * sets_per_thread + i) % KEYS_COUNT);
+                    auto set_start = std::chrono::steady_clock::now();
+                    storage->set(key, value);
+                    auto set_end = std::chrono::steady_clock::now();
+                    total_latency_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(set_end - set_start).count());
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        size_t total_sets = threads_count * sets_per_thread;
+        std::cout << mode.name
+            << "\t" << total_sets / std::chrono::duration<double>(end - start).count()
+            << "\t" << total_latency_ns.load() / 1000.0 / total_sets << std::endl;
+    }
+    return 0;
+}
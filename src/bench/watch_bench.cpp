@@ -0,0 +1,245 @@
+#include "bench_storage.h"
+
+#include "../client/client.h"
+#include "../server/io_context_pool.h"
+#include "../server/server.h"
+#include "../util/binary_protocol.h"
+#include "../util/latency_histogram.h"
+#include "../util/log.h"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/write.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const std::string WATCHED_KEY = "watched";
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+uint16_t free_port() {
+    boost::asio::io_context io_context;
+    boost::asio::ip::tcp::acceptor acceptor(io_context, {boost::asio::ip::address_v4::loopback(), 0});
+    return acceptor.local_endpoint().port();
+}
+
+// Every update is set to "<update index> <send time in ns>"
+struct Updates {
+    explicit Updates(size_t count)
+        : delivered(count)
+        , last_delivery_ns(count) {
+    }
+
+    std::vector<std::atomic<size_t>> delivered;
+    std::vector<std::atomic<int64_t>> last_delivery_ns;
+    std::vector<int64_t> sent_ns;
+
+    std::mutex mutex;
+    LatencyHistogram latencies;
+    size_t overflows = 0;
+};
+
+// A watching connection, read on the shared io_context
+class WatchConnection : public std::enable_shared_from_this<WatchConnection> {
+public:
+    WatchConnection(boost::asio::io_context& io_context, Client::Protocol protocol, Updates& updates)
+        : socket_(io_context)
+        , protocol_(protocol)
+        , updates_(updates) {
+    }
+
+    // Blocks until the watch is in place
+    void start(uint16_t port) {
+        socket_.connect({boost::asio::ip::address_v4::loopback(), port});
+        std::string message;
+        if (protocol_ == Client::Protocol::BINARY) {
+            message.append(binary_protocol::MAGIC);
+        }
+        Client::append_request(protocol_, {Client::Request::Type::WATCH, WATCHED_KEY}, message);
+        boost::asio::write(socket_, boost::asio::buffer(message));
+        while (Client::response_size(protocol_, input_, false) == 0) {
+            read_some();
+        }
+        input_.erase(0, Client::response_size(protocol_, input_, false));
+        schedule_read();
+    }
+
+private:
+    void read_some() {
+        char data[4096];
+        size_t length = socket_.read_some(boost::asio::buffer(data));
+        input_.append(data, length);
+    }
+
+    void schedule_read() {
+        socket_.async_read_some(boost::asio::buffer(buffer_), [this, self = shared_from_this()](const boost::system::error_code& error, size_t length) {
+            if (error) {
+                return;
+            }
+            input_.append(buffer_, length);
+            size_t pos = 0;
+            while (size_t size = Client::notification_size(protocol_, std::string_view(input_).substr(pos))) {
+                record(Client::parse_notification(protocol_, std::string_view(input_).substr(pos, size)));
+                pos += size;
+            }
+            input_.erase(0, pos);
+            schedule_read();
+        });
+    }
+
+    void record(const Client::Notification& notification) {
+        auto received_ns = now_ns();
+        if (notification.overflow) {
+            std::lock_guard lock(updates_.mutex);
+            ++updates_.overflows;
+            return;
+        }
+        size_t index = std::stoul(notification.value);
+        int64_t sent_ns = std::stoll(notification.value.substr(notification.value.find(' ') + 1));
+        updates_.delivered[index].fetch_add(1, std::memory_order_relaxed);
+        auto& last = updates_.last_delivery_ns[index];
+        auto previous = last.load(std::memory_order_relaxed);
+        while (previous < received_ns && !last.compare_exchange_weak(previous, received_ns, std::memory_order_relaxed)) {
+        }
+        std::lock_guard lock(updates_.mutex);
+        updates_.latencies.record(received_ns - sent_ns);
+    }
+
+    boost::asio::ip::tcp::socket socket_;
+    const Client::Protocol protocol_;
+    Updates& updates_;
+    char buffer_[4096];
+    std::string input_;
+};
+
+// Two sockets per watcher live in this process, the limit of descriptors is raised as far as allowed
+bool raise_files_limit(size_t files) {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return false;
+    }
+    if (limit.rlim_cur >= files) {
+        return true;
+    }
+    limit.rlim_cur = std::min<rlim_t>(files, limit.rlim_max);
+    return setrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur >= files;
+}
+
+double to_us(uint64_t ns) {
+    return ns / 1e3;
+}
+
+}
+
+// Fan-out of notifications: watchers connections watch one key of a server running in this process,
+// and a client sets the key every interval. For every notification prints the latency from the set
+// to the watcher reading it, and for every update the time until the last watcher read it.
+// Updates that come faster than the watchers read them are coalesced, so delivered may be less than sent.
+int main(int argc, char** argv) {
+    size_t watchers_count = argc > 1 ? std::stoul(argv[1]) : 10000;
+    size_t updates_count = argc > 2 ? std::stoul(argv[2]) : 100;
+    auto interval = std::chrono::milliseconds(argc > 3 ? std::stoul(argv[3]) : 20);
+    size_t threads_count = argc > 4 ? std::stoul(argv[4]) : std::max(1u, std::thread::hardware_concurrency());
+    auto protocol = argc > 5 && std::string(argv[5]) == "--binary" ? Client::Protocol::BINARY : Client::Protocol::JSON;
+
+    if (!raise_files_limit(2 * watchers_count + 64)) {
+        std::cerr << "Can't open " << 2 * watchers_count << " sockets, raise the limit with ulimit -n" << std::endl;
+        return 1;
+    }
+    logging::set_level(logging::Level::WARNING);
+
+    bench::TempDir dir("dictionary_watch_bench");
+    ServerOptions options;
+    options.storage_path = (dir / "config.txt").string();
+    options.storage = bench::storage_options();
+    options.port = free_port();
+    options.threads = threads_count;
+    std::ofstream(options.storage_path) << "{}";
+
+    IoContextPool io_contexts(options.threads, false, false);
+    Server server(io_contexts, options);
+    server.run();
+    std::thread server_thread([&io_contexts] {
+        io_contexts.run();
+    });
+
+    Updates updates(updates_count);
+    boost::asio::io_context watchers_context;
+    auto work = boost::asio::make_work_guard(watchers_context);
+    std::vector<std::thread> watcher_threads;
+    for (size_t i = 0; i < threads_count; ++i) {
+        watcher_threads.emplace_back([&watchers_context] {
+            watchers_context.run();
+        });
+    }
+    for (size_t i = 0; i < watchers_count; ++i) {
+        std::make_shared<WatchConnection>(watchers_context, protocol, updates)->start(options.port);
+    }
+
+    Client client("127.0.0.1", options.port, protocol);
+    auto next = Clock::now();
+    for (size_t i = 0; i < updates_count; ++i) {
+        std::this_thread::sleep_until(next);
+        next += interval;
+        updates.sent_ns.push_back(now_ns());
+        client.set(WATCHED_KEY, std::to_string(i) + " " + std::to_string(updates.sent_ns.back()));
+    }
+    // Until the watchers stop getting notifications
+    size_t delivered = 0;
+    for (size_t previous = SIZE_MAX; delivered != previous;) {
+        previous = delivered;
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        delivered = 0;
+        for (const auto& count : updates.delivered) {
+            delivered += count.load(std::memory_order_relaxed);
+        }
+    }
+
+    watchers_context.stop();
+    for (auto& thread : watcher_threads) {
+        thread.join();
+    }
+
+    // Only updates every watcher got have a fan-out time
+    LatencyHistogram fan_out;
+    for (size_t i = 0; i < updates_count; ++i) {
+        if (updates.delivered[i].load() == watchers_count) {
+            fan_out.record(updates.last_delivery_ns[i].load() - updates.sent_ns[i]);
+        }
+    }
+
+    std::cout << "watchers\tupdates\tsent\tdelivered\toverflows\tp50_us\tp99_us\tp999_us\tmax_us\tfan_out_p50_us\tfan_out_max_us" << std::endl;
+    std::cout << watchers_count
+        << "\t" << updates_count
+        << "\t" << watchers_count * updates_count
+        << "\t" << delivered
+        << "\t" << updates.overflows
+        << "\t" << to_us(updates.latencies.percentile(50))
+        << "\t" << to_us(updates.latencies.percentile(99))
+        << "\t" << to_us(updates.latencies.percentile(99.9))
+        << "\t" << to_us(updates.latencies.max())
+        << "\t" << to_us(fan_out.percentile(50))
+        << "\t" << to_us(fan_out.max()) << std::endl;
+
+    io_contexts.stop();
+    server_thread.join();
+    return 0;
+}
@@ -0,0 +1,372 @@
+#include "async_client.h"
+
+#include "backoff.h"
+
+#include "../util/binary_protocol.h"
+#include "../util/log.h"
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/write.hpp>
+
+#include <array>
+#include <deque>
+
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t READ_SIZE = 64 * 1024;
+constexpr size_t MAX_CONSUMED_INPUT = 64 * 1024;
+
+}
+
+// All the state of a connection is touched only on its strand, except the counters read to pick a connection
+class AsyncClient::Connection : public std::enable_shared_from_this<Connection> {
+public:
+    Connection(boost::asio::io_context& io_context, const boost::asio::ip::tcp::endpoint& endpoint, const AsyncClientOptions& options)
+        : strand_(boost::asio::make_strand(io_context))
+        , socket_(strand_)
+        , connect_timer_(strand_)
+        , request_timer_(strand_)
+        , endpoint_(endpoint)
+        , options_(options)
+        , backoff_(options.reconnect_delay_min, options.reconnect_delay_max) {
+    }
+
+    void start() {
+        boost::asio::dispatch(strand_, [self = shared_from_this()] {
+            self->connect();
+        });
+    }
+
+    void enqueue(std::string message, bool is_batch, size_t count, Callback callback) {
+        auto deadline = Clock::now() + options_.request_timeout;
+        boost::asio::dispatch(strand_, [self = shared_from_this(), message = std::move(message), is_batch, count, deadline,
+                callback = std::move(callback)]() mutable {
+            self->on_request(std::move(message), is_batch, count, deadline, std::move(callback));
+        });
+    }
+
+    void close() {
+        boost::asio::dispatch(strand_, [self = shared_from_this()] {
+            self->shutdown();
+        });
+    }
+
+    bool is_connected() const {
+        return connected_.load(std::memory_order_relaxed);
+    }
+
+    size_t in_flight() const {
+        return in_flight_.load(std::memory_order_relaxed);
+    }
+
+private:
+    enum class State {
+        CONNECTING,
+        CONNECTED,
+        // Until the next attempt to connect
+        WAITING,
+        CLOSED,
+    };
+
+    struct Pending {
+        Clock::time_point deadline;
+        bool is_batch;
+        size_t count;
+        // Empty once the request timed out, its response is still read and dropped
+        Callback callback;
+    };
+
+    void connect() {
+        if (state_ == State::CLOSED) {
+            return;
+        }
+        state_ = State::CONNECTING;
+        socket_ = boost::asio::ip::tcp::socket(strand_);
+        connect_deadline_ = Clock::now() + options_.connect_timeout;
+        connect_timer_.expires_at(connect_deadline_);
+        connect_timer_.async_wait([self = shared_from_this(), generation = generation_](const boost::system::error_code& error) {
+            if (!error && generation == self->generation_) {
+                // The connect completes with operation_aborted
+                boost::system::error_code ignored;
+                self->socket_.close(ignored);
+            }
+        });
+        socket_.async_connect(endpoint_, [self = shared_from_this(), generation = generation_](const boost::system::error_code& error) {
+            if (generation != self->generation_) {
+                return;
+            }
+            self->connect_timer_.cancel();
+            if (error) {
+                self->fail(Clock::now() >= self->connect_deadline_ ? boost::asio::error::timed_out : error);
+                return;
+            }
+            self->on_connected();
+        });
+    }
+
+    void on_connected() {
+        state_ = State::CONNECTED;
+        connected_ = true;
+        backoff_.reset();
+        boost::system::error_code ignored;
+        socket_.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+        // Requests queued while the connection was down go right after the magic
+        if (options_.protocol == Protocol::BINARY) {
+            output_.insert(0, binary_protocol::MAGIC);
+        }
+        read();
+        write();
+    }
+
+    void on_request(std::string message, bool is_batch, size_t count, Clock::time_point deadline, Callback callback) {
+        if (state_ == State::CLOSED) {
+            callback(boost::asio::error::operation_aborted, {});
+            return;
+        }
+        output_ += message;
+        pending_.push_back({deadline, is_batch, count, std::move(callback)});
+        in_flight_.store(pending_.size(), std::memory_order_relaxed);
+        arm_request_timer();
+        write();
+    }
+
+    void write() {
+        if (writing_ || output_.empty() || state_ != State::CONNECTED) {
+            return;
+        }
+        writing_ = true;
+        writing_output_.swap(output_);
+        output_.clear();
+        boost::asio::async_write(socket_, boost::asio::buffer(writing_output_),
+                [self = shared_from_this(), generation = generation_](const boost::system::error_code& error, size_t) {
+            if (generation != self->generation_) {
+                return;
+            }
+            self->writing_ = false;
+            if (error) {
+                self->fail(error);
+                return;
+            }
+            self->write();
+        });
+    }
+
+    void read() {
+        socket_.async_read_some(boost::asio::buffer(read_buffer_),
+                [self = shared_from_this(), generation = generation_](const boost::system::error_code& error, size_t length) {
+            if (generation != self->generation_) {
+                return;
+            }
+            if (error) {
+                self->fail(error);
+                return;
+            }
+            self->input_.append(self->read_buffer_.data(), length);
+            self->on_input();
+            if (self->state_ == State::CONNECTED && generation == self->generation_) {
+                self->read();
+            }
+        });
+    }
+
+    void on_input() {
+        auto generation = generation_;
+        // A callback may run inline and send new requests or close the client, so the request is
+        // removed from the queue before its callback is called
+        while (!pending_.empty() && generation == generation_) {
+            std::string_view input = std::string_view(input_).substr(input_pos_);
+            auto& request = pending_.front();
+            size_t size = Client::response_size(options_.protocol, input, request.is_batch);
+            if (size == 0) {
+                break;
+            }
+            auto frame = input.substr(0, size);
+            std::vector<Response> responses;
+            if (request.callback) {
+                if (request.is_batch) {
+                    responses = Client::parse_batch_response(options_.protocol, frame, request.count);
+                } else {
+                    responses.push_back(Client::parse_response(options_.protocol, frame));
+                }
+            }
+            auto callback = std::move(request.callback);
+            input_pos_ += size;
+            pop_request();
+            if (callback) {
+                callback({}, std::move(responses));
+            }
+        }
+        if (generation == generation_ && (input_pos_ == input_.size() || input_pos_ > MAX_CONSUMED_INPUT)) {
+            input_.erase(0, input_pos_);
+            input_pos_ = 0;
+        }
+    }
+
+    void pop_request() {
+        pending_.pop_front();
+        in_flight_.store(pending_.size(), std::memory_order_relaxed);
+        if (expired_ > 0) {
+            --expired_;
+        }
+    }
+
+    // Requests share the timeout, so deadlines grow along the queue
+    // and the first request that hasn't timed out yet is the next to time out
+    void arm_request_timer() {
+        if (request_timer_armed_ || expired_ == pending_.size()) {
+            return;
+        }
+        request_timer_armed_ = true;
+        request_timer_.expires_at(pending_[expired_].deadline);
+        request_timer_.async_wait([self = shared_from_this()](const boost::system::error_code& error) {
+            self->request_timer_armed_ = false;
+            if (!error && self->state_ != State::CLOSED) {
+                self->on_request_timer();
+            }
+        });
+    }
+
+    void on_request_timer() {
+        auto now = Clock::now();
+        std::vector<Callback> timed_out;
+        while (expired_ < pending_.size() && pending_[expired_].deadline <= now) {
+            auto& callback = pending_[expired_].callback;
+            if (callback) {
+                timed_out.push_back(std::move(callback));
+                callback = nullptr;
+            }
+            ++expired_;
+        }
+        arm_request_timer();
+        for (auto& callback : timed_out) {
+            callback(boost::asio::error::timed_out, {});
+        }
+    }
+
+    // Fails the requests in flight, nobody knows which of them were applied, and reconnects after a delay
+    void fail(const boost::system::error_code& error) {
+        if (state_ == State::CLOSED || state_ == State::WAITING) {
+            return;
+        }
+        if (state_ == State::CONNECTED) {
+            LOG_WARNING("Connection to " << endpoint_ << " failed: " << error.message());
+        }
+        reset();
+        state_ = State::WAITING;
+        connect_timer_.expires_after(backoff_.next());
+        connect_timer_.async_wait([self = shared_from_this()](const boost::system::error_code& error) {
+            if (!error) {
+                self->connect();
+            }
+        });
+        fail_pending(error);
+    }
+
+    void shutdown() {
+        if (state_ == State::CLOSED) {
+            return;
+        }
+        reset();
+        state_ = State::CLOSED;
+        connect_timer_.cancel();
+        request_timer_.cancel();
+        fail_pending(boost::asio::error::operation_aborted);
+    }
+
+    // Closes the socket, handlers of its operations see another generation and do nothing
+    void reset() {
+        ++generation_;
+        boost::system::error_code ignored;
+        socket_.close(ignored);
+        connected_ = false;
+        writing_ = false;
+        input_.clear();
+        input_pos_ = 0;
+        output_.clear();
+    }
+
+    void fail_pending(const boost::system::error_code& error) {
+        auto failed = std::move(pending_);
+        pending_.clear();
+        in_flight_.store(0, std::memory_order_relaxed);
+        expired_ = 0;
+        for (auto& request : failed) {
+            if (request.callback) {
+                request.callback(error, {});
+            }
+        }
+    }
+
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    boost::asio::ip::tcp::socket socket_;
+    // Connect timeout or the delay before the next attempt
+    boost::asio::steady_timer connect_timer_;
+    boost::asio::steady_timer request_timer_;
+    const boost::asio::ip::tcp::endpoint endpoint_;
+    const AsyncClientOptions options_;
+    Backoff backoff_;
+
+    State state_ = State::CONNECTING;
+    uint64_t generation_ = 0;
+    Clock::time_point connect_deadline_;
+    std::atomic_bool connected_ = false;
+    std::atomic<size_t> in_flight_ = 0;
+
+    std::deque<Pending> pending_;
+    // Leading requests of pending_ that timed out
+    size_t expired_ = 0;
+    bool request_timer_armed_ = false;
+
+    std::string output_;
+    std::string writing_output_;
+    bool writing_ = false;
+    std::array<char, READ_SIZE> read_buffer_;
+    std::string input_;
+    size_t input_pos_ = 0;
+};
+
+AsyncClient::AsyncClient(boost::asio::io_context& io_context, const std::string& host, uint16_t port, AsyncClientOptions options)
+    : io_context_(io_context)
+    , options_(options) {
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(host), port);
+    for (size_t i = 0; i < std::max<size_t>(options_.connections, 1); ++i) {
+        connections_.push_back(std::make_shared<Connection>(io_context_, endpoint, options_));
+        connections_.back()->start();
+    }
+}
+
+AsyncClient::~AsyncClient() {
+    for (auto& connection : connections_) {
+        connection->close();
+    }
+}
+
+size_t AsyncClient::connected_count() const {
+    size_t count = 0;
+    for (const auto& connection : connections_) {
+        count += connection->is_connected();
+    }
+    return count;
+}
+
+// The least loaded of the connections that are up, the search starts from the next connection in turn,
+// so that equally loaded connections take requests evenly. Without connections up the requests wait for a reconnect.
+void AsyncClient::submit(std::string message, bool is_batch, size_t count, Callback callback) {
+    size_t start = next_connection_.fetch_add(1, std::memory_order_relaxed);
+    Connection* best = nullptr;
+    for (size_t i = 0; i < connections_.size(); ++i) {
+        auto* connection = connections_[(start + i) % connections_.size()].get();
+        if (connection->is_connected() && (!best || connection->in_flight() < best->in_flight())) {
+            best = connection;
+        }
+    }
+    if (!best) {
+        best = connections_[start % connections_.size()].get();
+    }
+    best->enqueue(std::move(message), is_batch, count, std::move(callback));
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "client.h"
+
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct AsyncClientOptions {
+    Client::Protocol protocol = Client::Protocol::JSON;
+    size_t connections = 4;
+    // From the call to the completion, waiting for a connection included
+    std::chrono::milliseconds request_timeout{1000};
+    std::chrono::milliseconds connect_timeout{1000};
+    std::chrono::milliseconds reconnect_delay_min{100};
+    std::chrono::milliseconds reconnect_delay_max{5000};
+};
+
+// Client for services that keep many lookups in flight from a few threads. Requests are spread over a pool
+// of connections to the server, every connection pipelines any number of them and matches the responses
+// to the requests by order. A request completes within the timeout: with the response, with error::timed_out,
+// or with the error of its connection, which then reconnects in the background with growing delays.
+// A request whose connection broke after it was sent may or may not have been applied.
+//
+// Operations take any Asio completion token: a callback void(error_code, Response), boost::asio::use_future
+// or boost::asio::use_awaitable in coroutines. Handlers run on their associated executor, plain callbacks
+// on the io_context of the client, which may be run by any number of threads and must outlive the client.
+class AsyncClient {
+public:
+    using Protocol = Client::Protocol;
+    using Response = Client::Response;
+
+public:
+    AsyncClient(boost::asio::io_context& io_context, const std::string& host, uint16_t port, AsyncClientOptions options = {});
+    // Requests in flight complete with error::operation_aborted
+    ~AsyncClient();
+
+    AsyncClient(const AsyncClient&) = delete;
+    AsyncClient& operator=(const AsyncClient&) = delete;
+
+    template <class CompletionToken>
+    auto async_get(const std::string& key, CompletionToken&& token) {
+        return async_request({Client::Request::Type::GET, key, {}}, std::forward<CompletionToken>(token));
+    }
+
+    template <class CompletionToken>
+    auto async_set(const std::string& key, const std::string& value, CompletionToken&& token) {
+        return async_request({Client::Request::Type::SET, key, value}, std::forward<CompletionToken>(token));
+    }
+
+    // Responses are in the order of keys, the handler is void(error_code, std::vector<Response>)
+    template <class CompletionToken>
+    auto async_mget(const std::vector<std::string>& keys, CompletionToken&& token) {
+        return async_batch_request(Client::make_batch_request(options_.protocol, keys, {}, false), keys.size(),
+            std::forward<CompletionToken>(token));
+    }
+
+    template <class CompletionToken>
+    auto async_mset(const std::vector<std::pair<std::string, std::string>>& items, CompletionToken&& token) {
+        return async_batch_request(Client::make_batch_request(options_.protocol, {}, items, true), items.size(),
+            std::forward<CompletionToken>(token));
+    }
+
+    size_t connected_count() const;
+
+private:
+    class Connection;
+    using Callback = std::function<void(const boost::system::error_code&, std::vector<Response>)>;
+
+    template <class CompletionToken>
+    auto async_request(const Client::Request& request, CompletionToken&& token) {
+        std::string message;
+        Client::append_request(options_.protocol, request, message);
+        return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code, Response)>(
+            [this](auto handler, std::string message) {
+                submit(std::move(message), false, 1, make_callback(std::move(handler), [](std::vector<Response> responses) {
+                    return responses.empty() ? Response() : std::move(responses.front());
+                }));
+            }, token, std::move(message));
+    }
+
+    template <class CompletionToken>
+    auto async_batch_request(std::string message, size_t count, CompletionToken&& token) {
+        return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code, std::vector<Response>)>(
+            [this](auto handler, std::string message, size_t count) {
+                submit(std::move(message), true, count, make_callback(std::move(handler), [](std::vector<Response> responses) {
+                    return responses;
+                }));
+            }, token, std::move(message), count);
+    }
+
+    // Handlers may be move-only, the callback shares one and dispatches it to its associated executor
+    template <class Handler, class Convert>
+    Callback make_callback(Handler handler, Convert convert) {
+        auto shared_handler = std::make_shared<Handler>(std::move(handler));
+        auto executor = boost::asio::get_associated_executor(*shared_handler, io_context_.get_executor());
+        return [shared_handler, executor, convert](const boost::system::error_code& error, std::vector<Response> responses) {
+            boost::asio::dispatch(executor, [shared_handler, error, result = convert(std::move(responses))]() mutable {
+                std::move(*shared_handler)(error, std::move(result));
+            });
+        };
+    }
+
+    void submit(std::string message, bool is_batch, size_t count, Callback callback);
+
+    boost::asio::io_context& io_context_;
+    AsyncClientOptions options_;
+    std::vector<std::shared_ptr<Connection>> connections_;
+    std::atomic<size_t> next_connection_ = 0;
+};
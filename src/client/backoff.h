@@ -0,0 +1,35 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+// Delays between reconnection attempts: doubled after every failure up to max, with random jitter,
+// so that clients that lost the server at the same moment don't come back all at once
+class Backoff {
+public:
+    Backoff(std::chrono::milliseconds min, std::chrono::milliseconds max)
+        : min_(min)
+        , max_(std::max(min, max))
+        , delay_(min)
+        , gen_(std::random_device{}()) {
+    }
+
+    // Random delay in [delay / 2, delay]
+    std::chrono::milliseconds next() {
+        auto delay = delay_;
+        delay_ = std::min(delay_ * 2, max_);
+        std::uniform_int_distribution<std::chrono::milliseconds::rep> jitter(delay.count() / 2, delay.count());
+        return std::chrono::milliseconds(jitter(gen_));
+    }
+
+    void reset() {
+        delay_ = min_;
+    }
+
+private:
+    std::chrono::milliseconds min_;
+    std::chrono::milliseconds max_;
+    std::chrono::milliseconds delay_;
+    std::minstd_rand gen_;
+};
@@ -1,5 +1,10 @@
 #include "client.h"
 
+#include "backoff.h"
+
+#include "../util/binary_protocol.h"
+#include "../util/log.h"
+
 #include <boost/asio/connect.hpp>
 #include <boost/asio/write.hpp>
 
@@ -7,102 +12,579 @@
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
-#include <iostream>
+#include <array>
+#include <cstring>
 #include <thread>
+#include <utility>
 
 #include <arpa/inet.h>
+#include <poll.h>
+
+
+namespace {
+
+constexpr size_t MAX_CONSUMED_INPUT = 64 * 1024;
+
+const char* get_command(Client::Request::Type type) {
+    switch (type) {
+        case Client::Request::Type::GET: return "get";
+        case Client::Request::Type::SET: return "set";
+        case Client::Request::Type::CAS: return "cas";
+        case Client::Request::Type::INCR: return "incr";
+        case Client::Request::Type::DECR: return "decr";
+        case Client::Request::Type::APPEND: return "append";
+        case Client::Request::Type::SETNX: return "setnx";
+        case Client::Request::Type::WATCH: return "watch";
+        case Client::Request::Type::WATCH_PREFIX: return "watch";
+        case Client::Request::Type::UNWATCH: return "unwatch";
+        case Client::Request::Type::UNWATCH_PREFIX: return "unwatch";
+    }
+    return "";
+}
+
+binary_protocol::Opcode get_opcode(Client::Request::Type type) {
+    switch (type) {
+        case Client::Request::Type::GET: return binary_protocol::Opcode::GET;
+        case Client::Request::Type::SET: return binary_protocol::Opcode::SET;
+        case Client::Request::Type::CAS: return binary_protocol::Opcode::CAS;
+        case Client::Request::Type::INCR: return binary_protocol::Opcode::INCR;
+        case Client::Request::Type::DECR: return binary_protocol::Opcode::DECR;
+        case Client::Request::Type::APPEND: return binary_protocol::Opcode::APPEND;
+        case Client::Request::Type::SETNX: return binary_protocol::Opcode::SETNX;
+        case Client::Request::Type::WATCH: return binary_protocol::Opcode::WATCH;
+        case Client::Request::Type::WATCH_PREFIX: return binary_protocol::Opcode::WATCH_PREFIX;
+        case Client::Request::Type::UNWATCH: return binary_protocol::Opcode::UNWATCH;
+        case Client::Request::Type::UNWATCH_PREFIX: return binary_protocol::Opcode::UNWATCH_PREFIX;
+    }
+    return binary_protocol::Opcode::GET;
+}
 
+}
 
-Client::Client(const std::string& host, uint16_t port)
+Client::Client(const std::string& host, uint16_t port, Protocol protocol, std::chrono::seconds connect_timeout)
     : socket_(io_context_)
     , host_(host)
-    , port_(port) {
-    std::cerr << "Client created" << std::endl;
-    connect();
+    , port_(port)
+    , protocol_(protocol) {
+    LOG_DEBUG("Client created");
+    connect(connect_timeout);
 }
 
-void Client::connect(std::chrono::seconds timeout) {
+bool Client::connect(std::chrono::seconds timeout) {
+    input_.clear();
+    input_pos_ = 0;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    Backoff backoff(std::chrono::milliseconds(100), std::chrono::seconds(1));
     while (!socket_.is_open()) {
         try {
-            std::cerr << "Connecting to " << host_ << ":" << port_ << std::endl;
+            LOG_DEBUG("Connecting to " << host_ << ":" << port_);
             socket_.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(host_), port_));
+            if (protocol_ == Protocol::BINARY) {
+                boost::asio::write(socket_, boost::asio::buffer(binary_protocol::MAGIC));
+            }
         } catch (const boost::system::system_error& e) {
-            std::cerr << "Failed to connect to " << host_ << ":" << port_ << ": " << e.what() << std::endl;
+            LOG_WARNING("Failed to connect to " << host_ << ":" << port_ << ": " << e.what());
             socket_.close();
-            std::this_thread::sleep_for(std::chrono::seconds(1));
+            auto delay = backoff.next();
+            if (std::chrono::steady_clock::now() + delay >= deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(delay);
         }
     }
-    std::cerr << "Connected to " << host_ << ":" << port_ << std::endl;
+    LOG_INFO("Connected to " << host_ << ":" << port_);
+    return true;
 }
 
-std::pair<std::string, bool> Client::get(const std::string& key) {
-    rapidjson::Document d;
-    d.SetObject();
-    {
-        rapidjson::Value v;
-        v.SetString("get");
-        d.AddMember("command", v, d.GetAllocator());
-        v.SetString(rapidjson::StringRef(key.data(), key.size()));
-        d.AddMember("key", v, d.GetAllocator());
+std::pair<Client::Response, bool> Client::get(const std::string& key) {
+    return send_request({Request::Type::GET, key, {}});
+}
+
+std::pair<Client::Response, bool> Client::set(const std::string& key, const std::string& value) {
+    return send_request({Request::Type::SET, key, value});
+}
+
+std::pair<Client::Response, bool> Client::cas(const std::string& key, const std::string& expected, const std::string& value) {
+    return send_request({Request::Type::CAS, key, value, expected});
+}
+
+std::pair<Client::Response, bool> Client::incr(const std::string& key, int64_t delta) {
+    return send_request({Request::Type::INCR, key, {}, {}, delta});
+}
+
+std::pair<Client::Response, bool> Client::decr(const std::string& key, int64_t delta) {
+    return send_request({Request::Type::DECR, key, {}, {}, delta});
+}
+
+std::pair<Client::Response, bool> Client::append(const std::string& key, const std::string& value) {
+    return send_request({Request::Type::APPEND, key, value});
+}
+
+std::pair<Client::Response, bool> Client::setnx(const std::string& key, const std::string& value) {
+    return send_request({Request::Type::SETNX, key, value});
+}
+
+std::pair<Client::Response, bool> Client::send_request(const Request& request) {
+    Response response;
+    try {
+        response = send_request_and_get_response(request);
+    } catch (const boost::system::system_error& e) {
+        LOG_WARNING("Failed to send request: " << e.what());
+        socket_.close();
+        return {{}, false};
+    }
+    return {std::move(response), true};
+}
+
+std::pair<Client::Response, bool> Client::watch(const std::string& key) {
+    return send_request({Request::Type::WATCH, key});
+}
+
+std::pair<Client::Response, bool> Client::watch_prefix(const std::string& prefix) {
+    return send_request({Request::Type::WATCH_PREFIX, prefix});
+}
+
+std::pair<Client::Response, bool> Client::unwatch(const std::string& key) {
+    return send_request({Request::Type::UNWATCH, key});
+}
+
+std::pair<Client::Response, bool> Client::unwatch_prefix(const std::string& prefix) {
+    return send_request({Request::Type::UNWATCH_PREFIX, prefix});
+}
+
+std::pair<std::vector<Client::Notification>, bool> Client::wait_notifications(std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    try {
+        take_notifications();
+        while (notifications_.empty()) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            pollfd fd{socket_.native_handle(), POLLIN, 0};
+            if (left.count() <= 0 || ::poll(&fd, 1, left.count()) <= 0) {
+                break;
+            }
+            std::array<char, 4096> data;
+            size_t length = socket_.read_some(boost::asio::buffer(data));
+            input_.append(data.data(), length);
+            take_notifications();
+        }
+    } catch (const boost::system::system_error& e) {
+        LOG_WARNING("Failed to read notifications: " << e.what());
+        socket_.close();
+        return {{}, false};
     }
+    return {std::exchange(notifications_, {}), true};
+}
 
-    std::cerr << "Sending get request: " << key << std::endl;
+std::pair<std::vector<Client::Response>, bool> Client::pipeline(const std::vector<Request>& requests) {
+    std::string message;
+    for (const auto& request : requests) {
+        append_request(protocol_, request, message);
+    }
 
-    std::array<char, 4096> data;
-    size_t length = 0;
+    std::vector<Response> responses;
+    responses.reserve(requests.size());
     try {
-        length = send_request_and_get_response(d, data);
+        boost::asio::write(socket_, boost::asio::buffer(message));
+        for (size_t i = 0; i < requests.size(); ++i) {
+            responses.push_back(read_response());
+        }
     } catch (const boost::system::system_error& e) {
-        std::cerr << "Failed to send get request: " << e.what() << std::endl;
+        LOG_WARNING("Failed to send pipelined requests: " << e.what());
         socket_.close();
-        return {"", false};
+        return {{}, false};
     }
 
-    std::cerr << "Response to get: " << std::string(data.data(), length) << std::endl;
+    return {std::move(responses), true};
+}
+
+std::pair<std::vector<Client::Response>, bool> Client::mget(const std::vector<std::string>& keys) {
+    return send_batch_request(make_batch_request(protocol_, keys, {}, false), keys.size());
+}
 
-    return {std::string(data.data(), length), true};
+std::pair<std::vector<Client::Response>, bool> Client::mset(const std::vector<std::pair<std::string, std::string>>& items) {
+    return send_batch_request(make_batch_request(protocol_, {}, items, true), items.size());
 }
 
-std::pair<std::string, bool> Client::set(const std::string& key, const std::string& value) {
+std::pair<Client::TopResponse, bool> Client::top(size_t count, std::chrono::seconds period) {
+    if (protocol_ != Protocol::JSON) {
+        return {{}, true};
+    }
+
     rapidjson::Document d;
     d.SetObject();
-    {
-        rapidjson::Value v;
-        v.SetString("set");
-        d.AddMember("command", v, d.GetAllocator());
-        v.SetString(rapidjson::StringRef(key.data(), key.size()));
-        d.AddMember("key", v, d.GetAllocator());
-        v.SetString(rapidjson::StringRef(value.data(), value.size()));
-        d.AddMember("value", v, d.GetAllocator());
+    d.AddMember("command", rapidjson::StringRef("top"), d.GetAllocator());
+    d.AddMember("count", static_cast<uint64_t>(count), d.GetAllocator());
+    d.AddMember("seconds", static_cast<uint64_t>(period.count()), d.GetAllocator());
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    d.Accept(writer);
+
+    std::string message;
+    uint32_t len = htonl(buffer.GetSize());
+    message.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    message.append(buffer.GetString(), buffer.GetSize());
+
+    std::string_view frame;
+    try {
+        boost::asio::write(socket_, boost::asio::buffer(message));
+        frame = std::string_view(input_).substr(input_pos_, read_frame(false));
+    } catch (const boost::system::system_error& e) {
+        LOG_WARNING("Failed to send top request: " << e.what());
+        socket_.close();
+        return {{}, false};
+    }
+
+    TopResponse response;
+    rapidjson::Document r;
+    r.Parse(frame.data() + sizeof(uint32_t), frame.size() - sizeof(uint32_t));
+    consume_input(frame.size());
+    if (r.HasParseError() || !r.IsObject() || !r.HasMember("ok") || !r["ok"].IsBool() || !r["ok"].GetBool()
+            || !r.HasMember("keys") || !r["keys"].IsArray()) {
+        return {response, true};
+    }
+    response.ok = true;
+    if (r.HasMember("period_ms") && r["period_ms"].IsUint64()) {
+        response.period = std::chrono::milliseconds(r["period_ms"].GetUint64());
+    }
+    if (r.HasMember("requests") && r["requests"].IsUint64()) {
+        response.requests = r["requests"].GetUint64();
+    }
+    for (const auto& item : r["keys"].GetArray()) {
+        if (item.IsObject() && item.HasMember("key") && item["key"].IsString() && item.HasMember("count") && item["count"].IsUint64()) {
+            response.keys.push_back({std::string(item["key"].GetString(), item["key"].GetStringLength()), item["count"].GetUint64()});
+        }
+    }
+    return {std::move(response), true};
+}
+
+std::string Client::make_batch_request(Protocol protocol, const std::vector<std::string>& keys, const std::vector<std::pair<std::string, std::string>>& items, bool is_set) {
+    std::string message;
+    if (protocol == Protocol::BINARY) {
+        std::string body;
+        if (is_set) {
+            for (const auto& [key, value] : items) {
+                binary_protocol::append_batch_item(body, key, value);
+            }
+        } else {
+            for (const auto& key : keys) {
+                binary_protocol::append_batch_item(body, key);
+            }
+        }
+        auto opcode = is_set ? binary_protocol::Opcode::MSET : binary_protocol::Opcode::MGET;
+        binary_protocol::append_batch_request(message, opcode, is_set ? items.size() : keys.size(), body);
+        return message;
     }
 
-    std::cerr << "Sending set request: " << key << " -> " << value << std::endl;
+    rapidjson::Document d;
+    d.SetObject();
+    d.AddMember("command", rapidjson::StringRef(is_set ? "mset" : "mget"), d.GetAllocator());
+    rapidjson::Value array(rapidjson::kArrayType);
+    if (is_set) {
+        for (const auto& [key, value] : items) {
+            rapidjson::Value item(rapidjson::kObjectType);
+            item.AddMember("key", rapidjson::StringRef(key.data(), key.size()), d.GetAllocator());
+            item.AddMember("value", rapidjson::StringRef(value.data(), value.size()), d.GetAllocator());
+            array.PushBack(item, d.GetAllocator());
+        }
+    } else {
+        for (const auto& key : keys) {
+            array.PushBack(rapidjson::StringRef(key.data(), key.size()), d.GetAllocator());
+        }
+    }
+    d.AddMember(rapidjson::StringRef(is_set ? "items" : "keys"), array, d.GetAllocator());
 
-    std::array<char, 4096> data;
-    size_t length = 0;
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    d.Accept(writer);
+
+    uint32_t len = htonl(buffer.GetSize());
+    message.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    message.append(buffer.GetString(), buffer.GetSize());
+    return message;
+}
+
+std::pair<std::vector<Client::Response>, bool> Client::send_batch_request(const std::string& message, size_t count) {
+    if (!send_batch(message)) {
+        return {{}, false};
+    }
+    return receive_batch(count);
+}
+
+bool Client::send_batch(const std::string& message) {
     try {
-        length = send_request_and_get_response(d, data);
+        boost::asio::write(socket_, boost::asio::buffer(message));
     } catch (const boost::system::system_error& e) {
-        std::cerr << "Failed to send set request: " << e.what() << std::endl;
+        LOG_WARNING("Failed to send batch request: " << e.what());
         socket_.close();
-        return {"", false};
+        return false;
     }
+    return true;
+}
 
-    std::cerr << "Response to set: " << std::string(data.data(), length) << std::endl;
+std::pair<std::vector<Client::Response>, bool> Client::receive_batch(size_t count) {
+    std::vector<Response> responses;
+    try {
+        responses = read_batch_response(count);
+    } catch (const boost::system::system_error& e) {
+        LOG_WARNING("Failed to read batch response: " << e.what());
+        socket_.close();
+        return {{}, false};
+    }
+    return {std::move(responses), true};
+}
 
-    return {std::string(data.data(), length), true};
+rapidjson::Document Client::make_request(const Request& request) {
+    rapidjson::Document d;
+    d.SetObject();
+    rapidjson::Value v;
+    v.SetString(rapidjson::StringRef(get_command(request.type)));
+    d.AddMember("command", v, d.GetAllocator());
+    bool is_prefix = request.type == Request::Type::WATCH_PREFIX || request.type == Request::Type::UNWATCH_PREFIX;
+    v.SetString(rapidjson::StringRef(request.key.data(), request.key.size()));
+    d.AddMember(rapidjson::StringRef(is_prefix ? "prefix" : "key"), v, d.GetAllocator());
+    switch (request.type) {
+        case Request::Type::CAS:
+            v.SetString(rapidjson::StringRef(request.expected.data(), request.expected.size()));
+            d.AddMember("expected", v, d.GetAllocator());
+            [[fallthrough]];
+        case Request::Type::SET:
+        case Request::Type::APPEND:
+        case Request::Type::SETNX:
+            v.SetString(rapidjson::StringRef(request.value.data(), request.value.size()));
+            d.AddMember("value", v, d.GetAllocator());
+            break;
+        case Request::Type::INCR:
+        case Request::Type::DECR:
+            d.AddMember("delta", request.delta, d.GetAllocator());
+            break;
+        default:
+            break;
+    }
+    return d;
 }
 
-size_t Client::send_request_and_get_response(const rapidjson::Document& d, std::array<char, 4096>& resp) {
+void Client::append_request(Protocol protocol, const Request& request, std::string& message) {
+    if (protocol == Protocol::BINARY) {
+        std::string value;
+        switch (request.type) {
+            case Request::Type::CAS:
+                binary_protocol::append_uint32(value, request.expected.size());
+                value.append(request.expected);
+                value.append(request.value);
+                break;
+            case Request::Type::INCR:
+            case Request::Type::DECR:
+                binary_protocol::append_int64(value, request.delta);
+                break;
+            default:
+                binary_protocol::append_request(message, get_opcode(request.type), request.key, request.value);
+                return;
+        }
+        binary_protocol::append_request(message, get_opcode(request.type), request.key, value);
+        return;
+    }
+
     rapidjson::StringBuffer buffer;
     rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-    d.Accept(writer);
+    make_request(request).Accept(writer);
+
+    uint32_t len = htonl(buffer.GetSize());
+    message.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    message.append(buffer.GetString(), buffer.GetSize());
+}
 
-    int32_t len = buffer.GetLength();
-    len = htonl(len);
-    std::string len_str = std::string(reinterpret_cast<char*>(&len), sizeof(len));
-    std::string message = len_str + buffer.GetString();
+Client::Response Client::send_request_and_get_response(const Request& request) {
+    std::string message;
+    append_request(protocol_, request, message);
 
     boost::asio::write(socket_, boost::asio::buffer(message));
-    return socket_.read_some(boost::asio::buffer(resp));
+    return read_response();
+}
+
+size_t Client::response_size(Protocol protocol, std::string_view input, bool is_batch) {
+    if (protocol == Protocol::JSON) {
+        if (input.size() < sizeof(uint32_t)) {
+            return 0;
+        }
+        uint32_t len;
+        std::memcpy(&len, input.data(), sizeof(len));
+        size_t size = sizeof(len) + ntohl(len);
+        return input.size() >= size ? size : 0;
+    }
+
+    // A notification before the response
+    if (!input.empty() && binary_protocol::is_notification(input.data())) {
+        return 0;
+    }
+    size_t size = 0;
+    uint32_t count = 1;
+    if (is_batch) {
+        if (input.size() < binary_protocol::BATCH_RESPONSE_HEADER_SIZE) {
+            return 0;
+        }
+        count = binary_protocol::read_uint32(input.data() + 1);
+        size = binary_protocol::BATCH_RESPONSE_HEADER_SIZE;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        if (input.size() < size + binary_protocol::RESPONSE_HEADER_SIZE) {
+            return 0;
+        }
+        size += binary_protocol::RESPONSE_HEADER_SIZE + binary_protocol::read_response_header(input.data() + size).value_size;
+    }
+    return input.size() >= size ? size : 0;
+}
+
+Client::Response Client::read_response() {
+    size_t size = read_frame(false);
+    auto response = parse_response(protocol_, std::string_view(input_).substr(input_pos_, size));
+    consume_input(size);
+    return response;
+}
+
+std::vector<Client::Response> Client::read_batch_response(size_t count) {
+    size_t size = read_frame(true);
+    auto responses = parse_batch_response(protocol_, std::string_view(input_).substr(input_pos_, size), count);
+    consume_input(size);
+    return responses;
+}
+
+Client::Response Client::parse_response(Protocol protocol, std::string_view frame) {
+    if (protocol == Protocol::BINARY) {
+        auto header = binary_protocol::read_response_header(frame.data());
+        Response response;
+        response.ok = header.status == binary_protocol::Status::OK;
+        response.found = header.found;
+        response.applied = header.applied;
+        response.value = frame.substr(binary_protocol::RESPONSE_HEADER_SIZE, header.value_size);
+        response.get_count = header.get_count;
+        response.set_count = header.set_count;
+        return response;
+    }
+
+    rapidjson::Document d;
+    d.Parse(frame.data() + sizeof(uint32_t), frame.size() - sizeof(uint32_t));
+    if (d.HasParseError() || !d.IsObject()) {
+        return {};
+    }
+    return parse_json_response(d, d.HasMember("ok") && d["ok"].IsBool() && d["ok"].GetBool());
+}
+
+std::vector<Client::Response> Client::parse_batch_response(Protocol protocol, std::string_view frame, size_t count) {
+    // A rejected batch gets a single error reply, every key of it is reported as failed
+    std::vector<Response> responses(count);
+    if (protocol == Protocol::BINARY) {
+        auto status = static_cast<binary_protocol::Status>(frame[0]);
+        uint32_t received = binary_protocol::read_uint32(frame.data() + 1);
+        size_t pos = binary_protocol::BATCH_RESPONSE_HEADER_SIZE;
+        for (uint32_t i = 0; i < received; ++i) {
+            size_t size = binary_protocol::RESPONSE_HEADER_SIZE + binary_protocol::read_response_header(frame.data() + pos).value_size;
+            if (status == binary_protocol::Status::OK && i < count) {
+                responses[i] = parse_response(protocol, frame.substr(pos, size));
+            }
+            pos += size;
+        }
+        return responses;
+    }
+
+    rapidjson::Document d;
+    d.Parse(frame.data() + sizeof(uint32_t), frame.size() - sizeof(uint32_t));
+    if (d.HasParseError() || !d.IsObject() || !d.HasMember("ok") || !d["ok"].IsBool() || !d["ok"].GetBool()
+            || !d.HasMember("results") || !d["results"].IsArray()) {
+        return responses;
+    }
+    const auto& results = d["results"];
+    for (rapidjson::SizeType i = 0; i < results.Size() && i < count; ++i) {
+        if (results[i].IsObject()) {
+            responses[i] = parse_json_response(results[i], true);
+        }
+    }
+    return responses;
+}
+
+size_t Client::notification_size(Protocol protocol, std::string_view input) {
+    if (protocol == Protocol::JSON) {
+        // The server writes the event member first, responses never have it
+        size_t size = response_size(protocol, input, false);
+        return size > 0 && input.substr(sizeof(uint32_t)).starts_with(R"({"event")") ? size : 0;
+    }
+
+    if (input.size() < binary_protocol::NOTIFICATION_HEADER_SIZE || !binary_protocol::is_notification(input.data())) {
+        return 0;
+    }
+    auto header = binary_protocol::read_notification_header(input.data());
+    size_t size = binary_protocol::NOTIFICATION_HEADER_SIZE + uint64_t(header.key_size) + header.value_size;
+    return input.size() >= size ? size : 0;
+}
+
+Client::Notification Client::parse_notification(Protocol protocol, std::string_view frame) {
+    Notification notification;
+    if (protocol == Protocol::BINARY) {
+        auto header = binary_protocol::read_notification_header(frame.data());
+        notification.overflow = header.overflow;
+        notification.key = frame.substr(binary_protocol::NOTIFICATION_HEADER_SIZE, header.key_size);
+        notification.value = frame.substr(binary_protocol::NOTIFICATION_HEADER_SIZE + header.key_size, header.value_size);
+        return notification;
+    }
+
+    rapidjson::Document d;
+    d.Parse(frame.data() + sizeof(uint32_t), frame.size() - sizeof(uint32_t));
+    if (d.HasParseError() || !d.IsObject() || !d.HasMember("event") || !d["event"].IsString()) {
+        return notification;
+    }
+    notification.overflow = std::string_view(d["event"].GetString()) == "overflow";
+    if (d.HasMember("key") && d["key"].IsString()) {
+        notification.key.assign(d["key"].GetString(), d["key"].GetStringLength());
+    }
+    if (d.HasMember("value") && d["value"].IsString()) {
+        notification.value.assign(d["value"].GetString(), d["value"].GetStringLength());
+    }
+    return notification;
+}
+
+Client::Response Client::parse_json_response(const rapidjson::Value& v, bool ok) {
+    Response response;
+    response.ok = ok;
+    response.found = v.HasMember("found") && v["found"].IsBool() && v["found"].GetBool();
+    response.applied = v.HasMember("applied") && v["applied"].IsBool() && v["applied"].GetBool();
+    if (v.HasMember("value") && v["value"].IsString()) {
+        response.value.assign(v["value"].GetString(), v["value"].GetStringLength());
+    }
+    if (v.HasMember("stat") && v["stat"].IsObject()) {
+        const auto& stat = v["stat"];
+        if (stat.HasMember("get_count") && stat["get_count"].IsUint64()) {
+            response.get_count = stat["get_count"].GetUint64();
+        }
+        if (stat.HasMember("set_count") && stat["set_count"].IsUint64()) {
+            response.set_count = stat["set_count"].GetUint64();
+        }
+    }
+    return response;
+}
+
+size_t Client::read_frame(bool is_batch) {
+    while (true) {
+        take_notifications();
+        size_t size = response_size(protocol_, std::string_view(input_).substr(input_pos_), is_batch);
+        if (size > 0) {
+            return size;
+        }
+        std::array<char, 4096> data;
+        size_t length = socket_.read_some(boost::asio::buffer(data));
+        input_.append(data.data(), length);
+    }
+}
+
+void Client::take_notifications() {
+    while (size_t size = notification_size(protocol_, std::string_view(input_).substr(input_pos_))) {
+        notifications_.push_back(parse_notification(protocol_, std::string_view(input_).substr(input_pos_, size)));
+        consume_input(size);
+    }
+}
+
+void Client::consume_input(size_t size) {
+    input_pos_ += size;
+    if (input_pos_ == input_.size() || input_pos_ > MAX_CONSUMED_INPUT) {
+        input_.erase(0, input_pos_);
+        input_pos_ = 0;
+    }
 }
@@ -4,24 +4,162 @@
 #include <boost/asio/ip/tcp.hpp>
 
 #include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include <rapidjson/document.h>
 
 class Client {
 public:
-    Client(const std::string& host, uint16_t port);
+    enum class Protocol {
+        JSON,
+        BINARY,
+    };
 
-    void connect(std::chrono::seconds timeout = std::chrono::seconds(5));
+    struct Request {
+        enum class Type {
+            GET,
+            SET,
+            CAS,
+            INCR,
+            DECR,
+            APPEND,
+            SETNX,
+            WATCH,
+            WATCH_PREFIX,
+            UNWATCH,
+            UNWATCH_PREFIX,
+        };
 
-    std::pair<std::string, bool> get(const std::string& key);
-    std::pair<std::string, bool> set(const std::string& key, const std::string& value);
+        Type type;
+        // The prefix for WATCH_PREFIX and UNWATCH_PREFIX
+        std::string key = {};
+        std::string value = {};
+        // Only used by CAS
+        std::string expected = {};
+        // Only used by INCR and DECR
+        int64_t delta = 0;
+    };
+
+    struct Response {
+        // False if the server rejected the request
+        bool ok = false;
+        bool found = false;
+        // Whether an update changed the value, the value is the one after the update
+        bool applied = false;
+        std::string value;
+        uint64_t get_count = 0;
+        uint64_t set_count = 0;
+    };
+
+    struct Notification {
+        // Changes were dropped because the client read them too slowly, the watched keys must be read again.
+        // Key and value are empty then.
+        bool overflow = false;
+        std::string key;
+        std::string value;
+    };
+
+    struct HotKey {
+        std::string key;
+        uint64_t count = 0;
+    };
+
+    struct TopResponse {
+        bool ok = false;
+        // Period the report actually covers
+        std::chrono::milliseconds period{0};
+        uint64_t requests = 0;
+        // The hottest first
+        std::vector<HotKey> keys;
+    };
+
+public:
+    // Connects with connect_timeout, a zero timeout makes a single attempt
+    Client(const std::string& host, uint16_t port, Protocol protocol = Protocol::JSON,
+        std::chrono::seconds connect_timeout = std::chrono::seconds(5));
+
+    // Retries with growing delays until connected, false if the timeout is reached
+    bool connect(std::chrono::seconds timeout = std::chrono::seconds(5));
+
+    std::pair<Response, bool> get(const std::string& key);
+    std::pair<Response, bool> set(const std::string& key, const std::string& value);
+
+    // Atomic updates, the server reads and writes the value under the lock of the key in one round trip.
+    // A value incr and decr can't add to, not a decimal int64 or overflowing, gets a response that is not ok.
+    std::pair<Response, bool> cas(const std::string& key, const std::string& expected, const std::string& value);
+    std::pair<Response, bool> incr(const std::string& key, int64_t delta = 1);
+    std::pair<Response, bool> decr(const std::string& key, int64_t delta = 1);
+    std::pair<Response, bool> append(const std::string& key, const std::string& value);
+    std::pair<Response, bool> setnx(const std::string& key, const std::string& value);
+
+    // The server pushes every later set of the key, or of the keys with the prefix, to this connection.
+    // Notifications that come while the client waits for a response are kept for wait_notifications.
+    // A key watch answers like get, so the client knows the value the notifications start from.
+    std::pair<Response, bool> watch(const std::string& key);
+    std::pair<Response, bool> watch_prefix(const std::string& prefix);
+    std::pair<Response, bool> unwatch(const std::string& key);
+    std::pair<Response, bool> unwatch_prefix(const std::string& prefix);
+    // Notifications received since the previous call, in the order of the sets. If there are none,
+    // waits for them up to timeout.
+    std::pair<std::vector<Notification>, bool> wait_notifications(std::chrono::milliseconds timeout);
+
+    // Sends all requests in one write and then reads the responses, which come in the order of requests
+    std::pair<std::vector<Response>, bool> pipeline(const std::vector<Request>& requests);
+
+    // Batch commands, a single request and response for all keys. Responses are in the order of keys.
+    std::pair<std::vector<Response>, bool> mget(const std::vector<std::string>& keys);
+    std::pair<std::vector<Response>, bool> mset(const std::vector<std::pair<std::string, std::string>>& items);
+
+    // The count hottest keys of the server over the last period. Only the JSON protocol has the command,
+    // over the binary one the response is never ok.
+    std::pair<TopResponse, bool> top(size_t count, std::chrono::seconds period);
+
+    // The two halves of mget and mset, so that a caller can have batches in flight on several servers at once.
+    // message is made by make_batch_request, a client that failed to send it is disconnected.
+    bool send_batch(const std::string& message);
+    std::pair<std::vector<Response>, bool> receive_batch(size_t count);
+
+    // Encoding and framing, for callers that drive the socket themselves
+    static void append_request(Protocol protocol, const Request& request, std::string& message);
+    static std::string make_batch_request(Protocol protocol, const std::vector<std::string>& keys, const std::vector<std::pair<std::string, std::string>>& items, bool is_set);
+    // Size of the complete response at the beginning of input, 0 if more bytes are needed
+    static size_t response_size(Protocol protocol, std::string_view input, bool is_batch);
+    // Decode a complete response of response_size bytes
+    static Response parse_response(Protocol protocol, std::string_view frame);
+    static std::vector<Response> parse_batch_response(Protocol protocol, std::string_view frame, size_t count);
+    // Size of the complete notification at the beginning of input, 0 if there is none or more bytes are needed
+    static size_t notification_size(Protocol protocol, std::string_view input);
+    static Notification parse_notification(Protocol protocol, std::string_view frame);
 
 private:
-    size_t send_request_and_get_response(const rapidjson::Document& d, std::array<char, 4096>& resp);
+    static rapidjson::Document make_request(const Request& request);
+
+    Response send_request_and_get_response(const Request& request);
+    std::pair<Response, bool> send_request(const Request& request);
+    std::pair<std::vector<Response>, bool> send_batch_request(const std::string& message, size_t count);
+
+    Response read_response();
+    std::vector<Response> read_batch_response(size_t count);
+    static Response parse_json_response(const rapidjson::Value& v, bool ok);
+
+    // Reads from the socket until a complete response is buffered, returns its size
+    // Notifications that come first are moved to notifications_
+    size_t read_frame(bool is_batch);
+    // Moves the complete notifications at the beginning of the input to notifications_
+    void take_notifications();
+    void consume_input(size_t size);
 
     std::string host_;
     uint16_t port_;
+    Protocol protocol_;
 
     boost::asio::io_context io_context_;
     boost::asio::ip::tcp::socket socket_;
+
+    // Bytes read from the socket that are not returned as responses yet
+    std::string input_;
+    size_t input_pos_ = 0;
+    std::vector<Notification> notifications_;
 };
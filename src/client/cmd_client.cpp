@@ -3,15 +3,29 @@
 #include <iostream>
 #include <regex>
 
+void print_response(const Client::Response& response, bool is_get) {
+    if (!response.ok) {
+        std::cout << "ERROR" << std::endl;
+        return;
+    }
+    if (response.found) {
+        std::cout << "value: " << response.value << ", ";
+    } else if (is_get) {
+        std::cout << "not found, ";
+    }
+    std::cout << "get_count: " << response.get_count << ", set_count: " << response.set_count << std::endl;
+}
+
 int main(int argc, char** argv) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <host> <port>" << std::endl;
+    if (argc != 3 && !(argc == 4 && std::string(argv[3]) == "--binary")) {
+        std::cerr << "Usage: " << argv[0] << " <host> <port> [--binary]" << std::endl;
         return 1;
     }
-    Client client(argv[1], std::stoi(argv[2]));
+    Client client(argv[1], std::stoi(argv[2]), argc == 4 ? Client::Protocol::BINARY : Client::Protocol::JSON);
 
     std::regex get_regex(R"(^\$get\s+([^\s=]+)\s*$)");
     std::regex set_regex(R"(^\$set\s+([^\s=]+)\s*=\s*([^\s]+)\s*$)");
+    std::regex top_regex(R"(^\$top(?:\s+(\d+))?(?:\s+(\d+))?\s*$)");
 
     bool should_reconnect = false;
     while (true) {
@@ -21,7 +35,10 @@ int main(int argc, char** argv) {
         std::cout << "> ";
         if (should_reconnect) {
             std::cout << "Reconnecting..." << std::endl;
-            client.connect();
+            if (!client.connect()) {
+                std::cout << "Failed to reconnect, retrying" << std::endl;
+                continue;
+            }
             std::cout << "Reconnected" << std::endl;
             should_reconnect = false;
         }
@@ -33,21 +50,38 @@ int main(int argc, char** argv) {
         }
         std::smatch match;
         if (std::regex_match(cmd, match, get_regex)) {
-            auto [value, ok] = client.get(match[1]);
+            auto [response, ok] = client.get(match[1]);
             if (!ok) {
                 std::cout << "Failed to get value" << std::endl;
                 should_reconnect = true;
                 continue;
             }
-            std::cout << value << std::endl;
+            print_response(response, true);
         } else if (std::regex_match(cmd, match, set_regex)) {
-            auto [value, ok] = client.set(match[1], match[2]);
+            auto [response, ok] = client.set(match[1], match[2]);
             if (!ok) {
                 std::cout << "Failed to set value" << std::endl;
                 should_reconnect = true;
                 continue;
             }
-            std::cout << value << std::endl;
+            print_response(response, false);
+        } else if (std::regex_match(cmd, match, top_regex)) {
+            size_t count = match[1].matched ? std::stoul(match[1]) : 10;
+            auto seconds = std::chrono::seconds(match[2].matched ? std::stoul(match[2]) : 60);
+            auto [response, ok] = client.top(count, seconds);
+            if (!ok) {
+                std::cout << "Failed to get hot keys" << std::endl;
+                should_reconnect = true;
+                continue;
+            }
+            if (!response.ok) {
+                std::cout << "ERROR" << std::endl;
+                continue;
+            }
+            std::cout << response.requests << " requests in the last " << response.period.count() / 1000.0 << " s" << std::endl;
+            for (const auto& hot_key : response.keys) {
+                std::cout << hot_key.key << ": " << hot_key.count << std::endl;
+            }
         } else {
             std::cout << "Unknown command: " << cmd << std::endl;
         }
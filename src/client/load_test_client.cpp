@@ -1,178 +1,620 @@
-#include "client.h"
+#include "sharded_client.h"
+#include "workload.h"
 
+#include "../util/binary_protocol.h"
+#include "../util/hash_ring.h"
+#include "../util/latency_histogram.h"
+#include "../util/log.h"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <fstream>
 #include <iostream>
-#include <random>
+#include <memory>
+#include <string_view>
 #include <thread>
 
 #include <rapidjson/document.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
+#include <unistd.h>
+
+
+using Clock = std::chrono::steady_clock;
 
 struct Params {
     std::string host;
     int port;
-    int n_requests;
-    int requests_period_us;
-    std::vector<std::string> keys;
+    WorkloadOptions workload;
     std::string statistics_output;
+    // Requests per second of all connections, 0 for the closed loop
+    double rate = 0;
+    double duration_s = 10;
+    double warmup_s = 1;
+    int threads = 1;
+    int connections = 0;
+    int pipeline_depth = 1;
+    int max_in_flight = 1024;
+    // Servers on ports port, port + 1, ..., each holding the keys of its shard of the hash ring
+    int shards = 1;
+    // Set every key of the key space once before the load
+    bool populate = false;
+    Client::Protocol protocol = Client::Protocol::JSON;
 };
 
 void help() {
-    std::cerr << "Usage: load_test_client <host> <port> <n_requests> <requests_period_us> <keys_list_file> <statistics_output>" << std::endl;
+    std::cerr << "Usage: load_test_client <host> <port> [keys_list_file] [options]" << std::endl;
     std::cerr << "host - server host" << std::endl;
-    std::cerr << "port - server port" << std::endl;
-    std::cerr << "n_requests - number of requests to send, must be positive" << std::endl;
-    std::cerr << "requests_period_us - period between requests in microseconds, must be positive" << std::endl;
-    std::cerr << "keys_list_file - file with keys list" << std::endl;
-    std::cerr << "statistics_output - file to write statistics (optional)" << std::endl;
+    std::cerr << "port - server port, the first of --shards consecutive ones" << std::endl;
+    std::cerr << "keys_list_file - file with keys list, without it --key_count synthetic keys key_0, key_1, ... are used" << std::endl;
+    std::cerr << "--rate=N - target requests per second of all connections; 0 runs a closed loop, where every connection keeps pipeline_depth requests in flight (0)" << std::endl;
+    std::cerr << "--duration_s=N - measured part of the test, 0 with --populate only populates the server (10)" << std::endl;
+    std::cerr << "--warmup_s=N - requests of the first seconds are sent but not measured (1)" << std::endl;
+    std::cerr << "--threads=N - threads driving the connections (1)" << std::endl;
+    std::cerr << "--connections=N - connections to the server (threads)" << std::endl;
+    std::cerr << "--pipeline_depth=N - requests in flight per connection in the closed loop (1)" << std::endl;
+    std::cerr << "--shards=N - servers on ports port ... port + N - 1, keys are routed to them as by ShardedClient and batches are split between them (1)" << std::endl;
+    std::cerr << "--max_in_flight=N - in the open loop a connection falls behind the schedule rather than exceed it (1024)" << std::endl;
+    std::cerr << "--key_count=N - number of synthetic keys" << std::endl;
+    std::cerr << "--key_distribution=uniform|zipfian|hotspot|latest - popularity of the keys; latest reads the recently written keys more often (uniform)" << std::endl;
+    std::cerr << "--zipf_theta=N - skew of zipfian and latest, between 0 and 1 (0.99)" << std::endl;
+    std::cerr << "--hot_keys=N, --hot_access=N - hotspot sends hot_access of the requests to hot_keys of the keys (0.2, 0.8)" << std::endl;
+    std::cerr << "--mix=get:N,set:N,mget:N,mset:N - relative weights of the operations (get:99,set:1, or mget:99,mset:1 if batch_size is greater than 1)" << std::endl;
+    std::cerr << "--batch_size=N - keys per mget and mset (1)" << std::endl;
+    std::cerr << "--value_size=fixed:N|uniform:MIN:MAX|pareto:MIN:MAX[:ALPHA] - sizes of the written values (uniform:1:100)" << std::endl;
+    std::cerr << "--populate - set every key once before the load" << std::endl;
+    std::cerr << "--protocol=json|binary - wire protocol (json)" << std::endl;
+    std::cerr << "--output=FILE - file to write statistics to" << std::endl;
     exit(1);
 }
 
 Params parse_params(int argc, char** argv) {
-    if (argc != 6 && argc != 7) {
-        help();
+    Params params;
+    std::vector<char*> positional;
+    for (int i = 0; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (!arg.starts_with("--")) {
+            positional.push_back(argv[i]);
+            continue;
+        }
+        if (arg == "--populate") {
+            params.populate = true;
+            continue;
+        }
+        auto eq = arg.find('=');
+        if (eq == std::string_view::npos) {
+            help();
+        }
+        auto name = arg.substr(2, eq - 2);
+        auto value = std::string(arg.substr(eq + 1));
+        try {
+            if (parse_workload_option(name, value, params.workload)) {
+                continue;
+            }
+        } catch (const std::invalid_argument& e) {
+            std::cerr << e.what() << std::endl;
+            help();
+        }
+        if (name == "rate") {
+            params.rate = std::stod(value);
+        } else if (name == "duration_s") {
+            params.duration_s = std::stod(value);
+        } else if (name == "warmup_s") {
+            params.warmup_s = std::stod(value);
+        } else if (name == "threads") {
+            params.threads = std::stoi(value);
+        } else if (name == "connections") {
+            params.connections = std::stoi(value);
+        } else if (name == "pipeline_depth") {
+            params.pipeline_depth = std::stoi(value);
+        } else if (name == "max_in_flight") {
+            params.max_in_flight = std::stoi(value);
+        } else if (name == "shards") {
+            params.shards = std::stoi(value);
+        } else if (name == "protocol" && value == "json") {
+            params.protocol = Client::Protocol::JSON;
+        } else if (name == "protocol" && value == "binary") {
+            params.protocol = Client::Protocol::BINARY;
+        } else if (name == "output") {
+            params.statistics_output = value;
+        } else {
+            help();
+        }
     }
 
-    Params params;
-    params.host = argv[1];
-    params.port = std::stoi(argv[2]);
-    params.n_requests = std::stoi(argv[3]);
-    params.requests_period_us = std::stoi(argv[4]);
-
-    std::ifstream keys_file(argv[5]);
-    if (!keys_file.is_open()) {
-        std::cerr << "Failed to open keys list file" << std::endl;
+    if (positional.size() != 3 && positional.size() != 4) {
         help();
     }
-    std::string key;
-    while (keys_file >> key) {
-        params.keys.push_back(key);
+    params.host = positional[1];
+    params.port = std::stoi(positional[2]);
+    if (positional.size() == 4) {
+        params.workload.keys_file = positional[3];
     }
-    keys_file.close();
-    if (params.keys.empty()) {
-        std::cerr << "Keys list is empty" << std::endl;
+
+    if (params.connections == 0) {
+        params.connections = params.threads;
+    }
+    if (params.rate < 0 || params.duration_s < 0 || (params.duration_s == 0 && !params.populate) || params.warmup_s < 0) {
         help();
     }
-    if (argc == 7) {
-        params.statistics_output = argv[6];
+    if (params.threads <= 0 || params.connections < params.threads) {
+        help();
     }
-
-    if (params.n_requests <= 0) {
+    if (params.pipeline_depth <= 0 || params.max_in_flight <= 0) {
         help();
     }
-    if (params.requests_period_us < 0) {
+    if (params.shards <= 0 || params.port + params.shards - 1 > 65535) {
         help();
     }
 
     return params;
 }
 
-std::string random_alphanumerical_string(size_t length_min, size_t length_max, std::mt19937& gen) {
-    static const char alphanum[] =
-        "0123456789"
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-        "abcdefghijklmnopqrstuvwxyz";
-    std::uniform_int_distribution<size_t> length_dist(length_min, length_max);
-    std::uniform_int_distribution<int> letters_dist(0, sizeof(alphanum) - 1);
-    std::string s;
-    size_t length = length_dist(gen);
-    for (size_t i = 0; i < length; ++i) {
-        s += alphanum[letters_dist(gen)];
-    }
-    return s;
-}
+// Results of the connections of one thread, merged by main after the threads finish
+struct Totals {
+    LatencyHistogram read;
+    LatencyHistogram write;
+    size_t keys = 0;
+    // Requests lost to connection errors or left without a response at the end
+    size_t errors = 0;
+};
 
-class Stat {
+struct Schedule {
+    Clock::time_point start;
+    // Responses to requests scheduled before this point are not measured
+    Clock::time_point measure_from;
+    Clock::time_point end;
+};
+
+// One connection of the load. In the open loop request i of the connection is due at a fixed point
+// of the schedule, whether responses to the previous ones have come or not, and its latency is counted
+// from that point, not from the moment it was actually sent. A server that stalls delays the requests
+// queued behind the stall and they are all counted as slow, instead of not being sent at all while
+// the client waits (coordinated omission).
+//
+// With several shards the connection has a socket to every server. A request goes to the shard of its key,
+// a batch is split into a part per shard, and it is complete when all of its parts are answered.
+class LoadConnection {
 public:
-    void report_value(double val) {
-        sum_ += val;
-        ++number_of_samples_;
+    LoadConnection(boost::asio::io_context& io_context, const Params& params, const Workload& workload, const HashRing& ring,
+            const Schedule& schedule, Clock::duration first_offset, uint32_t seed, Totals& totals)
+        : params_(params)
+        , ring_(ring)
+        , schedule_(schedule)
+        , timer_(io_context)
+        , totals_(totals)
+        , generator_(workload, seed)
+        , batch_size_(workload.batch_size())
+        , shard_keys_(ring.shards_count())
+        , shard_items_(ring.shards_count())
+        , first_offset_(first_offset) {
+        for (int i = 0; i < params.shards; ++i) {
+            auto& shard = *shards_.emplace_back(std::make_unique<Shard>(io_context));
+            shard.socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(params.host), params.port + i));
+            shard.socket.set_option(boost::asio::ip::tcp::no_delay(true));
+            if (params.protocol == Client::Protocol::BINARY) {
+                boost::asio::write(shard.socket, boost::asio::buffer(binary_protocol::MAGIC));
+            }
+        }
+        if (params.rate > 0) {
+            interval_ = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(params.connections / params.rate));
+        }
     }
 
-    size_t get_number_of_samples() {
-        return number_of_samples_;
+    // The schedule must be set by now
+    void start() {
+        next_due_ = schedule_.start + first_offset_;
+        for (auto& shard : shards_) {
+            read(*shard);
+        }
+        wait_until(schedule_.start);
     }
 
-    double get_mean() {
-        return sum_ / number_of_samples_;
+private:
+    static constexpr size_t READ_SIZE = 64 * 1024;
+    static constexpr auto DRAIN_TIMEOUT = std::chrono::seconds(5);
+
+    struct InFlight {
+        Clock::time_point due;
+        Workload::Operation operation;
+        // Parts not answered yet
+        size_t pending = 0;
+    };
+
+    // A request, or the part of a batch, sent to a shard
+    struct Part {
+        // Position of the request in the sequence of requests of the connection
+        uint64_t id;
+        bool is_batch;
+    };
+
+    struct Shard {
+        explicit Shard(boost::asio::io_context& io_context)
+            : socket(io_context) {
+        }
+
+        boost::asio::ip::tcp::socket socket;
+        std::deque<Part> parts;
+        std::string output;
+        std::string writing_output;
+        bool writing = false;
+        std::array<char, READ_SIZE> read_buffer;
+        std::string input;
+        size_t input_pos = 0;
+    };
+
+    void wait_until(Clock::time_point time) {
+        timer_.expires_at(time);
+        timer_.async_wait([this](const boost::system::error_code& error) {
+            if (!error) {
+                on_timer();
+            }
+        });
     }
 
-private:
-    size_t number_of_samples_ = 0;
-    double sum_ = 0.0;
+    void on_timer() {
+        if (closed_) {
+            return;
+        }
+        if (Clock::now() >= schedule_.end + DRAIN_TIMEOUT) {
+            // The servers won't answer the rest
+            close();
+            return;
+        }
+        send_due();
+    }
+
+    // Queues every request that is due and fits into the in-flight limit, then sleeps until the next one
+    void send_due() {
+        auto now = Clock::now();
+        bool closed_loop = params_.rate == 0;
+        size_t limit = closed_loop ? params_.pipeline_depth : params_.max_in_flight;
+        while (in_flight_.size() < limit && now < schedule_.end && (closed_loop || next_due_ <= now)) {
+            auto due = closed_loop ? now : next_due_;
+            auto operation = generator_.next_operation();
+            in_flight_.push_back({due, operation, append_request(operation)});
+            next_due_ += interval_;
+        }
+        for (auto& shard : shards_) {
+            write(*shard);
+        }
+
+        if (now >= schedule_.end) {
+            if (in_flight_.empty()) {
+                close();
+            } else {
+                wait_until(schedule_.end + DRAIN_TIMEOUT);
+            }
+        } else if (!closed_loop && in_flight_.size() < limit) {
+            wait_until(std::min(next_due_, schedule_.end));
+        }
+    }
+
+    // Returns the number of parts the request is sent in
+    size_t append_request(Workload::Operation operation) {
+        uint64_t id = first_id_ + in_flight_.size();
+        bool is_write = Workload::is_write(operation);
+        if (!Workload::is_batch(operation)) {
+            request_.type = is_write ? Client::Request::Type::SET : Client::Request::Type::GET;
+            generator_.next_key(is_write, request_.key);
+            if (is_write) {
+                request_.value.assign(generator_.next_value());
+            } else {
+                request_.value.clear();
+            }
+            auto& shard = *shards_[ring_.shard(request_.key)];
+            Client::append_request(params_.protocol, request_, shard.output);
+            shard.parts.push_back({id, false});
+            return 1;
+        }
+
+        // The buffers keep their capacity, so that generating a request allocates little
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            shard_keys_[i].clear();
+            shard_items_[i].clear();
+        }
+        for (size_t i = 0; i < batch_size_; ++i) {
+            generator_.next_key(is_write, key_);
+            size_t shard = ring_.shard(key_);
+            if (is_write) {
+                shard_items_[shard].emplace_back(key_, generator_.next_value());
+            } else {
+                shard_keys_[shard].push_back(key_);
+            }
+        }
+        size_t parts = 0;
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            if (shard_keys_[i].empty() && shard_items_[i].empty()) {
+                continue;
+            }
+            shards_[i]->output += Client::make_batch_request(params_.protocol, shard_keys_[i], shard_items_[i], is_write);
+            shards_[i]->parts.push_back({id, true});
+            ++parts;
+        }
+        return parts;
+    }
+
+    void write(Shard& shard) {
+        if (shard.writing || shard.output.empty() || closed_) {
+            return;
+        }
+        shard.writing = true;
+        shard.writing_output.swap(shard.output);
+        shard.output.clear();
+        boost::asio::async_write(shard.socket, boost::asio::buffer(shard.writing_output), [this, &shard](const boost::system::error_code& error, size_t) {
+            shard.writing = false;
+            if (error) {
+                fail(error);
+                return;
+            }
+            write(shard);
+        });
+    }
+
+    void read(Shard& shard) {
+        if (shard.input_pos > 0) {
+            shard.input.erase(0, shard.input_pos);
+            shard.input_pos = 0;
+        }
+        shard.socket.async_read_some(boost::asio::buffer(shard.read_buffer), [this, &shard](const boost::system::error_code& error, size_t length) {
+            if (error) {
+                fail(error);
+                return;
+            }
+            shard.input.append(shard.read_buffer.data(), length);
+            on_input(shard);
+        });
+    }
+
+    void on_input(Shard& shard) {
+        if (closed_) {
+            return;
+        }
+        auto now = Clock::now();
+        while (!shard.parts.empty()) {
+            std::string_view input(shard.input.data() + shard.input_pos, shard.input.size() - shard.input_pos);
+            size_t size = Client::response_size(params_.protocol, input, shard.parts.front().is_batch);
+            if (size == 0) {
+                break;
+            }
+            shard.input_pos += size;
+
+            auto& request = in_flight_[shard.parts.front().id - first_id_];
+            shard.parts.pop_front();
+            if (--request.pending > 0) {
+                continue;
+            }
+            if (request.due >= schedule_.measure_from) {
+                auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(now - request.due).count();
+                (Workload::is_write(request.operation) ? totals_.write : totals_.read).record(latency);
+                totals_.keys += Workload::is_batch(request.operation) ? batch_size_ : 1;
+            }
+        }
+        // Requests complete out of order across shards, they leave in order
+        while (!in_flight_.empty() && in_flight_.front().pending == 0) {
+            in_flight_.pop_front();
+            ++first_id_;
+        }
+
+        send_due();
+        if (!closed_) {
+            read(shard);
+        }
+    }
+
+    void fail(const boost::system::error_code& error) {
+        if (closed_) {
+            return;
+        }
+        LOG_WARNING("Connection failed: " << error.message());
+        close();
+    }
+
+    void close() {
+        if (closed_) {
+            return;
+        }
+        closed_ = true;
+        for (const auto& request : in_flight_) {
+            totals_.errors += request.pending > 0;
+        }
+        in_flight_.clear();
+        timer_.cancel();
+        for (auto& shard : shards_) {
+            shard->parts.clear();
+            boost::system::error_code ignored;
+            shard->socket.close(ignored);
+        }
+    }
+
+    const Params& params_;
+    const HashRing& ring_;
+    const Schedule& schedule_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    boost::asio::steady_timer timer_;
+    Totals& totals_;
+
+    Workload::Generator generator_;
+    const size_t batch_size_;
+    Client::Request request_;
+    std::string key_;
+    std::vector<std::vector<std::string>> shard_keys_;
+    std::vector<std::vector<std::pair<std::string, std::string>>> shard_items_;
+
+    const Clock::duration first_offset_;
+    Clock::duration interval_{0};
+    Clock::time_point next_due_;
+    std::deque<InFlight> in_flight_;
+    // Id of the front of in_flight_
+    uint64_t first_id_ = 0;
+    bool closed_ = false;
 };
 
+void add_histogram(rapidjson::Document& d, const char* name, const LatencyHistogram& histogram) {
+    if (histogram.count() == 0) {
+        return;
+    }
+    auto& allocator = d.GetAllocator();
+    auto us = [](double ns) {
+        return ns / 1000.0;
+    };
+    rapidjson::Value stat(rapidjson::kObjectType);
+    stat.AddMember("n_samples", histogram.count(), allocator);
+    stat.AddMember("mean", us(histogram.mean()), allocator);
+    stat.AddMember("p50", us(histogram.percentile(50)), allocator);
+    stat.AddMember("p90", us(histogram.percentile(90)), allocator);
+    stat.AddMember("p99", us(histogram.percentile(99)), allocator);
+    stat.AddMember("p999", us(histogram.percentile(99.9)), allocator);
+    stat.AddMember("max", us(histogram.max()), allocator);
+    // Non-empty buckets as [lowest value in ns, count], so that runs of several processes can be merged
+    rapidjson::Value buckets(rapidjson::kArrayType);
+    histogram.for_each_bucket([&](uint64_t value, uint64_t count) {
+        rapidjson::Value bucket(rapidjson::kArrayType);
+        bucket.PushBack(value, allocator);
+        bucket.PushBack(count, allocator);
+        buckets.PushBack(bucket, allocator);
+    });
+    stat.AddMember("histogram_ns", buckets, allocator);
+    d.AddMember(rapidjson::StringRef(name), stat, allocator);
+}
+
+std::vector<ShardedClient::Endpoint> get_endpoints(const Params& params) {
+    std::vector<ShardedClient::Endpoint> endpoints;
+    for (int i = 0; i < params.shards; ++i) {
+        endpoints.push_back({params.host, static_cast<uint16_t>(params.port + i)});
+    }
+    return endpoints;
+}
+
+// Sets every key once with mset, the threads split the key space into contiguous ranges
+bool populate(const Params& params, const Workload& workload, uint32_t seed) {
+    constexpr uint64_t BATCH_SIZE = 100;
+    std::atomic_bool ok = true;
+    std::vector<std::thread> threads;
+    uint64_t count = workload.key_count();
+    for (int t = 0; t < params.threads; ++t) {
+        threads.emplace_back([&, t] {
+            ShardedClient client(get_endpoints(params), params.protocol);
+            Workload::Generator generator(workload, seed + t);
+            std::vector<std::pair<std::string, std::string>> items;
+            uint64_t end = count * (t + 1) / params.threads;
+            for (uint64_t i = count * t / params.threads; i < end && ok; i += BATCH_SIZE) {
+                items.resize(std::min(BATCH_SIZE, end - i));
+                for (size_t j = 0; j < items.size(); ++j) {
+                    workload.key(i + j, items[j].first);
+                    items[j].second.assign(generator.next_value());
+                }
+                if (!client.mset(items).second) {
+                    ok = false;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return ok;
+}
 
 int main(int argc, char** argv) {
     Params params = parse_params(argc, argv);
 
-    Client client(params.host, params.port);
-
-    // We add pid so we can initialize several clients automatically and be sure
-    //  that they will have different random generators
-    std::mt19937 gen(time(nullptr) + getpid());
-    std::uniform_int_distribution<int> key_dist(0, params.keys.size() - 1);
-    std::uniform_int_distribution<int> command_dist(0, 99);
-
-    Stat read_stat;
-    Stat write_stat;
-
-    int requests_sent = 0;
-    bool should_reconnect = false;
-    while (requests_sent < params.n_requests) {
-        if (should_reconnect) {
-            std::cerr << "Reconnecting..." << std::endl;
-            client.connect();
-            std::cerr << "Reconnected" << std::endl;
-            should_reconnect = false;
-        }
-
-        bool request_good;
-        if (command_dist(gen) == 0) {
-            const auto& key = params.keys[key_dist(gen)];
-            auto value = random_alphanumerical_string(1, 100, gen);
-
-            auto start = std::chrono::steady_clock::now();
-            auto [_, ok] = client.set(key, value);
-            auto end = std::chrono::steady_clock::now();
-            auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-            write_stat.report_value(duration_us);
-            request_good = ok;
-        } else {
-            const auto& key = params.keys[key_dist(gen)];
+    std::unique_ptr<Workload> workload;
+    try {
+        workload = std::make_unique<Workload>(params.workload);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        help();
+    }
+
+    std::vector<std::unique_ptr<boost::asio::io_context>> io_contexts;
+    std::vector<Totals> totals(params.threads);
+    std::vector<std::unique_ptr<LoadConnection>> connections;
+    HashRing ring(params.shards);
+    Schedule schedule;
 
-            auto start = std::chrono::steady_clock::now();
-            auto [_, ok] = client.get(key);
-            auto end = std::chrono::steady_clock::now();
-            auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-            read_stat.report_value(duration_us);
-            request_good = ok;
+    // Connections are established before the schedule starts, a little ahead of it.
+    // Connection i starts i / rate later than the first one, so that their requests interleave evenly.
+    auto rate = params.rate > 0 ? params.rate : 1.0;
+    // We add pid so we can start several clients at once and be sure that they have different random generators
+    uint32_t seed = time(nullptr) + getpid();
+    if (params.populate) {
+        auto begin = Clock::now();
+        if (!populate(params, *workload, seed)) {
+            std::cerr << "Failed to populate the server" << std::endl;
+            return 1;
         }
+        std::cerr << "Populated " << workload->key_count() << " keys in "
+            << std::chrono::duration<double>(Clock::now() - begin).count() << " s" << std::endl;
+        if (params.duration_s == 0) {
+            return 0;
+        }
+    }
 
-        if (!request_good) {
-            std::cerr << "Failed to send request" << std::endl;
-            should_reconnect = true;
-        } else {
-            ++requests_sent;
-            std::this_thread::sleep_for(std::chrono::microseconds(params.requests_period_us));
+    try {
+        for (int t = 0; t < params.threads; ++t) {
+            io_contexts.push_back(std::make_unique<boost::asio::io_context>(1));
         }
+        for (int i = 0; i < params.connections; ++i) {
+            auto offset = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(params.rate > 0 ? i / rate : 0));
+            connections.push_back(std::make_unique<LoadConnection>(*io_contexts[i % params.threads], params, *workload,
+                ring, schedule, offset, seed + i, totals[i % params.threads]));
+        }
+    } catch (const boost::system::system_error& e) {
+        std::cerr << "Failed to connect to " << params.host << ":" << params.port;
+        if (params.shards > 1) {
+            std::cerr << "-" << params.port + params.shards - 1;
+        }
+        std::cerr << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    schedule.start = Clock::now() + std::chrono::milliseconds(100);
+    schedule.measure_from = schedule.start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(params.warmup_s));
+    schedule.end = schedule.measure_from + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(params.duration_s));
+    for (auto& connection : connections) {
+        connection->start();
+    }
+
+    std::vector<std::thread> threads;
+    for (auto& io_context : io_contexts) {
+        threads.emplace_back([&io_context] {
+            io_context->run();
+        });
     }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    Totals result;
+    for (const auto& thread_totals : totals) {
+        result.read.merge(thread_totals.read);
+        result.write.merge(thread_totals.write);
+        result.keys += thread_totals.keys;
+        result.errors += thread_totals.errors;
+    }
+    size_t requests = result.read.count() + result.write.count();
 
     if (!params.statistics_output.empty()) {
         rapidjson::Document d;
         d.SetObject();
-        if (read_stat.get_number_of_samples() > 0) {
-            d.AddMember("read", rapidjson::Value().SetObject(), d.GetAllocator());
-            d["read"].AddMember("mean", read_stat.get_mean(), d.GetAllocator());
-            d["read"].AddMember("n_samples", read_stat.get_number_of_samples(), d.GetAllocator());
-        }
-        if (write_stat.get_number_of_samples() > 0) {
-            d.AddMember("write", rapidjson::Value().SetObject(), d.GetAllocator());
-            d["write"].AddMember("mean", write_stat.get_mean(), d.GetAllocator());
-            d["write"].AddMember("n_samples", write_stat.get_number_of_samples(), d.GetAllocator());
-        }
+        d.AddMember("duration_s", params.duration_s, d.GetAllocator());
+        d.AddMember("target_rate", params.rate, d.GetAllocator());
+        d.AddMember("connections", params.connections, d.GetAllocator());
+        d.AddMember("shards", params.shards, d.GetAllocator());
+        d.AddMember("requests_per_sec", requests / params.duration_s, d.GetAllocator());
+        d.AddMember("keys_per_sec", result.keys / params.duration_s, d.GetAllocator());
+        d.AddMember("errors", result.errors, d.GetAllocator());
+        add_histogram(d, "read", result.read);
+        add_histogram(d, "write", result.write);
 
         rapidjson::StringBuffer buffer;
         rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
@@ -181,5 +623,7 @@ int main(int argc, char** argv) {
         statistics_output << buffer.GetString();
     }
 
+    std::cerr << requests / params.duration_s << " requests/s, read p99 " << result.read.percentile(99) / 1000.0
+        << " us, write p99 " << result.write.percentile(99) / 1000.0 << " us, " << result.errors << " errors" << std::endl;
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,58 @@
+#include "replicated_client.h"
+
+
+ReplicatedClient::ReplicatedClient(const Endpoint& leader, const std::vector<Endpoint>& replicas, Protocol protocol)
+    : leader_(std::make_unique<Client>(leader.host, leader.port, protocol)) {
+    for (const auto& replica : replicas) {
+        // A single attempt, followers that are down are connected on use
+        auto client = std::make_unique<Client>(replica.host, replica.port, protocol, std::chrono::seconds(0));
+        replicas_.push_back({std::move(client)});
+    }
+}
+
+bool ReplicatedClient::connect(std::chrono::seconds timeout) {
+    for (auto& replica : replicas_) {
+        replica.connected = replica.connected || replica.client->connect(std::chrono::seconds(0));
+    }
+    return leader_->connect(timeout);
+}
+
+std::pair<ReplicatedClient::Response, bool> ReplicatedClient::get(const std::string& key) {
+    return read<Response>([&key](Client& client) {
+        return client.get(key);
+    });
+}
+
+std::pair<ReplicatedClient::Response, bool> ReplicatedClient::set(const std::string& key, const std::string& value) {
+    return leader_->set(key, value);
+}
+
+std::pair<std::vector<ReplicatedClient::Response>, bool> ReplicatedClient::mget(const std::vector<std::string>& keys) {
+    return read<std::vector<Response>>([&keys](Client& client) {
+        return client.mget(keys);
+    });
+}
+
+std::pair<std::vector<ReplicatedClient::Response>, bool> ReplicatedClient::mset(
+        const std::vector<std::pair<std::string, std::string>>& items) {
+    return leader_->mset(items);
+}
+
+template <typename R, typename F>
+std::pair<R, bool> ReplicatedClient::read(F&& read) {
+    for (size_t i = 0; i < replicas_.size(); ++i) {
+        auto& replica = replicas_[next_replica_];
+        next_replica_ = (next_replica_ + 1) % replicas_.size();
+        // A single attempt, a follower that is down must not delay the read
+        if (!replica.connected && !replica.client->connect(std::chrono::seconds(0))) {
+            continue;
+        }
+        replica.connected = true;
+        auto result = read(*replica.client);
+        if (result.second) {
+            return result;
+        }
+        replica.connected = false;
+    }
+    return read(*leader_);
+}
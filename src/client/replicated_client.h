@@ -0,0 +1,46 @@
+#pragma once
+
+#include "client.h"
+#include "sharded_client.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Client of a leader and its followers: sets go to the leader, gets go to the followers in turn.
+// A follower that fails is skipped until it reconnects, and gets go to the leader when all of them fail.
+// Followers lag behind the leader, a get from one may not see a set that was just acknowledged.
+class ReplicatedClient {
+public:
+    using Protocol = Client::Protocol;
+    using Response = Client::Response;
+    using Endpoint = ShardedClient::Endpoint;
+
+public:
+    ReplicatedClient(const Endpoint& leader, const std::vector<Endpoint>& replicas, Protocol protocol = Protocol::JSON);
+
+    // Connects the leader and the followers, false if the leader reaches the timeout.
+    // Followers that are not up yet are connected on use.
+    bool connect(std::chrono::seconds timeout = std::chrono::seconds(5));
+
+    std::pair<Response, bool> get(const std::string& key);
+    std::pair<Response, bool> set(const std::string& key, const std::string& value);
+
+    std::pair<std::vector<Response>, bool> mget(const std::vector<std::string>& keys);
+    std::pair<std::vector<Response>, bool> mset(const std::vector<std::pair<std::string, std::string>>& items);
+
+private:
+    struct Replica {
+        std::unique_ptr<Client> client;
+        bool connected = false;
+    };
+
+    // Calls read on followers in turn until one succeeds, then on the leader
+    template <typename R, typename F>
+    std::pair<R, bool> read(F&& read);
+
+    std::unique_ptr<Client> leader_;
+    std::vector<Replica> replicas_;
+    size_t next_replica_ = 0;
+};
@@ -0,0 +1,130 @@
+#include "sharded_client.h"
+
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+
+
+ShardedClient::ShardedClient(const std::vector<Endpoint>& endpoints, Protocol protocol, size_t virtual_nodes)
+    : protocol_(protocol)
+    , ring_(endpoints.size(), virtual_nodes) {
+    for (const auto& endpoint : endpoints) {
+        clients_.push_back(std::make_unique<Client>(endpoint.host, endpoint.port, protocol));
+    }
+}
+
+std::vector<ShardedClient::Endpoint> ShardedClient::parse_endpoints(std::string_view list) {
+    std::vector<Endpoint> endpoints;
+    while (!list.empty()) {
+        auto item = list.substr(0, list.find(','));
+        list.remove_prefix(std::min(list.size(), item.size() + 1));
+
+        auto colon = item.rfind(':');
+        uint16_t port = 0;
+        auto port_text = colon == std::string_view::npos ? std::string_view() : item.substr(colon + 1);
+        auto [end, ec] = std::from_chars(port_text.data(), port_text.data() + port_text.size(), port);
+        if (colon == 0 || port_text.empty() || ec != std::errc() || end != port_text.data() + port_text.size() || port == 0) {
+            throw std::invalid_argument("Expected host:port, got " + std::string(item));
+        }
+        endpoints.push_back({std::string(item.substr(0, colon)), port});
+    }
+    if (endpoints.empty()) {
+        throw std::invalid_argument("No servers in the list");
+    }
+    return endpoints;
+}
+
+bool ShardedClient::connect(std::chrono::seconds timeout) {
+    bool ok = true;
+    for (auto& client : clients_) {
+        ok = client->connect(timeout) && ok;
+    }
+    return ok;
+}
+
+std::pair<ShardedClient::Response, bool> ShardedClient::get(const std::string& key) {
+    return clients_[ring_.shard(key)]->get(key);
+}
+
+std::pair<ShardedClient::Response, bool> ShardedClient::set(const std::string& key, const std::string& value) {
+    return clients_[ring_.shard(key)]->set(key, value);
+}
+
+std::pair<std::vector<ShardedClient::Response>, bool> ShardedClient::mget(const std::vector<std::string>& keys) {
+    if (clients_.size() == 1) {
+        return clients_[0]->mget(keys);
+    }
+    std::vector<std::vector<size_t>> positions(clients_.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        positions[ring_.shard(keys[i])].push_back(i);
+    }
+    std::vector<std::string> messages(clients_.size());
+    std::vector<std::string> shard_keys;
+    for (size_t shard = 0; shard < clients_.size(); ++shard) {
+        if (positions[shard].empty()) {
+            continue;
+        }
+        shard_keys.clear();
+        for (size_t i : positions[shard]) {
+            shard_keys.push_back(keys[i]);
+        }
+        messages[shard] = Client::make_batch_request(protocol_, shard_keys, {}, false);
+    }
+    return exchange(messages, positions, keys.size());
+}
+
+std::pair<std::vector<ShardedClient::Response>, bool> ShardedClient::mset(const std::vector<std::pair<std::string, std::string>>& items) {
+    if (clients_.size() == 1) {
+        return clients_[0]->mset(items);
+    }
+    std::vector<std::vector<size_t>> positions(clients_.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        positions[ring_.shard(items[i].first)].push_back(i);
+    }
+    std::vector<std::string> messages(clients_.size());
+    std::vector<std::pair<std::string, std::string>> shard_items;
+    for (size_t shard = 0; shard < clients_.size(); ++shard) {
+        if (positions[shard].empty()) {
+            continue;
+        }
+        shard_items.clear();
+        for (size_t i : positions[shard]) {
+            shard_items.push_back(items[i]);
+        }
+        messages[shard] = Client::make_batch_request(protocol_, {}, shard_items, true);
+    }
+    return exchange(messages, positions, items.size());
+}
+
+std::pair<std::vector<ShardedClient::Response>, bool> ShardedClient::exchange(const std::vector<std::string>& messages,
+        const std::vector<std::vector<size_t>>& positions, size_t count) {
+    bool ok = true;
+    std::vector<bool> sent(clients_.size());
+    for (size_t shard = 0; shard < clients_.size(); ++shard) {
+        if (!messages[shard].empty()) {
+            sent[shard] = clients_[shard]->send_batch(messages[shard]);
+            ok = ok && sent[shard];
+        }
+    }
+
+    // Responses to the parts that were sent are read even if the batch failed, so that they are not taken
+    // for responses to the next requests
+    std::vector<Response> responses(count);
+    for (size_t shard = 0; shard < clients_.size(); ++shard) {
+        if (!sent[shard]) {
+            continue;
+        }
+        auto [shard_responses, received] = clients_[shard]->receive_batch(positions[shard].size());
+        if (!received) {
+            ok = false;
+            continue;
+        }
+        for (size_t i = 0; i < positions[shard].size(); ++i) {
+            responses[positions[shard][i]] = std::move(shard_responses[i]);
+        }
+    }
+    if (!ok) {
+        return {{}, false};
+    }
+    return {std::move(responses), true};
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "client.h"
+
+#include "../util/hash_ring.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Client of a dictionary split between several servers, each holding the keys that the hash ring maps
+// to its shard. get and set go to the shard of the key. mget and mset are split by shard: the parts are
+// written to all their servers first and read back after that, so the servers work on them at the same
+// time, and the responses are put back in the order of keys. A batch fails if any of its parts fails,
+// the parts that reached their servers may have been applied.
+class ShardedClient {
+public:
+    using Protocol = Client::Protocol;
+    using Response = Client::Response;
+
+    struct Endpoint {
+        std::string host;
+        uint16_t port;
+    };
+
+public:
+    // Shard i is served by endpoints[i], the order must be the same for all clients and for the split of the dictionary
+    ShardedClient(const std::vector<Endpoint>& endpoints, Protocol protocol = Protocol::JSON,
+        size_t virtual_nodes = HashRing::DEFAULT_VIRTUAL_NODES);
+
+    // "host:port,host:port,...", throws std::invalid_argument on malformed input
+    static std::vector<Endpoint> parse_endpoints(std::string_view list);
+
+    // Connects the shards that are not connected, false if any of them reaches the timeout
+    bool connect(std::chrono::seconds timeout = std::chrono::seconds(5));
+
+    std::pair<Response, bool> get(const std::string& key);
+    std::pair<Response, bool> set(const std::string& key, const std::string& value);
+
+    std::pair<std::vector<Response>, bool> mget(const std::vector<std::string>& keys);
+    std::pair<std::vector<Response>, bool> mset(const std::vector<std::pair<std::string, std::string>>& items);
+
+    const HashRing& ring() const {
+        return ring_;
+    }
+
+    Client& shard_client(size_t shard) {
+        return *clients_[shard];
+    }
+
+private:
+    // Sends messages[shard] to every shard that has one, then reads the responses for the keys at positions[shard]
+    std::pair<std::vector<Response>, bool> exchange(const std::vector<std::string>& messages,
+        const std::vector<std::vector<size_t>>& positions, size_t count);
+
+    Protocol protocol_;
+    HashRing ring_;
+    std::vector<std::unique_ptr<Client>> clients_;
+};
@@ -0,0 +1,280 @@
+#include "workload.h"
+
+#include <charconv>
+#include <fstream>
+#include <stdexcept>
+
+
+namespace {
+
+// Values are slices of the pool at random offsets, the extra space makes values of the same size differ
+constexpr size_t VALUE_POOL_EXTRA_SIZE = 1 << 20;
+
+std::vector<std::string_view> split(std::string_view s, char separator) {
+    std::vector<std::string_view> parts;
+    while (true) {
+        auto pos = s.find(separator);
+        parts.push_back(s.substr(0, pos));
+        if (pos == std::string_view::npos) {
+            return parts;
+        }
+        s.remove_prefix(pos + 1);
+    }
+}
+
+template <class T>
+T parse_number(std::string_view name, std::string_view value) {
+    T res = 0;
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), res);
+    if (ec != std::errc() || end != value.data() + value.size()) {
+        throw std::invalid_argument("Option --" + std::string(name) + " expects a number");
+    }
+    return res;
+}
+
+double parse_fraction(std::string_view name, std::string_view value) {
+    auto res = parse_number<double>(name, value);
+    if (res < 0 || res > 1) {
+        throw std::invalid_argument("Option --" + std::string(name) + " expects a number from 0 to 1");
+    }
+    return res;
+}
+
+std::array<uint32_t, 4> parse_mix(std::string_view value) {
+    static const std::string_view OPERATIONS[] = {"get", "set", "mget", "mset"};
+    std::array<uint32_t, 4> mix{};
+    for (auto part : split(value, ',')) {
+        auto colon = part.find(':');
+        auto operation = std::find(std::begin(OPERATIONS), std::end(OPERATIONS), part.substr(0, colon));
+        if (colon == std::string_view::npos || operation == std::end(OPERATIONS)) {
+            throw std::invalid_argument("Option --mix expects operation:weight pairs of get, set, mget and mset");
+        }
+        mix[operation - std::begin(OPERATIONS)] = parse_number<uint32_t>("mix", part.substr(colon + 1));
+    }
+    return mix;
+}
+
+void parse_value_size(std::string_view value, WorkloadOptions& options) {
+    auto parts = split(value, ':');
+    if (parts[0] == "fixed" && parts.size() == 2) {
+        options.value_size_distribution = WorkloadOptions::ValueSizeDistribution::FIXED;
+        options.value_size_min = options.value_size_max = parse_number<size_t>("value_size", parts[1]);
+    } else if (parts[0] == "uniform" && parts.size() == 3) {
+        options.value_size_distribution = WorkloadOptions::ValueSizeDistribution::UNIFORM;
+        options.value_size_min = parse_number<size_t>("value_size", parts[1]);
+        options.value_size_max = parse_number<size_t>("value_size", parts[2]);
+    } else if (parts[0] == "pareto" && (parts.size() == 3 || parts.size() == 4)) {
+        options.value_size_distribution = WorkloadOptions::ValueSizeDistribution::PARETO;
+        options.value_size_min = parse_number<size_t>("value_size", parts[1]);
+        options.value_size_max = parse_number<size_t>("value_size", parts[2]);
+        if (parts.size() == 4) {
+            options.value_size_alpha = parse_number<double>("value_size", parts[3]);
+        }
+    } else {
+        throw std::invalid_argument("Option --value_size expects fixed:N, uniform:MIN:MAX or pareto:MIN:MAX[:ALPHA]");
+    }
+}
+
+double zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; ++i) {
+        sum += 1 / std::pow(static_cast<double>(i), theta);
+    }
+    return sum;
+}
+
+std::string random_alphanumerical_string(size_t length, std::mt19937_64& gen) {
+    static const char alphanum[] =
+        "0123456789"
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+        "abcdefghijklmnopqrstuvwxyz";
+    std::uniform_int_distribution<int> letters_dist(0, sizeof(alphanum) - 2);
+    std::string s(length, '\0');
+    for (auto& c : s) {
+        c = alphanum[letters_dist(gen)];
+    }
+    return s;
+}
+
+}
+
+bool parse_workload_option(std::string_view name, const std::string& value, WorkloadOptions& options) {
+    if (name == "key_count") {
+        options.key_count = parse_number<uint64_t>(name, value);
+    } else if (name == "key_distribution") {
+        if (value == "uniform") {
+            options.key_distribution = WorkloadOptions::KeyDistribution::UNIFORM;
+        } else if (value == "zipfian") {
+            options.key_distribution = WorkloadOptions::KeyDistribution::ZIPFIAN;
+        } else if (value == "hotspot") {
+            options.key_distribution = WorkloadOptions::KeyDistribution::HOTSPOT;
+        } else if (value == "latest") {
+            options.key_distribution = WorkloadOptions::KeyDistribution::LATEST;
+        } else {
+            throw std::invalid_argument("Unknown key distribution " + value);
+        }
+    } else if (name == "zipf_theta") {
+        options.zipf_theta = parse_number<double>(name, value);
+    } else if (name == "hot_keys") {
+        options.hot_keys_fraction = parse_fraction(name, value);
+    } else if (name == "hot_access") {
+        options.hot_access_fraction = parse_fraction(name, value);
+    } else if (name == "mix") {
+        options.mix = parse_mix(value);
+    } else if (name == "batch_size") {
+        options.batch_size = parse_number<size_t>(name, value);
+    } else if (name == "value_size") {
+        parse_value_size(value, options);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+ZipfianDistribution::ZipfianDistribution(uint64_t n, double theta)
+    : n_(n)
+    , alpha_(1 / (1 - theta))
+    , zetan_(zeta(n, theta))
+    , half_pow_theta_(std::pow(0.5, theta)) {
+    eta_ = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta(2, theta) / zetan_);
+}
+
+Workload::Workload(const WorkloadOptions& options)
+    : options_(options) {
+    if (!options_.keys_file.empty()) {
+        std::ifstream keys_file(options_.keys_file);
+        if (!keys_file.is_open()) {
+            throw std::runtime_error(
+                "Failed to open keys list file " + options_.keys_file
+            );
+        }
+        std::string key;
+        while (keys_file >> key) {
+            keys_.push_back(key);
+        }
+        key_count_ = keys_.size();
+    } else {
+        key_count_ = options_.key_count;
+    }
+    if (key_count_ == 0) {
+        throw std::invalid_argument("Key space is empty, pass a non-empty keys list file or --key_count");
+    }
+
+    if (options_.batch_size == 0) {
+        throw std::invalid_argument("Option --batch_size must be positive");
+    }
+    if (options_.mix) {
+        mix_ = *options_.mix;
+    } else if (options_.batch_size > 1) {
+        mix_ = {0, 0, 99, 1};
+    } else {
+        mix_ = {99, 1, 0, 0};
+    }
+    if (mix_[0] + mix_[1] + mix_[2] + mix_[3] == 0) {
+        throw std::invalid_argument("Option --mix has no operations");
+    }
+
+    switch (options_.key_distribution) {
+        case WorkloadOptions::KeyDistribution::ZIPFIAN:
+        case WorkloadOptions::KeyDistribution::LATEST:
+            if (options_.zipf_theta <= 0 || options_.zipf_theta >= 1) {
+                throw std::invalid_argument("Option --zipf_theta expects a number between 0 and 1");
+            }
+            // The two most popular ranks are special cases of the sampling
+            zipfian_.emplace(std::max<uint64_t>(key_count_, 2), options_.zipf_theta);
+            break;
+        case WorkloadOptions::KeyDistribution::HOTSPOT:
+            hot_key_count_ = std::clamp<uint64_t>(key_count_ * options_.hot_keys_fraction, 1, key_count_);
+            break;
+        case WorkloadOptions::KeyDistribution::UNIFORM:
+            break;
+    }
+    // Reads of the latest distribution start from the end of the key space, which is written last when it's populated
+    latest_cursor_ = key_count_;
+
+    if (options_.value_size_min > options_.value_size_max) {
+        throw std::invalid_argument("Minimal value size exceeds the maximal one");
+    }
+    if (options_.value_size_distribution == WorkloadOptions::ValueSizeDistribution::PARETO
+            && (options_.value_size_min == 0 || options_.value_size_alpha <= 0)) {
+        throw std::invalid_argument("Pareto value sizes need a positive minimal size and alpha");
+    }
+    std::mt19937_64 gen(std::random_device{}());
+    value_pool_ = random_alphanumerical_string(options_.value_size_max + VALUE_POOL_EXTRA_SIZE, gen);
+}
+
+void Workload::key(uint64_t index, std::string& key) const {
+    if (!keys_.empty()) {
+        key.assign(keys_[index]);
+        return;
+    }
+    char buffer[24];
+    auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), index);
+    key.assign("key_");
+    key.append(buffer, end);
+}
+
+Workload::Generator::Generator(const Workload& workload, uint32_t seed)
+    : workload_(workload)
+    , gen_(seed)
+    , operation_dist_(workload.mix_.begin(), workload.mix_.end())
+    , key_dist_(0, workload.key_count_ - 1)
+    , hot_key_dist_(0, std::max<uint64_t>(workload.hot_key_count_, 1) - 1)
+    , cold_key_dist_(std::min(workload.hot_key_count_, workload.key_count_ - 1), workload.key_count_ - 1)
+    , hot_access_dist_(workload.options_.hot_access_fraction)
+    , value_size_dist_(workload.options_.value_size_min, workload.options_.value_size_max) {
+}
+
+Workload::Operation Workload::Generator::next_operation() {
+    return static_cast<Operation>(operation_dist_(gen_));
+}
+
+void Workload::Generator::next_key(bool is_write, std::string& key) {
+    workload_.key(next_key_index(is_write), key);
+}
+
+uint64_t Workload::Generator::next_key_index(bool is_write) {
+    uint64_t count = workload_.key_count_;
+    switch (workload_.options_.key_distribution) {
+        case WorkloadOptions::KeyDistribution::UNIFORM:
+            return key_dist_(gen_);
+        case WorkloadOptions::KeyDistribution::ZIPFIAN:
+            return (*workload_.zipfian_)(gen_) % count;
+        case WorkloadOptions::KeyDistribution::HOTSPOT:
+            if (workload_.hot_key_count_ == count || hot_access_dist_(gen_)) {
+                return hot_key_dist_(gen_);
+            }
+            return cold_key_dist_(gen_);
+        case WorkloadOptions::KeyDistribution::LATEST:
+            if (is_write) {
+                return workload_.latest_cursor_.fetch_add(1, std::memory_order_relaxed) % count;
+            }
+            // The cursor starts at key_count, so it never gets below the rank
+            return (workload_.latest_cursor_.load(std::memory_order_relaxed) - 1 - (*workload_.zipfian_)(gen_) % count) % count;
+    }
+    return 0;
+}
+
+std::string_view Workload::Generator::next_value() {
+    const auto& options = workload_.options_;
+    size_t size = options.value_size_min;
+    switch (options.value_size_distribution) {
+        case WorkloadOptions::ValueSizeDistribution::FIXED:
+            break;
+        case WorkloadOptions::ValueSizeDistribution::UNIFORM:
+            size = value_size_dist_(gen_);
+            break;
+        case WorkloadOptions::ValueSizeDistribution::PARETO: {
+            // Inverse of the CDF of the pareto distribution bounded by min and max
+            double low = options.value_size_min;
+            double high = options.value_size_max;
+            double a = options.value_size_alpha;
+            double u = pareto_dist_(gen_);
+            double x = low / std::pow(1 - u * (1 - std::pow(low / high, a)), 1 / a);
+            size = std::clamp<size_t>(static_cast<size_t>(x), options.value_size_min, options.value_size_max);
+            break;
+        }
+    }
+    std::uniform_int_distribution<size_t> offset_dist(0, workload_.value_pool_.size() - size);
+    return std::string_view(workload_.value_pool_).substr(offset_dist(gen_), size);
+}
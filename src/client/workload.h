@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct WorkloadOptions {
+    enum class KeyDistribution {
+        UNIFORM,
+        // Key of rank i (0 is the most popular) is requested with the probability proportional to 1 / (i + 1)^zipf_theta
+        ZIPFIAN,
+        // hot_access_fraction of the requests go to the first hot_keys_fraction of the keys
+        HOTSPOT,
+        // Writes go through the keys in order, reads are zipfian by how long ago the key was written
+        LATEST,
+    };
+
+    enum class ValueSizeDistribution {
+        FIXED,
+        UNIFORM,
+        // Bounded pareto between min and max: most values are small, a few are large
+        PARETO,
+    };
+
+    // Keys are read from the file if it's set, otherwise they are key_0 ... key_{key_count - 1}
+    std::string keys_file;
+    uint64_t key_count = 0;
+
+    KeyDistribution key_distribution = KeyDistribution::UNIFORM;
+    double zipf_theta = 0.99;
+    double hot_keys_fraction = 0.2;
+    double hot_access_fraction = 0.8;
+
+    // Relative weights of get, set, mget and mset. By default 1% of the requests are writes,
+    // they are mget and mset if batch_size is greater than 1.
+    std::optional<std::array<uint32_t, 4>> mix;
+    size_t batch_size = 1;
+
+    ValueSizeDistribution value_size_distribution = ValueSizeDistribution::UNIFORM;
+    size_t value_size_min = 1;
+    size_t value_size_max = 100;
+    double value_size_alpha = 1.5;
+};
+
+// Applies --name=value if it's a workload option. Returns false for other options,
+// throws std::invalid_argument if the value is malformed.
+bool parse_workload_option(std::string_view name, const std::string& value, WorkloadOptions& options);
+
+// Zipfian distribution over [0, n) of Gray et al., "Quickly generating billion-record synthetic databases",
+// as used by YCSB. Construction is O(n), sampling is O(1).
+class ZipfianDistribution {
+public:
+    ZipfianDistribution(uint64_t n, double theta);
+
+    template <class Generator>
+    uint64_t operator()(Generator& gen) const {
+        double u = std::uniform_real_distribution<double>(0, 1)(gen);
+        double uz = u * zetan_;
+        if (uz < 1) {
+            return 0;
+        }
+        if (uz < 1 + half_pow_theta_) {
+            return 1;
+        }
+        auto rank = static_cast<uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+        return std::min(rank, n_ - 1);
+    }
+
+private:
+    uint64_t n_;
+    double alpha_;
+    double zetan_;
+    double eta_;
+    double half_pow_theta_;
+};
+
+// Key space, value pool and mix shared by all connections of the load client. Requests are generated
+// by a Generator per connection, which doesn't allocate once its buffers are warmed up:
+// synthetic keys are formatted in place and values are slices of a pool of random characters generated at start.
+class Workload {
+public:
+    enum class Operation {
+        GET,
+        SET,
+        MGET,
+        MSET,
+    };
+
+    class Generator {
+    public:
+        Generator(const Workload& workload, uint32_t seed);
+
+        Operation next_operation();
+        void next_key(bool is_write, std::string& key);
+        std::string_view next_value();
+
+    private:
+        uint64_t next_key_index(bool is_write);
+
+        const Workload& workload_;
+        std::mt19937_64 gen_;
+        std::discrete_distribution<int> operation_dist_;
+        std::uniform_int_distribution<uint64_t> key_dist_;
+        std::uniform_int_distribution<uint64_t> hot_key_dist_;
+        std::uniform_int_distribution<uint64_t> cold_key_dist_;
+        std::bernoulli_distribution hot_access_dist_;
+        std::uniform_int_distribution<size_t> value_size_dist_;
+        std::uniform_real_distribution<double> pareto_dist_{0, 1};
+    };
+
+public:
+    explicit Workload(const WorkloadOptions& options);
+
+    const WorkloadOptions& options() const {
+        return options_;
+    }
+
+    uint64_t key_count() const {
+        return key_count_;
+    }
+
+    size_t batch_size() const {
+        return options_.batch_size;
+    }
+
+    void key(uint64_t index, std::string& key) const;
+
+    static bool is_write(Operation operation) {
+        return operation == Operation::SET || operation == Operation::MSET;
+    }
+
+    static bool is_batch(Operation operation) {
+        return operation == Operation::MGET || operation == Operation::MSET;
+    }
+
+private:
+    WorkloadOptions options_;
+    std::array<uint32_t, 4> mix_;
+    std::vector<std::string> keys_;
+    uint64_t key_count_;
+    uint64_t hot_key_count_ = 0;
+    std::optional<ZipfianDistribution> zipfian_;
+    std::string value_pool_;
+    // Writes of the latest distribution, all connections of the process share it
+    mutable std::atomic<uint64_t> latest_cursor_;
+};
@@ -0,0 +1,101 @@
+import argparse
+import json
+import os
+import signal
+import subprocess
+import time
+
+
+def run_clients(args):
+    if not os.path.exists("test_res"):
+        os.makedirs("test_res")
+    os.system("rm -rf test_res/*")
+
+    client_processes = []
+    for i in range(args.num_clients):
+        c = subprocess.Popen([
+            "./dictionary_load_client",
+            "127.0.0.1",
+            str(args.port),
+            args.key_file,
+            f"--duration_s={args.duration}",
+            "--warmup_s=0",
+            f"--pipeline_depth={args.pipeline_depth}",
+            f"--protocol={args.protocol}",
+            f"--output=test_res/client_{i}.txt",
+        ], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        client_processes.append(c)
+    for c in client_processes:
+        c.wait()
+
+    throughput = 0
+    for f in os.listdir("test_res"):
+        with open(f"test_res/{f}", "r") as f:
+            throughput += json.loads(f.read()).get("requests_per_sec", 0)
+    return throughput
+
+
+# Total number of calls from the summary of strace -c
+def read_syscalls_count(path):
+    with open(path, "r") as f:
+        for line in f.readlines():
+            fields = line.split()
+            if fields and fields[-1] == "total":
+                return int(fields[3])
+    return 0
+
+
+def run_server(args, backend, initial_keys, strace_output=None):
+    with open("config.txt", "w") as f:
+        f.write(json.dumps(initial_keys))
+
+    server_args = [
+        "./dictionary_server_main",
+        str(args.port),
+        f"--backend={backend}",
+        f"--threads={args.threads}",
+        "--io-mode=per-thread",
+        "--wal=off",
+    ]
+    if strace_output:
+        server_args = ["strace", "-f", "-c", "-o", strace_output] + server_args
+    server_process = subprocess.Popen(server_args, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    # Give the server time to load the dictionary and start listening
+    time.sleep(1)
+
+    throughput = run_clients(args)
+
+    # strace passes the signal on to the server and writes the summary once it exits
+    server_process.send_signal(signal.SIGINT)
+    server_process.wait()
+    return throughput
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Throughput and syscalls per request of the asio and io_uring backends")
+    parser.add_argument("--port", type=int, help="server port", required=True)
+    parser.add_argument("--key_file", help="path to key file", required=True)
+    parser.add_argument("--threads", type=int, help="server threads", default=os.cpu_count())
+    parser.add_argument("--num_clients", type=int, help="number of load clients", default=os.cpu_count())
+    parser.add_argument("--duration", type=float, help="seconds of load per run", default=10)
+    parser.add_argument("--pipeline_depth", type=int, help="requests in flight per client", default=16)
+    parser.add_argument("--protocol", choices=["json", "binary"], help="wire protocol of the clients", default="json")
+    parser.add_argument("--backends", nargs="+", choices=["asio", "io-uring"], help="backends to compare", default=["asio", "io-uring"])
+    args = parser.parse_args()
+
+    initial_keys = {}
+    with open(args.key_file, "r") as f:
+        for line in f.readlines():
+            initial_keys[line.strip()] = line.strip()
+
+    print("backend\trequests_per_sec\tsyscalls_per_request")
+    for backend in args.backends:
+        # Throughput is measured without strace, it slows every syscall down a lot
+        throughput = run_server(args, backend, initial_keys)
+        traced_throughput = run_server(args, backend, initial_keys, strace_output="strace.txt")
+        syscalls = read_syscalls_count("strace.txt")
+        print(f"{backend}\t{throughput:.0f}\t{syscalls / (traced_throughput * args.duration):.3f}", flush=True)
+
+
+if __name__ == "__main__":
+    main()
@@ -7,32 +7,156 @@ import time
 import json
 
 
+def merge_histograms(histograms):
+    merged = {}
+    for histogram in histograms:
+        for value, count in histogram:
+            merged[value] = merged.get(value, 0) + count
+    return sorted(merged.items())
+
+
+def percentile(buckets, total, p):
+    rank = max(1, min(total, int(p / 100 * total + 0.5)))
+    seen = 0
+    for value, count in buckets:
+        seen += count
+        if seen >= rank:
+            return value
+    return buckets[-1][0]
+
+
+# Latencies of all clients in microseconds. Percentiles are computed from the merged histograms,
+# they can't be derived from the percentiles of separate clients. A percentile is the lowest value of its bucket,
+# which is within 1% of the recorded values.
+def merge_latencies(stats):
+    if not stats:
+        return None
+    total = sum(s["n_samples"] for s in stats)
+    buckets = merge_histograms(s["histogram_ns"] for s in stats)
+    merged = {
+        "n_samples": total,
+        "mean": sum(s["mean"] * s["n_samples"] for s in stats) / total,
+        "max": max(s["max"] for s in stats),
+    }
+    for name, p in [("p50", 50), ("p90", 90), ("p99", 99), ("p999", 99.9)]:
+        merged[name] = min(percentile(buckets, total, p) / 1000, merged["max"])
+    merged["histogram_ns"] = buckets
+    return merged
+
+
+def merge_results(results):
+    merged = {
+        "requests_per_sec": sum(r.get("requests_per_sec", 0) for r in results),
+        "keys_per_sec": sum(r.get("keys_per_sec", 0) for r in results),
+        "errors": sum(r.get("errors", 0) for r in results),
+    }
+    for kind in ["read", "write"]:
+        latencies = merge_latencies([r[kind] for r in results if kind in r])
+        if latencies:
+            merged[kind] = latencies
+    return merged
+
+
+def print_latencies(name, latencies):
+    if not latencies:
+        return
+    print(f"{name}: mean {latencies['mean']:.1f} us, p50 {latencies['p50']:.1f} us, p90 {latencies['p90']:.1f} us, "
+          f"p99 {latencies['p99']:.1f} us, p99.9 {latencies['p999']:.1f} us, max {latencies['max']:.1f} us "
+          f"({latencies['n_samples']} samples)")
+
+
+# Starts a server per shard on consecutive ports. A single server serves config.txt as before,
+# shards serve the parts of it that dictionary_split_config puts in test_shards.
+def start_servers(args, initial_keys):
+    with open("config.txt", "w") as f:
+        f.write(json.dumps(initial_keys))
+    if args.shards == 1:
+        configs = [None]
+    else:
+        os.system("rm -rf test_shards")
+        os.makedirs("test_shards")
+        subprocess.run([
+            "./dictionary_split_config",
+            "config.txt",
+            str(args.shards),
+            "--output-dir=test_shards",
+        ], check=True, stdout=subprocess.DEVNULL)
+        configs = [f"--config=test_shards/config_{i}.txt" for i in range(args.shards)]
+
+    server_processes = []
+    for i, config in enumerate(configs):
+        server_args = ["./dictionary_server_main", str(args.port + i)]
+        if config:
+            server_args.append(config)
+        if args.server_threads:
+            server_args.append(f"--threads={args.server_threads}")
+        server_processes.append(subprocess.Popen(server_args))
+    return server_processes
+
+
 def main():
     parser = argparse.ArgumentParser()
-    parser.add_argument("--port", help="server port", type=int, required=True)
-    parser.add_argument("--num_requests", type=int, help="number of requests to send", required=True)
-    parser.add_argument("--request_period", type=int, help="period between requests (microseconds)", required=True)
-    parser.add_argument("--num_clients", type=int, help="number of clients to simulate", required=True)
-    parser.add_argument("--key_file", help="path to key file", required=True)
+    parser.add_argument("--port", help="server port, the first of --shards consecutive ones", type=int, required=True)
+    parser.add_argument("--shards", type=int, help="number of servers, keys are split between them by the hash ring", default=1)
+    parser.add_argument("--server_threads", type=int, help="io threads per server, hardware concurrency by default")
+    parser.add_argument("--num_clients", type=int, help="number of load client processes", required=True)
+    keys = parser.add_mutually_exclusive_group(required=True)
+    keys.add_argument("--key_file", help="path to key file")
+    keys.add_argument("--key_count", type=int, help="number of synthetic keys, the server is populated with them before the test")
+    parser.add_argument("--key_distribution", choices=["uniform", "zipfian", "hotspot", "latest"], default="uniform")
+    parser.add_argument("--zipf_theta", type=float, help="skew of zipfian and latest", default=0.99)
+    parser.add_argument("--mix", help="weights of the operations, e.g. get:90,set:5,mget:4,mset:1")
+    parser.add_argument("--value_size", help="fixed:N, uniform:MIN:MAX or pareto:MIN:MAX[:ALPHA]", default="uniform:1:100")
+    parser.add_argument("--rate", type=float, help="target requests per second of all clients, 0 for the closed loop", default=0)
+    parser.add_argument("--duration", type=float, help="measured part of the test (seconds)", default=10)
+    parser.add_argument("--warmup", type=float, help="unmeasured start of the test (seconds)", default=1)
+    parser.add_argument("--threads", type=int, help="threads per client", default=1)
+    parser.add_argument("--connections", type=int, help="connections per client", default=1)
+    parser.add_argument("--pipeline_depth", type=int, help="requests in flight per connection in the closed loop", default=1)
+    parser.add_argument("--batch_size", type=int, help="keys per mget/mset request", default=1)
+    parser.add_argument("--protocol", choices=["json", "binary"], help="wire protocol of the clients", default="json")
+    parser.add_argument("--output", help="file to write the merged statistics to")
     args = parser.parse_args()
 
-    # generate config.txt
+    # generate config.txt, synthetic keys are set by the load client instead
     initial_keys = {}
-    with open(args.key_file, "r") as f:
-        lines = f.readlines()
-        for line in lines:
-            initial_keys[line.strip()] = line.strip()
-    with open("config.txt", "w") as f:
-        f.write(json.dumps(initial_keys))
+    if args.key_file:
+        with open(args.key_file, "r") as f:
+            lines = f.readlines()
+            for line in lines:
+                initial_keys[line.strip()] = line.strip()
+
+    workload_args = [
+        f"--key_distribution={args.key_distribution}",
+        f"--zipf_theta={args.zipf_theta}",
+        f"--batch_size={args.batch_size}",
+        f"--value_size={args.value_size}",
+        f"--protocol={args.protocol}",
+        f"--shards={args.shards}",
+    ]
+    if args.mix:
+        workload_args.append(f"--mix={args.mix}")
+    keys_args = [args.key_file] if args.key_file else [f"--key_count={args.key_count}"]
 
     if not os.path.exists("test_res"):
         os.makedirs("test_res")
     os.system("rm -rf test_res/*")
 
-    server_process = subprocess.Popen([
-        "./dictionary_server_main",
-        str(args.port),
-    ])
+    server_processes = start_servers(args, initial_keys)
+    # Give the servers time to load the dictionary and start listening
+    time.sleep(1)
+
+    if args.key_count:
+        subprocess.run([
+            "./dictionary_load_client",
+            "127.0.0.1",
+            str(args.port),
+            *keys_args,
+            *workload_args,
+            f"--threads={args.threads}",
+            "--populate",
+            "--duration_s=0",
+        ], check=True)
 
     client_processes = []
     for i in range(int(args.num_clients)):
@@ -41,36 +165,40 @@ def main():
             "./dictionary_load_client",
             "127.0.0.1",
             str(args.port),
-            str(args.num_requests),
-            str(args.request_period),
-            args.key_file,
-            f"test_res/client_{i}.txt"
+            *keys_args,
+            *workload_args,
+            f"--rate={args.rate / args.num_clients}",
+            f"--duration_s={args.duration}",
+            f"--warmup_s={args.warmup}",
+            f"--threads={args.threads}",
+            f"--connections={args.connections}",
+            f"--pipeline_depth={args.pipeline_depth}",
+            f"--output=test_res/client_{i}.txt",
         ], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
         client_processes.append(c)
 
     for c in client_processes:
         c.wait()
 
-    server_process.send_signal(signal.SIGINT)
-    server_process.wait()
+    for server_process in server_processes:
+        server_process.send_signal(signal.SIGINT)
+    for server_process in server_processes:
+        server_process.wait()
 
-    total_reads = 0
-    total_writes = 0
-    total_read_time = 0
-    total_write_time = 0
+    results = []
     for f in os.listdir("test_res"):
         with open(f"test_res/{f}", "r") as f:
-            data = json.loads(f.read())
-            if "read" in data:
-                total_reads += data["read"]["n_samples"]
-                total_read_time += data["read"]["mean"] * data["read"]["n_samples"]
-            if "write" in data:
-                total_writes += data["write"]["n_samples"]
-                total_write_time += data["write"]["mean"] * data["write"]["n_samples"]
-
-    print(f"Read mean: {total_read_time / total_reads} us ({total_reads} samples)")
-    print(f"Write mean: {total_write_time / total_writes} us ({total_writes} samples)")
-
-    
+            results.append(json.loads(f.read()))
+    merged = merge_results(results)
+    merged["shards"] = args.shards
+
+    print_latencies("Read", merged.get("read"))
+    print_latencies("Write", merged.get("write"))
+    print(f"Throughput: {merged['requests_per_sec']:.0f} requests/s, {merged['keys_per_sec']:.0f} keys/s, {merged['errors']} errors")
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(json.dumps(merged))
+
+
 if __name__ == "__main__":
     main()
@@ -0,0 +1,185 @@
+import argparse
+import json
+import os
+import random
+import shutil
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import urllib.request
+
+
+class Connection:
+    def __init__(self, port):
+        self.sock = socket.create_connection(("127.0.0.1", port), timeout=10)
+
+    def request(self, message):
+        body = json.dumps(message).encode()
+        self.sock.sendall(struct.pack(">I", len(body)) + body)
+        (size,) = struct.unpack(">I", self.read_exact(4))
+        response = self.read_exact(size).decode()
+        try:
+            return json.loads(response)
+        except json.JSONDecodeError:
+            # Rejected requests get a bare ERROR
+            return {"ok": False}
+
+    def read_exact(self, size):
+        data = b""
+        while len(data) < size:
+            chunk = self.sock.recv(size - len(data))
+            if not chunk:
+                raise ConnectionError("server closed the connection")
+            data += chunk
+        return data
+
+    def close(self):
+        self.sock.close()
+
+
+def connect(port, timeout=10):
+    deadline = time.monotonic() + timeout
+    while True:
+        try:
+            return Connection(port)
+        except OSError:
+            if time.monotonic() > deadline:
+                raise
+            time.sleep(0.1)
+
+
+def read_metrics(admin_port):
+    with urllib.request.urlopen(f"http://127.0.0.1:{admin_port}/metrics", timeout=5) as response:
+        text = response.read().decode()
+    metrics = {}
+    for line in text.splitlines():
+        if line and not line.startswith("#"):
+            name, value = line.rsplit(" ", 1)
+            metrics[name] = float(value)
+    return metrics
+
+
+def wait_caught_up(leader_admin_port, replica_admin_port, timeout):
+    deadline = time.monotonic() + timeout
+    while True:
+        leader_seq = read_metrics(leader_admin_port)["dictionary_replication_seq"]
+        replica = read_metrics(replica_admin_port)
+        if replica["dictionary_replica_connected"] == 1 and replica["dictionary_replica_applied_seq"] >= leader_seq:
+            return time.monotonic()
+        if time.monotonic() > deadline:
+            raise AssertionError(f"replica on admin port {replica_admin_port} did not catch up: {replica}")
+        time.sleep(0.05)
+
+
+def check(condition, message):
+    if not condition:
+        raise AssertionError(message)
+    print(f"ok: {message}", flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Runs a leader and two replicas on localhost and checks that the replicas follow it")
+    parser.add_argument("--port", type=int, help="client port of the leader, the replicas take the next two", required=True)
+    parser.add_argument("--server", help="path to dictionary_server_main", default="./dictionary_server_main")
+    parser.add_argument("--key_count", type=int, help="keys in the leader's dictionary before the replicas start", default=10000)
+    parser.add_argument("--set_count", type=int, help="sets sent to the leader while the replicas run", default=10000)
+    parser.add_argument("--timeout", type=float, help="seconds a replica may take to catch up", default=30)
+    args = parser.parse_args()
+
+    server = os.path.abspath(args.server)
+    replication_port = args.port + 10
+    admin_ports = [args.port + 20 + i for i in range(3)]
+    work_dir = tempfile.mkdtemp(prefix="replication_e2e_")
+    processes = {}
+    passed = False
+    log = open(os.path.join(work_dir, "servers.log"), "w")
+
+    def start(index):
+        name = "leader" if index == 0 else f"replica{index}"
+        server_args = [
+            server,
+            str(args.port + index),
+            f"--config={os.path.join(work_dir, name + '.txt')}",
+            f"--admin-port={admin_ports[index]}",
+            "--threads=1",
+            "--wal=off",
+        ]
+        if index == 0:
+            server_args.append(f"--replication-port={replication_port}")
+        else:
+            server_args.append(f"--replica-of=127.0.0.1:{replication_port}")
+        processes[index] = subprocess.Popen(server_args, stdout=log, stderr=log)
+        return connect(args.port + index)
+
+    try:
+        initial = {f"key{i}": f"value{i}" for i in range(args.key_count)}
+        with open(os.path.join(work_dir, "leader.txt"), "w") as f:
+            f.write(json.dumps(initial))
+        leader = start(0)
+        replicas = [start(1), start(2)]
+        expected = dict(initial)
+
+        for replica_index in (1, 2):
+            wait_caught_up(admin_ports[0], admin_ports[replica_index], args.timeout)
+        sample = random.sample(sorted(initial), min(1000, len(initial)))
+        for replica in replicas:
+            check(all(replica.request({"command": "get", "key": key}).get("value") == initial[key] for key in sample),
+                "replica bootstrapped from the snapshot of the leader")
+
+        start_time = time.monotonic()
+        for i in range(args.set_count):
+            key = f"key{random.randrange(args.key_count * 2)}"
+            value = f"updated{i}"
+            response = leader.request({"command": "set", "key": key, "value": value})
+            if not response.get("ok"):
+                raise AssertionError(f"set on the leader failed: {response}")
+            expected[key] = value
+        write_time = time.monotonic() - start_time
+        for replica_index in (1, 2):
+            caught_up = wait_caught_up(admin_ports[0], admin_ports[replica_index], args.timeout)
+            print(f"replica{replica_index} caught up {caught_up - start_time - write_time:.3f} s after the last of "
+                f"{args.set_count} sets ({args.set_count / write_time:.0f} sets/s)", flush=True)
+        for replica in replicas:
+            mismatches = sum(replica.request({"command": "get", "key": key}).get("value") != value for key, value in expected.items())
+            check(mismatches == 0, "replica has every set of the leader")
+
+        response = replicas[0].request({"command": "set", "key": "key0", "value": "from replica"})
+        check(not response.get("ok"), "replica rejects sets")
+        check(replicas[0].request({"command": "get", "key": "key0"}).get("value") == expected["key0"], "rejected set changed nothing")
+
+        metrics = read_metrics(admin_ports[0])
+        check(metrics["dictionary_replication_followers"] == 2, "leader streams to two followers")
+
+        replicas[1].close()
+        processes[2].terminate()
+        processes[2].wait()
+        for i in range(args.set_count // 10):
+            key = f"restart{i}"
+            leader.request({"command": "set", "key": key, "value": str(i)})
+            expected[key] = str(i)
+        replicas[1] = start(2)
+        wait_caught_up(admin_ports[0], admin_ports[2], args.timeout)
+        mismatches = sum(replicas[1].request({"command": "get", "key": key}).get("value") != value for key, value in expected.items())
+        check(mismatches == 0, "restarted replica caught up with the sets it missed")
+
+        metrics = read_metrics(admin_ports[1])
+        check(metrics["dictionary_replica_lag_records"] == 0, "replica reports no lag when idle")
+        print("replication e2e passed")
+        passed = True
+    finally:
+        for process in processes.values():
+            process.terminate()
+        for process in processes.values():
+            process.wait()
+        log.close()
+        if passed:
+            shutil.rmtree(work_dir)
+        else:
+            print(f"server logs are in {work_dir}", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,91 @@
+import argparse
+import json
+import os
+import signal
+import subprocess
+import time
+
+
+def run_clients(args):
+    if not os.path.exists("test_res"):
+        os.makedirs("test_res")
+    os.system("rm -rf test_res/*")
+
+    client_processes = []
+    for i in range(args.num_clients):
+        c = subprocess.Popen([
+            "./dictionary_load_client",
+            "127.0.0.1",
+            str(args.port),
+            args.key_file,
+            f"--duration_s={args.duration}",
+            "--warmup_s=0",
+            f"--pipeline_depth={args.pipeline_depth}",
+            f"--protocol={args.protocol}",
+            f"--output=test_res/client_{i}.txt",
+        ], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        client_processes.append(c)
+    for c in client_processes:
+        c.wait()
+
+    throughput = 0
+    for f in os.listdir("test_res"):
+        with open(f"test_res/{f}", "r") as f:
+            throughput += json.loads(f.read()).get("requests_per_sec", 0)
+    return throughput
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Server throughput against the number of io threads")
+    parser.add_argument("--port", type=int, help="server port", required=True)
+    parser.add_argument("--key_file", help="path to key file", required=True)
+    parser.add_argument("--max_threads", type=int, help="largest number of server threads", default=os.cpu_count())
+    parser.add_argument("--num_clients", type=int, help="number of load clients", default=os.cpu_count())
+    parser.add_argument("--duration", type=float, help="seconds of load per run", default=10)
+    parser.add_argument("--pipeline_depth", type=int, help="requests in flight per client", default=16)
+    parser.add_argument("--protocol", choices=["json", "binary"], help="wire protocol of the clients", default="json")
+    parser.add_argument("--io_mode", choices=["shared", "per-thread"], help="server io mode", default="per-thread")
+    parser.add_argument("--accept", choices=["reuseport", "round-robin"], help="server accept mode", default="reuseport")
+    parser.add_argument("--pin_threads", action="store_true", help="pin server threads to CPUs")
+    args = parser.parse_args()
+
+    initial_keys = {}
+    with open(args.key_file, "r") as f:
+        for line in f.readlines():
+            initial_keys[line.strip()] = line.strip()
+
+    thread_counts = []
+    threads = 1
+    while threads < args.max_threads:
+        thread_counts.append(threads)
+        threads *= 2
+    thread_counts.append(args.max_threads)
+
+    print("threads\trequests_per_sec")
+    for threads in thread_counts:
+        with open("config.txt", "w") as f:
+            f.write(json.dumps(initial_keys))
+
+        server_args = [
+            "./dictionary_server_main",
+            str(args.port),
+            f"--threads={threads}",
+            f"--io-mode={args.io_mode}",
+            f"--accept={args.accept}",
+            "--wal=off",
+        ]
+        if args.pin_threads:
+            server_args.append("--pin-threads")
+        server_process = subprocess.Popen(server_args, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        # Give the server time to load the dictionary and start listening
+        time.sleep(1)
+
+        throughput = run_clients(args)
+
+        server_process.send_signal(signal.SIGINT)
+        server_process.wait()
+        print(f"{threads}\t{throughput:.0f}", flush=True)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,55 @@
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Throughput of a sharded cluster against the number of shards")
+    parser.add_argument("--port", type=int, help="port of the first server", required=True)
+    keys = parser.add_mutually_exclusive_group(required=True)
+    keys.add_argument("--key_file", help="path to key file")
+    keys.add_argument("--key_count", type=int, help="number of synthetic keys")
+    parser.add_argument("--max_shards", type=int, help="largest number of servers", default=4)
+    parser.add_argument("--server_threads", type=int, help="io threads per server", default=1)
+    parser.add_argument("--num_clients", type=int, help="number of load clients", default=os.cpu_count())
+    parser.add_argument("--duration", type=float, help="seconds of load per run", default=10)
+    parser.add_argument("--pipeline_depth", type=int, help="requests in flight per connection", default=16)
+    parser.add_argument("--batch_size", type=int, help="keys per mget/mset request", default=1)
+    parser.add_argument("--protocol", choices=["json", "binary"], help="wire protocol of the clients", default="json")
+    args = parser.parse_args()
+
+    shard_counts = []
+    shards = 1
+    while shards < args.max_shards:
+        shard_counts.append(shards)
+        shards *= 2
+    shard_counts.append(args.max_shards)
+
+    keys_args = ["--key_file", args.key_file] if args.key_file else ["--key_count", str(args.key_count)]
+    script = os.path.join(os.path.dirname(os.path.abspath(__file__)), "load_test.py")
+    print("shards\trequests_per_sec\tkeys_per_sec\terrors")
+    for shards in shard_counts:
+        subprocess.run([
+            sys.executable,
+            script,
+            f"--port={args.port}",
+            f"--shards={shards}",
+            f"--server_threads={args.server_threads}",
+            f"--num_clients={args.num_clients}",
+            *keys_args,
+            f"--duration={args.duration}",
+            f"--pipeline_depth={args.pipeline_depth}",
+            f"--batch_size={args.batch_size}",
+            f"--protocol={args.protocol}",
+            "--output=sharding_res.txt",
+        ], check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        with open("sharding_res.txt", "r") as f:
+            result = json.loads(f.read())
+        print(f"{shards}\t{result['requests_per_sec']:.0f}\t{result['keys_per_sec']:.0f}\t{result['errors']}", flush=True)
+    os.remove("sharding_res.txt")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,88 @@
+#include "admin_server.h"
+
+#include "../util/log.h"
+
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+
+#include <memory>
+#include <string_view>
+
+
+namespace {
+
+constexpr size_t MAX_REQUEST_SIZE = 8192;
+
+std::string make_response(std::string_view status, std::string_view content_type, std::string_view body) {
+    std::string response;
+    response.append("HTTP/1.1 ").append(status).append("\r\n");
+    response.append("Content-Type: ").append(content_type).append("\r\n");
+    response.append("Content-Length: ").append(std::to_string(body.size())).append("\r\n");
+    response.append("Connection: close\r\n\r\n");
+    response.append(body);
+    return response;
+}
+
+}
+
+class AdminServer::Session : public std::enable_shared_from_this<Session> {
+public:
+    Session(boost::asio::ip::tcp::socket socket, Render render)
+        : socket_(std::move(socket))
+        , input_(MAX_REQUEST_SIZE)
+        , render_(std::move(render)) {
+    }
+
+    void run() {
+        auto self(shared_from_this());
+        boost::asio::async_read_until(socket_, input_, "\r\n\r\n", [this, self](const boost::system::error_code& error, size_t length) {
+            if (error) {
+                return;
+            }
+            std::string_view request(static_cast<const char*>(input_.data().data()), length);
+            respond(request.substr(0, request.find("\r\n")));
+        });
+    }
+
+private:
+    void respond(std::string_view request_line) {
+        if (request_line.starts_with("GET /metrics ")) {
+            std::string body;
+            render_(body);
+            output_ = make_response("200 OK", "text/plain; version=0.0.4", body);
+        } else {
+            output_ = make_response("404 Not Found", "text/plain", "Not found\n");
+        }
+        auto self(shared_from_this());
+        boost::asio::async_write(socket_, boost::asio::buffer(output_), [this, self](const boost::system::error_code&, size_t) {
+            boost::system::error_code ignored;
+            socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+        });
+    }
+
+    boost::asio::ip::tcp::socket socket_;
+    boost::asio::streambuf input_;
+    std::string output_;
+    const Render render_;
+};
+
+AdminServer::AdminServer(boost::asio::io_context& io_context, uint16_t port, Render render)
+    : acceptor_(io_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port))
+    , render_(std::move(render)) {
+}
+
+void AdminServer::run() {
+    accept();
+}
+
+void AdminServer::accept() {
+    acceptor_.async_accept([this](const boost::system::error_code& error, boost::asio::ip::tcp::socket socket) {
+        if (error) {
+            LOG_ERROR("Error accepting admin connection: " << error.message());
+            return;
+        }
+        std::make_shared<Session>(std::move(socket), render_)->run();
+        accept();
+    });
+}
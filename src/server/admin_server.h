@@ -0,0 +1,31 @@
+#pragma once
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Minimal HTTP endpoint for monitoring, kept off the client port: GET /metrics responds with
+// what render appends to the body, in the Prometheus text format. Every connection serves one request.
+class AdminServer {
+public:
+    using Render = std::function<void(std::string& out)>;
+
+    AdminServer(boost::asio::io_context& io_context, uint16_t port, Render render);
+
+    AdminServer(const AdminServer&) = delete;
+    AdminServer& operator=(const AdminServer&) = delete;
+
+    // Starts accepting connections, the io_context must be run to serve them
+    void run();
+
+private:
+    class Session;
+
+    void accept();
+
+    boost::asio::ip::tcp::acceptor acceptor_;
+    Render render_;
+};
@@ -1,146 +1,117 @@
 #include "connection.h"
 
-#include <iostream>
+#include "../util/log.h"
 
-#include <regex>
+#include <boost/asio/post.hpp>
 #include <boost/asio/write.hpp>
 
-#include "../util/defer.h"
-
-#include <rapidjson/document.h>
-#include <rapidjson/stringbuffer.h>
-#include <rapidjson/writer.h>
-
 
 Connection::Connection(boost::asio::ip::tcp::socket socket, std::weak_ptr<Storage> storage)
     : socket_(std::move(socket))
-    , storage_(storage) {
+    , processor_(storage)
+    , input_(MIN_READ_SIZE) {
+    metrics::add(metrics::Counter::CONNECTIONS_ACCEPTED);
+}
+
+Connection::~Connection() {
+    metrics::add(metrics::Counter::CONNECTIONS_CLOSED);
 }
 
 void Connection::run() {
+    // Notifications are written by a handler on the executor of the socket, like responses
+    processor_.enable_watches([self = weak_from_this(), executor = socket_.get_executor()] {
+        boost::asio::post(executor, [self] {
+            if (auto connection = self.lock()) {
+                connection->write_notifications();
+            }
+        });
+    });
     schedule_read();
 }
 
+void Connection::write_notifications() {
+    // The write that drains the output takes them otherwise
+    if (closed_ || pending_output_.size() >= MAX_PENDING_OUTPUT) {
+        return;
+    }
+    bool had_output = !pending_output_.empty();
+    processor_.write_notifications(pending_output_);
+    if (!had_output && !pending_output_.empty()) {
+        queue_stopwatch_ = metrics::Stopwatch::start_sampled();
+    }
+    if (!writing_ && !pending_output_.empty()) {
+        schedule_write();
+    }
+}
+
 void Connection::schedule_read() {
+    reading_ = true;
     auto self(shared_from_this());
-    socket_.async_read_some(boost::asio::buffer(next_input_), [this, self](const boost::system::error_code& error, size_t length) {
+    auto free_space = input_.prepare();
+    socket_.async_read_some(boost::asio::buffer(free_space.data(), free_space.size()), [this, self](const boost::system::error_code& error, size_t length) {
+        reading_ = false;
         if (error) {
-            std::cerr << "Error reading data: " << error.message() << std::endl;
+            if (error == boost::asio::error::eof) {
+                LOG_DEBUG("Connection closed by the client");
+            } else {
+                LOG_WARNING("Error reading data: " << error.message());
+            }
+            closed_ = true;
             return;
         }
 
-        total_input_.insert(total_input_.end(), next_input_.begin(), next_input_.begin() + length);
-
-        auto cmd = parse_command();
+        input_.commit(length);
+        metrics::add(metrics::Counter::READS);
+        metrics::add(metrics::Counter::BYTES_READ, length);
 
-        if (auto* err = std::get_if<ParseFailed>(&cmd)) {
-            if (*err == ParseFailed::NOT_FULL) {
-                schedule_read();
-                return;
-            }
-            output_ = "ERROR";
-            schedule_write();
+        bool had_output = !pending_output_.empty();
+        auto consumed = processor_.process(input_.data(), pending_output_);
+        if (!consumed) {
+            closed_ = true;
+            socket_.close();
             return;
         }
-
-        auto storage = storage_.lock();
-        if (!storage) {
-            std::cerr << "Storage is gone" << std::endl;
-            return;
+        input_.consume(*consumed);
+        if (!had_output && !pending_output_.empty()) {
+            queue_stopwatch_ = metrics::Stopwatch::start_sampled();
         }
 
-        const auto& d = std::get<rapidjson::Document>(cmd);
-        std::string command = d["command"].GetString();
-        if (command == "get") {
-            std::string key = d["key"].GetString();
-            handle_get(*storage, key);
-        } else if (command == "set") {
-            std::string key = d["key"].GetString();
-            std::string value = d["value"].GetString();
-            handle_set(*storage, key, value);
-        } else {
-            output_ = "ERROR";
+        if (!writing_ && !pending_output_.empty()) {
             schedule_write();
         }
+        if (pending_output_.size() < MAX_PENDING_OUTPUT) {
+            schedule_read();
+        }
     });
 }
 
 void Connection::schedule_write() {
+    writing_ = true;
+    output_.swap(pending_output_);
+    queue_stopwatch_.record(metrics::Histogram::WRITE_QUEUE);
+    queue_stopwatch_ = {};
     auto self(shared_from_this());
     boost::asio::async_write(socket_, boost::asio::buffer(output_),
-    [this, self] (const boost::system::error_code& error, size_t length) {
+    [this, self, stopwatch = metrics::Stopwatch::start_sampled()] (const boost::system::error_code& error, size_t length) {
+        writing_ = false;
         if (error) {
-            std::cerr << "Error writing data: " << error.message() << std::endl;
+            LOG_WARNING("Error writing data: " << error.message());
+            closed_ = true;
             return;
         }
+        stopwatch.record(metrics::Histogram::WRITE);
+        metrics::add(metrics::Counter::WRITES);
+        metrics::add(metrics::Counter::BYTES_WRITTEN, length);
 
         output_.clear();
-        schedule_read();
-    });
-}
-
-std::variant<rapidjson::Document, Connection::ParseFailed> Connection::parse_command() {
-    if (total_input_.size() < 4) {
-        return ParseFailed::NOT_FULL;
-    }
-    int32_t message_size = reinterpret_cast<const int32_t*>(total_input_.data())[0];
-    message_size = ntohl(message_size);
-    if (total_input_.size() < message_size + 4) {
-        return ParseFailed::NOT_FULL;
-    }
-
-    Defer defer([&] {
-        total_input_.erase(total_input_.begin(), total_input_.begin() + message_size + 4);
+        if (pending_output_.size() < MAX_PENDING_OUTPUT) {
+            processor_.write_notifications(pending_output_);
+        }
+        if (!pending_output_.empty()) {
+            schedule_write();
+        }
+        if (!reading_ && !closed_ && pending_output_.size() < MAX_PENDING_OUTPUT) {
+            schedule_read();
+        }
     });
-
-    std::string_view message(total_input_.data() + 4, message_size);
-
-    rapidjson::Document d;
-    d.Parse(message.data(), message.size());
-    if (d.HasParseError()) {
-        return ParseFailed::ERROR;
-    }
-
-    return d;
-}
-
-void Connection::handle_get(Storage& storage, const std::string& key) {
-    auto [value, stat] = storage.get(key);
-    rapidjson::Document d;
-    d.SetObject();
-    d.AddMember("stat", rapidjson::Value().SetObject(), d.GetAllocator());
-    d["stat"].AddMember("get_count", stat.get_count, d.GetAllocator());
-    d["stat"].AddMember("set_count", stat.set_count, d.GetAllocator());
-    d.AddMember("ok", true, d.GetAllocator());
-    d.AddMember("key", rapidjson::Value(key.c_str(), key.size(), d.GetAllocator()), d.GetAllocator());
-    if (value.has_value()) {
-        d.AddMember("found", true, d.GetAllocator());
-        d.AddMember("value", rapidjson::Value(value->c_str(), value->size(), d.GetAllocator()), d.GetAllocator());
-    } else {
-        d.AddMember("found", false, d.GetAllocator());
-    }
-
-    rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-    d.Accept(writer);
-    output_ = buffer.GetString();
-
-    schedule_write();
-}
-
-void Connection::handle_set(Storage& storage, const std::string& key, const std::string& value) {
-    auto stat = storage.set(key, value);
-    rapidjson::Document d;
-    d.SetObject();
-    d.AddMember("stat", rapidjson::Value().SetObject(), d.GetAllocator());
-    d["stat"].AddMember("get_count", stat.get_count, d.GetAllocator());
-    d["stat"].AddMember("set_count", stat.set_count, d.GetAllocator());
-    d.AddMember("ok", true, d.GetAllocator());
-
-    rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-    d.Accept(writer);
-    output_ = buffer.GetString();
-
-    schedule_write();
 }
@@ -1,37 +1,45 @@
 #pragma once
 
+#include "input_buffer.h"
+#include "metrics.h"
+#include "request_processor.h"
 #include "storage.h"
 
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/streambuf.hpp>
 
-#include <rapidjson/document.h>
-
 #include <memory>
-#include <variant>
+#include <string>
 
+// Reads requests and writes responses concurrently, so a client can keep many requests
+// in flight. Responses produced while a write is in progress are coalesced into the next write.
+// The socket must be bound to a strand, read and write handlers share the buffers.
+// Notifications of watched keys are written between responses; while the output is full they wait
+// in the queue of the watcher, where they coalesce and eventually overflow.
 class Connection : public std::enable_shared_from_this<Connection> {
 public:
     Connection(boost::asio::ip::tcp::socket socket, std::weak_ptr<Storage> storage);
+    ~Connection();
 
     void run();
 private:
-    enum class ParseFailed {
-        NOT_FULL,
-        ERROR,
-    };
+    // Reading pauses while this much output is waiting for the client to read it
+    static constexpr size_t MAX_PENDING_OUTPUT = 1024 * 1024;
+    static constexpr size_t MIN_READ_SIZE = 16384;
 
     void schedule_read();
     void schedule_write();
-
-    std::variant<rapidjson::Document, ParseFailed> parse_command();
-
-    void handle_get(Storage& storage, const std::string& key);
-    void handle_set(Storage& storage, const std::string& key, const std::string& value);
+    void write_notifications();
 
     boost::asio::ip::tcp::socket socket_;
-    std::weak_ptr<Storage> storage_;
-    std::vector<char> total_input_;
-    std::array<char, 4096> next_input_;
+    RequestProcessor processor_;
+    InputBuffer input_;
     std::string output_;
+    std::string pending_output_;
+    // Started when pending_output_ gets its first response
+    metrics::Stopwatch queue_stopwatch_;
+
+    bool reading_ = false;
+    bool writing_ = false;
+    bool closed_ = false;
 };
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <type_traits>
+
+// Approximate counts of keys in a fixed amount of memory: DEPTH rows of width counters,
+// a key adds to one counter of every row, and its count is the smallest of them. Estimates are never
+// below the true count and exceed it by at most e / width of the total with probability 1 - e^-DEPTH.
+// Keys are identified by their 64-bit hash, rows take their positions from its two halves.
+//
+// With Counter = std::atomic<uint64_t> any number of threads may add and estimate concurrently,
+// with a plain integer the caller serializes access.
+template <class Counter>
+class CountMinSketch {
+public:
+    static constexpr size_t DEPTH = 4;
+
+    // width must be a power of two
+    explicit CountMinSketch(size_t width)
+        : mask_(width - 1)
+        , counters_(std::make_unique<Counter[]>(DEPTH * width)) {
+        clear();
+    }
+
+    // Returns the estimate including this addition
+    uint64_t add(uint64_t hash, uint64_t n = 1) {
+        uint64_t estimate = std::numeric_limits<uint64_t>::max();
+        for (size_t row = 0; row < DEPTH; ++row) {
+            auto& counter = counters_[index(hash, row)];
+            uint64_t value;
+            if constexpr (IS_ATOMIC) {
+                value = counter.fetch_add(n, std::memory_order_relaxed) + n;
+            } else {
+                value = counter += n;
+            }
+            estimate = std::min(estimate, value);
+        }
+        return estimate;
+    }
+
+    uint64_t estimate(uint64_t hash) const {
+        uint64_t estimate = std::numeric_limits<uint64_t>::max();
+        for (size_t row = 0; row < DEPTH; ++row) {
+            const auto& counter = counters_[index(hash, row)];
+            if constexpr (IS_ATOMIC) {
+                estimate = std::min<uint64_t>(estimate, counter.load(std::memory_order_relaxed));
+            } else {
+                estimate = std::min<uint64_t>(estimate, counter);
+            }
+        }
+        return estimate;
+    }
+
+    void clear() {
+        for (size_t i = 0; i < DEPTH * (mask_ + 1); ++i) {
+            if constexpr (IS_ATOMIC) {
+                counters_[i].store(0, std::memory_order_relaxed);
+            } else {
+                counters_[i] = 0;
+            }
+        }
+    }
+
+private:
+    static constexpr bool IS_ATOMIC = !std::is_integral_v<Counter>;
+
+    // Double hashing: row i uses low + i * high, with an odd high so that rows differ
+    size_t index(uint64_t hash, size_t row) const {
+        uint32_t low = static_cast<uint32_t>(hash);
+        uint32_t high = static_cast<uint32_t>(hash >> 32) | 1;
+        return row * (mask_ + 1) + ((low + row * high) & mask_);
+    }
+
+    const size_t mask_;
+    std::unique_ptr<Counter[]> counters_;
+};
@@ -0,0 +1,68 @@
+#include "epoch_manager.h"
+
+#include <algorithm>
+
+
+namespace {
+
+std::atomic_bool slot_taken[EpochManager::MAX_THREADS];
+// Slots below this bound have been handed out at least once
+std::atomic<size_t> slots_used = 0;
+
+struct ThreadSlot {
+    ThreadSlot() {
+        for (size_t i = 0; i < EpochManager::MAX_THREADS; ++i) {
+            bool expected = false;
+            if (!slot_taken[i].load(std::memory_order_relaxed) && slot_taken[i].compare_exchange_strong(expected, true)) {
+                index = i;
+                size_t used = slots_used.load();
+                while (used < i + 1 && !slots_used.compare_exchange_weak(used, i + 1)) {
+                }
+                return;
+            }
+        }
+    }
+
+    ~ThreadSlot() {
+        if (index != EpochManager::NO_SLOT) {
+            slot_taken[index].store(false);
+        }
+    }
+
+    size_t index = EpochManager::NO_SLOT;
+};
+
+}
+
+EpochManager::EpochManager()
+    : slots_(std::make_unique<Slot[]>(MAX_THREADS)) {
+}
+
+size_t EpochManager::thread_slot() {
+    thread_local ThreadSlot slot;
+    return slot.index;
+}
+
+EpochManager::Guard EpochManager::pin() const {
+    size_t slot = thread_slot();
+    if (slot == NO_SLOT) [[unlikely]] {
+        return Guard(nullptr);
+    }
+    // The store and the loads of the lookup that follows are sequentially consistent: either collect()
+    // sees this pin, or the lookup sees everything unlinked before that collect() started
+    auto& epoch = slots_[slot].epoch;
+    epoch.store(epoch_.load());
+    return Guard(&epoch);
+}
+
+uint64_t EpochManager::collect() {
+    uint64_t oldest = epoch_.fetch_add(1) + 1;
+    size_t used = slots_used.load();
+    for (size_t i = 0; i < used; ++i) {
+        uint64_t epoch = slots_[i].epoch.load();
+        if (epoch != 0) {
+            oldest = std::min(oldest, epoch);
+        }
+    }
+    return oldest;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Epoch-based reclamation for readers that don't take locks. A reader pins the current epoch
+// for the duration of a lookup; a writer tags what it unlinks with the epoch at the moment of unlinking
+// and frees it once no reader is pinned in that epoch or an earlier one.
+// Every thread pins in its own slot, so readers of different threads never write to a shared cache line.
+// Unlinking stores and the loads of readers must be sequentially consistent for this to hold.
+class EpochManager {
+public:
+    // Threads beyond this number get no slot and have to read under locks
+    static constexpr size_t MAX_THREADS = 512;
+    static constexpr size_t NO_SLOT = MAX_THREADS;
+
+    class Guard {
+    public:
+        explicit Guard(std::atomic<uint64_t>* slot)
+            : slot_(slot) {
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        ~Guard() {
+            if (slot_) {
+                slot_->store(0, std::memory_order_release);
+            }
+        }
+
+        // False if the thread has no slot, then nothing protects it from reclamation
+        bool pinned() const {
+            return slot_ != nullptr;
+        }
+
+    private:
+        std::atomic<uint64_t>* slot_;
+    };
+
+public:
+    EpochManager();
+
+    EpochManager(const EpochManager&) = delete;
+    EpochManager& operator=(const EpochManager&) = delete;
+
+    // Index of the calling thread, unique among running threads, or NO_SLOT.
+    // Indices of finished threads are reused.
+    static size_t thread_slot();
+
+    // Pins must not nest
+    Guard pin() const;
+
+    // Epoch to tag unlinked objects with
+    uint64_t current() const {
+        return epoch_.load();
+    }
+
+    // Starts a new epoch and returns the oldest epoch a reader may still be pinned in.
+    // Objects tagged with an earlier epoch are unreachable and can be freed.
+    uint64_t collect();
+
+private:
+    struct alignas(64) Slot {
+        // 0 while the thread is not reading
+        std::atomic<uint64_t> epoch = 0;
+    };
+
+    std::atomic<uint64_t> epoch_ = 1;
+    std::unique_ptr<Slot[]> slots_;
+};
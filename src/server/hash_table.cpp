@@ -0,0 +1,99 @@
+#include "hash_table.h"
+
+#include <algorithm>
+#include <bit>
+
+
+namespace {
+
+// Table grows when it is more than 7/8 full
+bool is_overloaded(size_t size, size_t capacity) {
+    return size * 8 >= capacity * 7;
+}
+
+}
+
+HashTable::HashTable(size_t initial_capacity)
+    : slots_(new Slots(std::bit_ceil(std::max<size_t>(initial_capacity, 2)))) {
+}
+
+HashTable::~HashTable() {
+    auto* slots = slots_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < slots->capacity(); ++i) {
+        delete slots->slots[i].entry.load(std::memory_order_relaxed);
+    }
+    delete slots;
+}
+
+HashTable::Entry* HashTable::find(std::string_view key, uint64_t hash) const {
+    const auto* slots = slots_.load();
+    return slots->slots[probe(*slots, key, hash)].entry.load(std::memory_order_acquire);
+}
+
+std::pair<HashTable::Entry*, bool> HashTable::find_or_insert(std::string_view key, uint64_t hash) {
+    auto* slots = slots_.load(std::memory_order_relaxed);
+    size_t index = probe(*slots, key, hash);
+    if (auto* entry = slots->slots[index].entry.load(std::memory_order_relaxed)) {
+        return {entry, false};
+    }
+
+    if (is_overloaded(size_ + 1, slots->capacity())) {
+        rehash(slots->capacity() * 2);
+        slots = slots_.load(std::memory_order_relaxed);
+        index = probe(*slots, key, hash);
+    }
+
+    // The hash is written first, a reader that sees the entry sees its hash
+    auto* entry = new Entry{std::string(key)};
+    slots->slots[index].hash.store(hash, std::memory_order_relaxed);
+    slots->slots[index].entry.store(entry, std::memory_order_release);
+    ++size_;
+    return {entry, true};
+}
+
+void HashTable::reserve(size_t size) {
+    size_t old_capacity = slots_.load(std::memory_order_relaxed)->capacity();
+    size_t capacity = old_capacity;
+    while (is_overloaded(size, capacity)) {
+        capacity *= 2;
+    }
+    if (capacity != old_capacity) {
+        rehash(capacity);
+    }
+}
+
+// Returns the slot holding the key or the empty slot where it should be inserted
+size_t HashTable::probe(const Slots& slots, std::string_view key, uint64_t hash) {
+    size_t index = hash & slots.mask;
+    while (true) {
+        const auto& slot = slots.slots[index];
+        auto* entry = slot.entry.load(std::memory_order_acquire);
+        if (!entry || (slot.hash.load(std::memory_order_relaxed) == hash && entry->key == key)) {
+            return index;
+        }
+        index = (index + 1) & slots.mask;
+    }
+}
+
+// The new array is filled before it is published, readers see either the old one or the complete new one
+void HashTable::rehash(size_t capacity) {
+    auto* old_slots = slots_.load(std::memory_order_relaxed);
+    auto new_slots = std::make_unique<Slots>(capacity);
+
+    for (size_t i = 0; i < old_slots->capacity(); ++i) {
+        auto* entry = old_slots->slots[i].entry.load(std::memory_order_relaxed);
+        if (!entry) {
+            continue;
+        }
+        uint64_t hash = old_slots->slots[i].hash.load(std::memory_order_relaxed);
+        size_t index = hash & new_slots->mask;
+        while (new_slots->slots[index].entry.load(std::memory_order_relaxed)) {
+            index = (index + 1) & new_slots->mask;
+        }
+        new_slots->slots[index].hash.store(hash, std::memory_order_relaxed);
+        new_slots->slots[index].entry.store(entry, std::memory_order_relaxed);
+    }
+
+    slots_.store(new_slots.release());
+    retired_.emplace_back(old_slots);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Open addressing hash table with linear probing. Slots keep the full hash
+// next to the pointer to the entry, so probing compares keys only on a hash
+// match and entries keep their addresses when the table grows.
+// A single writer (Storage serializes them with the shard lock) may run concurrently with
+// any number of find() calls. Entries are never removed and the slot array replaced by a rehash
+// is handed to the caller through take_retired(), as readers may still be probing it.
+class HashTable {
+public:
+    // Values are immutable: a set publishes a new one and retires the old one, so a reader
+    // that does not lock the shard never sees a value change under it.
+    // Bytes follow the header, the whole value is allocated by the shard's SlabAllocator.
+    struct Value {
+        size_t size;
+
+        std::string_view get() const {
+            return {reinterpret_cast<const char*>(this + 1), size};
+        }
+
+        static size_t allocation_size(size_t size) {
+            return sizeof(Value) + size;
+        }
+
+        // memory must hold allocation_size(value.size()) bytes
+        static const Value* create(char* memory, std::string_view value) {
+            auto* res = new (memory) Value{value.size()};
+            if (!value.empty()) {
+                std::memcpy(memory + sizeof(Value), value.data(), value.size());
+            }
+            return res;
+        }
+    };
+
+    // Entries are only created by sets and loads. An entry is inserted before its first value is published,
+    // so a reader that does not lock the shard may find it without a value.
+    struct Entry {
+        std::string key;
+        // Published with sequentially consistent stores and read with sequentially consistent loads,
+        // EpochManager relies on it to decide when a replaced value can be freed
+        std::atomic<const Value*> value = nullptr;
+
+        std::atomic<size_t> get_count = 0;
+        std::atomic<size_t> set_count = 0;
+
+        // Generation of dumps the entry was last put in the dirty list of its shard for,
+        // only touched by the writer
+        uint32_t dirty_generation = 0;
+    };
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> hash = 0;
+        std::atomic<Entry*> entry = nullptr;
+    };
+
+public:
+    struct Slots {
+        explicit Slots(size_t capacity)
+            : mask(capacity - 1)
+            , slots(std::make_unique<Slot[]>(capacity)) {
+        }
+
+        size_t capacity() const {
+            return mask + 1;
+        }
+
+        const size_t mask;
+        std::unique_ptr<Slot[]> slots;
+    };
+
+public:
+    HashTable(size_t initial_capacity = 16);
+
+    HashTable(const HashTable&) = delete;
+    HashTable& operator=(const HashTable&) = delete;
+
+    ~HashTable();
+
+    // Safe to call concurrently with the writer
+    Entry* find(std::string_view key, uint64_t hash) const;
+
+    // Returns the existing entry for the key or inserts an empty one
+    std::pair<Entry*, bool> find_or_insert(std::string_view key, uint64_t hash);
+
+    size_t size() const {
+        return size_;
+    }
+
+    // Calls f(hash, entry) for every entry. Must not run concurrently with the writer.
+    template <class F>
+    void for_each(F&& f) const {
+        const auto* slots = slots_.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < slots->capacity(); ++i) {
+            if (auto* entry = slots->slots[i].entry.load(std::memory_order_relaxed)) {
+                f(slots->slots[i].hash.load(std::memory_order_relaxed), *entry);
+            }
+        }
+    }
+
+    void reserve(size_t size);
+
+    // Slot arrays replaced by rehashes since the last call. The caller frees them once no reader can be probing them.
+    std::vector<std::unique_ptr<Slots>> take_retired() {
+        auto res = std::move(retired_);
+        retired_.clear();
+        return res;
+    }
+
+private:
+    static size_t probe(const Slots& slots, std::string_view key, uint64_t hash);
+    void rehash(size_t capacity);
+
+    // Owned, replaced by rehash with a sequentially consistent store
+    std::atomic<Slots*> slots_;
+    std::vector<std::unique_ptr<Slots>> retired_;
+    size_t size_ = 0;
+};
@@ -0,0 +1,328 @@
+#include "hot_keys.h"
+
+#include "count_min_sketch.h"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+
+namespace hot_keys {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Space-saving summary: at most capacity keys with counts that are never below their true counts.
+// A key that is not in a full summary has been counted at most min_count() times.
+// Keys are looked up by hash, a key whose hash collides with a tracked one is not tracked.
+// Buffers are flushed on the threads that serve requests, so counting doesn't allocate once the summary
+// has been filled: counters keep their keys' memory across windows and the index is a fixed table.
+class SpaceSaving {
+public:
+    explicit SpaceSaving(size_t capacity)
+        : capacity_(capacity)
+        , index_(std::bit_ceil(2 * capacity))
+        , index_mask_(index_.size() - 1) {
+        counters_.reserve(capacity);
+        heap_.reserve(capacity);
+    }
+
+    // Counts one request of the key. estimate is the count of the key from a sketch that has already
+    // counted this request, it decides whether the key takes the place of the least counted one.
+    void add(uint64_t hash, std::string_view key, uint64_t estimate) {
+        size_t slot = find_slot(hash);
+        if (index_[slot].counter != EMPTY) {
+            auto& counter = counters_[index_[slot].counter];
+            if (counter.key == key) [[likely]] {
+                ++counter.count;
+                sift_down(counter.heap_pos);
+            }
+            return;
+        }
+        if (size_ < capacity_) {
+            if (size_ == counters_.size()) {
+                counters_.emplace_back();
+            }
+            auto& counter = counters_[size_];
+            counter.key.assign(key);
+            counter.hash = hash;
+            counter.count = estimate;
+            counter.heap_pos = heap_.size();
+            index_[slot] = {hash, static_cast<uint32_t>(size_)};
+            heap_.push_back(size_);
+            ++size_;
+            sift_up(heap_.size() - 1);
+            return;
+        }
+        // Whatever the sketch says, the key was seen at most estimate times, so the count stays an upper bound
+        if (estimate <= min_count()) {
+            return;
+        }
+        size_t replaced = heap_[0];
+        auto& counter = counters_[replaced];
+        erase_slot(find_slot(counter.hash));
+        counter.key.assign(key);
+        counter.hash = hash;
+        counter.count = estimate;
+        index_[find_slot(hash)] = {hash, static_cast<uint32_t>(replaced)};
+        sift_down(0);
+    }
+
+    bool full() const {
+        return size_ == capacity_;
+    }
+
+    uint64_t min_count() const {
+        return heap_.empty() ? 0 : counters_[heap_[0]].count;
+    }
+
+    std::optional<uint64_t> count(uint64_t hash, std::string_view key) const {
+        const auto& slot = index_[find_slot(hash)];
+        if (slot.counter == EMPTY || counters_[slot.counter].key != key) {
+            return std::nullopt;
+        }
+        return counters_[slot.counter].count;
+    }
+
+    // Calls f(hash, key) for every key
+    template <class F>
+    void for_each(F&& f) const {
+        for (size_t i = 0; i < size_; ++i) {
+            f(counters_[i].hash, counters_[i].key);
+        }
+    }
+
+    void clear() {
+        std::fill(index_.begin(), index_.end(), Slot());
+        size_ = 0;
+        heap_.clear();
+    }
+
+private:
+    static constexpr uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
+
+    struct Counter {
+        std::string key;
+        uint64_t hash = 0;
+        uint64_t count = 0;
+        size_t heap_pos = 0;
+    };
+
+    struct Slot {
+        uint64_t hash = 0;
+        uint32_t counter = EMPTY;
+    };
+
+    // The slot of the hash, or the empty slot where it goes. The index is at most half full.
+    size_t find_slot(uint64_t hash) const {
+        size_t slot = hash & index_mask_;
+        while (index_[slot].counter != EMPTY && index_[slot].hash != hash) {
+            slot = (slot + 1) & index_mask_;
+        }
+        return slot;
+    }
+
+    // Linear probing without tombstones: the following slots of the run move back into the hole
+    // unless that would put them before the slot of their hash
+    void erase_slot(size_t hole) {
+        for (size_t slot = (hole + 1) & index_mask_; index_[slot].counter != EMPTY; slot = (slot + 1) & index_mask_) {
+            size_t home = index_[slot].hash & index_mask_;
+            if (((slot - home) & index_mask_) >= ((slot - hole) & index_mask_)) {
+                index_[hole] = index_[slot];
+                hole = slot;
+            }
+        }
+        index_[hole] = Slot();
+    }
+
+    bool less(size_t a, size_t b) const {
+        return counters_[heap_[a]].count < counters_[heap_[b]].count;
+    }
+
+    void swap(size_t a, size_t b) {
+        std::swap(heap_[a], heap_[b]);
+        counters_[heap_[a]].heap_pos = a;
+        counters_[heap_[b]].heap_pos = b;
+    }
+
+    void sift_up(size_t pos) {
+        while (pos > 0 && less(pos, (pos - 1) / 2)) {
+            swap(pos, (pos - 1) / 2);
+            pos = (pos - 1) / 2;
+        }
+    }
+
+    void sift_down(size_t pos) {
+        while (true) {
+            size_t smallest = pos;
+            for (size_t child = 2 * pos + 1; child <= 2 * pos + 2 && child < heap_.size(); ++child) {
+                if (less(child, smallest)) {
+                    smallest = child;
+                }
+            }
+            if (smallest == pos) {
+                return;
+            }
+            swap(pos, smallest);
+            pos = smallest;
+        }
+    }
+
+    const size_t capacity_;
+    // The first size_ are in use, the rest keep the memory of their keys for later windows
+    std::vector<Counter> counters_;
+    size_t size_ = 0;
+    // Min-heap of positions in counters_ by count
+    std::vector<size_t> heap_;
+    // Hash of a key -> its position in counters_
+    std::vector<Slot> index_;
+    const size_t index_mask_;
+};
+
+struct Window {
+    Window()
+        : sketch(SKETCH_WIDTH)
+        , top(TOP_CAPACITY) {
+    }
+
+    void reset(Clock::time_point new_start) {
+        start = new_start;
+        requests = 0;
+        sketch.clear();
+        top.clear();
+    }
+
+    // Upper bound of the sampled requests of the key in this window
+    uint64_t count(uint64_t hash, std::string_view key) const {
+        auto tracked = top.count(hash, key);
+        uint64_t bound = tracked ? *tracked : top.full() ? top.min_count() : 0;
+        return std::min(bound, sketch.estimate(hash));
+    }
+
+    // Never used windows start at the epoch of the clock
+    Clock::time_point start;
+    uint64_t requests = 0;
+    CountMinSketch<uint32_t> sketch;
+    SpaceSaving top;
+};
+
+class Tracker {
+public:
+    Tracker() {
+        for (size_t i = 0; i < WINDOWS_COUNT; ++i) {
+            windows_.push_back(std::make_unique<Window>());
+        }
+        windows_[current_]->start = Clock::now();
+    }
+
+    static Tracker& instance() {
+        // Never destroyed, threads flush their buffers into it when they exit
+        static auto* tracker = new Tracker();
+        return *tracker;
+    }
+
+    void add(const detail::Buffer& buffer) {
+        std::lock_guard lock(mutex_);
+        advance(Clock::now());
+        auto& window = *windows_[current_];
+        window.requests += buffer.hashes.size();
+        size_t key_begin = 0;
+        for (size_t i = 0; i < buffer.hashes.size(); ++i) {
+            std::string_view key(buffer.keys.data() + key_begin, buffer.key_ends[i] - key_begin);
+            key_begin = buffer.key_ends[i];
+            window.top.add(buffer.hashes[i], key, window.sketch.add(buffer.hashes[i]));
+        }
+    }
+
+    Report top(size_t count, std::chrono::seconds period) {
+        std::lock_guard lock(mutex_);
+        auto now = Clock::now();
+        advance(now);
+
+        size_t windows_count = std::clamp<size_t>((period + WINDOW - std::chrono::seconds(1)) / WINDOW, 1, WINDOWS_COUNT);
+        std::vector<const Window*> windows;
+        for (size_t i = 0; i < windows_count; ++i) {
+            const auto* window = windows_[(current_ + WINDOWS_COUNT - i) % WINDOWS_COUNT].get();
+            if (window->start == Clock::time_point()) {
+                break;
+            }
+            windows.push_back(window);
+        }
+
+        Report report;
+        report.period = std::chrono::duration_cast<std::chrono::milliseconds>(now - windows.back()->start);
+        std::unordered_map<std::string_view, uint64_t> candidates;
+        for (const auto* window : windows) {
+            report.requests += window->requests * SAMPLE_PERIOD;
+            window->top.for_each([&](uint64_t hash, std::string_view key) {
+                candidates.emplace(key, hash);
+            });
+        }
+        for (auto [key, hash] : candidates) {
+            uint64_t key_count = 0;
+            for (const auto* window : windows) {
+                key_count += window->count(hash, key);
+            }
+            report.keys.push_back({std::string(key), key_count * SAMPLE_PERIOD});
+        }
+
+        std::sort(report.keys.begin(), report.keys.end(), [](const HotKey& a, const HotKey& b) {
+            return a.count != b.count ? a.count > b.count : a.key < b.key;
+        });
+        report.keys.resize(std::min({report.keys.size(), count, TOP_CAPACITY}));
+        return report;
+    }
+
+private:
+    // Moves to the window that covers now, starting new ones as needed
+    void advance(Clock::time_point now) {
+        auto* window = windows_[current_].get();
+        if (now - window->start < WINDOW) {
+            return;
+        }
+        if (now - window->start >= WINDOW * WINDOWS_COUNT) {
+            // Idle for longer than the whole history
+            for (auto& old : windows_) {
+                old->reset(Clock::time_point());
+            }
+            windows_[current_]->start = now;
+            return;
+        }
+        while (now - windows_[current_]->start >= WINDOW) {
+            auto start = windows_[current_]->start + WINDOW;
+            current_ = (current_ + 1) % WINDOWS_COUNT;
+            windows_[current_]->reset(start);
+        }
+    }
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Window>> windows_;
+    size_t current_ = 0;
+};
+
+}
+
+detail::Buffer::~Buffer() {
+    flush(*this);
+}
+
+void detail::flush(Buffer& buffer) {
+    if (buffer.hashes.empty()) {
+        return;
+    }
+    Tracker::instance().add(buffer);
+    buffer.hashes.clear();
+    buffer.key_ends.clear();
+    buffer.keys.clear();
+}
+
+Report top(size_t count, std::chrono::seconds period) {
+    return Tracker::instance().top(count, period);
+}
+
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Keys that get the most requests, over the last minute or so, in bounded memory.
+// Storage records the key of every get and set, and one request in SAMPLE_PERIOD, picked at random,
+// is counted. A thread collects sampled keys in its own buffer and adds BUFFER_SIZE of them at a time
+// to the current window under a lock, so a request mostly costs a random number.
+// A window counts every key in a count-min sketch and keeps TOP_CAPACITY candidates in a space-saving summary.
+// A key gets into a full summary only if its estimate from the sketch is above the smallest count there,
+// so a scan of random keys does not push hot keys out. Reports cover whole windows, keys still buffered
+// by threads are not in them yet.
+namespace hot_keys {
+
+// A power of two. Counts in reports are scaled back up, so keys with a few hundred requests are noise.
+constexpr uint32_t SAMPLE_PERIOD = 64;
+constexpr size_t BUFFER_SIZE = 256;
+// Candidates kept per window, also the largest report
+constexpr size_t TOP_CAPACITY = 256;
+// Counters in a row of a window sketch: estimates are at most 1/6000 of the sampled requests of the window too high
+constexpr size_t SKETCH_WIDTH = size_t(1) << 14;
+constexpr auto WINDOW = std::chrono::seconds(10);
+constexpr size_t WINDOWS_COUNT = 6;
+
+struct HotKey {
+    std::string key;
+    // Estimated requests of the key in the period of the report
+    uint64_t count = 0;
+};
+
+struct Report {
+    // From the start of the oldest window in the report to now
+    std::chrono::milliseconds period{0};
+    // Estimated requests of all keys in the period
+    uint64_t requests = 0;
+    // The hottest first
+    std::vector<HotKey> keys;
+};
+
+namespace detail {
+
+// Keys recorded by a thread since it last handed them over, flushed when the thread exits
+struct Buffer {
+    ~Buffer();
+
+    // xorshift32 state, never 0
+    uint32_t random = 0x9e3779b9;
+    std::vector<uint64_t> hashes;
+    // Keys are stored back to back, key i ends at key_ends[i]
+    std::vector<size_t> key_ends;
+    std::string keys;
+};
+
+void flush(Buffer& buffer);
+
+inline Buffer& local() {
+    thread_local Buffer buffer;
+    return buffer;
+}
+
+}
+
+// hash is the hash the storage uses for the key
+inline void record(uint64_t hash, std::string_view key) {
+    auto& buffer = detail::local();
+    buffer.random ^= buffer.random << 13;
+    buffer.random ^= buffer.random >> 17;
+    buffer.random ^= buffer.random << 5;
+    if ((buffer.random & (SAMPLE_PERIOD - 1)) != 0) {
+        return;
+    }
+    buffer.hashes.push_back(hash);
+    buffer.keys.append(key);
+    buffer.key_ends.push_back(buffer.keys.size());
+    if (buffer.hashes.size() == BUFFER_SIZE) {
+        detail::flush(buffer);
+    }
+}
+
+// At most count of the hottest keys over the last period, rounded up to whole windows.
+// count is capped by TOP_CAPACITY and period by WINDOWS_COUNT windows.
+Report top(size_t count, std::chrono::seconds period);
+
+}
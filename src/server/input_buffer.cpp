@@ -0,0 +1,40 @@
+#include "input_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+InputBuffer::InputBuffer(size_t min_read_size)
+    : buffer_(min_read_size)
+    , min_read_size_(min_read_size) {
+}
+
+std::span<char> InputBuffer::prepare() {
+    if (buffer_.size() - end_ < min_read_size_) {
+        if (begin_ > 0) {
+            std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        if (buffer_.size() - end_ < min_read_size_) {
+            buffer_.resize(std::max(buffer_.size() * 2, end_ + min_read_size_));
+        }
+    }
+    return std::span<char>(buffer_.data() + end_, buffer_.size() - end_);
+}
+
+void InputBuffer::commit(size_t size) {
+    end_ += size;
+}
+
+std::string_view InputBuffer::data() const {
+    return std::string_view(buffer_.data() + begin_, end_ - begin_);
+}
+
+void InputBuffer::consume(size_t size) {
+    begin_ += size;
+    if (begin_ == end_) {
+        begin_ = 0;
+        end_ = 0;
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Bytes read from a socket that are not processed yet. Processed bytes are dropped by moving the
+// unprocessed tail to the front only when the next read does not fit behind it, so once the buffer
+// has grown to the largest request it neither allocates nor shifts data on every message.
+class InputBuffer {
+public:
+    explicit InputBuffer(size_t min_read_size);
+
+    // Free space for the next read, at least min_read_size bytes.
+    // The buffer must not be changed until the read is committed.
+    std::span<char> prepare();
+    void commit(size_t size);
+
+    std::string_view data() const;
+    void consume(size_t size);
+
+private:
+    std::vector<char> buffer_;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+    const size_t min_read_size_;
+};
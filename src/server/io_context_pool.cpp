@@ -0,0 +1,60 @@
+#include "io_context_pool.h"
+
+#include "../util/thread_affinity.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+
+IoContextPool::IoContextPool(size_t threads_count, bool per_thread, bool pin_threads)
+    : threads_count_(threads_count)
+    , pin_threads_(pin_threads) {
+    if (threads_count_ == 0) {
+        throw std::invalid_argument(
+            "Io context pool needs at least one thread."
+        );
+    }
+
+    size_t io_contexts_count = per_thread ? threads_count_ : 1;
+    // The hint lets asio skip locking when a single thread runs the io_context
+    int concurrency_hint = per_thread ? 1 : static_cast<int>(threads_count_);
+    for (size_t i = 0; i < io_contexts_count; ++i) {
+        io_contexts_.push_back(std::make_unique<boost::asio::io_context>(concurrency_hint));
+        work_guards_.push_back(boost::asio::make_work_guard(*io_contexts_.back()));
+    }
+}
+
+size_t IoContextPool::size() const {
+    return io_contexts_.size();
+}
+
+boost::asio::io_context& IoContextPool::get(size_t i) {
+    return *io_contexts_[i];
+}
+
+boost::asio::io_context& IoContextPool::next() {
+    return *io_contexts_[next_.fetch_add(1, std::memory_order_relaxed) % io_contexts_.size()];
+}
+
+void IoContextPool::run() {
+    size_t cpus_count = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < threads_count_; ++i) {
+        threads.emplace_back([this, i, cpus_count] {
+            if (pin_threads_) {
+                pin_current_thread(i % cpus_count);
+            }
+            io_contexts_[i % io_contexts_.size()]->run();
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void IoContextPool::stop() {
+    for (auto& io_context : io_contexts_) {
+        io_context->stop();
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// io_contexts of the server and the threads that run them. With per_thread every thread runs
+// its own io_context, so everything bound to one of them stays on a single thread.
+// Otherwise all threads run one shared io_context.
+class IoContextPool {
+public:
+    IoContextPool(size_t threads_count, bool per_thread, bool pin_threads);
+
+    IoContextPool(const IoContextPool&) = delete;
+    IoContextPool& operator=(const IoContextPool&) = delete;
+
+    size_t size() const;
+    boost::asio::io_context& get(size_t i);
+    // Returns io_contexts in turn
+    boost::asio::io_context& next();
+
+    // Blocks until stop() is called and all threads finish
+    void run();
+    void stop();
+
+private:
+    using WorkGuard = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+
+    std::vector<std::unique_ptr<boost::asio::io_context>> io_contexts_;
+    // Keep io_contexts without pending work running until stop()
+    std::vector<WorkGuard> work_guards_;
+    std::atomic<size_t> next_ = 0;
+
+    const size_t threads_count_;
+    const bool pin_threads_;
+};
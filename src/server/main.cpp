@@ -1,43 +1,46 @@
 #include "server.h"
 
+#include "../util/log.h"
+
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/signal_set.hpp>
 
+#include <algorithm>
 #include <iostream>
+#include <thread>
 
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <port>" << std::endl;
+    ServerOptions options;
+    try {
+        options = parse_server_options(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        print_server_usage(argv[0]);
         return 1;
     }
-    uint16_t port = std::stoi(argv[1]);
 
-    boost::asio::io_context io_context;
-    boost::asio::signal_set signals(io_context, SIGINT);
+    logging::set_level(options.log_level);
+
+    size_t threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    options.threads = threads;
+    // The io_uring backend runs its own threads, the pool is only left with signals and timers
+    bool uring = options.backend == NetworkBackend::IO_URING;
+    IoContextPool io_contexts(uring ? 1 : threads, !uring && options.io_mode == IoMode::PER_THREAD, !uring && options.pin_threads);
+    boost::asio::signal_set signals(io_contexts.get(0), SIGINT);
 
-    Server server(io_context, "config.txt", port);
+    Server server(io_contexts, options);
 
     signals.async_wait([&](const boost::system::error_code&, int) {
-        std::cerr << "signal received, stopping server" << std::endl;
-        io_context.stop();
+        LOG_INFO("signal received, stopping server");
+        io_contexts.stop();
     });
 
-    size_t threads = std::thread::hardware_concurrency();
-    std::cerr << "Starting server with " << threads << " threads" << std::endl;
-    std::vector<std::thread> thread_pool;
-    for (size_t i = 0; i < threads; ++i) {
-        thread_pool.emplace_back([&io_context] {
-            io_context.run();
-        });
-    }
-
+    LOG_INFO("Starting server with " << threads << " threads, " << io_contexts.size() << " io contexts");
     server.run();
+    io_contexts.run();
 
-    std::cerr << "Server stopped" << std::endl;
-    for (auto& t : thread_pool) {
-        t.join();
-    }
-    std::cerr << "Io context threads joined" << std::endl;
+    LOG_INFO("Server stopped");
+    LOG_INFO("Io context threads joined");
     return 0;
 }
@@ -0,0 +1,216 @@
+#include "metrics.h"
+
+#include "epoch_manager.h"
+
+#include <charconv>
+#include <memory>
+
+
+namespace metrics {
+
+namespace detail {
+
+std::atomic_bool enabled = false;
+
+}
+
+namespace {
+
+// Blocks are allocated by the first thread of a slot, the extra one is shared by threads without a slot
+std::atomic<detail::ThreadMetrics*> thread_metrics[EpochManager::MAX_THREADS + 1];
+
+// Bucket bounds exposed as `le`, from 1 us to about a minute. Buckets below are counted in the first one,
+// buckets above in +Inf only.
+constexpr uint64_t MIN_BOUND_NS = uint64_t(1) << 10;
+constexpr uint64_t MAX_BOUND_NS = uint64_t(1) << 36;
+
+struct Totals {
+    struct HistogramTotals {
+        uint64_t counts[Buckets::COUNT] = {};
+        uint64_t sum = 0;
+    };
+
+    uint64_t counters[static_cast<size_t>(Counter::COUNT)] = {};
+    HistogramTotals histograms[static_cast<size_t>(Histogram::COUNT)];
+
+    uint64_t counter(Counter counter) const {
+        return counters[static_cast<size_t>(counter)];
+    }
+
+    const HistogramTotals& histogram(Histogram histogram) const {
+        return histograms[static_cast<size_t>(histogram)];
+    }
+};
+
+void take_totals(Totals& totals) {
+    for (const auto& slot : thread_metrics) {
+        const auto* metrics = slot.load(std::memory_order_acquire);
+        if (!metrics) {
+            continue;
+        }
+        for (size_t i = 0; i < static_cast<size_t>(Counter::COUNT); ++i) {
+            totals.counters[i] += metrics->counters[i].load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < static_cast<size_t>(Histogram::COUNT); ++i) {
+            auto& histogram = totals.histograms[i];
+            for (size_t j = 0; j < Buckets::COUNT; ++j) {
+                histogram.counts[j] += metrics->histograms[i].counts[j].load(std::memory_order_relaxed);
+            }
+            histogram.sum += metrics->histograms[i].sum.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void append_number(std::string& out, double value) {
+    char buffer[32];
+    auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, end);
+}
+
+void append_number(std::string& out, uint64_t value) {
+    char buffer[24];
+    auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, end);
+}
+
+void append_header(std::string& out, std::string_view name, std::string_view help, std::string_view type) {
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+// name{labels} value, labels are either empty or a ready list like command="get"
+template <class T>
+void append_sample(std::string& out, std::string_view name, std::string_view labels, T value) {
+    out.append(name);
+    if (!labels.empty()) {
+        out.append("{").append(labels).append("}");
+    }
+    out.append(" ");
+    append_number(out, value);
+    out.append("\n");
+}
+
+void append_histogram(std::string& out, std::string_view name, std::string_view labels, const Totals::HistogramTotals& histogram) {
+    std::string bucket_name = std::string(name) + "_bucket";
+    std::string bucket_labels(labels);
+    if (!bucket_labels.empty()) {
+        bucket_labels += ",";
+    }
+    size_t labels_size = bucket_labels.size();
+
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < Buckets::COUNT; ++i) {
+        cumulative += histogram.counts[i];
+        uint64_t bound = Buckets::highest_value(i) + 1;
+        if (bound < MIN_BOUND_NS) {
+            continue;
+        }
+        if (bound > MAX_BOUND_NS) {
+            break;
+        }
+        bucket_labels.resize(labels_size);
+        bucket_labels += "le=\"";
+        append_number(bucket_labels, bound / 1e9);
+        bucket_labels += "\"";
+        append_sample(out, bucket_name, bucket_labels, cumulative);
+    }
+    uint64_t count = 0;
+    for (auto bucket_count : histogram.counts) {
+        count += bucket_count;
+    }
+    bucket_labels.resize(labels_size);
+    bucket_labels += "le=\"+Inf\"";
+    append_sample(out, bucket_name, bucket_labels, count);
+    append_sample(out, std::string(name) + "_sum", labels, histogram.sum / 1e9);
+    append_sample(out, std::string(name) + "_count", labels, count);
+}
+
+}
+
+detail::ThreadMetrics& detail::acquire_thread_metrics() {
+    auto& slot = thread_metrics[EpochManager::thread_slot()];
+    auto* metrics = slot.load(std::memory_order_acquire);
+    if (metrics) {
+        return *metrics;
+    }
+    // Only the thread without a slot may race for a block
+    auto fresh = std::make_unique<ThreadMetrics>();
+    if (slot.compare_exchange_strong(metrics, fresh.get(), std::memory_order_acq_rel)) {
+        return *fresh.release();
+    }
+    return *metrics;
+}
+
+void set_enabled(bool enabled) {
+    detail::enabled.store(enabled);
+}
+
+void render(std::string& out) {
+    auto totals = std::make_unique<Totals>();
+    take_totals(*totals);
+
+    append_counter(out, "dictionary_connections_accepted_total", "Client connections accepted.",
+        totals->counter(Counter::CONNECTIONS_ACCEPTED));
+    append_counter(out, "dictionary_connections_closed_total", "Client connections closed.",
+        totals->counter(Counter::CONNECTIONS_CLOSED));
+    // Blocks are summed up one by one, a connection may be counted as closed before it is counted as accepted
+    append_gauge(out, "dictionary_connections_active", "Client connections open.",
+        std::max<int64_t>(totals->counter(Counter::CONNECTIONS_ACCEPTED) - totals->counter(Counter::CONNECTIONS_CLOSED), 0));
+    append_counter(out, "dictionary_reads_total", "Reads from client sockets.", totals->counter(Counter::READS));
+    append_counter(out, "dictionary_read_bytes_total", "Bytes read from client sockets.", totals->counter(Counter::BYTES_READ));
+    append_counter(out, "dictionary_writes_total", "Writes to client sockets.", totals->counter(Counter::WRITES));
+    append_counter(out, "dictionary_written_bytes_total", "Bytes written to client sockets.",
+        totals->counter(Counter::BYTES_WRITTEN));
+
+    append_header(out, "dictionary_requests_total", "Requests handled, by command.", "counter");
+    append_sample(out, "dictionary_requests_total", "command=\"get\"", totals->counter(Counter::REQUESTS_GET));
+    append_sample(out, "dictionary_requests_total", "command=\"set\"", totals->counter(Counter::REQUESTS_SET));
+    append_sample(out, "dictionary_requests_total", "command=\"mget\"", totals->counter(Counter::REQUESTS_MGET));
+    append_sample(out, "dictionary_requests_total", "command=\"mset\"", totals->counter(Counter::REQUESTS_MSET));
+    append_sample(out, "dictionary_requests_total", "command=\"top\"", totals->counter(Counter::REQUESTS_TOP));
+    append_sample(out, "dictionary_requests_total", "command=\"cas\"", totals->counter(Counter::REQUESTS_CAS));
+    append_sample(out, "dictionary_requests_total", "command=\"incr\"", totals->counter(Counter::REQUESTS_INCR));
+    append_sample(out, "dictionary_requests_total", "command=\"decr\"", totals->counter(Counter::REQUESTS_DECR));
+    append_sample(out, "dictionary_requests_total", "command=\"append\"", totals->counter(Counter::REQUESTS_APPEND));
+    append_sample(out, "dictionary_requests_total", "command=\"setnx\"", totals->counter(Counter::REQUESTS_SETNX));
+    append_sample(out, "dictionary_requests_total", "command=\"watch\"", totals->counter(Counter::REQUESTS_WATCH));
+    append_sample(out, "dictionary_requests_total", "command=\"unwatch\"", totals->counter(Counter::REQUESTS_UNWATCH));
+    append_counter(out, "dictionary_request_errors_total", "Malformed, unknown or rejected requests.",
+        totals->counter(Counter::REQUEST_ERRORS));
+    append_counter(out, "dictionary_storage_get_misses_total", "Lookups of keys without a value.",
+        totals->counter(Counter::STORAGE_GET_MISSES));
+    append_counter(out, "dictionary_watch_notifications_total", "Changes of watched keys queued for connections.",
+        totals->counter(Counter::WATCH_NOTIFICATIONS));
+    append_counter(out, "dictionary_watch_coalesced_total", "Changes of watched keys merged into a queued change of the key.",
+        totals->counter(Counter::WATCH_COALESCED));
+    append_counter(out, "dictionary_watch_overflows_total", "Watch queues dropped because their connection read too slowly.",
+        totals->counter(Counter::WATCH_OVERFLOWS));
+    append_counter(out, "dictionary_watch_dropped_total", "Queued changes of watched keys dropped by overflows.",
+        totals->counter(Counter::WATCH_DROPPED));
+
+    append_header(out, "dictionary_request_stage_seconds",
+        "Time requests spend in the stages of a connection, sampled: one request or write in 64 per thread.", "histogram");
+    append_histogram(out, "dictionary_request_stage_seconds", "stage=\"parse\"", totals->histogram(Histogram::PARSE));
+    append_histogram(out, "dictionary_request_stage_seconds", "stage=\"execute\"", totals->histogram(Histogram::EXECUTE));
+    append_histogram(out, "dictionary_request_stage_seconds", "stage=\"write_queue\"", totals->histogram(Histogram::WRITE_QUEUE));
+    append_histogram(out, "dictionary_request_stage_seconds", "stage=\"write\"", totals->histogram(Histogram::WRITE));
+
+    append_header(out, "dictionary_storage_set_seconds", "Duration of storage sets with the WAL wait, sampled: one set in 64 per thread.",
+        "histogram");
+    append_histogram(out, "dictionary_storage_set_seconds", {}, totals->histogram(Histogram::STORAGE_SET));
+
+    append_header(out, "dictionary_dump_seconds", "Duration of dictionary dumps.", "histogram");
+    append_histogram(out, "dictionary_dump_seconds", {}, totals->histogram(Histogram::DUMP));
+}
+
+void append_gauge(std::string& out, std::string_view name, std::string_view help, double value) {
+    append_header(out, name, help, "gauge");
+    append_sample(out, name, {}, value);
+}
+
+void append_counter(std::string& out, std::string_view name, std::string_view help, double value) {
+    append_header(out, name, help, "counter");
+    append_sample(out, name, {}, value);
+}
+
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "../util/latency_histogram.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Counters and latency histograms of the server, exposed in the Prometheus text format.
+// Every thread records into its own cache-aligned block, so recording takes no locks and touches
+// no memory shared with other threads; blocks are only summed up when the metrics are rendered.
+// Blocks belong to the thread slots of EpochManager and outlive their threads, so totals never go down.
+// Nothing is recorded while the metrics are disabled, which they are by default.
+namespace metrics {
+
+enum class Counter {
+    CONNECTIONS_ACCEPTED,
+    CONNECTIONS_CLOSED,
+    READS,
+    BYTES_READ,
+    WRITES,
+    BYTES_WRITTEN,
+    REQUESTS_GET,
+    REQUESTS_SET,
+    REQUESTS_MGET,
+    REQUESTS_MSET,
+    REQUESTS_TOP,
+    REQUESTS_CAS,
+    REQUESTS_INCR,
+    REQUESTS_DECR,
+    REQUESTS_APPEND,
+    REQUESTS_SETNX,
+    REQUESTS_WATCH,
+    REQUESTS_UNWATCH,
+    REQUEST_ERRORS,
+    STORAGE_GET_MISSES,
+    WATCH_NOTIFICATIONS,
+    WATCH_COALESCED,
+    WATCH_OVERFLOWS,
+    WATCH_DROPPED,
+    COUNT,
+};
+
+enum class Histogram {
+    // Framing and decoding of a request
+    PARSE,
+    // Handling of a decoded request, storage access and encoding of the response included
+    EXECUTE,
+    // From the moment a response is ready to the start of the write that sends it
+    WRITE_QUEUE,
+    // One write of coalesced responses to the socket
+    WRITE,
+    // Storage::set, the wait for the WAL included
+    STORAGE_SET,
+    DUMP,
+    COUNT,
+};
+
+// Four linear buckets per power of two: a bucket is at most 50% wide, and a histogram takes 1 KiB
+using Buckets = LogLinearBuckets<2>;
+
+// Clock reads cost a noticeable share of a request, so per-request timings are taken
+// for one request in SAMPLE_PERIOD on every thread
+constexpr uint32_t SAMPLE_PERIOD = 64;
+
+namespace detail {
+
+struct alignas(64) ThreadMetrics {
+    struct HistogramData {
+        std::atomic<uint64_t> counts[Buckets::COUNT];
+        // Nanoseconds
+        std::atomic<uint64_t> sum;
+    };
+
+    std::atomic<uint64_t> counters[static_cast<size_t>(Counter::COUNT)];
+    HistogramData histograms[static_cast<size_t>(Histogram::COUNT)];
+};
+
+extern std::atomic_bool enabled;
+
+ThreadMetrics& acquire_thread_metrics();
+
+inline ThreadMetrics& local() {
+    thread_local ThreadMetrics& metrics = acquire_thread_metrics();
+    return metrics;
+}
+
+}
+
+void set_enabled(bool enabled);
+
+inline bool enabled() {
+    return detail::enabled.load(std::memory_order_relaxed);
+}
+
+// Threads beyond EpochManager::MAX_THREADS share a block, so even the owner adds atomically
+inline void add(Counter counter, uint64_t n = 1) {
+    if (!enabled()) {
+        return;
+    }
+    detail::local().counters[static_cast<size_t>(counter)].fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void record(Histogram histogram, std::chrono::nanoseconds duration) {
+    if (!enabled()) {
+        return;
+    }
+    uint64_t value = std::max<int64_t>(duration.count(), 0);
+    auto& data = detail::local().histograms[static_cast<size_t>(histogram)];
+    data.counts[Buckets::index(value)].fetch_add(1, std::memory_order_relaxed);
+    data.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+// True for one call in SAMPLE_PERIOD on the calling thread
+inline bool sample() {
+    thread_local uint32_t countdown = 1;
+    if (--countdown != 0) {
+        return false;
+    }
+    countdown = SAMPLE_PERIOD;
+    return true;
+}
+
+// Measures a stage of work. A default-constructed stopwatch is stopped and records nothing,
+// so that callers don't need to check whether metrics are enabled or the call was sampled.
+class Stopwatch {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Stopwatch() = default;
+
+    static Stopwatch start() {
+        return enabled() ? Stopwatch(Clock::now()) : Stopwatch();
+    }
+
+    // Running for one call in SAMPLE_PERIOD
+    static Stopwatch start_sampled() {
+        return enabled() && sample() ? Stopwatch(Clock::now()) : Stopwatch();
+    }
+
+    bool running() const {
+        return start_ != Clock::time_point();
+    }
+
+    void record(Histogram histogram) const {
+        if (running()) {
+            metrics::record(histogram, Clock::now() - start_);
+        }
+    }
+
+    // Records the time since the start or the previous lap and starts the next stage
+    void lap(Histogram histogram) {
+        if (running()) {
+            auto now = Clock::now();
+            metrics::record(histogram, now - start_);
+            start_ = now;
+        }
+    }
+
+private:
+    explicit Stopwatch(Clock::time_point start)
+        : start_(start) {
+    }
+
+    Clock::time_point start_;
+};
+
+// Appends all the metrics in the Prometheus text exposition format
+void render(std::string& out);
+
+void append_gauge(std::string& out, std::string_view name, std::string_view help, double value);
+void append_counter(std::string& out, std::string_view name, std::string_view help, double value);
+
+}
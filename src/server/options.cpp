@@ -0,0 +1,219 @@
+#include "options.h"
+
+#include <charconv>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+
+
+namespace {
+
+std::pair<std::string_view, std::string_view> split_flag(std::string_view arg) {
+    if (!arg.starts_with("--")) {
+        throw std::invalid_argument("Unexpected argument " + std::string(arg));
+    }
+    arg.remove_prefix(2);
+    auto eq = arg.find('=');
+    if (eq == std::string_view::npos) {
+        return {arg, {}};
+    }
+    return {arg.substr(0, eq), arg.substr(eq + 1)};
+}
+
+size_t parse_number(std::string_view name, std::string_view value) {
+    size_t res = 0;
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), res);
+    if (ec != std::errc() || end != value.data() + value.size()) {
+        throw std::invalid_argument("Option --" + std::string(name) + " expects a number");
+    }
+    return res;
+}
+
+uint16_t parse_port(std::string_view name, std::string_view value) {
+    auto port = parse_number(name, value);
+    if (port == 0 || port > std::numeric_limits<uint16_t>::max()) {
+        throw std::invalid_argument("Option --" + std::string(name) + " expects a port");
+    }
+    return port;
+}
+
+void set_wal_mode(ServerOptions& options, WriteAheadLog::SyncMode mode) {
+    if (!options.storage.wal) {
+        options.storage.wal.emplace();
+    }
+    options.storage.wal->mode = mode;
+}
+
+WriteAheadLog::Options& get_wal_options(ServerOptions& options, std::string_view name) {
+    if (!options.storage.wal) {
+        throw std::invalid_argument("Option --" + std::string(name) + " requires WAL to be enabled");
+    }
+    return *options.storage.wal;
+}
+
+}
+
+ServerOptions parse_server_options(int argc, char** argv) {
+    if (argc < 2) {
+        throw std::invalid_argument("Port is not specified");
+    }
+
+    ServerOptions options;
+    options.port = std::stoi(argv[1]);
+
+    for (int i = 2; i < argc; ++i) {
+        auto [name, value] = split_flag(argv[i]);
+        if (name == "wal") {
+            if (value == "off") {
+                options.storage.wal.reset();
+            } else if (value == "no-sync") {
+                set_wal_mode(options, WriteAheadLog::SyncMode::NO_SYNC);
+            } else if (value == "group-commit") {
+                set_wal_mode(options, WriteAheadLog::SyncMode::GROUP_COMMIT);
+            } else if (value == "sync") {
+                set_wal_mode(options, WriteAheadLog::SyncMode::SYNC_PER_WRITE);
+            } else {
+                throw std::invalid_argument("Unknown WAL mode " + std::string(value));
+            }
+        } else if (name == "wal-group-commit-ms") {
+            get_wal_options(options, name).group_commit_interval = std::chrono::milliseconds(parse_number(name, value));
+        } else if (name == "wal-group-commit-records") {
+            get_wal_options(options, name).group_commit_records = parse_number(name, value);
+        } else if (name == "snapshot-format") {
+            if (value == "binary") {
+                options.storage.snapshot_format = SnapshotFormat::BINARY;
+            } else if (value == "json") {
+                options.storage.snapshot_format = SnapshotFormat::JSON;
+            } else {
+                throw std::invalid_argument("Unknown snapshot format " + std::string(value));
+            }
+        } else if (name == "config") {
+            if (value.empty()) {
+                throw std::invalid_argument("Option --config expects a path");
+            }
+            options.storage_path = value;
+        } else if (name == "dumps") {
+            if (value == "incremental") {
+                options.storage.incremental_dumps = true;
+            } else if (value == "full") {
+                options.storage.incremental_dumps = false;
+            } else {
+                throw std::invalid_argument("Unknown dump mode " + std::string(value));
+            }
+        } else if (name == "delta-merge-percent") {
+            options.storage.delta_merge_percent = parse_number(name, value);
+        } else if (name == "max-deltas") {
+            options.storage.max_deltas = parse_number(name, value);
+            if (options.storage.max_deltas == 0) {
+                throw std::invalid_argument("Option --max-deltas must be positive");
+            }
+        } else if (name == "watch-queue-keys") {
+            options.storage.watch_queue_keys = parse_number(name, value);
+            if (options.storage.watch_queue_keys == 0) {
+                throw std::invalid_argument("Option --watch-queue-keys must be positive");
+            }
+        } else if (name == "load-threads") {
+            options.storage.load_threads = parse_number(name, value);
+        } else if (name == "shards") {
+            options.storage.shards_count = parse_number(name, value);
+        } else if (name == "backend") {
+            if (value == "asio") {
+                options.backend = NetworkBackend::ASIO;
+            } else if (value == "io-uring") {
+#ifdef DICTIONARY_WITH_IO_URING
+                options.backend = NetworkBackend::IO_URING;
+#else
+                throw std::invalid_argument("The server is built without io_uring support");
+#endif
+            } else {
+                throw std::invalid_argument("Unknown backend " + std::string(value));
+            }
+        } else if (name == "threads") {
+            options.threads = parse_number(name, value);
+        } else if (name == "io-mode") {
+            if (value == "shared") {
+                options.io_mode = IoMode::SHARED;
+            } else if (value == "per-thread") {
+                options.io_mode = IoMode::PER_THREAD;
+            } else {
+                throw std::invalid_argument("Unknown io mode " + std::string(value));
+            }
+        } else if (name == "accept") {
+            if (value == "reuseport") {
+                options.accept_mode = AcceptMode::REUSEPORT;
+            } else if (value == "round-robin") {
+                options.accept_mode = AcceptMode::ROUND_ROBIN;
+            } else {
+                throw std::invalid_argument("Unknown accept mode " + std::string(value));
+            }
+        } else if (name == "pin-threads") {
+            if (!value.empty()) {
+                throw std::invalid_argument("Option --pin-threads takes no value");
+            }
+            options.pin_threads = true;
+        } else if (name == "admin-port") {
+            options.admin_port = parse_port(name, value);
+        } else if (name == "replication-port") {
+            options.replication_port = parse_port(name, value);
+        } else if (name == "replication-log-mb") {
+            options.replication_log_mb = parse_number(name, value);
+        } else if (name == "replica-of") {
+            auto colon = value.rfind(':');
+            if (colon == std::string_view::npos || colon == 0) {
+                throw std::invalid_argument("Option --replica-of expects host:port");
+            }
+            options.leader_host = value.substr(0, colon);
+            options.leader_port = parse_port(name, value.substr(colon + 1));
+        } else if (name == "log-level") {
+            if (value == "debug") {
+                options.log_level = logging::Level::DEBUG;
+            } else if (value == "info") {
+                options.log_level = logging::Level::INFO;
+            } else if (value == "warning") {
+                options.log_level = logging::Level::WARNING;
+            } else if (value == "error") {
+                options.log_level = logging::Level::ERROR;
+            } else {
+                throw std::invalid_argument("Unknown log level " + std::string(value));
+            }
+        } else {
+            throw std::invalid_argument("Unknown option --" + std::string(name));
+        }
+    }
+
+    if (options.replication_port != 0) {
+        if (options.replication_log_mb == 0) {
+            throw std::invalid_argument("Option --replication-log-mb must be positive");
+        }
+        options.storage.replication_log_bytes = options.replication_log_mb * 1024 * 1024;
+    }
+    options.storage.read_only = options.leader_port != 0;
+
+    return options;
+}
+
+void print_server_usage(const char* program) {
+    std::cerr << "Usage: " << program << " <port> [options]" << std::endl;
+    std::cerr << "--backend=asio|io-uring - network backend, io-uring needs a build with DICTIONARY_WITH_IO_URING (asio)" << std::endl;
+    std::cerr << "--threads=N - io threads (hardware concurrency)" << std::endl;
+    std::cerr << "--io-mode=shared|per-thread - one io_context for all threads or one per thread (shared)" << std::endl;
+    std::cerr << "--accept=reuseport|round-robin - how connections are spread in the per-thread mode (reuseport)" << std::endl;
+    std::cerr << "--pin-threads - pin io threads to CPUs" << std::endl;
+    std::cerr << "--log-level=debug|info|warning|error - least severe messages logged, debug needs a build with DICTIONARY_WITH_DEBUG_LOGS (info)" << std::endl;
+    std::cerr << "--admin-port=N - collect metrics and serve them at http://host:N/metrics (off)" << std::endl;
+    std::cerr << "--replication-port=N - stream sets to followers connecting to this port (off)" << std::endl;
+    std::cerr << "--replication-log-mb=N - newest sets kept for followers to catch up from, older followers get a snapshot (64)" << std::endl;
+    std::cerr << "--replica-of=HOST:PORT - follow the leader with this replication port and only serve reads (off)" << std::endl;
+    std::cerr << "--watch-queue-keys=N - changed keys a watching connection may have queued before they are dropped for an overflow (4096)" << std::endl;
+    std::cerr << "--shards=N - number of storage shards, power of two (64)" << std::endl;
+    std::cerr << "--config=PATH - dictionary file, loaded on start and dumped to; its WAL segments are next to it (config.txt)" << std::endl;
+    std::cerr << "--snapshot-format=binary|json - format of config.txt dumps, both are accepted on load (binary)" << std::endl;
+    std::cerr << "--dumps=incremental|full - dump only the keys set since the previous dump, or the whole dictionary every time (incremental)" << std::endl;
+    std::cerr << "--delta-merge-percent=N - rewrite config.txt once the deltas add up to N% of it (50)" << std::endl;
+    std::cerr << "--max-deltas=N - rewrite config.txt once there are N deltas (32)" << std::endl;
+    std::cerr << "--load-threads=N - threads loading a binary config.txt (hardware concurrency)" << std::endl;
+    std::cerr << "--wal=off|no-sync|group-commit|sync - write-ahead log mode (no-sync)" << std::endl;
+    std::cerr << "--wal-group-commit-ms=N - group commit interval (5)" << std::endl;
+    std::cerr << "--wal-group-commit-records=N - records that trigger group commit early (256)" << std::endl;
+}
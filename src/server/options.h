@@ -0,0 +1,62 @@
+#pragma once
+
+#include "storage.h"
+
+#include "../util/log.h"
+
+#include <cstdint>
+#include <string>
+
+enum class IoMode {
+    // All threads run one io_context, handlers of a connection may run on any of them
+    SHARED,
+    // Every thread runs its own io_context, a connection stays on one thread for its lifetime
+    PER_THREAD,
+};
+
+enum class AcceptMode {
+    // Every thread accepts on its own SO_REUSEPORT socket, the kernel spreads connections
+    REUSEPORT,
+    // One acceptor hands accepted sockets to the threads in turn
+    ROUND_ROBIN,
+};
+
+enum class NetworkBackend {
+    ASIO,
+    // Only available when built with DICTIONARY_WITH_IO_URING
+    IO_URING,
+};
+
+struct ServerOptions {
+    uint16_t port = 0;
+    std::string storage_path = "config.txt";
+    StorageOptions storage;
+
+    NetworkBackend backend = NetworkBackend::ASIO;
+    // Hardware concurrency when 0
+    size_t threads = 0;
+    // io_mode and accept_mode only apply to the ASIO backend, IO_URING always runs
+    // a ring and a SO_REUSEPORT socket per thread
+    IoMode io_mode = IoMode::SHARED;
+    // Only used in the PER_THREAD mode
+    AcceptMode accept_mode = AcceptMode::REUSEPORT;
+    // Pins thread i to CPU i modulo the number of CPUs
+    bool pin_threads = false;
+
+    // Port of the HTTP endpoint with metrics, metrics are neither collected nor served when 0
+    uint16_t admin_port = 0;
+
+    // Port followers connect to, the server keeps no replication log and has no followers when 0
+    uint16_t replication_port = 0;
+    size_t replication_log_mb = 64;
+    // The server follows this leader and rejects writes when leader_port is set
+    std::string leader_host;
+    uint16_t leader_port = 0;
+    // Debug messages are only there when built with DICTIONARY_WITH_DEBUG_LOGS
+    logging::Level log_level = logging::Level::INFO;
+};
+
+// Parses "<port> [--name=value ...]", throws std::invalid_argument on bad input
+ServerOptions parse_server_options(int argc, char** argv);
+
+void print_server_usage(const char* program);
@@ -0,0 +1,470 @@
+#include "replication.h"
+
+#include "../client/backoff.h"
+#include "../util/crc32.h"
+#include "../util/log.h"
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include <array>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+
+
+namespace replication {
+
+namespace {
+
+constexpr std::string_view MAGIC = "DICTREPL";
+constexpr size_t HELLO_SIZE = 8 + sizeof(uint32_t) + 2 * sizeof(uint64_t);
+constexpr size_t FRAME_HEADER_SIZE = 4 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+// Payloads are cut at this size, a single larger record makes a larger one
+constexpr size_t MAX_PAYLOAD = 256 * 1024;
+constexpr uint32_t MAX_RECORD_PAYLOAD = 64 * 1024 * 1024 + 8;
+
+template <class T>
+void append_pod(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <class T>
+T read_pod(const char* data) {
+    T value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+struct FrameHeader {
+    FrameType type;
+    uint32_t count;
+    uint32_t payload_size;
+    uint32_t crc;
+    uint64_t seq;
+    uint64_t leader_seq;
+};
+
+FrameHeader read_frame_header(const char* data) {
+    return {
+        static_cast<FrameType>(read_pod<uint32_t>(data)),
+        read_pod<uint32_t>(data + 4),
+        read_pod<uint32_t>(data + 8),
+        read_pod<uint32_t>(data + 12),
+        read_pod<uint64_t>(data + 16),
+        read_pod<uint64_t>(data + 24),
+    };
+}
+
+// Throws boost::system::system_error if the follower is gone
+void write_frame(boost::asio::ip::tcp::socket& socket, FrameType type, uint32_t count, uint64_t seq, uint64_t leader_seq,
+        std::string_view payload = {}) {
+    std::string header;
+    append_pod<uint32_t>(header, static_cast<uint32_t>(type));
+    append_pod<uint32_t>(header, count);
+    append_pod<uint32_t>(header, payload.size());
+    append_pod<uint32_t>(header, crc32(payload));
+    append_pod<uint64_t>(header, seq);
+    append_pod<uint64_t>(header, leader_seq);
+    std::array<boost::asio::const_buffer, 2> buffers = {
+        boost::asio::buffer(header),
+        boost::asio::buffer(payload.data(), payload.size()),
+    };
+    boost::asio::write(socket, buffers);
+}
+
+std::string log_id_payload(uint64_t id) {
+    std::string payload;
+    append_pod<uint64_t>(payload, id);
+    return payload;
+}
+
+// Sends the image of the dictionary as SNAPSHOT frames. add() runs under shard locks and only buffers,
+// write_shard() sends. If the follower is gone, the rest of the image is dropped.
+class SnapshotSender : public SnapshotWriter {
+public:
+    SnapshotSender(boost::asio::ip::tcp::socket& socket, const ReplicationLog& log)
+        : socket_(socket)
+        , log_(log) {
+    }
+
+    void add(uint32_t, uint64_t, std::string_view key, std::string_view value) override {
+        if (failed_) {
+            return;
+        }
+        if (payloads_.empty() || payloads_.back().size() >= MAX_PAYLOAD) {
+            payloads_.emplace_back();
+            counts_.push_back(0);
+        }
+        auto& payload = payloads_.back();
+        append_pod<uint32_t>(payload, key.size());
+        append_pod<uint32_t>(payload, value.size());
+        payload.append(key);
+        payload.append(value);
+        ++counts_.back();
+    }
+
+    void write_shard() override {
+        if (!failed_) {
+            try {
+                for (size_t i = 0; i < payloads_.size(); ++i) {
+                    write_frame(socket_, FrameType::SNAPSHOT, counts_[i], 0, log_.last_seq(), payloads_[i]);
+                }
+            } catch (const boost::system::system_error& e) {
+                LOG_WARNING("Failed to send snapshot to follower: " << e.what());
+                failed_ = true;
+            }
+        }
+        payloads_.clear();
+        counts_.clear();
+    }
+
+    void finish() override {
+        write_shard();
+    }
+
+    bool failed() const {
+        return failed_;
+    }
+
+private:
+    boost::asio::ip::tcp::socket& socket_;
+    const ReplicationLog& log_;
+    std::vector<std::string> payloads_;
+    std::vector<uint32_t> counts_;
+    bool failed_ = false;
+};
+
+}
+
+}
+
+using namespace replication;
+
+ReplicationServer::ReplicationServer(boost::asio::io_context& io_context, uint16_t port, std::shared_ptr<Storage> storage)
+    : acceptor_(io_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port))
+    , storage_(std::move(storage)) {
+    if (!storage_->get_replication_log()) {
+        throw std::invalid_argument("Replication needs the replication log of the storage");
+    }
+}
+
+ReplicationServer::~ReplicationServer() {
+    stopped_ = true;
+    std::lock_guard lock(mutex_);
+    for (auto& follower : followers_) {
+        // Interrupts blocking reads and writes of the follower thread
+        ::shutdown(follower.socket.native_handle(), SHUT_RDWR);
+    }
+    for (auto& follower : followers_) {
+        follower.thread.join();
+    }
+}
+
+void ReplicationServer::run() {
+    accept();
+}
+
+size_t ReplicationServer::get_followers_count() const {
+    std::lock_guard lock(mutex_);
+    size_t count = 0;
+    for (const auto& follower : followers_) {
+        count += !follower.done;
+    }
+    return count;
+}
+
+void ReplicationServer::accept() {
+    acceptor_.async_accept([this](const boost::system::error_code& error, boost::asio::ip::tcp::socket socket) {
+        if (error) {
+            LOG_ERROR("Error accepting follower: " << error.message());
+            return;
+        }
+        std::lock_guard lock(mutex_);
+        for (auto it = followers_.begin(); it != followers_.end();) {
+            if (it->done) {
+                it->thread.join();
+                it = followers_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        auto& follower = followers_.emplace_back(std::move(socket));
+        follower.thread = std::thread([this, &follower] {
+            serve(follower);
+            // The socket is closed when the follower is reaped, the follower must notice now
+            ::shutdown(follower.socket.native_handle(), SHUT_RDWR);
+            follower.done = true;
+        });
+        accept();
+    });
+}
+
+void ReplicationServer::serve(Follower& follower) {
+    auto& socket = follower.socket;
+    const auto& log = *storage_->get_replication_log();
+    std::string endpoint;
+    try {
+        endpoint = socket.remote_endpoint().address().to_string() + ":" + std::to_string(socket.remote_endpoint().port());
+        socket.set_option(boost::asio::ip::tcp::no_delay(true));
+
+        std::array<char, HELLO_SIZE> hello;
+        boost::asio::read(socket, boost::asio::buffer(hello));
+        if (std::string_view(hello.data(), MAGIC.size()) != MAGIC || read_pod<uint32_t>(hello.data() + 8) != VERSION) {
+            LOG_WARNING("Follower " << endpoint << " sent a malformed hello");
+            return;
+        }
+        uint64_t log_id = read_pod<uint64_t>(hello.data() + 12);
+        uint64_t next_seq = read_pod<uint64_t>(hello.data() + 20);
+
+        std::string payload;
+        std::optional<size_t> count = log_id == log.id() ? log.read(next_seq, MAX_PAYLOAD, payload) : std::nullopt;
+        if (count) {
+            LOG_INFO("Follower " << endpoint << " resumes from " << next_seq);
+            write_frame(socket, FrameType::RESUME, 0, next_seq, log.last_seq(), log_id_payload(log.id()));
+        } else {
+            LOG_INFO("Sending snapshot to follower " << endpoint);
+            write_frame(socket, FrameType::SNAPSHOT_BEGIN, 0, 0, log.last_seq(), log_id_payload(log.id()));
+            SnapshotSender sender(socket, log);
+            uint64_t seq = storage_->write_snapshot(sender);
+            if (sender.failed()) {
+                return;
+            }
+            write_frame(socket, FrameType::SNAPSHOT_END, 0, seq, log.last_seq());
+            LOG_INFO("Snapshot up to " << seq << " sent to follower " << endpoint);
+            next_seq = seq + 1;
+            payload.clear();
+            count = 0;
+        }
+
+        while (!stopped_) {
+            if (!count) {
+                LOG_WARNING("Follower " << endpoint << " fell behind the replication log, it will start over from a snapshot");
+                return;
+            }
+            if (*count > 0) {
+                write_frame(socket, FrameType::RECORDS, *count, next_seq, log.last_seq(), payload);
+                next_seq += *count;
+            } else if (!log.wait(next_seq, HEARTBEAT_INTERVAL)) {
+                write_frame(socket, FrameType::HEARTBEAT, 0, 0, log.last_seq());
+            }
+            payload.clear();
+            count = log.read(next_seq, MAX_PAYLOAD, payload);
+        }
+    } catch (const boost::system::system_error& e) {
+        if (!stopped_) {
+            LOG_WARNING("Follower " << endpoint << " disconnected: " << e.what());
+        }
+    }
+}
+
+Replica::Replica(std::shared_ptr<Storage> storage, const std::string& leader_host, uint16_t leader_port)
+    : storage_(std::move(storage))
+    , leader_host_(leader_host)
+    , leader_port_(leader_port)
+    , caught_up_at_(std::chrono::steady_clock::now().time_since_epoch().count()) {
+}
+
+Replica::~Replica() {
+    {
+        std::lock_guard lock(mutex_);
+        stopped_ = true;
+        if (fd_ >= 0) {
+            ::shutdown(fd_, SHUT_RDWR);
+        }
+    }
+    stop_cv_.notify_one();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void Replica::start() {
+    thread_ = std::thread([this] {
+        run();
+    });
+}
+
+Replica::Status Replica::get_status() const {
+    Status status;
+    status.connected = connected_;
+    status.applied_seq = applied_seq_;
+    status.leader_seq = leader_seq_;
+    if (!status.connected || status.applied_seq < status.leader_seq) {
+        auto caught_up_at = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(caught_up_at_.load()));
+        status.lag = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - caught_up_at);
+    }
+    return status;
+}
+
+void Replica::run() {
+    boost::asio::io_context io_context;
+    Backoff backoff(std::chrono::milliseconds(100), std::chrono::seconds(5));
+    while (true) {
+        boost::asio::ip::tcp::socket socket(io_context);
+        try {
+            boost::asio::ip::tcp::resolver resolver(io_context);
+            boost::asio::connect(socket, resolver.resolve(leader_host_, std::to_string(leader_port_)));
+            socket.set_option(boost::asio::ip::tcp::no_delay(true));
+        } catch (const boost::system::system_error& e) {
+            LOG_WARNING("Failed to connect to leader " << leader_host_ << ":" << leader_port_ << ": " << e.what());
+            boost::system::error_code ignored;
+            socket.close(ignored);
+        }
+
+        if (socket.is_open()) {
+            {
+                std::lock_guard lock(mutex_);
+                if (stopped_) {
+                    return;
+                }
+                fd_ = socket.native_handle();
+            }
+            LOG_INFO("Connected to leader " << leader_host_ << ":" << leader_port_);
+            backoff.reset();
+            stream(socket);
+            connected_ = false;
+            std::lock_guard lock(mutex_);
+            fd_ = -1;
+        }
+
+        std::unique_lock lock(mutex_);
+        if (stop_cv_.wait_for(lock, backoff.next(), [this] { return stopped_; })) {
+            return;
+        }
+    }
+}
+
+void Replica::stream(boost::asio::ip::tcp::socket& socket) {
+    std::string hello(MAGIC);
+    append_pod<uint32_t>(hello, VERSION);
+    append_pod<uint64_t>(hello, log_id_);
+    append_pod<uint64_t>(hello, next_seq_);
+    try {
+        boost::asio::write(socket, boost::asio::buffer(hello));
+    } catch (const boost::system::system_error& e) {
+        LOG_WARNING("Failed to send hello to leader: " << e.what());
+        return;
+    }
+
+    std::array<char, FRAME_HEADER_SIZE> header_data;
+    std::string payload;
+    // Sets of an image are applied before its seq is known
+    bool in_snapshot = false;
+    while (read_exact(socket, header_data.data(), header_data.size())) {
+        auto header = read_frame_header(header_data.data());
+        if (header.payload_size > MAX_RECORD_PAYLOAD + MAX_PAYLOAD) {
+            LOG_WARNING("Leader sent a frame of " << header.payload_size << " bytes");
+            return;
+        }
+        payload.resize(header.payload_size);
+        if (!read_exact(socket, payload.data(), payload.size())) {
+            break;
+        }
+        if (crc32(payload) != header.crc) {
+            LOG_WARNING("Corrupted frame from leader");
+            return;
+        }
+
+        bool ok = true;
+        switch (header.type) {
+            case FrameType::SNAPSHOT_BEGIN:
+                ok = payload.size() == sizeof(uint64_t);
+                if (ok) {
+                    log_id_ = read_pod<uint64_t>(payload.data());
+                    in_snapshot = true;
+                    LOG_INFO("Receiving snapshot from leader");
+                }
+                break;
+            case FrameType::SNAPSHOT:
+                ok = in_snapshot && apply(payload, header.count);
+                break;
+            case FrameType::SNAPSHOT_END:
+                ok = in_snapshot;
+                in_snapshot = false;
+                next_seq_ = header.seq + 1;
+                applied_seq_ = header.seq;
+                LOG_INFO("Snapshot up to " << header.seq << " applied");
+                break;
+            case FrameType::RESUME:
+                ok = payload.size() == sizeof(uint64_t) && read_pod<uint64_t>(payload.data()) == log_id_ && header.seq == next_seq_;
+                break;
+            case FrameType::RECORDS:
+                ok = !in_snapshot && header.seq == next_seq_ && apply(payload, header.count);
+                if (ok) {
+                    next_seq_ += header.count;
+                    applied_seq_ = next_seq_ - 1;
+                }
+                break;
+            case FrameType::HEARTBEAT:
+                break;
+            default:
+                ok = false;
+        }
+        if (!ok) {
+            LOG_WARNING("Unexpected frame of type " << static_cast<uint32_t>(header.type) << " from leader");
+            return;
+        }
+
+        connected_ = true;
+        leader_seq_ = header.leader_seq;
+        if (!in_snapshot && applied_seq_ >= header.leader_seq) {
+            caught_up_at_ = std::chrono::steady_clock::now().time_since_epoch().count();
+        }
+    }
+}
+
+bool Replica::read_exact(boost::asio::ip::tcp::socket& socket, char* data, size_t size) {
+    auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(LEADER_TIMEOUT).count();
+    while (size > 0) {
+        pollfd fd{socket.native_handle(), POLLIN, 0};
+        int ready = ::poll(&fd, 1, timeout);
+        if (ready == 0) {
+            LOG_WARNING("Leader is silent for " << timeout << " ms");
+            return false;
+        }
+        if (ready < 0 && errno != EINTR) {
+            return false;
+        }
+        boost::system::error_code error;
+        size_t length = socket.read_some(boost::asio::buffer(data, size), error);
+        if (error) {
+            std::lock_guard lock(mutex_);
+            if (!stopped_) {
+                LOG_WARNING("Connection to leader failed: " << error.message());
+            }
+            return false;
+        }
+        data += length;
+        size -= length;
+    }
+    return true;
+}
+
+bool Replica::apply(std::string_view payload, uint32_t count) {
+    keys_.clear();
+    values_.clear();
+    size_t pos = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (payload.size() - pos < 2 * sizeof(uint32_t)) {
+            return false;
+        }
+        uint64_t key_size = read_pod<uint32_t>(payload.data() + pos);
+        uint64_t value_size = read_pod<uint32_t>(payload.data() + pos + sizeof(uint32_t));
+        pos += 2 * sizeof(uint32_t);
+        if (payload.size() - pos < key_size + value_size) {
+            return false;
+        }
+        keys_.push_back(payload.substr(pos, key_size));
+        values_.push_back(payload.substr(pos + key_size, value_size));
+        pos += key_size + value_size;
+    }
+    if (pos != payload.size()) {
+        return false;
+    }
+    // The last value of a repeated key wins, as it does on the leader
+    storage_->set_many(keys_, values_);
+    return true;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "storage.h"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Leader -> follower replication. The leader logs every applied set in its ReplicationLog and streams
+// the log to followers over a port of its own. A follower applies the sets in the order of the log
+// and serves gets from its own storage, clients can't write to it.
+//
+// A follower says which log it knows and which record it needs next. If the leader still has that
+// record of that log, the stream resumes from it. Otherwise the follower gets a point-in-time image
+// of the dictionary, taken the way dumps are, and then the records after the image. Keys are never
+// removed, so the image can be applied on top of whatever the follower had.
+//
+// Stream layout, integers are little-endian:
+//
+// hello (follower): "DICTREPL", version (uint32_t), log id, next seq (uint64_t)
+// frame (leader):   type, records count, payload size, crc32 of payload (uint32_t), seq, leader seq (uint64_t), payload
+//
+// Leader seq is the last seq of the log when the frame was sent, followers measure their lag by it.
+// Payloads of SNAPSHOT and RECORDS are records in the ReplicationLog layout, SNAPSHOT_BEGIN and RESUME
+// carry the log id. Seq is the seq of the first record of RECORDS, of the last set in the image
+// for SNAPSHOT_END and of the next record for RESUME. HEARTBEAT is sent when there is nothing to send.
+namespace replication {
+
+enum class FrameType : uint32_t {
+    SNAPSHOT_BEGIN = 1,
+    SNAPSHOT = 2,
+    SNAPSHOT_END = 3,
+    RESUME = 4,
+    RECORDS = 5,
+    HEARTBEAT = 6,
+};
+
+constexpr uint32_t VERSION = 1;
+constexpr auto HEARTBEAT_INTERVAL = std::chrono::milliseconds(100);
+// A follower that hears nothing from the leader for this long reconnects
+constexpr auto LEADER_TIMEOUT = std::chrono::seconds(5);
+
+}
+
+// Streams the replication log of the storage to followers, one thread per follower
+class ReplicationServer {
+public:
+    ReplicationServer(boost::asio::io_context& io_context, uint16_t port, std::shared_ptr<Storage> storage);
+    // Disconnects the followers
+    ~ReplicationServer();
+
+    ReplicationServer(const ReplicationServer&) = delete;
+    ReplicationServer& operator=(const ReplicationServer&) = delete;
+
+    // Starts accepting followers, the io_context must be run to accept them
+    void run();
+
+    size_t get_followers_count() const;
+
+private:
+    struct Follower {
+        boost::asio::ip::tcp::socket socket;
+        std::thread thread;
+        std::atomic_bool done = false;
+    };
+
+    void accept();
+    void serve(Follower& follower);
+
+    boost::asio::ip::tcp::acceptor acceptor_;
+    std::shared_ptr<Storage> storage_;
+
+    mutable std::mutex mutex_;
+    std::list<Follower> followers_;
+    std::atomic_bool stopped_ = false;
+};
+
+// Follower side: keeps a connection to the leader and applies its stream to the storage.
+// Reconnects with growing delays when the connection breaks or the leader goes silent.
+class Replica {
+public:
+    struct Status {
+        bool connected = false;
+        // Last set of the leader's log applied here
+        uint64_t applied_seq = 0;
+        // Last set of the leader's log the replica knows of
+        uint64_t leader_seq = 0;
+        // Time since the replica last had every set it knew of, 0 while it has them
+        std::chrono::milliseconds lag{0};
+    };
+
+public:
+    Replica(std::shared_ptr<Storage> storage, const std::string& leader_host, uint16_t leader_port);
+    ~Replica();
+
+    Replica(const Replica&) = delete;
+    Replica& operator=(const Replica&) = delete;
+
+    void start();
+
+    Status get_status() const;
+
+private:
+    void run();
+    // Returns when the connection breaks or the replica is stopped
+    void stream(boost::asio::ip::tcp::socket& socket);
+    // False if the connection broke, the replica is stopped or the leader is silent for LEADER_TIMEOUT
+    bool read_exact(boost::asio::ip::tcp::socket& socket, char* data, size_t size);
+    bool apply(std::string_view payload, uint32_t count);
+
+    std::shared_ptr<Storage> storage_;
+    const std::string leader_host_;
+    const uint16_t leader_port_;
+
+    // Log of the leader the replica follows and the next record of it, only used by the thread
+    uint64_t log_id_ = 0;
+    uint64_t next_seq_ = 1;
+    std::vector<std::string_view> keys_;
+    std::vector<std::string_view> values_;
+
+    std::atomic_bool connected_ = false;
+    std::atomic<uint64_t> applied_seq_ = 0;
+    std::atomic<uint64_t> leader_seq_ = 0;
+    std::atomic<std::chrono::steady_clock::rep> caught_up_at_;
+
+    std::mutex mutex_;
+    std::condition_variable stop_cv_;
+    bool stopped_ = false;
+    // Socket of the current connection, shut down to interrupt the thread
+    int fd_ = -1;
+    std::thread thread_;
+};
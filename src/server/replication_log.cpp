@@ -0,0 +1,104 @@
+#include "replication_log.h"
+
+#include <algorithm>
+#include <random>
+
+
+namespace {
+
+constexpr size_t CHUNK_SIZE = 1024 * 1024;
+constexpr size_t RECORD_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+uint64_t random_id() {
+    std::random_device random;
+    uint64_t id = 0;
+    while (id == 0) {
+        id = (uint64_t(random()) << 32) | random();
+    }
+    return id;
+}
+
+}
+
+ReplicationLog::ReplicationLog(size_t capacity)
+    : capacity_(std::max(capacity, CHUNK_SIZE))
+    , id_(random_id()) {
+}
+
+uint64_t ReplicationLog::append(std::string_view key, std::string_view value) {
+    uint32_t sizes[2] = {static_cast<uint32_t>(key.size()), static_cast<uint32_t>(value.size())};
+    uint64_t seq;
+    {
+        std::lock_guard lock(mutex_);
+        if (chunks_.empty() || chunks_.back().data.size() >= CHUNK_SIZE) {
+            while (!chunks_.empty() && size_ + CHUNK_SIZE > capacity_) {
+                size_ -= chunks_.front().data.size();
+                chunks_.pop_front();
+            }
+            auto& chunk = chunks_.emplace_back();
+            chunk.first_seq = last_seq_ + 1;
+            chunk.data.reserve(CHUNK_SIZE + RECORD_HEADER_SIZE + key.size() + value.size());
+        }
+        auto& chunk = chunks_.back();
+        chunk.offsets.push_back(chunk.data.size());
+        chunk.data.append(reinterpret_cast<const char*>(sizes), RECORD_HEADER_SIZE);
+        chunk.data.append(key);
+        chunk.data.append(value);
+        size_ += RECORD_HEADER_SIZE + key.size() + value.size();
+        seq = ++last_seq_;
+    }
+    appended_cv_.notify_all();
+    return seq;
+}
+
+uint64_t ReplicationLog::last_seq() const {
+    std::lock_guard lock(mutex_);
+    return last_seq_;
+}
+
+std::optional<size_t> ReplicationLog::read(uint64_t seq, size_t max_bytes, std::string& out) const {
+    std::lock_guard lock(mutex_);
+    if (seq > last_seq_) {
+        return seq == last_seq_ + 1 ? std::optional<size_t>(0) : std::nullopt;
+    }
+    if (chunks_.empty() || seq < chunks_.front().first_seq) {
+        return std::nullopt;
+    }
+
+    // The last chunk that starts at or before seq
+    auto it = std::upper_bound(chunks_.begin(), chunks_.end(), seq, [](uint64_t seq, const Chunk& chunk) {
+        return seq < chunk.first_seq;
+    }) - 1;
+    size_t count = 0;
+    size_t bytes = 0;
+    size_t index = seq - it->first_seq;
+    while (it != chunks_.end()) {
+        size_t begin = it->offsets[index];
+        size_t end = begin;
+        size_t records = 0;
+        for (size_t i = index; i < it->offsets.size(); ++i) {
+            size_t next = i + 1 < it->offsets.size() ? it->offsets[i + 1] : it->data.size();
+            if (count + records > 0 && bytes + next - begin > max_bytes) {
+                break;
+            }
+            end = next;
+            ++records;
+        }
+        out.append(it->data, begin, end - begin);
+        bytes += end - begin;
+        count += records;
+        if (index + records < it->offsets.size()) {
+            break;
+        }
+        ++it;
+        index = 0;
+    }
+    return count;
+}
+
+bool ReplicationLog::wait(uint64_t seq, std::chrono::milliseconds timeout) const {
+    std::unique_lock lock(mutex_);
+    return appended_cv_.wait_for(lock, timeout, [&] {
+        return last_seq_ >= seq;
+    });
+}
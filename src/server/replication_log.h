@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// In-memory log of the sets a leader applied, for followers to catch up from. Records get sequence numbers
+// 1, 2, ... in the order of append, and the newest capacity bytes of them are kept in chunks; older chunks
+// are dropped, and a follower that needs them has to start over from a snapshot.
+//
+// Every log gets a random id when it is created, so a follower that reconnects to a restarted leader
+// notices that its sequence numbers mean nothing there.
+//
+// Record layout, the same as in batches of the replication stream: key size, value size (uint32_t), key, value.
+class ReplicationLog {
+public:
+    explicit ReplicationLog(size_t capacity);
+
+    ReplicationLog(const ReplicationLog&) = delete;
+    ReplicationLog& operator=(const ReplicationLog&) = delete;
+
+    // Returns the sequence number of the record. Meant to be called under the shard lock of the key,
+    // so that the records of a key are in the order of its updates.
+    uint64_t append(std::string_view key, std::string_view value);
+
+    uint64_t id() const {
+        return id_;
+    }
+
+    uint64_t last_seq() const;
+
+    // Appends records from seq on to out, as many as fit into max_bytes but at least one, and returns
+    // their number: 0 if there are no records from seq yet, nullopt if they are not kept anymore
+    std::optional<size_t> read(uint64_t seq, size_t max_bytes, std::string& out) const;
+
+    // Waits until the record seq is appended, false on timeout
+    bool wait(uint64_t seq, std::chrono::milliseconds timeout) const;
+
+private:
+    struct Chunk {
+        uint64_t first_seq;
+        std::string data;
+        // Offsets of the records in data
+        std::vector<uint32_t> offsets;
+    };
+
+    const size_t capacity_;
+    const uint64_t id_;
+
+    mutable std::mutex mutex_;
+    mutable std::condition_variable appended_cv_;
+    std::deque<Chunk> chunks_;
+    size_t size_ = 0;
+    uint64_t last_seq_ = 0;
+};
@@ -0,0 +1,738 @@
+#include "request_processor.h"
+
+#include "hot_keys.h"
+
+#include "../util/log.h"
+
+#include <cstring>
+#include <limits>
+
+#include <arpa/inet.h>
+
+#include <rapidjson/writer.h>
+
+
+namespace {
+
+constexpr uint32_t MAX_MESSAGE_SIZE = 64 * 1024 * 1024;
+
+// Lets rapidjson::Writer append straight to the connection output
+struct StringOutputStream {
+    using Ch = char;
+
+    void Put(char c) {
+        output.push_back(c);
+    }
+    void Flush() {
+    }
+
+    std::string& output;
+};
+
+using ResponseWriter = rapidjson::Writer<StringOutputStream, rapidjson::UTF8<>, rapidjson::UTF8<>, rapidjson::MemoryPoolAllocator<>>;
+
+// Reserves the length prefix of a JSON response, returns its position for end_frame
+size_t begin_frame(std::string& output) {
+    size_t pos = output.size();
+    output.append(sizeof(uint32_t), '\0');
+    return pos;
+}
+
+void end_frame(std::string& output, size_t pos) {
+    uint32_t len = htonl(output.size() - pos - sizeof(len));
+    std::memcpy(output.data() + pos, &len, sizeof(len));
+}
+
+void write_stat(ResponseWriter& writer, const Storage::Stat& stat) {
+    writer.Key("stat");
+    writer.StartObject();
+    writer.Key("get_count");
+    writer.Uint64(stat.get_count);
+    writer.Key("set_count");
+    writer.Uint64(stat.set_count);
+    writer.EndObject();
+}
+
+bool has_string_member(const rapidjson::Value& d, const char* name) {
+    auto it = d.FindMember(name);
+    return it != d.MemberEnd() && it->value.IsString();
+}
+
+std::string_view get_string(const rapidjson::Value& v) {
+    return std::string_view(v.GetString(), v.GetStringLength());
+}
+
+// False if the member is there but is not an unsigned integer
+bool get_uint_member(const rapidjson::Value& d, const char* name, uint64_t& value) {
+    auto it = d.FindMember(name);
+    if (it == d.MemberEnd()) {
+        return true;
+    }
+    if (!it->value.IsUint64()) {
+        return false;
+    }
+    value = it->value.GetUint64();
+    return true;
+}
+
+// False if the member is there but is not a signed integer
+bool get_int_member(const rapidjson::Value& d, const char* name, int64_t& value) {
+    auto it = d.FindMember(name);
+    if (it == d.MemberEnd()) {
+        return true;
+    }
+    if (!it->value.IsInt64()) {
+        return false;
+    }
+    value = it->value.GetInt64();
+    return true;
+}
+
+bool is_write(std::string_view command) {
+    return command == "set" || command == "mset" || command == "cas" || command == "incr" || command == "decr"
+        || command == "append" || command == "setnx";
+}
+
+// Delta of an incr or decr as the storage adds it, nullopt if it can't be negated
+std::optional<int64_t> signed_delta(int64_t delta, bool decrement) {
+    if (!decrement) {
+        return delta;
+    }
+    if (delta == std::numeric_limits<int64_t>::min()) {
+        return std::nullopt;
+    }
+    return -delta;
+}
+
+}
+
+RequestProcessor::RequestProcessor(std::weak_ptr<Storage> storage)
+    : storage_(storage)
+    , value_allocator_(value_arena_, sizeof(value_arena_))
+    , stack_allocator_(stack_arena_, sizeof(stack_arena_)) {
+}
+
+std::optional<size_t> RequestProcessor::process(std::string_view input, std::string& output) {
+    size_t consumed = 0;
+    if (protocol_ == Protocol::UNKNOWN) {
+        if (input.size() < binary_protocol::MAGIC.size()) {
+            return 0;
+        }
+        if (input.starts_with(binary_protocol::MAGIC)) {
+            protocol_ = Protocol::BINARY;
+            consumed = binary_protocol::MAGIC.size();
+        } else {
+            protocol_ = Protocol::JSON;
+        }
+    }
+
+    auto storage = storage_.lock();
+    if (!storage) {
+        LOG_ERROR("Storage is gone");
+        return std::nullopt;
+    }
+
+    auto result = protocol_ == Protocol::BINARY
+        ? process_binary(*storage, input.substr(consumed), output)
+        : process_json(*storage, input.substr(consumed), output);
+    flush_counts();
+    if (!result) {
+        return std::nullopt;
+    }
+    return consumed + *result;
+}
+
+std::optional<size_t> RequestProcessor::process_json(Storage& storage, std::string_view input, std::string& output) {
+    size_t total_consumed = 0;
+    while (true) {
+        value_allocator_.Clear();
+        stack_allocator_.Clear();
+        Document d(&value_allocator_, PARSE_STACK_CAPACITY, &stack_allocator_);
+
+        size_t consumed = 0;
+        auto stopwatch = metrics::Stopwatch::start_sampled();
+        auto result = parse_command(input.substr(total_consumed), consumed, d);
+        total_consumed += consumed;
+
+        if (result == ParseResult::NOT_FULL) {
+            return total_consumed;
+        }
+        if (result == ParseResult::FATAL) {
+            return std::nullopt;
+        }
+        if (result == ParseResult::ERROR) {
+            count(metrics::Counter::REQUEST_ERRORS);
+            write_response("ERROR", output);
+            continue;
+        }
+        stopwatch.lap(metrics::Histogram::PARSE);
+
+        std::string_view command = get_string(d["command"]);
+        if (command == "get" && has_string_member(d, "key")) {
+            count(metrics::Counter::REQUESTS_GET);
+            handle_get(storage, get_string(d["key"]), output);
+        } else if (is_write(command) && storage.is_read_only()) {
+            // Followers are updated by their leader only
+            count(metrics::Counter::REQUEST_ERRORS);
+            write_response("ERROR", output);
+        } else if (command == "set" && has_string_member(d, "key") && has_string_member(d, "value")) {
+            count(metrics::Counter::REQUESTS_SET);
+            handle_set(storage, get_string(d["key"]), get_string(d["value"]), output);
+        } else if (command == "mget" && parse_json_batch(d, false)) {
+            count(metrics::Counter::REQUESTS_MGET);
+            handle_mget(storage, output);
+        } else if (command == "mset" && parse_json_batch(d, true)) {
+            count(metrics::Counter::REQUESTS_MSET);
+            handle_mset(storage, output);
+        } else if (command == "top") {
+            count(metrics::Counter::REQUESTS_TOP);
+            handle_top(d, output);
+        } else if ((command == "watch" || command == "unwatch") && (has_string_member(d, "key") || has_string_member(d, "prefix"))) {
+            bool is_prefix = !has_string_member(d, "key");
+            handle_watch(storage, command == "watch", get_string(d[is_prefix ? "prefix" : "key"]), is_prefix, output);
+        } else if (is_write(command) && has_string_member(d, "key")) {
+            handle_update(storage, command, d, output);
+        } else {
+            count(metrics::Counter::REQUEST_ERRORS);
+            write_response("ERROR", output);
+        }
+        stopwatch.record(metrics::Histogram::EXECUTE);
+    }
+}
+
+std::optional<size_t> RequestProcessor::process_binary(Storage& storage, std::string_view input, std::string& output) {
+    size_t consumed = 0;
+    while (input.size() - consumed >= binary_protocol::REQUEST_HEADER_SIZE) {
+        auto stopwatch = metrics::Stopwatch::start_sampled();
+        auto header = binary_protocol::read_request_header(input.data() + consumed);
+        bool is_batch = header.opcode == binary_protocol::Opcode::MGET || header.opcode == binary_protocol::Opcode::MSET;
+        uint64_t body_size = is_batch ? header.value_size : uint64_t(header.key_size) + header.value_size;
+        if (body_size > MAX_MESSAGE_SIZE) {
+            LOG_WARNING("Request of " << body_size << " bytes is too large");
+            return std::nullopt;
+        }
+        size_t request_size = binary_protocol::REQUEST_HEADER_SIZE + body_size;
+        if (input.size() - consumed < request_size) {
+            break;
+        }
+
+        std::string_view body = input.substr(consumed + binary_protocol::REQUEST_HEADER_SIZE, body_size);
+        consumed += request_size;
+        stopwatch.lap(metrics::Histogram::PARSE);
+
+        binary_protocol::ResponseHeader response;
+        switch (header.opcode) {
+            case binary_protocol::Opcode::GET: {
+                count(metrics::Counter::REQUESTS_GET);
+                storage.visit_value(body.substr(0, header.key_size), [&](std::optional<std::string_view> found_value, Storage::Stat stat) {
+                    response.found = found_value.has_value();
+                    response.get_count = stat.get_count;
+                    response.set_count = stat.set_count;
+                    binary_protocol::append_response(output, response, found_value.value_or(std::string_view()));
+                });
+                break;
+            }
+            case binary_protocol::Opcode::SET: {
+                if (storage.is_read_only()) {
+                    count(metrics::Counter::REQUEST_ERRORS);
+                    response.status = binary_protocol::Status::ERROR;
+                    binary_protocol::append_response(output, response);
+                    break;
+                }
+                count(metrics::Counter::REQUESTS_SET);
+                auto stat = storage.set(body.substr(0, header.key_size), body.substr(header.key_size));
+                response.get_count = stat.get_count;
+                response.set_count = stat.set_count;
+                binary_protocol::append_response(output, response);
+                break;
+            }
+            case binary_protocol::Opcode::MGET: {
+                if (!parse_binary_batch(body, header.key_size, false)) {
+                    count(metrics::Counter::REQUEST_ERRORS);
+                    binary_protocol::append_batch_response_header(output, binary_protocol::Status::ERROR, 0);
+                    break;
+                }
+                count(metrics::Counter::REQUESTS_MGET);
+                get_batch(storage);
+                binary_protocol::append_batch_response_header(output, binary_protocol::Status::OK, batch_results_.size());
+                for (const auto& result : batch_results_) {
+                    response.found = result.found;
+                    response.get_count = result.stat.get_count;
+                    response.set_count = result.stat.set_count;
+                    binary_protocol::append_response(output, response, get_batch_value(result));
+                }
+                break;
+            }
+            case binary_protocol::Opcode::MSET: {
+                if (storage.is_read_only() || !parse_binary_batch(body, header.key_size, true)) {
+                    count(metrics::Counter::REQUEST_ERRORS);
+                    binary_protocol::append_batch_response_header(output, binary_protocol::Status::ERROR, 0);
+                    break;
+                }
+                count(metrics::Counter::REQUESTS_MSET);
+                auto stats = storage.set_many(batch_keys_, batch_values_);
+                binary_protocol::append_batch_response_header(output, binary_protocol::Status::OK, stats.size());
+                for (const auto& stat : stats) {
+                    response.get_count = stat.get_count;
+                    response.set_count = stat.set_count;
+                    binary_protocol::append_response(output, response);
+                }
+                break;
+            }
+            case binary_protocol::Opcode::CAS:
+            case binary_protocol::Opcode::INCR:
+            case binary_protocol::Opcode::DECR:
+            case binary_protocol::Opcode::APPEND:
+            case binary_protocol::Opcode::SETNX: {
+                auto result = storage.is_read_only()
+                    ? std::nullopt
+                    : update_binary(storage, header.opcode, body.substr(0, header.key_size), body.substr(header.key_size));
+                if (!result || result->invalid) {
+                    count(metrics::Counter::REQUEST_ERRORS);
+                    response.status = binary_protocol::Status::ERROR;
+                    binary_protocol::append_response(output, response);
+                    break;
+                }
+                response.found = result->value.has_value();
+                response.applied = result->applied;
+                response.get_count = result->stat.get_count;
+                response.set_count = result->stat.set_count;
+                binary_protocol::append_response(output, response, result->value.value_or(std::string()));
+                break;
+            }
+            case binary_protocol::Opcode::WATCH:
+            case binary_protocol::Opcode::WATCH_PREFIX:
+            case binary_protocol::Opcode::UNWATCH:
+            case binary_protocol::Opcode::UNWATCH_PREFIX: {
+                bool watch = header.opcode == binary_protocol::Opcode::WATCH || header.opcode == binary_protocol::Opcode::WATCH_PREFIX;
+                bool is_prefix = header.opcode == binary_protocol::Opcode::WATCH_PREFIX || header.opcode == binary_protocol::Opcode::UNWATCH_PREFIX;
+                handle_watch(storage, watch, body.substr(0, header.key_size), is_prefix, output);
+                break;
+            }
+            default:
+                count(metrics::Counter::REQUEST_ERRORS);
+                response.status = binary_protocol::Status::ERROR;
+                binary_protocol::append_response(output, response);
+        }
+        stopwatch.record(metrics::Histogram::EXECUTE);
+    }
+    return consumed;
+}
+
+RequestProcessor::ParseResult RequestProcessor::parse_command(std::string_view input, size_t& consumed, Document& d) {
+    if (input.size() < 4) {
+        return ParseResult::NOT_FULL;
+    }
+    uint32_t message_size;
+    std::memcpy(&message_size, input.data(), sizeof(message_size));
+    message_size = ntohl(message_size);
+    if (message_size > MAX_MESSAGE_SIZE) {
+        LOG_WARNING("Request of " << message_size << " bytes is too large");
+        return ParseResult::FATAL;
+    }
+    if (input.size() < message_size + 4) {
+        return ParseResult::NOT_FULL;
+    }
+    consumed = message_size + 4;
+
+    frame_.assign(input.data() + 4, input.data() + 4 + message_size);
+    frame_.push_back('\0');
+
+    d.ParseInsitu(frame_.data());
+    if (d.HasParseError() || !d.IsObject() || !has_string_member(d, "command")) {
+        return ParseResult::ERROR;
+    }
+
+    return ParseResult::OK;
+}
+
+void RequestProcessor::handle_get(Storage& storage, std::string_view key, std::string& output) {
+    size_t frame = begin_frame(output);
+    StringOutputStream stream{output};
+    ResponseWriter writer(stream, &stack_allocator_);
+
+    // The value is written straight from the storage while the shard is read-locked
+    storage.visit_value(key, [&](std::optional<std::string_view> value, Storage::Stat stat) {
+        writer.StartObject();
+        write_stat(writer, stat);
+        writer.Key("ok");
+        writer.Bool(true);
+        writer.Key("key");
+        writer.String(key.data(), key.size());
+        writer.Key("found");
+        writer.Bool(value.has_value());
+        if (value) {
+            writer.Key("value");
+            writer.String(value->data(), value->size());
+        }
+        writer.EndObject();
+    });
+
+    end_frame(output, frame);
+}
+
+void RequestProcessor::handle_set(Storage& storage, std::string_view key, std::string_view value, std::string& output) {
+    auto stat = storage.set(key, value);
+
+    size_t frame = begin_frame(output);
+    StringOutputStream stream{output};
+    ResponseWriter writer(stream, &stack_allocator_);
+    writer.StartObject();
+    write_stat(writer, stat);
+    writer.Key("ok");
+    writer.Bool(true);
+    writer.EndObject();
+    end_frame(output, frame);
+}
+
+void RequestProcessor::handle_mget(Storage& storage, std::string& output) {
+    get_batch(storage);
+
+    size_t frame = begin_frame(output);
+    StringOutputStream stream{output};
+    ResponseWriter writer(stream, &stack_allocator_);
+    writer.StartObject();
+    writer.Key("ok");
+    writer.Bool(true);
+    writer.Key("results");
+    writer.StartArray();
+    for (size_t i = 0; i < batch_keys_.size(); ++i) {
+        const auto& result = batch_results_[i];
+        writer.StartObject();
+        write_stat(writer, result.stat);
+        writer.Key("key");
+        writer.String(batch_keys_[i].data(), batch_keys_[i].size());
+        writer.Key("found");
+        writer.Bool(result.found);
+        if (result.found) {
+            auto value = get_batch_value(result);
+            writer.Key("value");
+            writer.String(value.data(), value.size());
+        }
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+    end_frame(output, frame);
+}
+
+void RequestProcessor::handle_mset(Storage& storage, std::string& output) {
+    auto stats = storage.set_many(batch_keys_, batch_values_);
+
+    size_t frame = begin_frame(output);
+    StringOutputStream stream{output};
+    ResponseWriter writer(stream, &stack_allocator_);
+    writer.StartObject();
+    writer.Key("ok");
+    writer.Bool(true);
+    writer.Key("results");
+    writer.StartArray();
+    for (const auto& stat : stats) {
+        writer.StartObject();
+        write_stat(writer, stat);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+    end_frame(output, frame);
+}
+
+// {"command": "top", "count": 10, "seconds": 60}, both numbers are optional
+void RequestProcessor::handle_top(const Document& d, std::string& output) {
+    uint64_t keys_count = DEFAULT_TOP_COUNT;
+    uint64_t seconds = std::chrono::duration_cast<std::chrono::seconds>(hot_keys::WINDOW * hot_keys::WINDOWS_COUNT).count();
+    if (!get_uint_member(d, "count", keys_count) || !get_uint_member(d, "seconds", seconds)) {
+        count(metrics::Counter::REQUEST_ERRORS);
+        write_response("ERROR", output);
+        return;
+    }
+    auto report = hot_keys::top(keys_count, std::chrono::seconds(seconds));
+
+    size_t frame = begin_frame(output);
+    StringOutputStream stream{output};
+    ResponseWriter writer(stream, &stack_allocator_);
+    writer.StartObject();
+    writer.Key("ok");
+    writer.Bool(true);
+    writer.Key("period_ms");
+    writer.Uint64(report.period.count());
+    writer.Key("requests");
+    writer.Uint64(report.requests);
+    writer.Key("keys");
+    writer.StartArray();
+    for (const auto& hot_key : report.keys) {
+        writer.StartObject();
+        writer.Key("key");
+        writer.String(hot_key.key.data(), hot_key.key.size());
+        writer.Key("count");
+        writer.Uint64(hot_key.count);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+    end_frame(output, frame);
+}
+
+// {"command": "watch", "key": "a"} or {"command": "watch", "prefix": "a/"}, unwatch takes the same
+void RequestProcessor::handle_watch(Storage& storage, bool watch, std::string_view key, bool is_prefix, std::string& output) {
+    bool binary = protocol_ == Protocol::BINARY;
+    if (!watch_wakeup_) {
+        count(metrics::Counter::REQUEST_ERRORS);
+        if (binary) {
+            binary_protocol::ResponseHeader response;
+            response.status = binary_protocol::Status::ERROR;
+            binary_protocol::append_response(output, response);
+        } else {
+            write_response("ERROR", output);
+        }
+        return;
+    }
+    if (!watcher_) {
+        watcher_ = std::make_unique<Watcher>(storage.get_watch_registry(), watch_wakeup_);
+    }
+
+    count(watch ? metrics::Counter::REQUESTS_WATCH : metrics::Counter::REQUESTS_UNWATCH);
+    if (watch) {
+        watcher_->watch(key, is_prefix);
+    } else {
+        watcher_->unwatch(key, is_prefix);
+    }
+    // The value is read after the watch is counted and fenced, and a set fences its value before checking
+    // for watches, so a change that comes in between is either read here or notified
+    if (watch && !is_prefix) {
+        if (binary) {
+            storage.visit_value(key, [&](std::optional<std::string_view> value, Storage::Stat stat) {
+                binary_protocol::ResponseHeader response;
+                response.found = value.has_value();
+                response.get_count = stat.get_count;
+                response.set_count = stat.set_count;
+                binary_protocol::append_response(output, response, value.value_or(std::string_view()));
+            });
+        } else {
+            handle_get(storage, key, output);
+        }
+        return;
+    }
+
+    if (binary) {
+        binary_protocol::append_response(output, binary_protocol::ResponseHeader());
+        return;
+    }
+    size_t frame = begin_frame(output);
+    StringOutputStream stream{output};
+    ResponseWriter writer(stream, &stack_allocator_);
+    writer.StartObject();
+    writer.Key("ok");
+    writer.Bool(true);
+    writer.EndObject();
+    end_frame(output, frame);
+}
+
+void RequestProcessor::enable_watches(std::function<void()> wakeup) {
+    watch_wakeup_ = std::move(wakeup);
+}
+
+// {"event": "set", "key": "a", "value": "1"} or {"event": "overflow"}
+void RequestProcessor::write_notifications(std::string& output) {
+    if (!watcher_) {
+        return;
+    }
+    bool overflow = watcher_->take(watch_events_);
+    bool binary = protocol_ == Protocol::BINARY;
+    if (overflow) {
+        if (binary) {
+            binary_protocol::append_notification(output, true);
+        } else {
+            write_response(R"({"event":"overflow"})", output);
+        }
+    }
+    stack_allocator_.Clear();
+    StringOutputStream stream{output};
+    ResponseWriter writer(stream, &stack_allocator_);
+    for (const auto& event : watch_events_) {
+        if (binary) {
+            binary_protocol::append_notification(output, false, event.key, *event.value);
+            continue;
+        }
+        size_t frame = begin_frame(output);
+        writer.Reset(stream);
+        writer.StartObject();
+        writer.Key("event");
+        writer.String("set");
+        writer.Key("key");
+        writer.String(event.key.data(), event.key.size());
+        writer.Key("value");
+        writer.String(event.value->data(), event.value->size());
+        writer.EndObject();
+        end_frame(output, frame);
+    }
+    // Values of keys that nobody else queued are freed here rather than at the next take
+    watch_events_.clear();
+}
+
+// cas: {"key": "a", "expected": "1", "value": "2"}, incr and decr: {"key": "a", "delta": 1} with an optional delta of 1,
+// append and setnx: {"key": "a", "value": "1"}
+void RequestProcessor::handle_update(Storage& storage, std::string_view command, const Document& d, std::string& output) {
+    auto key = get_string(d["key"]);
+    std::optional<Storage::UpdateResult> result;
+    if (command == "cas" && has_string_member(d, "expected") && has_string_member(d, "value")) {
+        count(metrics::Counter::REQUESTS_CAS);
+        result = storage.compare_and_set(key, get_string(d["expected"]), get_string(d["value"]));
+    } else if (command == "incr" || command == "decr") {
+        int64_t delta = 1;
+        auto added = get_int_member(d, "delta", delta) ? signed_delta(delta, command == "decr") : std::nullopt;
+        if (added) {
+            count(command == "incr" ? metrics::Counter::REQUESTS_INCR : metrics::Counter::REQUESTS_DECR);
+            result = storage.increment(key, *added);
+        }
+    } else if (command == "append" && has_string_member(d, "value")) {
+        count(metrics::Counter::REQUESTS_APPEND);
+        result = storage.append(key, get_string(d["value"]));
+    } else if (command == "setnx" && has_string_member(d, "value")) {
+        count(metrics::Counter::REQUESTS_SETNX);
+        result = storage.set_if_absent(key, get_string(d["value"]));
+    }
+    if (!result || result->invalid) {
+        count(metrics::Counter::REQUEST_ERRORS);
+        write_response("ERROR", output);
+        return;
+    }
+
+    size_t frame = begin_frame(output);
+    StringOutputStream stream{output};
+    ResponseWriter writer(stream, &stack_allocator_);
+    writer.StartObject();
+    write_stat(writer, result->stat);
+    writer.Key("ok");
+    writer.Bool(true);
+    writer.Key("applied");
+    writer.Bool(result->applied);
+    writer.Key("found");
+    writer.Bool(result->value.has_value());
+    if (result->value) {
+        writer.Key("value");
+        writer.String(result->value->data(), result->value->size());
+    }
+    writer.EndObject();
+    end_frame(output, frame);
+}
+
+std::optional<Storage::UpdateResult> RequestProcessor::update_binary(Storage& storage, binary_protocol::Opcode opcode, std::string_view key, std::string_view value) {
+    switch (opcode) {
+        case binary_protocol::Opcode::CAS: {
+            if (value.size() < sizeof(uint32_t)) {
+                return std::nullopt;
+            }
+            uint64_t expected_size = binary_protocol::read_uint32(value.data());
+            if (value.size() - sizeof(uint32_t) < expected_size) {
+                return std::nullopt;
+            }
+            count(metrics::Counter::REQUESTS_CAS);
+            return storage.compare_and_set(key, value.substr(sizeof(uint32_t), expected_size), value.substr(sizeof(uint32_t) + expected_size));
+        }
+        case binary_protocol::Opcode::INCR:
+        case binary_protocol::Opcode::DECR: {
+            if (value.size() != sizeof(int64_t)) {
+                return std::nullopt;
+            }
+            bool decrement = opcode == binary_protocol::Opcode::DECR;
+            auto delta = signed_delta(binary_protocol::read_int64(value.data()), decrement);
+            if (!delta) {
+                return std::nullopt;
+            }
+            count(decrement ? metrics::Counter::REQUESTS_DECR : metrics::Counter::REQUESTS_INCR);
+            return storage.increment(key, *delta);
+        }
+        case binary_protocol::Opcode::APPEND:
+            count(metrics::Counter::REQUESTS_APPEND);
+            return storage.append(key, value);
+        case binary_protocol::Opcode::SETNX:
+            count(metrics::Counter::REQUESTS_SETNX);
+            return storage.set_if_absent(key, value);
+        default:
+            return std::nullopt;
+    }
+}
+
+// mget: {"keys": ["a", "b"]}, mset: {"items": [{"key": "a", "value": "1"}]}
+bool RequestProcessor::parse_json_batch(const Document& d, bool with_values) {
+    batch_keys_.clear();
+    batch_values_.clear();
+    auto it = d.FindMember(with_values ? "items" : "keys");
+    if (it == d.MemberEnd() || !it->value.IsArray()) {
+        return false;
+    }
+    for (const auto& item : it->value.GetArray()) {
+        if (!with_values) {
+            if (!item.IsString()) {
+                return false;
+            }
+            batch_keys_.push_back(get_string(item));
+            continue;
+        }
+        if (!item.IsObject() || !has_string_member(item, "key") || !has_string_member(item, "value")) {
+            return false;
+        }
+        batch_keys_.push_back(get_string(item["key"]));
+        batch_values_.push_back(get_string(item["value"]));
+    }
+    return true;
+}
+
+bool RequestProcessor::parse_binary_batch(std::string_view items, uint32_t count, bool with_values) {
+    batch_keys_.clear();
+    batch_values_.clear();
+    size_t pos = 0;
+    size_t sizes_size = (with_values ? 2 : 1) * sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (items.size() - pos < sizes_size) {
+            return false;
+        }
+        uint64_t key_size = binary_protocol::read_uint32(items.data() + pos);
+        uint64_t value_size = with_values ? binary_protocol::read_uint32(items.data() + pos + sizeof(uint32_t)) : 0;
+        pos += sizes_size;
+        if (items.size() - pos < key_size + value_size) {
+            return false;
+        }
+        batch_keys_.push_back(items.substr(pos, key_size));
+        if (with_values) {
+            batch_values_.push_back(items.substr(pos + key_size, value_size));
+        }
+        pos += key_size + value_size;
+    }
+    return pos == items.size();
+}
+
+void RequestProcessor::get_batch(Storage& storage) {
+    batch_results_.assign(batch_keys_.size(), BatchResult{});
+    batch_result_values_.clear();
+    storage.visit_values(batch_keys_, [this](size_t index, std::optional<std::string_view> value, Storage::Stat stat) {
+        auto& result = batch_results_[index];
+        result.found = value.has_value();
+        result.stat = stat;
+        if (value) {
+            result.value_offset = batch_result_values_.size();
+            result.value_size = value->size();
+            batch_result_values_.append(*value);
+        }
+    });
+}
+
+std::string_view RequestProcessor::get_batch_value(const BatchResult& result) const {
+    return std::string_view(batch_result_values_).substr(result.value_offset, result.value_size);
+}
+
+void RequestProcessor::flush_counts() {
+    for (size_t i = 0; i < std::size(counts_); ++i) {
+        if (counts_[i] > 0) {
+            metrics::add(static_cast<metrics::Counter>(i), counts_[i]);
+            counts_[i] = 0;
+        }
+    }
+}
+
+void RequestProcessor::write_response(std::string_view body, std::string& output) {
+    uint32_t len = htonl(body.size());
+    output.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    output.append(body);
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "metrics.h"
+#include "storage.h"
+
+#include "../util/binary_protocol.h"
+
+#include <rapidjson/allocators.h>
+#include <rapidjson/document.h>
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Protocol logic of a connection, independent of how bytes get to and from the socket.
+// The protocol is chosen by the first bytes of the connection: binary_protocol::MAGIC switches it
+// to the binary protocol, anything else is JSON. JSON requests and responses are framed the same way:
+// 4-byte big-endian length, then JSON.
+// Requests that fit the parsing arenas are handled without allocations.
+class RequestProcessor {
+public:
+    RequestProcessor(std::weak_ptr<Storage> storage);
+
+    RequestProcessor(const RequestProcessor&) = delete;
+    RequestProcessor& operator=(const RequestProcessor&) = delete;
+
+    // Handles every complete request at the beginning of input and appends the responses to output.
+    // Returns the number of consumed bytes, or nullopt if the connection must be closed.
+    std::optional<size_t> process(std::string_view input, std::string& output);
+
+    // Enables watch commands. wakeup is called, from any thread, when watched keys change; the connection
+    // must then call write_notifications on its own thread. Without it watch commands are rejected.
+    void enable_watches(std::function<void()> wakeup);
+    // Appends the notifications queued since the previous call to output
+    void write_notifications(std::string& output);
+
+private:
+    enum class Protocol {
+        UNKNOWN,
+        JSON,
+        BINARY,
+    };
+
+    enum class ParseResult {
+        OK,
+        NOT_FULL,
+        ERROR,
+        FATAL,
+    };
+
+    struct BatchResult {
+        bool found = false;
+        Storage::Stat stat;
+        // Position of the value in batch_result_values_
+        size_t value_offset = 0;
+        size_t value_size = 0;
+    };
+
+    using Document = rapidjson::GenericDocument<rapidjson::UTF8<>, rapidjson::MemoryPoolAllocator<>, rapidjson::MemoryPoolAllocator<>>;
+
+    static constexpr size_t ARENA_SIZE = 4096;
+    static constexpr size_t PARSE_STACK_CAPACITY = 512;
+    static constexpr size_t DEFAULT_TOP_COUNT = 10;
+
+    std::optional<size_t> process_json(Storage& storage, std::string_view input, std::string& output);
+    std::optional<size_t> process_binary(Storage& storage, std::string_view input, std::string& output);
+
+    ParseResult parse_command(std::string_view input, size_t& consumed, Document& d);
+
+    void handle_get(Storage& storage, std::string_view key, std::string& output);
+    void handle_set(Storage& storage, std::string_view key, std::string_view value, std::string& output);
+    // Batch handlers take keys and values from batch_keys_ and batch_values_
+    void handle_mget(Storage& storage, std::string& output);
+    void handle_mset(Storage& storage, std::string& output);
+    void handle_top(const Document& d, std::string& output);
+    // cas, incr, decr, append and setnx
+    void handle_update(Storage& storage, std::string_view command, const Document& d, std::string& output);
+    // watch and unwatch of a key or a prefix, key watches answer like get
+    void handle_watch(Storage& storage, bool watch, std::string_view key, bool is_prefix, std::string& output);
+    // Nullopt if the body of the update is malformed
+    std::optional<Storage::UpdateResult> update_binary(Storage& storage, binary_protocol::Opcode opcode, std::string_view key, std::string_view value);
+
+    bool parse_json_batch(const Document& d, bool with_values);
+    bool parse_binary_batch(std::string_view items, uint32_t count, bool with_values);
+    // Fills batch_results_ for batch_keys_. Keys are visited in the order of shards,
+    // so the values are copied aside and the response is written afterwards.
+    void get_batch(Storage& storage);
+    std::string_view get_batch_value(const BatchResult& result) const;
+
+    static void write_response(std::string_view body, std::string& output);
+
+    // Requests are counted here and added to the metrics once per process call
+    void count(metrics::Counter counter) {
+        ++counts_[static_cast<size_t>(counter)];
+    }
+    void flush_counts();
+
+    std::weak_ptr<Storage> storage_;
+    Protocol protocol_ = Protocol::UNKNOWN;
+
+    // Request DOM and parser/writer stacks live in these arenas, which are reset before every request
+    alignas(8) char value_arena_[ARENA_SIZE];
+    alignas(8) char stack_arena_[ARENA_SIZE];
+    rapidjson::MemoryPoolAllocator<> value_allocator_;
+    rapidjson::MemoryPoolAllocator<> stack_allocator_;
+    // Null-terminated copy of the request being parsed, ParseInsitu unescapes strings in it
+    std::vector<char> frame_;
+
+    // Views of the batch request being handled and the results of an mget, reused between requests
+    std::vector<std::string_view> batch_keys_;
+    std::vector<std::string_view> batch_values_;
+    std::vector<BatchResult> batch_results_;
+    std::string batch_result_values_;
+
+    uint64_t counts_[static_cast<size_t>(metrics::Counter::COUNT)] = {};
+
+    std::function<void()> watch_wakeup_;
+    // Created by the first watch of the connection
+    std::unique_ptr<Watcher> watcher_;
+    std::vector<Watcher::Event> watch_events_;
+};
@@ -1,60 +1,221 @@
 #include "server.h"
 
 #include "connection.h"
+#include "metrics.h"
+
+#include "../util/log.h"
 
 #include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/asio/thread_pool.hpp>
 #include <boost/asio/write.hpp>
 
-#include <iostream>
 #include <regex>
 
-Server::Server(boost::asio::io_context& io_context, const std::string& storage_path, uint16_t port)
-    : io_context_(io_context)
-    , acceptor_(io_context_, {boost::asio::ip::tcp::v4(), port})
-    , storage_(std::make_shared<Storage>(storage_path))
-    , dump_timer_(io_context_)
-    , stat_timer_(io_context_) {
-    dump_storage_job();
+namespace {
+
+using ReusePort = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+boost::asio::ip::tcp::acceptor make_acceptor(boost::asio::io_context& io_context, uint16_t port, bool reuse_port) {
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), port);
+    boost::asio::ip::tcp::acceptor acceptor(io_context);
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+    if (reuse_port) {
+        acceptor.set_option(ReusePort(true));
+    }
+    acceptor.bind(endpoint);
+    acceptor.listen();
+    return acceptor;
+}
+
+}
+
+Server::Server(IoContextPool& io_contexts, const ServerOptions& options)
+    : io_contexts_(io_contexts)
+    , io_mode_(options.io_mode)
+    , storage_(std::make_shared<Storage>(options.storage_path, options.storage))
+    , stat_timer_(io_contexts_.get(0)) {
+#ifdef DICTIONARY_WITH_IO_URING
+    if (options.backend == NetworkBackend::IO_URING) {
+        uring_server_ = std::make_unique<UringServer>(storage_, options.port, options.threads, options.pin_threads);
+    } else
+#endif
+    if (io_mode_ == IoMode::PER_THREAD && options.accept_mode == AcceptMode::REUSEPORT) {
+        for (size_t i = 0; i < io_contexts_.size(); ++i) {
+            acceptors_.push_back(make_acceptor(io_contexts_.get(i), options.port, true));
+        }
+    } else {
+        acceptors_.push_back(make_acceptor(io_contexts_.get(0), options.port, false));
+    }
+    if (options.admin_port != 0) {
+        metrics::set_enabled(true);
+        admin_server_ = std::make_unique<AdminServer>(io_contexts_.get(0), options.admin_port, [this](std::string& out) {
+            render_metrics(out);
+        });
+    }
+
+    if (options.replication_port != 0) {
+        replication_server_ = std::make_unique<ReplicationServer>(io_contexts_.get(0), options.replication_port, storage_);
+    }
+    if (options.leader_port != 0) {
+        replica_ = std::make_unique<Replica>(storage_, options.leader_host, options.leader_port);
+    }
+
+    dump_thread_ = std::thread([this] {
+        dump_storage_job();
+    });
     statistics_print_job();
 }
 
 Server::~Server() {
-    io_context_.stop();
+    io_contexts_.stop();
+#ifdef DICTIONARY_WITH_IO_URING
+    if (uring_server_) {
+        uring_server_->stop();
+    }
+#endif
+    replica_.reset();
+    replication_server_.reset();
+    {
+        std::lock_guard lock(dump_mutex_);
+        stopped_ = true;
+    }
+    dump_cv_.notify_one();
+    dump_thread_.join();
 }
 
 void Server::run() {
-    boost::asio::ip::tcp::socket socket(io_context_);
-    std::cerr << "Accepting connection" << std::endl;
-    acceptor_.async_accept([this] (const boost::system::error_code& error, boost::asio::ip::tcp::socket socket) {
+#ifdef DICTIONARY_WITH_IO_URING
+    if (uring_server_) {
+        uring_server_->start();
+    }
+#endif
+    for (size_t i = 0; i < acceptors_.size(); ++i) {
+        accept(i);
+    }
+    if (admin_server_) {
+        admin_server_->run();
+    }
+    if (replication_server_) {
+        replication_server_->run();
+    }
+    if (replica_) {
+        replica_->start();
+    }
+}
+
+void Server::accept(size_t acceptor_index) {
+    auto handler = [this, acceptor_index] (const boost::system::error_code& error, boost::asio::ip::tcp::socket socket) {
         if (error) {
-            std::cerr << "Error accepting connection: " << error.message() << std::endl;
+            LOG_ERROR("Error accepting connection: " << error.message());
             return;
         }
 
+        // The connection starts on the executor of its socket, which may belong to another io_context
+        auto executor = socket.get_executor();
         auto connection = std::make_shared<Connection>(std::move(socket), storage_);
-        connection->run();
+        boost::asio::post(executor, [connection] {
+            connection->run();
+        });
 
-        run();
-    });
+        accept(acceptor_index);
+    };
+
+    LOG_DEBUG("Accepting connection");
+    auto& acceptor = acceptors_[acceptor_index];
+    if (io_mode_ == IoMode::SHARED) {
+        // Every connection gets its own strand, its read and write handlers must not run concurrently
+        acceptor.async_accept(boost::asio::make_strand(io_contexts_.get(0)), handler);
+    } else if (acceptors_.size() > 1) {
+        // Sockets stay on the io_context of their acceptor, which is run by a single thread
+        acceptor.async_accept(handler);
+    } else {
+        acceptor.async_accept(io_contexts_.next(), handler);
+    }
 }
 
 void Server::dump_storage_job() {
-    storage_->dump_to_file();
+    std::unique_lock lock(dump_mutex_);
+    while (!stopped_) {
+        lock.unlock();
+        storage_->dump_to_file();
+        lock.lock();
 
-    dump_timer_.expires_after(std::chrono::seconds(5));
-    dump_timer_.async_wait([this](const boost::system::error_code& e) {
-        dump_storage_job();
-    });
+        dump_cv_.wait_for(lock, std::chrono::seconds(5), [this] {
+            return stopped_;
+        });
+    }
 }
 
 void Server::statistics_print_job() {
     auto [total_stats, last_stats] = storage_->get_and_reset_stats();
-    std::cout << "Total stats: " << total_stats.get_count << " get, " << total_stats.set_count << " set" << std::endl;
-    std::cout << "Last stats: " << last_stats.get_count << " get, " << last_stats.set_count << " set" << std::endl;
+    LOG_INFO("Total stats: " << total_stats.get_count << " get, " << total_stats.set_count << " set");
+    LOG_INFO("Last stats: " << last_stats.get_count << " get, " << last_stats.set_count << " set");
+    auto memory_stats = storage_->get_memory_stats();
+    LOG_INFO("Memory: " << memory_stats.live_bytes << " live bytes, " << memory_stats.allocated_bytes << " allocated bytes");
+    auto snapshot_stats = storage_->get_snapshot_stats();
+    LOG_INFO("Snapshots: " << snapshot_stats.snapshots_count << " full and " << snapshot_stats.deltas_count
+        << " deltas written, " << snapshot_stats.bytes_written << " bytes in total, last took "
+        << snapshot_stats.last_duration.count() << " us, writers stalled for "
+        << snapshot_stats.total_writer_stall.count() << " us in total");
+    if (replica_) {
+        auto status = replica_->get_status();
+        LOG_INFO("Replication: " << (status.connected ? "connected" : "disconnected") << ", applied "
+            << status.applied_seq << " of " << status.leader_seq << ", lagging for " << status.lag.count() << " ms");
+    }
+    if (replication_server_) {
+        LOG_INFO("Replication: " << replication_server_->get_followers_count() << " followers, last seq "
+            << storage_->get_replication_log()->last_seq());
+    }
 
     stat_timer_.expires_after(std::chrono::seconds(5));
     stat_timer_.async_wait([this](const boost::system::error_code& e) {
         statistics_print_job();
     });
 }
+
+void Server::render_metrics(std::string& out) const {
+    metrics::render(out);
+
+    auto stats = storage_->get_total_stats();
+    metrics::append_counter(out, "dictionary_storage_gets_total", "Lookups of keys, misses included.", stats.get_count);
+    metrics::append_counter(out, "dictionary_storage_sets_total", "Keys set, keys of batches included.", stats.set_count);
+    metrics::append_gauge(out, "dictionary_keys", "Keys in the dictionary.",
+        storage_->size());
+    auto memory_stats = storage_->get_memory_stats();
+    metrics::append_gauge(out, "dictionary_memory_live_bytes", "Bytes of values in use.", memory_stats.live_bytes);
+    metrics::append_gauge(out, "dictionary_memory_allocated_bytes", "Bytes of slabs allocated for values.",
+        memory_stats.allocated_bytes);
+    auto snapshot_stats = storage_->get_snapshot_stats();
+    metrics::append_counter(out, "dictionary_dumps_total", "Dumps of the whole dictionary written.", snapshot_stats.snapshots_count);
+    metrics::append_counter(out, "dictionary_delta_dumps_total", "Dumps of the keys set since the previous dump written.",
+        snapshot_stats.deltas_count);
+    metrics::append_counter(out, "dictionary_dump_bytes_total", "Bytes written by dumps of both kinds.", snapshot_stats.bytes_written);
+    metrics::append_counter(out, "dictionary_dump_writer_stall_seconds_total",
+        "Time sets waited for shard locks and preserved old values while dumps were running.",
+        snapshot_stats.total_writer_stall.count() / 1e6);
+
+    metrics::append_gauge(out, "dictionary_watches", "Keys and prefixes watched by connections.",
+        storage_->get_watch_registry()->get_watches_count());
+
+    if (replication_server_) {
+        metrics::append_gauge(out, "dictionary_replication_seq", "Last set in the replication log.",
+            storage_->get_replication_log()->last_seq());
+        metrics::append_gauge(out, "dictionary_replication_followers", "Followers streaming the replication log.",
+            replication_server_->get_followers_count());
+    }
+    if (replica_) {
+        auto status = replica_->get_status();
+        metrics::append_gauge(out, "dictionary_replica_connected", "1 while the follower is connected to its leader.",
+            status.connected);
+        metrics::append_gauge(out, "dictionary_replica_applied_seq", "Last set of the leader's log applied.", status.applied_seq);
+        metrics::append_gauge(out, "dictionary_replica_leader_seq", "Last set of the leader's log the follower knows of.",
+            status.leader_seq);
+        metrics::append_gauge(out, "dictionary_replica_lag_records", "Sets of the leader's log not applied yet.",
+            status.leader_seq - std::min(status.applied_seq, status.leader_seq));
+        metrics::append_gauge(out, "dictionary_replica_lag_seconds", "Time since the follower last had every set it knew of.",
+            status.lag.count() / 1e3);
+    }
+}
@@ -5,30 +5,59 @@
 #include <boost/asio/steady_timer.hpp>
 #include <boost/asio/thread_pool.hpp>
 
+#include "admin_server.h"
+#include "io_context_pool.h"
+#include "options.h"
+#include "replication.h"
 #include "storage.h"
+#ifdef DICTIONARY_WITH_IO_URING
+#include "uring_server.h"
+#endif
 
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <unordered_set>
 
 
 class Server {
 public:
-    Server(boost::asio::io_context& io_context, const std::string& storage_path, uint16_t port);
+    Server(IoContextPool& io_contexts, const ServerOptions& options);
     ~Server();
 
+    // Starts accepting connections, the pool must be run to serve them
     void run();
 
 private:
+    void accept(size_t acceptor_index);
     void dump_storage_job();
     void statistics_print_job();
+    void render_metrics(std::string& out) const;
 
-    boost::asio::io_context& io_context_;
-    boost::asio::ip::tcp::acceptor acceptor_;
+    IoContextPool& io_contexts_;
+    const IoMode io_mode_;
+    // A single acceptor, or one per io_context when they accept on SO_REUSEPORT sockets
+    std::vector<boost::asio::ip::tcp::acceptor> acceptors_;
 
-    boost::asio::steady_timer dump_timer_;
     boost::asio::steady_timer stat_timer_;
 
     std::shared_ptr<Storage> storage_;
+    std::unique_ptr<AdminServer> admin_server_;
+    // Set on leaders that have a replication port
+    std::unique_ptr<ReplicationServer> replication_server_;
+    // Set on followers
+    std::unique_ptr<Replica> replica_;
+#ifdef DICTIONARY_WITH_IO_URING
+    // Serves connections instead of acceptors_ with the IO_URING backend, the pool then only runs timers
+    std::unique_ptr<UringServer> uring_server_;
+#endif
+
+    // Dumps run on their own thread so that they never occupy io_context threads
+    std::thread dump_thread_;
+    std::mutex dump_mutex_;
+    std::condition_variable dump_cv_;
     bool stopped_ = false;
 };
@@ -0,0 +1,121 @@
+#include "slab_allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+
+namespace {
+
+constexpr size_t MIN_SLAB_SIZE = 1024;
+constexpr size_t MAX_SLAB_SIZE = 64 * 1024;
+constexpr size_t GRANULARITY = 8;
+
+// Classes grow by ~25% so that a value wastes at most a quarter of its chunk
+std::vector<size_t> make_class_sizes() {
+    std::vector<size_t> sizes;
+    size_t size = 16;
+    while (size < SlabAllocator::MAX_CHUNK_SIZE) {
+        sizes.push_back(size);
+        size = (size + size / 4 + GRANULARITY - 1) / GRANULARITY * GRANULARITY;
+    }
+    sizes.push_back(SlabAllocator::MAX_CHUNK_SIZE);
+    return sizes;
+}
+
+const std::vector<size_t>& class_sizes() {
+    static const std::vector<size_t> sizes = make_class_sizes();
+    return sizes;
+}
+
+// Maps size rounded up to GRANULARITY into the class index
+const std::vector<uint8_t>& class_lookup() {
+    static const std::vector<uint8_t> lookup = [] {
+        const auto& sizes = class_sizes();
+        std::vector<uint8_t> res(SlabAllocator::MAX_CHUNK_SIZE / GRANULARITY + 1);
+        size_t index = 0;
+        for (size_t i = 0; i < res.size(); ++i) {
+            while (sizes[index] < i * GRANULARITY) {
+                ++index;
+            }
+            res[i] = index;
+        }
+        return res;
+    }();
+    return lookup;
+}
+
+}
+
+SlabAllocator::SlabAllocator()
+    : classes_(class_sizes().size()) {
+    for (size_t i = 0; i < classes_.size(); ++i) {
+        classes_[i].chunk_size = class_sizes()[i];
+        classes_[i].next_slab_size = std::max(MIN_SLAB_SIZE, classes_[i].chunk_size * 4);
+    }
+}
+
+SlabAllocator::~SlabAllocator() = default;
+
+char* SlabAllocator::allocate(size_t size) {
+    if (size == 0) {
+        return nullptr;
+    }
+    stats_.live_bytes += size;
+    if (size > MAX_CHUNK_SIZE) {
+        stats_.allocated_bytes += size;
+        return static_cast<char*>(::operator new(size));
+    }
+    return allocate_from_class(classes_[get_class_index(size)]);
+}
+
+void SlabAllocator::deallocate(char* ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    stats_.live_bytes -= size;
+    if (size > MAX_CHUNK_SIZE) {
+        stats_.allocated_bytes -= size;
+        ::operator delete(ptr);
+        return;
+    }
+    auto& size_class = classes_[get_class_index(size)];
+    auto* chunk = reinterpret_cast<FreeChunk*>(ptr);
+    chunk->next = size_class.free_list;
+    size_class.free_list = chunk;
+}
+
+char* SlabAllocator::reallocate(char* ptr, size_t old_size, size_t new_size) {
+    if (ptr && old_size <= MAX_CHUNK_SIZE && new_size != 0 && new_size <= MAX_CHUNK_SIZE
+        && get_class_index(old_size) == get_class_index(new_size)) {
+        stats_.live_bytes = stats_.live_bytes - old_size + new_size;
+        return ptr;
+    }
+    deallocate(ptr, old_size);
+    return allocate(new_size);
+}
+
+size_t SlabAllocator::get_class_index(size_t size) {
+    return class_lookup()[(size + GRANULARITY - 1) / GRANULARITY];
+}
+
+char* SlabAllocator::allocate_from_class(SizeClass& size_class) {
+    if (size_class.free_list) {
+        auto* chunk = size_class.free_list;
+        size_class.free_list = chunk->next;
+        return reinterpret_cast<char*>(chunk);
+    }
+
+    if (static_cast<size_t>(size_class.slab_end - size_class.slab_cursor) < size_class.chunk_size) {
+        size_t slab_size = size_class.next_slab_size;
+        size_class.next_slab_size = std::min(slab_size * 2, std::max(MAX_SLAB_SIZE, size_class.chunk_size));
+        slabs_.push_back(std::make_unique_for_overwrite<char[]>(slab_size));
+        stats_.allocated_bytes += slab_size;
+        size_class.slab_cursor = slabs_.back().get();
+        size_class.slab_end = size_class.slab_cursor + slab_size;
+    }
+
+    char* res = size_class.slab_cursor;
+    size_class.slab_cursor += size_class.chunk_size;
+    return res;
+}
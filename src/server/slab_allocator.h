@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Size-class allocator for values. Chunks of one class are carved from slabs
+// and returned to a per-class free list on deallocation, so overwriting a
+// value reuses memory instead of growing the heap. Values larger than the
+// biggest class go straight to operator new.
+// Not synchronized, every Storage shard owns one allocator.
+class SlabAllocator {
+public:
+    struct Stats {
+        // Bytes requested by live values
+        size_t live_bytes = 0;
+        // Bytes taken from the system: slabs and large values
+        size_t allocated_bytes = 0;
+    };
+
+    static constexpr size_t MAX_CHUNK_SIZE = 16 * 1024;
+
+public:
+    SlabAllocator();
+
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+    ~SlabAllocator();
+
+    char* allocate(size_t size);
+    void deallocate(char* ptr, size_t size);
+
+    // Keeps the chunk if the new size falls into the same class. Contents are not preserved.
+    char* reallocate(char* ptr, size_t old_size, size_t new_size);
+
+    const Stats& get_stats() const {
+        return stats_;
+    }
+
+private:
+    struct FreeChunk {
+        FreeChunk* next;
+    };
+
+    struct SizeClass {
+        size_t chunk_size = 0;
+        size_t next_slab_size = 0;
+        FreeChunk* free_list = nullptr;
+        char* slab_cursor = nullptr;
+        char* slab_end = nullptr;
+    };
+
+    static size_t get_class_index(size_t size);
+
+    char* allocate_from_class(SizeClass& size_class);
+
+    std::vector<SizeClass> classes_;
+    std::vector<std::unique_ptr<char[]>> slabs_;
+    Stats stats_;
+};
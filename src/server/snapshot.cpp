@@ -0,0 +1,359 @@
+#include "snapshot.h"
+
+#include "../util/crc32.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <rapidjson/document.h>
+#include <rapidjson/istreamwrapper.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+
+namespace {
+
+constexpr std::string_view MAGIC = "DICTSNAP";
+constexpr size_t FILE_HEADER_SIZE = 32;
+constexpr size_t BLOCK_HEADER_SIZE = 4 * sizeof(uint32_t);
+constexpr size_t MAX_BLOCK_PAYLOAD = 1024 * 1024;
+
+// Flushes a written and closed file to the disk
+void sync_file(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + path + ": " + std::strerror(errno));
+    }
+    int res = ::fdatasync(fd);
+    int error = errno;
+    ::close(fd);
+    if (res != 0) {
+        throw std::runtime_error("Failed to sync " + path + ": " + std::strerror(error));
+    }
+}
+
+template <class T>
+void append_pod(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <class T>
+T read_pod(const char* data) {
+    T value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+class BinarySnapshotWriter : public SnapshotWriter {
+public:
+    BinarySnapshotWriter(const std::string& path, uint32_t shards_count, uint64_t hash_probe)
+        : path_(path)
+        , file_(path, std::ios::binary | std::ios::trunc) {
+        std::string header(MAGIC);
+        append_pod<uint32_t>(header, BinarySnapshot::VERSION);
+        append_pod<uint32_t>(header, BinarySnapshot::HAS_HASHES);
+        append_pod<uint32_t>(header, shards_count);
+        append_pod<uint32_t>(header, 0);
+        append_pod<uint64_t>(header, hash_probe);
+        file_.write(header.data(), header.size());
+    }
+
+    void add(uint32_t shard, uint64_t hash, std::string_view key, std::string_view value) override {
+        if (shard != shard_ || payload_.size() >= MAX_BLOCK_PAYLOAD) {
+            close_block();
+            shard_ = shard;
+        }
+        append_pod<uint64_t>(payload_, hash);
+        append_pod<uint32_t>(payload_, key.size());
+        append_pod<uint32_t>(payload_, value.size());
+        payload_.append(key);
+        payload_.append(value);
+        ++entries_count_;
+    }
+
+    void write_shard() override {
+        close_block();
+        file_.write(blocks_.data(), blocks_.size());
+        blocks_.clear();
+    }
+
+    void finish() override {
+        write_shard();
+        shard_ = BinarySnapshot::END_OF_SNAPSHOT;
+        append_block_header();
+        file_.write(blocks_.data(), blocks_.size());
+        file_.close();
+        if (!file_) {
+            throw std::runtime_error(
+                "Failed to write snapshot."
+            );
+        }
+        sync_file(path_);
+    }
+
+private:
+    void close_block() {
+        if (entries_count_ == 0) {
+            return;
+        }
+        append_block_header();
+        blocks_.append(payload_);
+        payload_.clear();
+        entries_count_ = 0;
+    }
+
+    void append_block_header() {
+        append_pod<uint32_t>(blocks_, shard_);
+        append_pod<uint32_t>(blocks_, entries_count_);
+        append_pod<uint32_t>(blocks_, payload_.size());
+        append_pod<uint32_t>(blocks_, crc32(payload_));
+    }
+
+    const std::string path_;
+    std::ofstream file_;
+    uint32_t shard_ = 0;
+    uint32_t entries_count_ = 0;
+    std::string payload_;
+    std::string blocks_;
+};
+
+class JsonSnapshotWriter : public SnapshotWriter {
+public:
+    JsonSnapshotWriter(const std::string& path)
+        : path_(path)
+        , file_(path, std::ios::trunc)
+        , writer_(buffer_) {
+        writer_.StartObject();
+    }
+
+    void add(uint32_t, uint64_t, std::string_view key, std::string_view value) override {
+        writer_.Key(key.data(), key.size());
+        writer_.String(value.data(), value.size());
+    }
+
+    void write_shard() override {
+        file_.write(buffer_.GetString(), buffer_.GetSize());
+        buffer_.Clear();
+    }
+
+    void finish() override {
+        writer_.EndObject();
+        write_shard();
+        file_.close();
+        if (!file_) {
+            throw std::runtime_error(
+                "Failed to write snapshot."
+            );
+        }
+        sync_file(path_);
+    }
+
+private:
+    const std::string path_;
+    std::ofstream file_;
+    rapidjson::StringBuffer buffer_;
+    rapidjson::Writer<rapidjson::StringBuffer> writer_;
+};
+
+}
+
+std::unique_ptr<SnapshotWriter> SnapshotWriter::create(SnapshotFormat format, const std::string& path, uint32_t shards_count, uint64_t hash_probe) {
+    if (format == SnapshotFormat::BINARY) {
+        return std::make_unique<BinarySnapshotWriter>(path, shards_count, hash_probe);
+    }
+    return std::make_unique<JsonSnapshotWriter>(path);
+}
+
+BinarySnapshot::BinarySnapshot(const std::string& path)
+    : path_(path) {
+    int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error(
+            "Failed to open snapshot " + path_ + ": " + std::strerror(errno)
+        );
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < FILE_HEADER_SIZE) {
+        ::close(fd);
+        throw std::runtime_error(
+            "Snapshot " + path_ + " is truncated."
+        );
+    }
+    size_ = st.st_size;
+    void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error(
+            "Failed to map snapshot " + path_ + ": " + std::strerror(errno)
+        );
+    }
+    data_ = static_cast<const char*>(data);
+    ::madvise(data, size_, MADV_WILLNEED);
+
+    try {
+        index_blocks();
+    } catch (...) {
+        ::munmap(data, size_);
+        throw;
+    }
+}
+
+void BinarySnapshot::index_blocks() {
+    if (std::string_view(data_, MAGIC.size()) != MAGIC || read_pod<uint32_t>(data_ + 8) != VERSION) {
+        throw std::runtime_error(
+            "Snapshot " + path_ + " has unknown format or version."
+        );
+    }
+    flags_ = read_pod<uint32_t>(data_ + 12);
+    shards_count_ = read_pod<uint32_t>(data_ + 16);
+    hash_probe_ = read_pod<uint64_t>(data_ + 24);
+
+    size_t pos = FILE_HEADER_SIZE;
+    while (true) {
+        if (size_ - pos < BLOCK_HEADER_SIZE) {
+            throw std::runtime_error(
+                "Snapshot " + path_ + " is truncated."
+            );
+        }
+        Block block;
+        block.shard = read_pod<uint32_t>(data_ + pos);
+        block.entries_count = read_pod<uint32_t>(data_ + pos + 4);
+        uint32_t payload_size = read_pod<uint32_t>(data_ + pos + 8);
+        block.crc = read_pod<uint32_t>(data_ + pos + 12);
+        pos += BLOCK_HEADER_SIZE;
+        if (block.shard == END_OF_SNAPSHOT) {
+            break;
+        }
+        if (size_ - pos < payload_size) {
+            throw std::runtime_error(
+                "Snapshot " + path_ + " is truncated."
+            );
+        }
+        block.payload = std::string_view(data_ + pos, payload_size);
+        pos += payload_size;
+        blocks_.push_back(block);
+    }
+}
+
+BinarySnapshot::~BinarySnapshot() {
+    if (data_) {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+bool BinarySnapshot::is_binary_snapshot(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::string magic(MAGIC.size(), '\0');
+    file.read(magic.data(), magic.size());
+    return file && magic == MAGIC;
+}
+
+void BinarySnapshot::for_each_entry(const Block& block, const std::function<void(uint64_t, std::string_view, std::string_view)>& f) const {
+    if (crc32(block.payload) != block.crc) {
+        throw std::runtime_error(
+            "Snapshot " + path_ + " has a corrupted block."
+        );
+    }
+
+    const size_t entry_header_size = (has_hashes() ? sizeof(uint64_t) : 0) + 2 * sizeof(uint32_t);
+    const char* data = block.payload.data();
+    size_t left = block.payload.size();
+    for (uint32_t i = 0; i < block.entries_count; ++i) {
+        if (left < entry_header_size) {
+            throw std::runtime_error(
+                "Snapshot " + path_ + " has a malformed block."
+            );
+        }
+        uint64_t hash = 0;
+        if (has_hashes()) {
+            hash = read_pod<uint64_t>(data);
+            data += sizeof(uint64_t);
+        }
+        uint32_t key_size = read_pod<uint32_t>(data);
+        uint32_t value_size = read_pod<uint32_t>(data + sizeof(uint32_t));
+        data += 2 * sizeof(uint32_t);
+        left -= entry_header_size;
+        if (left < static_cast<size_t>(key_size) + value_size) {
+            throw std::runtime_error(
+                "Snapshot " + path_ + " has a malformed block."
+            );
+        }
+        f(hash, std::string_view(data, key_size), std::string_view(data + key_size, value_size));
+        data += key_size + value_size;
+        left -= key_size + value_size;
+    }
+}
+
+void read_json_snapshot(const std::string& path, const std::function<void(std::string_view, std::string_view)>& f) {
+    rapidjson::Document dictionary;
+    {
+        std::ifstream file(path);
+        rapidjson::IStreamWrapper isw(file);
+        dictionary.ParseStream(isw);
+    }
+    if (dictionary.HasParseError() || !dictionary.IsObject()) {
+        throw std::runtime_error(
+            "Error parsing dictionary file."
+        );
+    }
+
+    for (const auto& [key, value] : dictionary.GetObject()) {
+        if (!value.IsString()) {
+            throw std::runtime_error(
+                "Dictionary file contains non-string values."
+            );
+        }
+        f(std::string_view(key.GetString(), key.GetStringLength()), std::string_view(value.GetString(), value.GetStringLength()));
+    }
+}
+
+std::string get_snapshot_delta_path(const std::string& path, uint64_t delta_id) {
+    return path + ".delta." + std::to_string(delta_id);
+}
+
+void sync_parent_directory(const std::string& path) {
+    std::filesystem::path file_path(path);
+    auto dir = file_path.has_parent_path() ? file_path.parent_path().string() : std::string(".");
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + dir + ": " + std::strerror(errno));
+    }
+    int res = ::fsync(fd);
+    int error = errno;
+    ::close(fd);
+    if (res != 0) {
+        throw std::runtime_error("Failed to sync " + dir + ": " + std::strerror(error));
+    }
+}
+
+std::vector<std::pair<uint64_t, std::string>> list_snapshot_deltas(const std::string& path) {
+    std::filesystem::path dictionary_path(path);
+    auto dir = dictionary_path.has_parent_path() ? dictionary_path.parent_path() : std::filesystem::path(".");
+    auto prefix = dictionary_path.filename().string() + ".delta.";
+
+    std::vector<std::pair<uint64_t, std::string>> deltas;
+    for (const auto& file : std::filesystem::directory_iterator(dir)) {
+        auto name = file.path().filename().string();
+        if (!name.starts_with(prefix)) {
+            continue;
+        }
+        uint64_t id = 0;
+        auto [end, ec] = std::from_chars(name.data() + prefix.size(), name.data() + name.size(), id);
+        if (ec != std::errc() || end != name.data() + name.size()) {
+            continue;
+        }
+        deltas.emplace_back(id, file.path().string());
+    }
+    std::sort(deltas.begin(), deltas.end());
+    return deltas;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+enum class SnapshotFormat {
+    BINARY,
+    JSON,
+};
+
+// Streams a dump shard by shard. add() only buffers, write_shard() does the I/O,
+// so that add() can be called under a shard lock and write_shard() outside of it.
+class SnapshotWriter {
+public:
+    virtual ~SnapshotWriter() = default;
+
+    virtual void add(uint32_t shard, uint64_t hash, std::string_view key, std::string_view value) = 0;
+    virtual void write_shard() = 0;
+    // Writes the rest, file writers sync the file before returning. Throws on failure
+    virtual void finish() = 0;
+
+    static std::unique_ptr<SnapshotWriter> create(SnapshotFormat format, const std::string& path, uint32_t shards_count, uint64_t hash_probe);
+};
+
+// Binary snapshot layout, all integers are little-endian:
+//
+// header:  "DICTSNAP", version, flags, writer's shards count, reserved (uint32_t), hash probe (uint64_t)
+// block:   shard, entries count, payload size, crc32 of payload (uint32_t), payload
+// entry:   [hash (uint64_t)], key size, value size (uint32_t), key, value
+// trailer: block with shard == END_OF_SNAPSHOT and no entries
+//
+// Entries of a block belong to one writer shard. Hashes are stored when HAS_HASHES is set,
+// they are only valid if the hash probe (hash of HASH_PROBE_KEY) matches the reader's one.
+class BinarySnapshot {
+public:
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t HAS_HASHES = 1;
+    static constexpr uint32_t END_OF_SNAPSHOT = 0xFFFFFFFF;
+    static constexpr std::string_view HASH_PROBE_KEY = "dictionary";
+
+    struct Block {
+        uint32_t shard;
+        uint32_t entries_count;
+        uint32_t crc;
+        std::string_view payload;
+    };
+
+public:
+    // Maps the file and indexes its blocks, throws if the file is not a complete snapshot
+    BinarySnapshot(const std::string& path);
+
+    BinarySnapshot(const BinarySnapshot&) = delete;
+    BinarySnapshot& operator=(const BinarySnapshot&) = delete;
+
+    ~BinarySnapshot();
+
+    static bool is_binary_snapshot(const std::string& path);
+
+    uint32_t get_shards_count() const {
+        return shards_count_;
+    }
+    bool has_hashes() const {
+        return flags_ & HAS_HASHES;
+    }
+    uint64_t get_hash_probe() const {
+        return hash_probe_;
+    }
+    const std::vector<Block>& get_blocks() const {
+        return blocks_;
+    }
+
+    // Throws if the checksum does not match
+    void for_each_entry(const Block& block, const std::function<void(uint64_t, std::string_view, std::string_view)>& f) const;
+
+private:
+    void index_blocks();
+
+    const std::string path_;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+
+    uint32_t flags_ = 0;
+    uint32_t shards_count_ = 0;
+    uint64_t hash_probe_ = 0;
+    std::vector<Block> blocks_;
+};
+
+// Calls f for every key/value pair of a JSON object file, throws on parse errors and non-string values
+void read_json_snapshot(const std::string& path, const std::function<void(std::string_view, std::string_view)>& f);
+
+// Syncs the directory of path, making the files renamed or removed in it durable
+void sync_parent_directory(const std::string& path);
+
+// Incremental dumps of the dictionary file at path are written to <path>.delta.<id>, ids grow with every delta
+std::string get_snapshot_delta_path(const std::string& path, uint64_t delta_id);
+// Deltas of the dictionary file at path as (id, path), in the order they were written
+std::vector<std::pair<uint64_t, std::string>> list_snapshot_deltas(const std::string& path);
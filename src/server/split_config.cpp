@@ -0,0 +1,125 @@
+#include "snapshot.h"
+
+#include "../util/hash_ring.h"
+
+#include <charconv>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+namespace {
+
+// Writers buffer what they are given, it is written out every this many keys
+constexpr size_t FLUSH_EVERY = 100000;
+
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " <config.txt> <shards_count> [options]" << std::endl;
+    std::cerr << "Splits a dictionary, with the deltas of its incremental dumps, between shards_count servers the way ShardedClient routes the keys," << std::endl;
+    std::cerr << "shard i is written to output_dir/config_i.txt and is served with --config=output_dir/config_i.txt" << std::endl;
+    std::cerr << "--output-dir=DIR - directory of the shard files, created if missing (.)" << std::endl;
+    std::cerr << "--format=binary|json - format of the shard files (binary)" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    std::string input = argv[1];
+    size_t shards_count = 0;
+    std::string_view shards_arg = argv[2];
+    auto [end, ec] = std::from_chars(shards_arg.data(), shards_arg.data() + shards_arg.size(), shards_count);
+    if (ec != std::errc() || end != shards_arg.data() + shards_arg.size() || shards_count == 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::filesystem::path output_dir = ".";
+    SnapshotFormat format = SnapshotFormat::BINARY;
+    for (int i = 3; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with("--output-dir=")) {
+            output_dir = std::string(arg.substr(arg.find('=') + 1));
+        } else if (arg == "--format=binary") {
+            format = SnapshotFormat::BINARY;
+        } else if (arg == "--format=json") {
+            format = SnapshotFormat::JSON;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    try {
+        std::filesystem::create_directories(output_dir);
+        HashRing ring(shards_count);
+        // One writer shard and no valid hashes: the server hashes the keys itself, with its own number of shards
+        std::vector<std::unique_ptr<SnapshotWriter>> writers;
+        for (size_t i = 0; i < shards_count; ++i) {
+            auto path = output_dir / ("config_" + std::to_string(i) + ".txt");
+            writers.push_back(SnapshotWriter::create(format, path.string(), 1, 0));
+        }
+
+        std::vector<size_t> counts(shards_count);
+        size_t total = 0;
+        auto add = [&](std::string_view key, std::string_view value) {
+            size_t shard = ring.shard(key);
+            writers[shard]->add(0, 0, key, value);
+            ++counts[shard];
+            if (++total % FLUSH_EVERY == 0) {
+                for (auto& writer : writers) {
+                    writer->write_shard();
+                }
+            }
+        };
+        auto read = [](const std::string& path, const std::function<void(std::string_view, std::string_view)>& f) {
+            if (BinarySnapshot::is_binary_snapshot(path)) {
+                BinarySnapshot snapshot(path);
+                for (const auto& block : snapshot.get_blocks()) {
+                    snapshot.for_each_entry(block, [&](uint64_t, std::string_view key, std::string_view value) {
+                        f(key, value);
+                    });
+                }
+            } else {
+                read_json_snapshot(path, f);
+            }
+        };
+        // Keys of incremental dumps replace those of the file. The shard files are loaded in parallel,
+        // so a key must appear in them once.
+        std::unordered_map<std::string, std::string> updated;
+        for (const auto& [id, delta_path] : list_snapshot_deltas(input)) {
+            read(delta_path, [&](std::string_view key, std::string_view value) {
+                updated.insert_or_assign(std::string(key), std::string(value));
+            });
+        }
+        read(input, [&](std::string_view key, std::string_view value) {
+            if (!updated.contains(std::string(key))) {
+                add(key, value);
+            }
+        });
+        for (const auto& [key, value] : updated) {
+            add(key, value);
+        }
+        for (auto& writer : writers) {
+            writer->finish();
+        }
+
+        std::cout << "shard\tkeys" << std::endl;
+        for (size_t i = 0; i < shards_count; ++i) {
+            std::cout << i << "\t" << counts[i] << std::endl;
+        }
+        std::cerr << "Split " << total << " keys of " << input << " into " << shards_count << " shards in " << output_dir.string() << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to split " << input << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
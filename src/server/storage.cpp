@@ -1,47 +1,76 @@
 #include "storage.h"
 
+#include "../util/log.h"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <exception>
 #include <filesystem>
 #include <fstream>
+#include <limits>
 #include <mutex>
+#include <vector>
+
 
-#include <iostream>
+namespace {
 
-#include <yaml-cpp/yaml.h>
+// Retired values a shard accumulates before it asks the epoch manager which of them can be freed
+constexpr size_t RECLAIM_BATCH = 64;
 
-#include <rapidjson/istreamwrapper.h>
-#include <rapidjson/ostreamwrapper.h>
-#include <rapidjson/stringbuffer.h>
-#include <rapidjson/writer.h>
+// 1 MiB of counters, estimates of get counts of missing keys are too high by at most 1/12000 of all misses
+constexpr size_t MISS_SKETCH_WIDTH = size_t(1) << 15;
 
+}
 
-Storage::Storage(const std::string& path)
-    : path_(path)
-    , tmp_path_(path + ".tmp") {
+Storage::Storage(const std::string& path, const StorageOptions& options)
+    : shards_(std::make_unique<Shard[]>(options.shards_count))
+    , shards_count_(options.shards_count)
+    , miss_counts_(MISS_SKETCH_WIDTH)
+    , watches_(std::make_shared<WatchRegistry>(options.watch_queue_keys))
+    , read_only_(options.read_only)
+    , incremental_dumps_(options.incremental_dumps)
+    , delta_merge_percent_(options.delta_merge_percent)
+    , max_deltas_(std::max<size_t>(options.max_deltas, 1))
+    , path_(path)
+    , tmp_path_(path + ".tmp")
+    , snapshot_format_(options.snapshot_format) {
+    if (!std::has_single_bit(shards_count_)) {
+        throw std::invalid_argument(
+            "Shards count must be a power of two."
+        );
+    }
     if (std::filesystem::exists(tmp_path_)) {
         throw std::runtime_error(
             ".tmp file exists at start, there must be a problem with the previous run. Fix it manually and restart the server."
         );
     }
-    if (!std::filesystem::exists(path_)) {
+    // A follower gets the dictionary from its leader, it may start without a file
+    bool exists = std::filesystem::exists(path_);
+    if (!exists && !read_only_) {
         throw std::runtime_error(
             "Dictionary file does not exist."
         );
     }
 
-    std::ifstream file(path_);
-    rapidjson::IStreamWrapper isw(file);
-    dictionary_.ParseStream(isw);
-    if (dictionary_.HasParseError()) {
-        throw std::runtime_error(
-            "Error parsing dictionary file."
-        );
+    size_t load_threads = options.load_threads > 0 ? options.load_threads : std::max(1u, std::thread::hardware_concurrency());
+    if (exists) {
+        load_from_file(path_, load_threads);
     }
-    for (const auto& [key, value] : dictionary_.GetObject()) {
-        if (!value.IsString()) {
-            throw std::runtime_error(
-                "Dictionary file contains non-string values."
-            );
-        }
+    auto deltas = list_snapshot_deltas(path_);
+    for (const auto& [id, delta_path] : deltas) {
+        load_from_file(delta_path, load_threads);
+    }
+    if (!deltas.empty()) {
+        LOG_INFO("Applied " << deltas.size() << " deltas");
+    }
+    replay_wal();
+    if (options.wal) {
+        wal_ = std::make_unique<WriteAheadLog>(path_, *options.wal);
+    }
+    if (options.replication_log_bytes > 0) {
+        replication_log_ = std::make_unique<ReplicationLog>(options.replication_log_bytes);
     }
 }
 
@@ -49,80 +78,607 @@ Storage::~Storage() {
     dump_to_file();
 }
 
-Storage::Stat Storage::set(const std::string& key, const std::string& value) {
-    auto& key_stat = get_key_stats(key);
-    key_stat.inc_set();
-    auto res = stats_per_key_[key].take();
+Storage::Stat Storage::set(std::string_view key, std::string_view value) {
+    auto key_hash = hash(key);
+    auto& shard = get_shard(key_hash);
+    count_set();
+    hot_keys::record(key_hash, key);
+    auto stopwatch = metrics::Stopwatch::start_sampled();
 
-    total_stats_.inc_set();
-    last_period_total_stats_.inc_set();
+    Stat res;
+    uint64_t lsn = 0;
+    {
+        bool snapshot_pending = shard.snapshot_pending.load(std::memory_order_relaxed);
+        auto lock_start = snapshot_pending ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
 
-    rapidjson::Value key_json = rapidjson::Value(key.c_str(), dictionary_.GetAllocator());
-    rapidjson::Value value_json = rapidjson::Value(value.c_str(), dictionary_.GetAllocator());
+        std::unique_lock lock(shard.mutex);
+        res = set_locked(shard, key, key_hash, value, lsn);
+        if (snapshot_pending) [[unlikely]] {
+            auto stall = std::chrono::steady_clock::now() - lock_start;
+            snapshot_writer_stall_us_.fetch_add(
+                std::chrono::duration_cast<std::chrono::microseconds>(stall).count(),
+                std::memory_order_relaxed
+            );
+        }
+    }
 
-    std::unique_lock lock(dictionary_mutex_);
-    if (dictionary_.HasMember(key_json)) {
-        dictionary_[key_json].SetString(value_json.GetString(), dictionary_.GetAllocator());
-    } else {
-        dictionary_.AddMember(key_json, value_json, dictionary_.GetAllocator());
+    if (wal_) {
+        wal_->wait_durable(lsn);
     }
-    need_dump_.store(true);
+    stopwatch.record(metrics::Histogram::STORAGE_SET);
+    return res;
+}
+
+std::vector<Storage::Stat> Storage::set_many(std::span<const std::string_view> keys, std::span<const std::string_view> values) {
+    if (keys.size() != values.size()) {
+        throw std::invalid_argument(
+            "Every key of a batch must have a value."
+        );
+    }
+
+    std::vector<Stat> res(keys.size());
+    uint64_t lsn = 0;
+    auto batch = group_by_shard(keys);
+    for (size_t begin = 0; begin < batch.size();) {
+        auto& shard = shards_[batch[begin].shard];
+        size_t end = begin + 1;
+        while (end < batch.size() && batch[end].shard == batch[begin].shard) {
+            ++end;
+        }
+
+        bool snapshot_pending = shard.snapshot_pending.load(std::memory_order_relaxed);
+        auto lock_start = snapshot_pending ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
 
+        std::unique_lock lock(shard.mutex);
+        for (size_t i = begin; i < end; ++i) {
+            count_set();
+            size_t index = batch[i].index;
+            hot_keys::record(batch[i].hash, keys[index]);
+            res[index] = set_locked(shard, keys[index], batch[i].hash, values[index], lsn);
+        }
+        if (snapshot_pending) [[unlikely]] {
+            auto stall = std::chrono::steady_clock::now() - lock_start;
+            snapshot_writer_stall_us_.fetch_add(
+                std::chrono::duration_cast<std::chrono::microseconds>(stall).count(),
+                std::memory_order_relaxed
+            );
+        }
+        begin = end;
+    }
+
+    // Records are appended in order, durability of the last one covers the whole batch
+    if (wal_ && !keys.empty()) {
+        wal_->wait_durable(lsn);
+    }
     return res;
 }
 
-std::pair<std::optional<std::string>, Storage::Stat> Storage::get(const std::string& key) const {
-    auto& key_stat = get_key_stats(key);
-    key_stat.inc_get();
-    auto res = stats_per_key_[key].take();
+Storage::Stat Storage::set_locked(Shard& shard, std::string_view key, uint64_t key_hash, std::string_view value, uint64_t& lsn) {
+    auto& entry = insert_locked(shard, key, key_hash);
+    if (!entry.value.load(std::memory_order_relaxed)) {
+        // The first set of the key, lookups before it were counted as misses
+        entry.get_count.store(miss_counts_.estimate(key_hash), std::memory_order_relaxed);
+    }
+    if (shard.snapshot_pending.load(std::memory_order_relaxed)) [[unlikely]] {
+        preserve_for_snapshot(shard, entry);
+    }
+    assign_value(shard, entry, value);
+    mark_dirty(shard, entry, key_hash);
+    // Logged under the shard lock, so records of one key are in the order of updates
+    if (wal_) {
+        lsn = wal_->append(key, value);
+    }
+    if (replication_log_) {
+        replication_log_->append(key, value);
+    }
+    // Orders the value written above before the check, see WatchRegistry::active()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (watches_->active()) [[unlikely]] {
+        watches_->notify(key, value);
+    }
+    need_dump_.store(true);
+    return inc_set(entry);
+}
+
+template <typename F>
+Storage::UpdateResult Storage::update(std::string_view key, F&& f) {
+    auto key_hash = hash(key);
+    auto& shard = get_shard(key_hash);
+    hot_keys::record(key_hash, key);
+    auto stopwatch = metrics::Stopwatch::start_sampled();
+
+    UpdateResult res;
+    uint64_t lsn = 0;
+    {
+        bool snapshot_pending = shard.snapshot_pending.load(std::memory_order_relaxed);
+        auto lock_start = snapshot_pending ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
 
-    total_stats_.inc_get();
-    last_period_total_stats_.inc_get();
+        std::unique_lock lock(shard.mutex);
+        auto* entry = shard.table.find(key, key_hash);
+        auto current = entry ? value_of(*entry) : std::nullopt;
+        // The new value is a copy, current is retired by the set and must not be used after it
+        res.value = f(current, res);
+        if (res.value) {
+            count_set();
+            res.applied = true;
+            res.stat = set_locked(shard, key, key_hash, *res.value, lsn);
+        } else if (current) {
+            count_get();
+            res.value.emplace(*current);
+            res.stat = inc_get(*entry);
+        } else {
+            count_get();
+            res.stat = count_miss(key_hash);
+        }
+        if (snapshot_pending) [[unlikely]] {
+            auto stall = std::chrono::steady_clock::now() - lock_start;
+            snapshot_writer_stall_us_.fetch_add(
+                std::chrono::duration_cast<std::chrono::microseconds>(stall).count(),
+                std::memory_order_relaxed
+            );
+        }
+    }
 
-    auto key_json = rapidjson::StringRef(key.data(), key.size());
-    std::shared_lock lock(dictionary_mutex_);
-    if (dictionary_.HasMember(key_json)) {
-        return {dictionary_.FindMember(key_json)->value.GetString(), res};
+    if (res.applied && wal_) {
+        wal_->wait_durable(lsn);
     }
+    stopwatch.record(metrics::Histogram::STORAGE_SET);
+    return res;
+}
 
-    return {std::nullopt, res};
+Storage::UpdateResult Storage::compare_and_set(std::string_view key, std::string_view expected, std::string_view value) {
+    return update(key, [&](std::optional<std::string_view> current, UpdateResult&) -> std::optional<std::string> {
+        if (current != expected) {
+            return std::nullopt;
+        }
+        return std::string(value);
+    });
+}
+
+Storage::UpdateResult Storage::increment(std::string_view key, int64_t delta) {
+    return update(key, [&](std::optional<std::string_view> current, UpdateResult& result) -> std::optional<std::string> {
+        int64_t number = 0;
+        if (current) {
+            auto [end, error] = std::from_chars(current->data(), current->data() + current->size(), number);
+            if (error != std::errc() || end != current->data() + current->size()) {
+                result.invalid = true;
+                return std::nullopt;
+            }
+        }
+        if (__builtin_add_overflow(number, delta, &number)) {
+            result.invalid = true;
+            return std::nullopt;
+        }
+        return std::to_string(number);
+    });
+}
+
+Storage::UpdateResult Storage::append(std::string_view key, std::string_view value) {
+    return update(key, [&](std::optional<std::string_view> current, UpdateResult&) -> std::optional<std::string> {
+        std::string res;
+        res.reserve(current.value_or(std::string_view()).size() + value.size());
+        res.append(current.value_or(std::string_view()));
+        res.append(value);
+        return res;
+    });
+}
+
+Storage::UpdateResult Storage::set_if_absent(std::string_view key, std::string_view value) {
+    return update(key, [&](std::optional<std::string_view> current, UpdateResult&) -> std::optional<std::string> {
+        if (current) {
+            return std::nullopt;
+        }
+        return std::string(value);
+    });
+}
+
+std::pair<std::optional<std::string>, Storage::Stat> Storage::get(std::string_view key) const {
+    std::pair<std::optional<std::string>, Stat> res;
+    visit_value(key, [&res](std::optional<std::string_view> value, Stat stat) {
+        if (value) {
+            res.first.emplace(*value);
+        }
+        res.second = stat;
+    });
+    return res;
 }
 
 void Storage::dump_to_file() const {
+    std::lock_guard dump_lock(dump_mutex_);
     if (!need_dump_.exchange(false)) {
         return;
     }
-    rapidjson::Document dictionary_copy;
+    auto start = std::chrono::steady_clock::now();
+
+    auto deltas = list_snapshot_deltas(path_);
+    bool base = should_write_base(deltas);
+
+    uint64_t wal_segment = std::numeric_limits<uint64_t>::max();
+    auto writer = SnapshotWriter::create(snapshot_format_, tmp_path_, shards_count_, hash(BinarySnapshot::HASH_PROBE_KEY));
+    write_snapshot_locked(*writer, base ? CutMode::BASE : CutMode::DELTA, &wal_segment);
+    writer->finish();
+    dump_bytes_.fetch_add(std::filesystem::file_size(tmp_path_));
+
+    // The dump is synced by finish(), its rename has to be durable as well before the files it replaces are removed
+    if (base) {
+        std::filesystem::rename(tmp_path_, path_);
+        sync_parent_directory(path_);
+        // The base has the keys of the deltas now. A crash before they are removed applies them over it again:
+        // their keys go back to the values of the last delta, and the WAL, removed after them, brings the keys
+        // forward. Without the WAL no key ends up older than a crash before this dump would leave it.
+        for (const auto& [id, delta_path] : deltas) {
+            std::filesystem::remove(delta_path);
+        }
+        // Deltas coming back after the WAL is removed would take their keys back with nothing to bring them forward
+        if (!deltas.empty()) {
+            sync_parent_directory(path_);
+        }
+        snapshots_count_.fetch_add(1);
+    } else {
+        std::filesystem::rename(tmp_path_, get_snapshot_delta_path(path_, deltas.empty() ? 1 : deltas.back().first + 1));
+        sync_parent_directory(path_);
+        deltas_count_.fetch_add(1);
+    }
+    // Every record of the closed segments is in the dump now
+    WriteAheadLog::remove_segments_before(path_, wal_segment);
+
+    auto duration = std::chrono::steady_clock::now() - start;
+    metrics::record(metrics::Histogram::DUMP, duration);
+    last_snapshot_duration_us_.store(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+}
+
+bool Storage::should_write_base(const std::vector<std::pair<uint64_t, std::string>>& deltas) const {
+    if (!incremental_dumps_ || !std::filesystem::exists(path_) || deltas.size() >= max_deltas_) {
+        return true;
+    }
+    // A delta of most of the keys, after a bulk load for one, would be merged right away
+    size_t dirty_count = 0;
+    size_t keys_count = 0;
+    for (size_t i = 0; i < shards_count_; ++i) {
+        std::shared_lock lock(shards_[i].mutex);
+        dirty_count += shards_[i].dirty.size();
+        keys_count += shards_[i].table.size();
+    }
+    if (dirty_count * 100 >= keys_count * delta_merge_percent_) {
+        return true;
+    }
+    uintmax_t deltas_size = 0;
+    for (const auto& [id, delta_path] : deltas) {
+        deltas_size += std::filesystem::file_size(delta_path);
+    }
+    return deltas_size * 100 >= std::filesystem::file_size(path_) * delta_merge_percent_;
+}
+
+uint64_t Storage::write_snapshot(SnapshotWriter& writer) const {
+    std::lock_guard dump_lock(dump_mutex_);
+    return write_snapshot_locked(writer, CutMode::IMAGE, nullptr);
+}
+
+uint64_t Storage::write_snapshot_locked(SnapshotWriter& writer, CutMode mode, uint64_t* wal_segment) const {
+    // Cut: no set is in progress while all shards are locked, so the closed WAL segments
+    // and the replication log up to seq contain exactly the sets that are in the image
+    uint64_t seq = 0;
+    // Dirty lists of the shards at the cut, a delta consists of them
+    std::vector<std::vector<DirtyEntry>> dirty(mode == CutMode::DELTA ? shards_count_ : 0);
     {
-        std::shared_lock lock(dictionary_mutex_);
-        dictionary_copy.CopyFrom(dictionary_, dictionary_copy.GetAllocator());
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        locks.reserve(shards_count_);
+        for (size_t i = 0; i < shards_count_; ++i) {
+            locks.emplace_back(shards_[i].mutex);
+        }
+        if (wal_ && wal_segment) {
+            *wal_segment = wal_->rotate();
+        }
+        if (replication_log_) {
+            seq = replication_log_->last_seq();
+        }
+        for (size_t i = 0; i < shards_count_; ++i) {
+            shards_[i].snapshot_pending.store(true, std::memory_order_relaxed);
+        }
+        if (mode != CutMode::IMAGE) {
+            // Entries of the old lists are put in the new ones by their next set
+            ++dirty_generation_;
+            for (size_t i = 0; i < shards_count_; ++i) {
+                if (mode == CutMode::DELTA) {
+                    dirty[i].swap(shards_[i].dirty);
+                }
+                shards_[i].dirty.clear();
+            }
+        }
     }
 
-    std::ofstream tmp_file(tmp_path_);
-    rapidjson::OStreamWrapper osw(tmp_file);
-    rapidjson::Writer<rapidjson::OStreamWrapper> writer(osw);
-    dictionary_copy.Accept(writer);
-    tmp_file.close();
+    for (size_t i = 0; i < shards_count_; ++i) {
+        auto& shard = shards_[i];
+        auto add = [&](uint64_t key_hash, const HashTable::Entry& entry) {
+            auto preserved = shard.snapshot_preserved.find(entry.key);
+            if (preserved != shard.snapshot_preserved.end()) {
+                if (preserved->second) {
+                    writer.add(i, key_hash, entry.key, *preserved->second);
+                }
+            } else if (auto value = value_of(entry)) {
+                writer.add(i, key_hash, entry.key, *value);
+            }
+        };
+        {
+            // Sets preserve values under the exclusive lock, so they can be read under the shared one
+            std::shared_lock lock(shard.mutex);
+            if (mode == CutMode::DELTA) {
+                for (const auto& dirty_entry : dirty[i]) {
+                    add(dirty_entry.hash, *dirty_entry.entry);
+                }
+            } else {
+                shard.table.for_each(add);
+            }
+        }
+        {
+            std::unique_lock lock(shard.mutex);
+            shard.snapshot_pending.store(false, std::memory_order_relaxed);
+            shard.snapshot_preserved.clear();
+        }
 
-    std::filesystem::rename(tmp_path_, path_);
+        writer.write_shard();
+    }
+    return seq;
+}
+
+Storage::SnapshotStats Storage::get_snapshot_stats() const {
+    SnapshotStats stats;
+    stats.snapshots_count = snapshots_count_.load();
+    stats.deltas_count = deltas_count_.load();
+    stats.bytes_written = dump_bytes_.load();
+    stats.last_duration = std::chrono::microseconds(last_snapshot_duration_us_.load());
+    stats.total_writer_stall = std::chrono::microseconds(snapshot_writer_stall_us_.load());
+    return stats;
 }
 
 std::pair<Storage::Stat, Storage::Stat> Storage::get_and_reset_stats() const {
-    auto total_stats = total_stats_.take();
-    auto last_period_total_stats = last_period_total_stats_.take_and_reset();
-    return {total_stats, last_period_total_stats};
+    return {total_stats_.take(), last_period_total_stats_.take_and_reset()};
 }
 
-Storage::AtomicStat& Storage::get_key_stats(const std::string& key) const {
-    std::shared_lock stats_lock(stats_mutex_);
-    if (!stats_per_key_.contains(key)) [[unlikely]] {
-        stats_lock.unlock();
-        {
-            std::unique_lock insert_stats_lock(stats_mutex_);
-            stats_per_key_[key];
+Storage::Stat Storage::get_total_stats() const {
+    return total_stats_.take();
+}
+
+Storage::Stat Storage::ThreadStats::take() const {
+    Stat res;
+    for (size_t i = 0; i <= EpochManager::MAX_THREADS; ++i) {
+        auto stat = stripes_[i].take();
+        res.get_count += stat.get_count;
+        res.set_count += stat.set_count;
+    }
+    return res;
+}
+
+Storage::Stat Storage::ThreadStats::take_and_reset() const {
+    Stat res;
+    for (size_t i = 0; i <= EpochManager::MAX_THREADS; ++i) {
+        auto stat = stripes_[i].take_and_reset();
+        res.get_count += stat.get_count;
+        res.set_count += stat.set_count;
+    }
+    return res;
+}
+
+SlabAllocator::Stats Storage::get_memory_stats() const {
+    SlabAllocator::Stats res;
+    for (size_t i = 0; i < shards_count_; ++i) {
+        std::shared_lock lock(shards_[i].mutex);
+        const auto& shard_stats = shards_[i].allocator.get_stats();
+        res.live_bytes += shard_stats.live_bytes;
+        res.allocated_bytes += shard_stats.allocated_bytes;
+    }
+    return res;
+}
+
+size_t Storage::size() const {
+    size_t size = 0;
+    for (size_t i = 0; i < shards_count_; ++i) {
+        std::shared_lock lock(shards_[i].mutex);
+        size += shards_[i].table.size();
+    }
+    return size;
+}
+
+uint64_t Storage::hash(std::string_view key) {
+    return std::hash<std::string_view>{}(key);
+}
+
+void Storage::count_get() const {
+    total_stats_.local().inc_get();
+    last_period_total_stats_.local().inc_get();
+}
+
+void Storage::count_set() const {
+    total_stats_.local().inc_set();
+    last_period_total_stats_.local().inc_set();
+}
+
+Storage::Stat Storage::inc_get(HashTable::Entry& entry) {
+    return {
+        entry.get_count.fetch_add(1, std::memory_order_relaxed) + 1,
+        entry.set_count.load(std::memory_order_relaxed),
+    };
+}
+
+Storage::Stat Storage::inc_set(HashTable::Entry& entry) {
+    return {
+        entry.get_count.load(std::memory_order_relaxed),
+        entry.set_count.fetch_add(1, std::memory_order_relaxed) + 1,
+    };
+}
+
+std::optional<std::string_view> Storage::value_of(const HashTable::Entry& entry) {
+    auto* value = entry.value.load();
+    if (!value) {
+        return std::nullopt;
+    }
+    return value->get();
+}
+
+Storage::Stat Storage::count_miss(uint64_t key_hash) const {
+    metrics::add(metrics::Counter::STORAGE_GET_MISSES);
+    return {miss_counts_.add(key_hash), 0};
+}
+
+// Slots inside a shard are picked by the low bits of the hash, so shards use the high ones
+size_t Storage::get_shard_index(uint64_t hash) const {
+    return (hash >> 32) & (shards_count_ - 1);
+}
+
+Storage::Shard& Storage::get_shard(uint64_t hash) const {
+    return shards_[get_shard_index(hash)];
+}
+
+std::vector<Storage::BatchKey> Storage::group_by_shard(std::span<const std::string_view> keys) const {
+    std::vector<BatchKey> batch;
+    batch.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        auto key_hash = hash(keys[i]);
+        batch.push_back({get_shard_index(key_hash), key_hash, i});
+    }
+    std::sort(batch.begin(), batch.end(), [](const BatchKey& a, const BatchKey& b) {
+        return a.shard != b.shard ? a.shard < b.shard : a.index < b.index;
+    });
+    return batch;
+}
+
+HashTable::Entry& Storage::insert_locked(Shard& shard, std::string_view key, uint64_t key_hash) const {
+    auto [entry, inserted] = shard.table.find_or_insert(key, key_hash);
+    if (inserted) {
+        for (auto& slots : shard.table.take_retired()) {
+            shard.retired_slots.push_back({epochs_.current(), std::move(slots)});
         }
-        stats_lock.lock();
+        reclaim(shard);
     }
+    return *entry;
+}
 
-    return stats_per_key_[key];
+// Readers may be holding the old value, it is retired instead of being overwritten in place
+void Storage::assign_value(Shard& shard, HashTable::Entry& entry, std::string_view value) const {
+    char* memory = shard.allocator.allocate(HashTable::Value::allocation_size(value.size()));
+    if (auto* old_value = entry.value.exchange(HashTable::Value::create(memory, value))) {
+        shard.retired_values.push_back({epochs_.current(), old_value});
+        reclaim(shard);
+    }
+}
+
+void Storage::reclaim(Shard& shard) const {
+    if (shard.retired_values.size() < RECLAIM_BATCH && shard.retired_slots.empty()) {
+        return;
+    }
+    auto oldest_epoch = epochs_.collect();
+    std::erase_if(shard.retired_values, [&](const RetiredValue& retired) {
+        if (retired.epoch >= oldest_epoch) {
+            return false;
+        }
+        auto* memory = const_cast<char*>(reinterpret_cast<const char*>(retired.value));
+        shard.allocator.deallocate(memory, HashTable::Value::allocation_size(retired.value->size));
+        return true;
+    });
+    std::erase_if(shard.retired_slots, [&](const RetiredSlots& retired) {
+        return retired.epoch < oldest_epoch;
+    });
+}
+
+void Storage::preserve_for_snapshot(Shard& shard, const HashTable::Entry& entry) {
+    if (shard.snapshot_preserved.contains(entry.key)) {
+        return;
+    }
+    std::optional<std::string> value;
+    if (auto current = value_of(entry)) {
+        value.emplace(*current);
+    }
+    shard.snapshot_preserved.emplace(entry.key, std::move(value));
+}
+
+void Storage::mark_dirty(Shard& shard, HashTable::Entry& entry, uint64_t key_hash) const {
+    if (!incremental_dumps_ || entry.dirty_generation == dirty_generation_) {
+        return;
+    }
+    entry.dirty_generation = dirty_generation_;
+    shard.dirty.push_back({key_hash, &entry});
+}
+
+void Storage::load_from_file(const std::string& path, size_t threads_count) {
+    if (BinarySnapshot::is_binary_snapshot(path)) {
+        load_binary_snapshot(path, threads_count);
+        return;
+    }
+
+    read_json_snapshot(path, [this](std::string_view key, std::string_view value) {
+        auto key_hash = hash(key);
+        auto& shard = get_shard(key_hash);
+        assign_value(shard, insert_locked(shard, key, key_hash), value);
+    });
+}
+
+void Storage::load_binary_snapshot(const std::string& path, size_t threads_count) {
+    BinarySnapshot snapshot(path);
+    const auto& blocks = snapshot.get_blocks();
+    bool hashes_valid = snapshot.has_hashes() && snapshot.get_hash_probe() == hash(BinarySnapshot::HASH_PROBE_KEY);
+    // Then every block goes to a single shard, threads own disjoint shards and don't need locks
+    bool same_layout = hashes_valid && snapshot.get_shards_count() == shards_count_;
+
+    if (same_layout) {
+        std::vector<size_t> shard_sizes(shards_count_);
+        for (const auto& block : blocks) {
+            if (block.shard >= shards_count_) {
+                throw std::runtime_error(
+                    "Snapshot block refers to a nonexistent shard."
+                );
+            }
+            shard_sizes[block.shard] += block.entries_count;
+        }
+        for (size_t i = 0; i < shards_count_; ++i) {
+            shards_[i].table.reserve(shard_sizes[i]);
+        }
+    }
+
+    std::vector<std::exception_ptr> errors(threads_count);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threads_count; ++t) {
+        threads.emplace_back([&, t] {
+            try {
+                for (size_t i = 0; i < blocks.size(); ++i) {
+                    if ((same_layout ? blocks[i].shard : i) % threads_count != t) {
+                        continue;
+                    }
+                    snapshot.for_each_entry(blocks[i], [&](uint64_t stored_hash, std::string_view key, std::string_view value) {
+                        auto key_hash = hashes_valid ? stored_hash : hash(key);
+                        auto& shard = get_shard(key_hash);
+                        std::unique_lock lock(shard.mutex, std::defer_lock);
+                        if (!same_layout) {
+                            lock.lock();
+                        }
+                        assign_value(shard, insert_locked(shard, key, key_hash), value);
+                    });
+                }
+            } catch (...) {
+                errors[t] = std::current_exception();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (const auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+void Storage::replay_wal() {
+    auto applied = WriteAheadLog::replay(path_, [this](std::string_view key, std::string_view value) {
+        auto key_hash = hash(key);
+        auto& shard = get_shard(key_hash);
+        auto& entry = insert_locked(shard, key, key_hash);
+        assign_value(shard, entry, value);
+        // The segments are removed by the next dump, which must have the key then
+        mark_dirty(shard, entry, key_hash);
+    });
+    if (applied > 0) {
+        LOG_INFO("Replayed " << applied << " WAL records");
+        need_dump_.store(true);
+    }
 }
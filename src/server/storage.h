@@ -1,14 +1,52 @@
 #pragma once
 
+#include "count_min_sketch.h"
+#include "epoch_manager.h"
+#include "hash_table.h"
+#include "hot_keys.h"
+#include "metrics.h"
+#include "replication_log.h"
+#include "slab_allocator.h"
+#include "snapshot.h"
+#include "wal.h"
+#include "watch.h"
+
 #include <atomic>
 #include <chrono>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <shared_mutex>
+#include <span>
+#include <string>
 #include <string_view>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
-#include <rapidjson/document.h>
+struct StorageOptions {
+    // Must be a power of two
+    size_t shards_count = 64;
+    // Sets are not logged when empty, the dictionary is persisted only by dumps then
+    std::optional<WriteAheadLog::Options> wal = WriteAheadLog::Options{};
+    // Format of dumps, both formats are accepted on load
+    SnapshotFormat snapshot_format = SnapshotFormat::BINARY;
+    // Threads loading a binary snapshot, hardware concurrency when 0
+    size_t load_threads = 0;
+    // Bytes of the newest sets kept for followers to catch up from, sets are not logged for replication when 0
+    size_t replication_log_bytes = 0;
+    // Set on followers: clients may only read, the dictionary is updated by the replication stream
+    bool read_only = false;
+    // Dumps write only the keys set since the previous dump to <path>.delta.<id>, on start the deltas
+    // are applied over path in order before the WAL. Dumps write all keys to path when false.
+    bool incremental_dumps = true;
+    // A dump rewrites path and removes the deltas once they add up to this percentage of its size,
+    // or once there are max_deltas of them
+    size_t delta_merge_percent = 50;
+    size_t max_deltas = 32;
+    // Changed keys a watching connection may have queued, it gets an overflow instead of them beyond that
+    size_t watch_queue_keys = 4096;
+};
 
 class Storage {
 public:
@@ -17,8 +55,30 @@ public:
         size_t set_count = 0;
     };
 
+    struct UpdateResult {
+        // False if the key kept its value: the condition of the update didn't hold or the update was invalid
+        bool applied = false;
+        // The value is not a decimal integer or the sum overflows, only increment sets it
+        bool invalid = false;
+        // Value of the key after the update
+        std::optional<std::string> value;
+        // Counted as a set when applied and as a get otherwise
+        Stat stat;
+    };
+
+    struct SnapshotStats {
+        // Dumps of all keys
+        size_t snapshots_count = 0;
+        size_t deltas_count = 0;
+        // Bytes of the files written by dumps of both kinds
+        uint64_t bytes_written = 0;
+        std::chrono::microseconds last_duration{0};
+        // Time sets spent waiting for shard locks and preserving old values while a snapshot was running
+        std::chrono::microseconds total_writer_stall{0};
+    };
+
 public:
-    Storage(const std::string& path);
+    Storage(const std::string& path, const StorageOptions& options = {});
 
     Storage(const Storage&) = delete;
     Storage& operator=(const Storage&) = delete;
@@ -27,46 +87,292 @@ public:
 
     ~Storage();
 
-    Stat set(const std::string& key, const std::string& value);
-    std::pair<std::optional<std::string>, Stat> get(const std::string& key) const;
+    Stat set(std::string_view key, std::string_view value);
+    std::pair<std::optional<std::string>, Stat> get(std::string_view key) const;
+
+    // Read-modify-write updates of a single key. The current value is read and the new one is written
+    // under the exclusive lock of the shard, so concurrent updates of a key never overwrite each other.
+    // Applied updates are logged and replicated as sets of the new value.
+    //
+    // Sets value if the key has the value expected, a key without a value never matches
+    UpdateResult compare_and_set(std::string_view key, std::string_view expected, std::string_view value);
+    // Adds delta to the value, a decimal int64; a key without a value counts as 0
+    UpdateResult increment(std::string_view key, int64_t delta);
+    // Appends value to the value, a key without a value is set to value
+    UpdateResult append(std::string_view key, std::string_view value);
+    // Sets value only if the key has no value
+    UpdateResult set_if_absent(std::string_view key, std::string_view value);
+
+    // Calls f(std::optional<std::string_view> value, Stat stat) while the value is protected from reclamation,
+    // so it can be written out without copying it. f must not call the storage.
+    // Lookups of existing keys take no locks and write no memory shared with other readers
+    // except the counters of the key. A key without a value gets no entry, its get_count is an estimate
+    // that may be slightly too high.
+    template <typename F>
+    void visit_value(std::string_view key, F&& f) const;
 
+    // Sets keys[i] to values[i], taking the lock of every involved shard once.
+    // Stats are in the order of keys; if a key repeats, the last value wins.
+    std::vector<Stat> set_many(std::span<const std::string_view> keys, std::span<const std::string_view> values);
+
+    // visit_value for several keys: calls f(size_t index, std::optional<std::string_view> value, Stat stat)
+    // for every key. Keys are visited grouped by shard, not in the order of keys.
+    template <typename F>
+    void visit_values(std::span<const std::string_view> keys, F&& f) const;
+
+    // Writes a point-in-time image of the dictionary, or of the keys set since the previous dump
+    // when dumps are incremental. Shards are serialized one by one, sets that come to a shard before
+    // it is written keep the old value aside for the dump, so the image corresponds to the moment
+    // the dump started.
     void dump_to_file() const;
 
+    // Writes a point-in-time image of the dictionary to writer the way dumps do, without finishing it.
+    // Returns the sequence number of the last set of the replication log the image includes, 0 without the log.
+    uint64_t write_snapshot(SnapshotWriter& writer) const;
+
+    // Null unless replication_log_bytes is set
+    const ReplicationLog* get_replication_log() const {
+        return replication_log_.get();
+    }
+
+    // Every set, of a client or of the replication stream, is pushed to the watchers of the key
+    const std::shared_ptr<WatchRegistry>& get_watch_registry() const {
+        return watches_;
+    }
+
+    bool is_read_only() const {
+        return read_only_;
+    }
+
+    SnapshotStats get_snapshot_stats() const;
+
     std::pair<Stat, Stat> get_and_reset_stats() const;
+    // Same as the first of get_and_reset_stats, without resetting the stats of the period
+    Stat get_total_stats() const;
 
-private:
-    rapidjson::Document dictionary_;
-    mutable std::shared_mutex dictionary_mutex_;
+    SlabAllocator::Stats get_memory_stats() const;
 
-    mutable std::atomic_bool need_dump_ = false;
+    size_t size() const;
 
-    struct AtomicStat {
+private:
+    // Counters are only summed up for reports, relaxed ordering is enough
+    struct alignas(64) AtomicStat {
         std::atomic<size_t> get_count = 0;
         std::atomic<size_t> set_count = 0;
 
         void inc_get() {
-            get_count.fetch_add(1);
+            get_count.fetch_add(1, std::memory_order_relaxed);
         }
         void inc_set() {
-            set_count.fetch_add(1);
+            set_count.fetch_add(1, std::memory_order_relaxed);
         }
 
         Stat take() const {
-            return {get_count.load(), set_count.load()};
+            return {get_count.load(std::memory_order_relaxed), set_count.load(std::memory_order_relaxed)};
         }
 
         Stat take_and_reset() {
-            return {get_count.exchange(0), set_count.exchange(0)};
+            return {get_count.exchange(0, std::memory_order_relaxed), set_count.exchange(0, std::memory_order_relaxed)};
         }
     };
 
-    AtomicStat& get_key_stats(const std::string& key) const;
+    // Totals are kept per thread so that concurrent requests don't share a cache line
+    class ThreadStats {
+    public:
+        ThreadStats()
+            : stripes_(std::make_unique<AtomicStat[]>(EpochManager::MAX_THREADS + 1)) {
+        }
+
+        // Threads without a slot share the last stripe
+        AtomicStat& local() const {
+            return stripes_[EpochManager::thread_slot()];
+        }
+
+        Stat take() const;
+        Stat take_and_reset() const;
 
-    mutable std::unordered_map<std::string, AtomicStat> stats_per_key_;
-    mutable AtomicStat total_stats_;
-    mutable AtomicStat last_period_total_stats_;
-    mutable std::shared_mutex stats_mutex_;
+    private:
+        std::unique_ptr<AtomicStat[]> stripes_;
+    };
+
+    struct RetiredValue {
+        uint64_t epoch;
+        const HashTable::Value* value;
+    };
+
+    struct RetiredSlots {
+        uint64_t epoch;
+        std::unique_ptr<HashTable::Slots> slots;
+    };
+
+    struct DirtyEntry {
+        uint64_t hash;
+        const HashTable::Entry* entry;
+    };
+
+    enum class CutMode {
+        // All keys, the dirty lists are left as they are
+        IMAGE,
+        // All keys for a new base file, the dirty lists are cleared
+        BASE,
+        // The keys of the dirty lists, which are cleared
+        DELTA,
+    };
+
+    // The mutex serializes writers of the shard. Readers of existing keys don't take it,
+    // they pin an epoch instead, and whatever a writer unlinks waits in the retired lists.
+    struct alignas(64) Shard {
+        HashTable table;
+        SlabAllocator allocator;
+        mutable std::shared_mutex mutex;
+
+        std::vector<RetiredValue> retired_values;
+        std::vector<RetiredSlots> retired_slots;
+
+        // Set while a snapshot has not written this shard yet
+        std::atomic_bool snapshot_pending = false;
+        // Values the keys had when the snapshot started, empty if the key had no value
+        std::unordered_map<std::string, std::optional<std::string>> snapshot_preserved;
+
+        // Entries set since the last dump, only kept when dumps are incremental
+        std::vector<DirtyEntry> dirty;
+    };
+
+    struct BatchKey {
+        size_t shard;
+        uint64_t hash;
+        // Position in the batch
+        size_t index;
+    };
+
+    static uint64_t hash(std::string_view key);
+    void count_get() const;
+    void count_set() const;
+    static Stat inc_get(HashTable::Entry& entry);
+    static Stat inc_set(HashTable::Entry& entry);
+    static std::optional<std::string_view> value_of(const HashTable::Entry& entry);
+    // Counts a lookup of a key without a value in miss_counts_
+    Stat count_miss(uint64_t key_hash) const;
+
+    size_t get_shard_index(uint64_t hash) const;
+    Shard& get_shard(uint64_t hash) const;
+    // Keys of a batch ordered by shard, keys of one shard stay in the batch order
+    std::vector<BatchKey> group_by_shard(std::span<const std::string_view> keys) const;
+
+    // Must be called with the shard locked exclusively. lsn is set to the LSN of the WAL record.
+    Stat set_locked(Shard& shard, std::string_view key, uint64_t key_hash, std::string_view value, uint64_t& lsn);
+    // Sets the key to f(std::optional<std::string_view> current, UpdateResult& result) unless it returns
+    // std::nullopt, with the shard locked exclusively. f may only fill result.invalid.
+    template <typename F>
+    UpdateResult update(std::string_view key, F&& f);
+    // These must be called with the shard locked exclusively as well
+    HashTable::Entry& insert_locked(Shard& shard, std::string_view key, uint64_t key_hash) const;
+    void assign_value(Shard& shard, HashTable::Entry& entry, std::string_view value) const;
+    // Frees retired objects no reader can see anymore, once enough of them pile up
+    void reclaim(Shard& shard) const;
+    static void preserve_for_snapshot(Shard& shard, const HashTable::Entry& entry);
+    // Puts the entry in the dirty list of the shard unless it is there, must be called with the shard locked exclusively
+    void mark_dirty(Shard& shard, HashTable::Entry& entry, uint64_t key_hash) const;
+
+    // Whether the next dump rewrites the base file rather than adding a delta to deltas, must be called with dump_mutex_ held
+    bool should_write_base(const std::vector<std::pair<uint64_t, std::string>>& deltas) const;
+    // Must be called with dump_mutex_ held. Rotates the WAL at the cut if wal_segment is set,
+    // and sets it to the id of the new segment.
+    uint64_t write_snapshot_locked(SnapshotWriter& writer, CutMode mode, uint64_t* wal_segment) const;
+
+    void load_from_file(const std::string& path, size_t threads_count);
+    void load_binary_snapshot(const std::string& path, size_t threads_count);
+    void replay_wal();
+
+    std::unique_ptr<Shard[]> shards_;
+    const size_t shards_count_;
+
+    mutable EpochManager epochs_;
+    ThreadStats total_stats_;
+    ThreadStats last_period_total_stats_;
+    // Lookups of keys that have no value don't create entries, their get counts are estimated here.
+    // A key set for the first time starts with the estimate.
+    mutable CountMinSketch<std::atomic<uint64_t>> miss_counts_;
+
+    std::unique_ptr<WriteAheadLog> wal_;
+    std::unique_ptr<ReplicationLog> replication_log_;
+    const std::shared_ptr<WatchRegistry> watches_;
+    const bool read_only_;
+
+    mutable std::atomic_bool need_dump_ = false;
+    mutable std::mutex dump_mutex_;
+    const bool incremental_dumps_;
+    const size_t delta_merge_percent_;
+    const size_t max_deltas_;
+    // Changes only while all shards are locked, so it may be read under any shard lock
+    mutable uint32_t dirty_generation_ = 1;
+
+    mutable std::atomic<size_t> snapshots_count_ = 0;
+    mutable std::atomic<size_t> deltas_count_ = 0;
+    mutable std::atomic<uint64_t> dump_bytes_ = 0;
+    mutable std::atomic<int64_t> last_snapshot_duration_us_ = 0;
+    mutable std::atomic<int64_t> snapshot_writer_stall_us_ = 0;
 
     const std::string path_;
     const std::string tmp_path_;
+    const SnapshotFormat snapshot_format_;
 };
+
+template <typename F>
+void Storage::visit_value(std::string_view key, F&& f) const {
+    auto key_hash = hash(key);
+    auto& shard = get_shard(key_hash);
+    count_get();
+    hot_keys::record(key_hash, key);
+
+    {
+        auto guard = epochs_.pin();
+        std::shared_lock lock(shard.mutex, std::defer_lock);
+        if (!guard.pinned()) [[unlikely]] {
+            // Writers reclaim under the exclusive lock, so the shared one protects as well as an epoch
+            lock.lock();
+        }
+        // An entry being set for the first time has no value yet
+        if (auto* entry = shard.table.find(key, key_hash)) [[likely]] {
+            if (auto value = value_of(*entry)) [[likely]] {
+                auto stat = inc_get(*entry);
+                f(value, stat);
+                return;
+            }
+        }
+    }
+
+    f(std::optional<std::string_view>(), count_miss(key_hash));
+}
+
+template <typename F>
+void Storage::visit_values(std::span<const std::string_view> keys, F&& f) const {
+    auto batch = group_by_shard(keys);
+    for (size_t begin = 0; begin < batch.size();) {
+        auto& shard = shards_[batch[begin].shard];
+        size_t end = begin + 1;
+        while (end < batch.size() && batch[end].shard == batch[begin].shard) {
+            ++end;
+        }
+
+        auto guard = epochs_.pin();
+        std::shared_lock lock(shard.mutex, std::defer_lock);
+        if (!guard.pinned()) [[unlikely]] {
+            lock.lock();
+        }
+        for (size_t i = begin; i < end; ++i) {
+            auto key = keys[batch[i].index];
+            count_get();
+            hot_keys::record(batch[i].hash, key);
+            auto* entry = shard.table.find(key, batch[i].hash);
+            auto value = entry ? value_of(*entry) : std::nullopt;
+            if (value) [[likely]] {
+                auto stat = inc_get(*entry);
+                f(batch[i].index, value, stat);
+            } else {
+                f(batch[i].index, value, count_miss(batch[i].hash));
+            }
+        }
+        begin = end;
+    }
+}
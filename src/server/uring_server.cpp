@@ -0,0 +1,526 @@
+#include "uring_server.h"
+
+#include "input_buffer.h"
+#include "metrics.h"
+#include "request_processor.h"
+#include "../util/thread_affinity.h"
+#include "../util/log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include <liburing.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+namespace {
+
+constexpr unsigned RING_ENTRIES = 4096;
+constexpr unsigned CQE_BATCH = 256;
+
+// Provided receive buffers, shared by all connections of a loop
+constexpr unsigned BUFFERS_COUNT = 1024;
+constexpr size_t BUFFER_SIZE = 16384;
+constexpr int BUFFER_GROUP = 0;
+
+// Receiving pauses while this much output is waiting for the client to read it
+constexpr size_t MAX_PENDING_OUTPUT = 1024 * 1024;
+
+// user_data of an operation: connection id in the high bits, operation in the low byte
+enum class Op : uint8_t {
+    ACCEPT,
+    RECV,
+    SEND,
+    CANCEL,
+    WAKEUP,
+};
+
+uint64_t make_user_data(uint64_t connection_id, Op op) {
+    return (connection_id << 8) | static_cast<uint8_t>(op);
+}
+
+std::runtime_error system_error(const std::string& what, int error) {
+    return std::runtime_error(what + ": " + std::strerror(error));
+}
+
+void append_input(InputBuffer& input, std::string_view data) {
+    while (!data.empty()) {
+        auto space = input.prepare();
+        size_t size = std::min(space.size(), data.size());
+        std::memcpy(space.data(), data.data(), size);
+        input.commit(size);
+        data.remove_prefix(size);
+    }
+}
+
+int listen_reuseport(uint16_t port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw system_error("Failed to create a socket", errno);
+    }
+    int one = 1;
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+            || ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0
+            || ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+            || ::listen(fd, SOMAXCONN) < 0) {
+        int error = errno;
+        ::close(fd);
+        throw system_error("Failed to listen on port " + std::to_string(port), error);
+    }
+    return fd;
+}
+
+}
+
+class UringServer::EventLoop {
+public:
+    EventLoop(std::weak_ptr<Storage> storage, uint16_t port);
+    ~EventLoop();
+
+    void run();
+    // May be called from any thread
+    void stop();
+
+private:
+    struct Connection {
+        Connection(int fd, std::weak_ptr<Storage> storage)
+            : fd(fd)
+            , processor(storage)
+            , input(BUFFER_SIZE) {
+        }
+
+        int fd;
+        RequestProcessor processor;
+        // Only holds the tail of a request split between receives
+        InputBuffer input;
+        std::string output;
+        std::string pending_output;
+        size_t output_sent = 0;
+
+        // Operations whose final completion has not arrived yet
+        size_t ops_in_flight = 0;
+        bool receiving = false;
+        bool sending = false;
+        bool send_queued = false;
+        bool closing = false;
+    };
+
+    io_uring_sqe* get_sqe();
+    void submit(io_uring_sqe* sqe, uint64_t connection_id, Op op);
+
+    void arm_accept();
+    void arm_wakeup();
+    void arm_recv(uint64_t id, Connection& connection);
+    void queue_send(uint64_t id, Connection& connection);
+    void flush_sends();
+
+    void handle(const io_uring_cqe& cqe);
+    void on_accept(const io_uring_cqe& cqe);
+    void on_recv(uint64_t id, Connection& connection, const io_uring_cqe& cqe);
+    void on_send(uint64_t id, Connection& connection, const io_uring_cqe& cqe);
+    void on_data(uint64_t id, Connection& connection, std::string_view data);
+
+    void recycle_buffer(uint16_t buffer_id);
+    void close_connection(uint64_t id, Connection& connection);
+    // Frees the connection once no operation refers to it
+    void release_if_idle(uint64_t id, Connection& connection);
+
+    std::weak_ptr<Storage> storage_;
+
+    io_uring ring_;
+    io_uring_buf_ring* buffer_ring_ = nullptr;
+    std::unique_ptr<char[]> buffers_;
+    int listen_fd_ = -1;
+    int wakeup_fd_ = -1;
+    uint64_t wakeup_value_ = 0;
+
+    std::unordered_map<uint64_t, std::unique_ptr<Connection>> connections_;
+    // Id 0 is used by operations that belong to no connection
+    uint64_t next_connection_id_ = 1;
+    std::vector<uint64_t> send_queue_;
+
+    std::atomic_bool stopped_ = false;
+};
+
+UringServer::EventLoop::EventLoop(std::weak_ptr<Storage> storage, uint16_t port)
+    : storage_(storage) {
+    io_uring_params params{};
+    // The ring is created here, on the thread that builds the server, and only used by the thread of run().
+    // A single issuer ring belongs to the task that enables it, so it starts disabled and run() enables it.
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_R_DISABLED;
+    int res = io_uring_queue_init_params(RING_ENTRIES, &ring_, &params);
+    if (res == -EINVAL) {
+        // Kernels before 6.0 don't know these flags
+        params = {};
+        res = io_uring_queue_init_params(RING_ENTRIES, &ring_, &params);
+    }
+    if (res < 0) {
+        throw system_error("Failed to set up io_uring", -res);
+    }
+
+    try {
+        buffer_ring_ = io_uring_setup_buf_ring(&ring_, BUFFERS_COUNT, BUFFER_GROUP, 0, &res);
+        if (!buffer_ring_) {
+            throw system_error("Failed to register receive buffers", -res);
+        }
+        buffers_ = std::make_unique<char[]>(BUFFERS_COUNT * BUFFER_SIZE);
+        for (unsigned i = 0; i < BUFFERS_COUNT; ++i) {
+            io_uring_buf_ring_add(buffer_ring_, buffers_.get() + i * BUFFER_SIZE, BUFFER_SIZE, i,
+                io_uring_buf_ring_mask(BUFFERS_COUNT), i);
+        }
+        io_uring_buf_ring_advance(buffer_ring_, BUFFERS_COUNT);
+
+        wakeup_fd_ = ::eventfd(0, EFD_CLOEXEC);
+        if (wakeup_fd_ < 0) {
+            throw system_error("Failed to create an eventfd", errno);
+        }
+        listen_fd_ = listen_reuseport(port);
+    } catch (...) {
+        if (wakeup_fd_ >= 0) {
+            ::close(wakeup_fd_);
+        }
+        if (buffer_ring_) {
+            io_uring_free_buf_ring(&ring_, buffer_ring_, BUFFERS_COUNT, BUFFER_GROUP);
+        }
+        io_uring_queue_exit(&ring_);
+        throw;
+    }
+}
+
+UringServer::EventLoop::~EventLoop() {
+    for (auto& [_, connection] : connections_) {
+        ::close(connection->fd);
+    }
+    io_uring_free_buf_ring(&ring_, buffer_ring_, BUFFERS_COUNT, BUFFER_GROUP);
+    io_uring_queue_exit(&ring_);
+    ::close(listen_fd_);
+    ::close(wakeup_fd_);
+}
+
+void UringServer::EventLoop::run() {
+    if (ring_.flags & IORING_SETUP_R_DISABLED) {
+        if (int res = io_uring_enable_rings(&ring_); res < 0) {
+            throw system_error("Failed to enable io_uring", -res);
+        }
+    }
+    arm_accept();
+    arm_wakeup();
+
+    io_uring_cqe* cqes[CQE_BATCH];
+    while (!stopped_.load()) {
+        flush_sends();
+        int res = io_uring_submit_and_wait(&ring_, 1);
+        if (res < 0 && res != -EINTR) {
+            LOG_ERROR("io_uring_submit_and_wait failed: " << std::strerror(-res));
+            return;
+        }
+
+        unsigned count;
+        while ((count = io_uring_peek_batch_cqe(&ring_, cqes, CQE_BATCH)) > 0) {
+            for (unsigned i = 0; i < count; ++i) {
+                handle(*cqes[i]);
+            }
+            io_uring_cq_advance(&ring_, count);
+        }
+    }
+}
+
+void UringServer::EventLoop::stop() {
+    stopped_.store(true);
+    uint64_t one = 1;
+    if (::write(wakeup_fd_, &one, sizeof(one)) < 0) {
+        LOG_ERROR("Failed to wake up io_uring loop: " << std::strerror(errno));
+    }
+}
+
+io_uring_sqe* UringServer::EventLoop::get_sqe() {
+    auto* sqe = io_uring_get_sqe(&ring_);
+    if (!sqe) {
+        // The submission queue is full, hand it to the kernel and retry
+        io_uring_submit(&ring_);
+        sqe = io_uring_get_sqe(&ring_);
+    }
+    if (!sqe) {
+        throw std::runtime_error(
+            "io_uring submission queue is full."
+        );
+    }
+    return sqe;
+}
+
+void UringServer::EventLoop::submit(io_uring_sqe* sqe, uint64_t connection_id, Op op) {
+    io_uring_sqe_set_data64(sqe, make_user_data(connection_id, op));
+}
+
+void UringServer::EventLoop::arm_accept() {
+    auto* sqe = get_sqe();
+    io_uring_prep_multishot_accept(sqe, listen_fd_, nullptr, nullptr, 0);
+    submit(sqe, 0, Op::ACCEPT);
+}
+
+void UringServer::EventLoop::arm_wakeup() {
+    auto* sqe = get_sqe();
+    io_uring_prep_read(sqe, wakeup_fd_, &wakeup_value_, sizeof(wakeup_value_), 0);
+    submit(sqe, 0, Op::WAKEUP);
+}
+
+void UringServer::EventLoop::arm_recv(uint64_t id, Connection& connection) {
+    auto* sqe = get_sqe();
+    io_uring_prep_recv_multishot(sqe, connection.fd, nullptr, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    submit(sqe, id, Op::RECV);
+    connection.receiving = true;
+    ++connection.ops_in_flight;
+}
+
+void UringServer::EventLoop::queue_send(uint64_t id, Connection& connection) {
+    if (!connection.send_queued) {
+        connection.send_queued = true;
+        send_queue_.push_back(id);
+    }
+}
+
+// Sends are prepared after all completions of an iteration are handled, so a connection
+// sends everything its requests of this iteration produced at once
+void UringServer::EventLoop::flush_sends() {
+    for (auto id : send_queue_) {
+        auto it = connections_.find(id);
+        if (it == connections_.end()) {
+            continue;
+        }
+        auto& connection = *it->second;
+        connection.send_queued = false;
+        if (connection.closing || connection.sending || connection.pending_output.empty()) {
+            continue;
+        }
+
+        connection.output.swap(connection.pending_output);
+        connection.pending_output.clear();
+        connection.output_sent = 0;
+        auto* sqe = get_sqe();
+        io_uring_prep_send(sqe, connection.fd, connection.output.data(), connection.output.size(), MSG_NOSIGNAL);
+        submit(sqe, id, Op::SEND);
+        connection.sending = true;
+        ++connection.ops_in_flight;
+    }
+    send_queue_.clear();
+}
+
+void UringServer::EventLoop::handle(const io_uring_cqe& cqe) {
+    uint64_t user_data = io_uring_cqe_get_data64(&cqe);
+    auto op = static_cast<Op>(user_data & 0xFF);
+    uint64_t id = user_data >> 8;
+
+    switch (op) {
+        case Op::ACCEPT:
+            on_accept(cqe);
+            return;
+        case Op::WAKEUP:
+            if (!stopped_.load()) {
+                arm_wakeup();
+            }
+            return;
+        case Op::CANCEL:
+            return;
+        case Op::RECV:
+        case Op::SEND:
+            break;
+    }
+
+    auto it = connections_.find(id);
+    if (it == connections_.end()) {
+        return;
+    }
+    auto& connection = *it->second;
+    if (op == Op::RECV) {
+        on_recv(id, connection, cqe);
+    } else {
+        on_send(id, connection, cqe);
+    }
+    release_if_idle(id, connection);
+}
+
+void UringServer::EventLoop::on_accept(const io_uring_cqe& cqe) {
+    if (cqe.res < 0) {
+        LOG_ERROR("Error accepting connection: " << std::strerror(-cqe.res));
+    } else {
+        uint64_t id = next_connection_id_++;
+        auto& connection = connections_.emplace(id, std::make_unique<Connection>(cqe.res, storage_)).first->second;
+        metrics::add(metrics::Counter::CONNECTIONS_ACCEPTED);
+        arm_recv(id, *connection);
+    }
+    if (!(cqe.flags & IORING_CQE_F_MORE) && !stopped_.load()) {
+        arm_accept();
+    }
+}
+
+void UringServer::EventLoop::on_recv(uint64_t id, Connection& connection, const io_uring_cqe& cqe) {
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    if (!more) {
+        connection.receiving = false;
+        --connection.ops_in_flight;
+    }
+
+    if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+        uint16_t buffer_id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        metrics::add(metrics::Counter::READS);
+        metrics::add(metrics::Counter::BYTES_READ, cqe.res);
+        if (!connection.closing) {
+            on_data(id, connection, std::string_view(buffers_.get() + buffer_id * BUFFER_SIZE, cqe.res));
+        }
+        recycle_buffer(buffer_id);
+    } else if (cqe.res == 0) {
+        close_connection(id, connection);
+        return;
+    } else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+        LOG_WARNING("Error reading data: " << std::strerror(-cqe.res));
+        close_connection(id, connection);
+        return;
+    }
+
+    // Multishot receive stops when buffers run out or when it is cancelled for backpressure
+    if (!connection.receiving && !connection.closing && connection.pending_output.size() < MAX_PENDING_OUTPUT) {
+        arm_recv(id, connection);
+    }
+}
+
+void UringServer::EventLoop::on_data(uint64_t id, Connection& connection, std::string_view data) {
+    std::optional<size_t> consumed;
+    if (connection.input.data().empty()) {
+        // Common case: requests are handled straight from the provided buffer, only a split tail is copied
+        consumed = connection.processor.process(data, connection.pending_output);
+        if (consumed && *consumed < data.size()) {
+            append_input(connection.input, data.substr(*consumed));
+        }
+    } else {
+        append_input(connection.input, data);
+        consumed = connection.processor.process(connection.input.data(), connection.pending_output);
+        if (consumed) {
+            connection.input.consume(*consumed);
+        }
+    }
+
+    if (!consumed) {
+        close_connection(id, connection);
+        return;
+    }
+    if (!connection.pending_output.empty()) {
+        queue_send(id, connection);
+    }
+    if (connection.receiving && connection.pending_output.size() >= MAX_PENDING_OUTPUT) {
+        auto* sqe = get_sqe();
+        io_uring_prep_cancel64(sqe, make_user_data(id, Op::RECV), 0);
+        submit(sqe, id, Op::CANCEL);
+    }
+}
+
+void UringServer::EventLoop::on_send(uint64_t id, Connection& connection, const io_uring_cqe& cqe) {
+    connection.sending = false;
+    --connection.ops_in_flight;
+    if (cqe.res < 0) {
+        LOG_WARNING("Error writing data: " << std::strerror(-cqe.res));
+        close_connection(id, connection);
+        return;
+    }
+    if (connection.closing) {
+        return;
+    }
+
+    metrics::add(metrics::Counter::WRITES);
+    metrics::add(metrics::Counter::BYTES_WRITTEN, cqe.res);
+    connection.output_sent += cqe.res;
+    if (connection.output_sent < connection.output.size()) {
+        auto* sqe = get_sqe();
+        io_uring_prep_send(sqe, connection.fd, connection.output.data() + connection.output_sent,
+            connection.output.size() - connection.output_sent, MSG_NOSIGNAL);
+        submit(sqe, id, Op::SEND);
+        connection.sending = true;
+        ++connection.ops_in_flight;
+        return;
+    }
+
+    connection.output.clear();
+    if (!connection.pending_output.empty()) {
+        queue_send(id, connection);
+    }
+    if (!connection.receiving && connection.pending_output.size() < MAX_PENDING_OUTPUT) {
+        arm_recv(id, connection);
+    }
+}
+
+void UringServer::EventLoop::recycle_buffer(uint16_t buffer_id) {
+    io_uring_buf_ring_add(buffer_ring_, buffers_.get() + buffer_id * BUFFER_SIZE, BUFFER_SIZE, buffer_id,
+        io_uring_buf_ring_mask(BUFFERS_COUNT), 0);
+    io_uring_buf_ring_advance(buffer_ring_, 1);
+}
+
+void UringServer::EventLoop::close_connection(uint64_t id, Connection& connection) {
+    if (connection.closing) {
+        return;
+    }
+    connection.closing = true;
+    if (connection.receiving) {
+        auto* sqe = get_sqe();
+        io_uring_prep_cancel64(sqe, make_user_data(id, Op::RECV), 0);
+        submit(sqe, id, Op::CANCEL);
+    }
+}
+
+void UringServer::EventLoop::release_if_idle(uint64_t id, Connection& connection) {
+    if (connection.closing && connection.ops_in_flight == 0) {
+        ::close(connection.fd);
+        connections_.erase(id);
+        metrics::add(metrics::Counter::CONNECTIONS_CLOSED);
+    }
+}
+
+UringServer::UringServer(std::weak_ptr<Storage> storage, uint16_t port, size_t threads_count, bool pin_threads)
+    : pin_threads_(pin_threads) {
+    for (size_t i = 0; i < threads_count; ++i) {
+        loops_.push_back(std::make_unique<EventLoop>(storage, port));
+    }
+}
+
+UringServer::~UringServer() {
+    stop();
+}
+
+void UringServer::start() {
+    size_t cpus_count = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < loops_.size(); ++i) {
+        threads_.emplace_back([this, i, cpus_count] {
+            if (pin_threads_) {
+                pin_current_thread(i % cpus_count);
+            }
+            try {
+                loops_[i]->run();
+            } catch (const std::exception& e) {
+                LOG_ERROR("io_uring loop failed: " << e.what());
+            }
+        });
+    }
+}
+
+void UringServer::stop() {
+    for (auto& loop : loops_) {
+        loop->stop();
+    }
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+}
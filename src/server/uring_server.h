@@ -0,0 +1,34 @@
+#pragma once
+
+#include "storage.h"
+
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Network backend on io_uring, an alternative to the asio one. Every thread runs its own ring
+// with its own SO_REUSEPORT listening socket, so a connection never leaves the thread that accepted it.
+// Accepts and receives are multishot, received data lands in buffers provided to the kernel through
+// a buffer ring, and the sends produced by one batch of completions are submitted together with
+// the wait for the next batch, in a single system call.
+// Requests are handled by the same RequestProcessor as in the asio backend.
+class UringServer {
+public:
+    UringServer(std::weak_ptr<Storage> storage, uint16_t port, size_t threads_count, bool pin_threads);
+    ~UringServer();
+
+    UringServer(const UringServer&) = delete;
+    UringServer& operator=(const UringServer&) = delete;
+
+    // Starts the threads, returns immediately
+    void start();
+    void stop();
+
+private:
+    class EventLoop;
+
+    std::vector<std::unique_ptr<EventLoop>> loops_;
+    std::vector<std::thread> threads_;
+    const bool pin_threads_;
+};
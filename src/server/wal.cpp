@@ -0,0 +1,249 @@
+#include "wal.h"
+
+#include "../util/crc32.h"
+#include "../util/log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace {
+
+constexpr size_t HEADER_SIZE = 3 * sizeof(uint32_t);
+
+// Returns 0 or the errno of the failed write
+int write_all(int fd, std::string_view data) {
+    while (!data.empty()) {
+        auto written = ::write(fd, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        data.remove_prefix(written);
+    }
+    return 0;
+}
+
+// A failed write may leave a torn record in the middle of the segment, and replay would drop every record
+// after it; after a failed fdatasync the kernel may have dropped the written pages. Either way no later set
+// can be acknowledged, so the server stops and recovers from what reached the disk.
+[[noreturn]] void fail(const std::string& what, int error) {
+    LOG_ERROR(what << ": " << std::strerror(error) << ", stopping");
+    logging::flush();
+    std::abort();
+}
+
+}
+
+WriteAheadLog::WriteAheadLog(const std::string& path, const Options& options)
+    : path_(path)
+    , options_(options) {
+    auto segments = list_segments(path_);
+    open_segment(segments.empty() ? 1 : segments.back().first + 1);
+
+    if (options_.mode == SyncMode::GROUP_COMMIT) {
+        group_commit_thread_ = std::thread([this] {
+            group_commit_job();
+        });
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        std::lock_guard lock(mutex_);
+        stopped_ = true;
+    }
+    flush_cv_.notify_one();
+    if (group_commit_thread_.joinable()) {
+        group_commit_thread_.join();
+    }
+
+    std::lock_guard file_lock(file_mutex_);
+    flush(options_.mode != SyncMode::NO_SYNC);
+    ::close(fd_);
+    // Nothing to replay, don't leave an empty segment behind every restart
+    if (segment_size_ == 0) {
+        std::filesystem::remove(get_segment_path(segment_id_));
+    }
+}
+
+uint64_t WriteAheadLog::append(std::string_view key, std::string_view value) {
+    uint32_t header[3] = {0, static_cast<uint32_t>(key.size()), static_cast<uint32_t>(value.size())};
+    std::string_view sizes(reinterpret_cast<const char*>(header + 1), 2 * sizeof(uint32_t));
+    header[0] = crc32(value, crc32(key, crc32(sizes)));
+
+    std::lock_guard lock(mutex_);
+    buffer_.append(reinterpret_cast<const char*>(header), HEADER_SIZE);
+    buffer_.append(key);
+    buffer_.append(value);
+    ++last_lsn_;
+    if (options_.mode == SyncMode::GROUP_COMMIT && last_lsn_ - durable_lsn_ >= options_.group_commit_records) {
+        flush_cv_.notify_one();
+    }
+    return last_lsn_;
+}
+
+void WriteAheadLog::wait_durable(uint64_t lsn) {
+    if (options_.mode == SyncMode::GROUP_COMMIT) {
+        std::unique_lock lock(mutex_);
+        durable_cv_.wait(lock, [&] {
+            return durable_lsn_ >= lsn || stopped_;
+        });
+        return;
+    }
+
+    // Whoever takes the file lock first writes out the records of everybody waiting behind it
+    std::lock_guard file_lock(file_mutex_);
+    {
+        std::lock_guard lock(mutex_);
+        if (durable_lsn_ >= lsn) {
+            return;
+        }
+    }
+    flush(options_.mode == SyncMode::SYNC_PER_WRITE);
+}
+
+uint64_t WriteAheadLog::rotate() {
+    std::lock_guard file_lock(file_mutex_);
+    flush(options_.mode != SyncMode::NO_SYNC);
+    ::close(fd_);
+    open_segment(segment_id_ + 1);
+    return segment_id_;
+}
+
+void WriteAheadLog::remove_segments_before(const std::string& path, uint64_t segment_id) {
+    for (const auto& [id, segment_path] : list_segments(path)) {
+        if (id < segment_id) {
+            std::filesystem::remove(segment_path);
+        }
+    }
+}
+
+size_t WriteAheadLog::replay(const std::string& path, const std::function<void(std::string_view, std::string_view)>& apply) {
+    size_t applied = 0;
+    for (const auto& [id, segment_path] : list_segments(path)) {
+        std::ifstream file(segment_path, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        size_t pos = 0;
+        while (pos < data.size()) {
+            if (data.size() - pos < HEADER_SIZE) {
+                LOG_WARNING("Torn record at the end of " << segment_path);
+                break;
+            }
+            uint32_t header[3];
+            std::memcpy(header, data.data() + pos, HEADER_SIZE);
+            size_t record_size = HEADER_SIZE + header[1] + header[2];
+            if (data.size() - pos < record_size) {
+                LOG_WARNING("Torn record at the end of " << segment_path);
+                break;
+            }
+            std::string_view sizes(data.data() + pos + sizeof(uint32_t), 2 * sizeof(uint32_t));
+            std::string_view key(data.data() + pos + HEADER_SIZE, header[1]);
+            std::string_view value(key.data() + key.size(), header[2]);
+            if (crc32(value, crc32(key, crc32(sizes))) != header[0]) {
+                LOG_WARNING("Corrupted record in " << segment_path << " at offset " << pos);
+                break;
+            }
+
+            apply(key, value);
+            ++applied;
+            pos += record_size;
+        }
+    }
+    return applied;
+}
+
+std::vector<std::pair<uint64_t, std::string>> WriteAheadLog::list_segments(const std::string& path) {
+    std::filesystem::path log_path(path);
+    auto dir = log_path.has_parent_path() ? log_path.parent_path() : std::filesystem::path(".");
+    auto prefix = log_path.filename().string() + ".wal.";
+
+    std::vector<std::pair<uint64_t, std::string>> segments;
+    for (const auto& file : std::filesystem::directory_iterator(dir)) {
+        auto name = file.path().filename().string();
+        if (!name.starts_with(prefix)) {
+            continue;
+        }
+        uint64_t id = 0;
+        auto [end, ec] = std::from_chars(name.data() + prefix.size(), name.data() + name.size(), id);
+        if (ec != std::errc() || end != name.data() + name.size()) {
+            continue;
+        }
+        segments.emplace_back(id, file.path().string());
+    }
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+std::string WriteAheadLog::get_segment_path(uint64_t segment_id) const {
+    return path_ + ".wal." + std::to_string(segment_id);
+}
+
+void WriteAheadLog::open_segment(uint64_t segment_id) {
+    auto segment_path = get_segment_path(segment_id);
+    fd_ = ::open(segment_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        throw std::runtime_error(
+            "Failed to open WAL segment " + segment_path + ": " + std::strerror(errno)
+        );
+    }
+    segment_id_ = segment_id;
+    segment_size_ = 0;
+}
+
+void WriteAheadLog::flush(bool sync) {
+    uint64_t lsn;
+    flush_buffer_.clear();
+    {
+        std::lock_guard lock(mutex_);
+        flush_buffer_.swap(buffer_);
+        lsn = last_lsn_;
+    }
+
+    if (int error = write_all(fd_, flush_buffer_)) {
+        fail("Error writing WAL segment " + get_segment_path(segment_id_), error);
+    }
+    segment_size_ += flush_buffer_.size();
+    if (sync && ::fdatasync(fd_) != 0) {
+        fail("Error syncing WAL segment " + get_segment_path(segment_id_), errno);
+    }
+
+    {
+        std::lock_guard lock(mutex_);
+        durable_lsn_ = std::max(durable_lsn_, lsn);
+    }
+    durable_cv_.notify_all();
+}
+
+void WriteAheadLog::group_commit_job() {
+    while (true) {
+        {
+            std::unique_lock lock(mutex_);
+            flush_cv_.wait_for(lock, options_.group_commit_interval, [&] {
+                return stopped_ || last_lsn_ - durable_lsn_ >= options_.group_commit_records;
+            });
+            if (stopped_) {
+                return;
+            }
+            if (last_lsn_ == durable_lsn_) {
+                continue;
+            }
+        }
+
+        std::lock_guard file_lock(file_mutex_);
+        flush(true);
+    }
+}
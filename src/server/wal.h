@@ -0,0 +1,90 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Append-only log of set operations. The log is split into segments
+// <path>.wal.<id>, a new segment is started before every snapshot, so
+// segments older than a written snapshot can be removed.
+//
+// A failed write or fdatasync stops the process, so no set is acknowledged after a record that may be torn.
+//
+// Record layout: crc32 of the rest, key size, value size (all uint32_t), key, value.
+class WriteAheadLog {
+public:
+    enum class SyncMode {
+        // Records are written to the file before the set is answered, but never fsynced
+        NO_SYNC,
+        // A background thread fsyncs every group_commit_interval or group_commit_records,
+        // sets wait for the fsync covering their record
+        GROUP_COMMIT,
+        // Every set waits for its own fsync
+        SYNC_PER_WRITE,
+    };
+
+    struct Options {
+        SyncMode mode = SyncMode::NO_SYNC;
+        std::chrono::milliseconds group_commit_interval = std::chrono::milliseconds(5);
+        size_t group_commit_records = 256;
+    };
+
+public:
+    WriteAheadLog(const std::string& path, const Options& options);
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    ~WriteAheadLog();
+
+    // Returns the sequence number of the record. Cheap, meant to be called under the shard lock.
+    uint64_t append(std::string_view key, std::string_view value);
+
+    // Blocks until the record is persisted according to the sync mode
+    void wait_durable(uint64_t lsn);
+
+    // Closes the current segment and starts a new one, returns the id of the new segment
+    uint64_t rotate();
+
+    // Removes segments with ids less than segment_id
+    static void remove_segments_before(const std::string& path, uint64_t segment_id);
+
+    // Applies records of all segments in order, returns the number of applied records.
+    // Reading stops at the first torn or corrupted record of a segment.
+    static size_t replay(const std::string& path, const std::function<void(std::string_view, std::string_view)>& apply);
+
+private:
+    static std::vector<std::pair<uint64_t, std::string>> list_segments(const std::string& path);
+
+    std::string get_segment_path(uint64_t segment_id) const;
+    void open_segment(uint64_t segment_id);
+    // Writes buffered records, must be called with file_mutex_ held
+    void flush(bool sync);
+    void group_commit_job();
+
+    const std::string path_;
+    const Options options_;
+
+    std::mutex file_mutex_;
+    int fd_ = -1;
+    uint64_t segment_id_ = 0;
+    size_t segment_size_ = 0;
+    // Swapped with buffer_ on flush, so both keep their capacity
+    std::string flush_buffer_;
+
+    std::mutex mutex_;
+    std::condition_variable durable_cv_;
+    std::condition_variable flush_cv_;
+    std::string buffer_;
+    uint64_t last_lsn_ = 0;
+    uint64_t durable_lsn_ = 0;
+    bool stopped_ = false;
+
+    std::thread group_commit_thread_;
+};
@@ -0,0 +1,141 @@
+#include "watch.h"
+
+#include "metrics.h"
+
+#include <algorithm>
+
+
+Watcher::Watcher(std::shared_ptr<WatchRegistry> registry, std::function<void()> wakeup)
+    : registry_(std::move(registry))
+    , wakeup_(std::move(wakeup)) {
+}
+
+Watcher::~Watcher() {
+    for (const auto& [key, is_prefix] : watches_) {
+        registry_->remove(this, key, is_prefix);
+    }
+}
+
+bool Watcher::watch(std::string_view key, bool is_prefix) {
+    if (!watches_.emplace(key, is_prefix).second) {
+        return false;
+    }
+    registry_->add(this, key, is_prefix);
+    return true;
+}
+
+bool Watcher::unwatch(std::string_view key, bool is_prefix) {
+    auto it = watches_.find(std::pair(std::string(key), is_prefix));
+    if (it == watches_.end()) {
+        return false;
+    }
+    registry_->remove(this, key, is_prefix);
+    watches_.erase(it);
+    return true;
+}
+
+bool Watcher::take(std::vector<Event>& events) {
+    events.clear();
+    std::lock_guard lock(mutex_);
+    events.swap(events_);
+    positions_.clear();
+    wakeup_pending_ = false;
+    return std::exchange(overflowed_, false);
+}
+
+void Watcher::push(std::string_view key, const std::shared_ptr<const std::string>& value) {
+    bool wakeup = false;
+    {
+        std::lock_guard lock(mutex_);
+        if (auto it = positions_.find(key); it != positions_.end()) {
+            events_[it->second].value = value;
+            metrics::add(metrics::Counter::WATCH_COALESCED);
+            return;
+        }
+        if (events_.size() >= registry_->get_max_queued_keys()) {
+            // The connection doesn't keep up, its client reads the keys again once it gets the overflow
+            metrics::add(metrics::Counter::WATCH_OVERFLOWS);
+            metrics::add(metrics::Counter::WATCH_DROPPED, events_.size());
+            events_.clear();
+            positions_.clear();
+            overflowed_ = true;
+        }
+        positions_.emplace(key, events_.size());
+        events_.push_back({std::string(key), value});
+        metrics::add(metrics::Counter::WATCH_NOTIFICATIONS);
+        wakeup = !std::exchange(wakeup_pending_, true);
+    }
+    if (wakeup) {
+        wakeup_();
+    }
+}
+
+WatchRegistry::WatchRegistry(size_t max_queued_keys)
+    : max_queued_keys_(std::max<size_t>(max_queued_keys, 1)) {
+}
+
+void WatchRegistry::notify(std::string_view key, std::string_view value) {
+    std::shared_ptr<const std::string> shared_value;
+    auto push = [&](const std::vector<Watcher*>& watchers) {
+        // Watchers of the key share one copy of the value
+        if (!shared_value) {
+            shared_value = std::make_shared<const std::string>(value);
+        }
+        for (auto* watcher : watchers) {
+            watcher->push(key, shared_value);
+        }
+    };
+
+    std::shared_lock lock(mutex_);
+    if (auto it = keys_.find(key); it != keys_.end()) {
+        push(it->second);
+    }
+    for (auto [length, count] : prefix_lengths_) {
+        if (length > key.size()) {
+            break;
+        }
+        if (auto it = prefixes_.find(key.substr(0, length)); it != prefixes_.end()) {
+            push(it->second);
+        }
+    }
+}
+
+void WatchRegistry::add(Watcher* watcher, std::string_view key, bool is_prefix) {
+    std::lock_guard lock(mutex_);
+    auto& watches = is_prefix ? prefixes_ : keys_;
+    auto it = watches.find(key);
+    if (it == watches.end()) {
+        it = watches.emplace(key, std::vector<Watcher*>()).first;
+    }
+    it->second.push_back(watcher);
+    if (is_prefix) {
+        auto length = std::lower_bound(prefix_lengths_.begin(), prefix_lengths_.end(), std::pair(key.size(), size_t(0)));
+        if (length == prefix_lengths_.end() || length->first != key.size()) {
+            length = prefix_lengths_.insert(length, {key.size(), 0});
+        }
+        ++length->second;
+    }
+    watches_count_.fetch_add(1, std::memory_order_relaxed);
+    // Pairs with the fence of a set between its write of the value and active(), see there
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void WatchRegistry::remove(Watcher* watcher, std::string_view key, bool is_prefix) {
+    std::lock_guard lock(mutex_);
+    auto& watches = is_prefix ? prefixes_ : keys_;
+    auto it = watches.find(key);
+    if (it == watches.end()) {
+        return;
+    }
+    std::erase(it->second, watcher);
+    if (it->second.empty()) {
+        watches.erase(it);
+    }
+    if (is_prefix) {
+        auto length = std::lower_bound(prefix_lengths_.begin(), prefix_lengths_.end(), std::pair(key.size(), size_t(0)));
+        if (--length->second == 0) {
+            prefix_lengths_.erase(length);
+        }
+    }
+    watches_count_.fetch_sub(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class WatchRegistry;
+
+// Lets maps keyed by std::string be searched by std::string_view
+struct WatchKeyHash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view s) const {
+        return std::hash<std::string_view>()(s);
+    }
+};
+
+// Changes of the keys a connection watches, waiting to be written to it. A key changed several times
+// before the connection takes the queue is there once, with the newest value, at the place of its first change.
+// A queue that gets more than the limit of keys drops them and remembers that it did, so that the client
+// can read the keys again instead of trusting notifications it partly missed.
+class Watcher {
+public:
+    struct Event {
+        std::string key;
+        std::shared_ptr<const std::string> value;
+    };
+
+public:
+    // wakeup is called once the queue gets an event after it was taken, from the thread of the set
+    // and with the shard of the key locked. It must only schedule the connection to take the queue.
+    Watcher(std::shared_ptr<WatchRegistry> registry, std::function<void()> wakeup);
+    // Removes the watches of the watcher, no wakeup is called after that
+    ~Watcher();
+
+    Watcher(const Watcher&) = delete;
+    Watcher& operator=(const Watcher&) = delete;
+
+    // False if the watcher already has the watch
+    bool watch(std::string_view key, bool is_prefix);
+    // False if the watcher has no such watch
+    bool unwatch(std::string_view key, bool is_prefix);
+
+    // Moves the queued events to events, which is cleared first. Returns true if events were dropped
+    // since the previous take, the dropped ones were queued before the events that are returned.
+    bool take(std::vector<Event>& events);
+
+private:
+    friend class WatchRegistry;
+
+    void push(std::string_view key, const std::shared_ptr<const std::string>& value);
+
+    const std::shared_ptr<WatchRegistry> registry_;
+    const std::function<void()> wakeup_;
+
+    // Only used by the connection
+    std::set<std::pair<std::string, bool>> watches_;
+
+    std::mutex mutex_;
+    std::vector<Event> events_;
+    // Position of every queued key in events_
+    std::unordered_map<std::string, size_t, WatchKeyHash, std::equal_to<>> positions_;
+    bool overflowed_ = false;
+    // Set once wakeup is called, until the queue is taken
+    bool wakeup_pending_ = false;
+};
+
+// Watches of all connections by key and by prefix. Storage notifies the registry of every set under
+// the lock of the shard, so a key's notifications are queued in the order of its sets.
+// A set that nobody watches only checks an atomic counter.
+class WatchRegistry {
+public:
+    explicit WatchRegistry(size_t max_queued_keys);
+
+    WatchRegistry(const WatchRegistry&) = delete;
+    WatchRegistry& operator=(const WatchRegistry&) = delete;
+
+    // A set writes the value, issues a seq_cst fence and then checks active(). A watch is counted, followed by
+    // a seq_cst fence, before the watcher reads the value. With the fences on both sides either the set sees
+    // the watch and notifies it, or the watcher reads the new value, or both.
+    bool active() const {
+        return watches_count_.load(std::memory_order_relaxed) > 0;
+    }
+
+    // Queues the value for the watchers of key and of its prefixes
+    void notify(std::string_view key, std::string_view value);
+
+    size_t get_watches_count() const {
+        return watches_count_.load(std::memory_order_relaxed);
+    }
+
+    size_t get_max_queued_keys() const {
+        return max_queued_keys_;
+    }
+
+private:
+    friend class Watcher;
+
+    using Watches = std::unordered_map<std::string, std::vector<Watcher*>, WatchKeyHash, std::equal_to<>>;
+
+    void add(Watcher* watcher, std::string_view key, bool is_prefix);
+    void remove(Watcher* watcher, std::string_view key, bool is_prefix);
+
+    const size_t max_queued_keys_;
+
+    mutable std::shared_mutex mutex_;
+    Watches keys_;
+    Watches prefixes_;
+    // Lengths of the watched prefixes and the number of prefixes of each length
+    std::vector<std::pair<size_t, size_t>> prefix_lengths_;
+    std::atomic<size_t> watches_count_ = 0;
+};
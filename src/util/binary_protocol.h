@@ -0,0 +1,201 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Compact alternative to the JSON protocol. A client switches a connection to it by sending
+// MAGIC as its first bytes; as a JSON frame length it would exceed any allowed request size.
+// All integers are little-endian.
+namespace binary_protocol {
+
+inline constexpr std::string_view MAGIC = "DBP1";
+
+enum class Opcode : uint8_t {
+    GET = 1,
+    SET = 2,
+    MGET = 3,
+    MSET = 4,
+    CAS = 5,
+    INCR = 6,
+    DECR = 7,
+    APPEND = 8,
+    SETNX = 9,
+    WATCH = 10,
+    WATCH_PREFIX = 11,
+    UNWATCH = 12,
+    UNWATCH_PREFIX = 13,
+};
+
+enum class Status : uint8_t {
+    OK = 0,
+    ERROR = 1,
+    // Not a response: the frame is a notification of a watched key
+    NOTIFICATION = 2,
+};
+
+// Request: opcode (uint8_t), key size, value size (uint32_t), key, value
+struct RequestHeader {
+    Opcode opcode;
+    uint32_t key_size;
+    uint32_t value_size;
+};
+
+inline constexpr size_t REQUEST_HEADER_SIZE = 1 + 2 * sizeof(uint32_t);
+
+// Response: status, flags (uint8_t), get count, set count (uint64_t), value size (uint32_t), value
+struct ResponseHeader {
+    Status status = Status::OK;
+    bool found = false;
+    // Only set in responses to updates
+    bool applied = false;
+    uint64_t get_count = 0;
+    uint64_t set_count = 0;
+    uint32_t value_size = 0;
+};
+
+inline constexpr size_t RESPONSE_HEADER_SIZE = 2 + 2 * sizeof(uint64_t) + sizeof(uint32_t);
+
+// Bits of the flags byte of a response
+inline constexpr uint8_t FOUND = 1;
+inline constexpr uint8_t APPLIED = 2;
+
+// Updates of a single key (CAS, INCR, DECR, APPEND, SETNX) are requests of the GET and SET layout.
+// The value of CAS is expected size (uint32_t), expected, new value; the value of INCR and DECR is
+// the delta (int64_t). The response carries the value of the key after the update, APPLIED is set
+// if the update changed it. A value INCR or DECR can't add to gets status ERROR.
+
+// MGET and MSET requests carry the number of keys in the key size field of the header
+// and the size of the items in the value size field. Items are key size (uint32_t), key for MGET
+// and key size, value size (uint32_t), key, value for MSET.
+// The response is status (uint8_t), number of keys (uint32_t), then a response per key in the order of keys.
+inline constexpr size_t BATCH_RESPONSE_HEADER_SIZE = 1 + sizeof(uint32_t);
+
+// WATCH and UNWATCH take a key, WATCH_PREFIX and UNWATCH_PREFIX a prefix in the key field, the value is empty.
+// WATCH gets the response of GET, the others an empty one. Between responses, a watching connection
+// gets notifications: Status::NOTIFICATION (uint8_t), flags (uint8_t), key size, value size (uint32_t), key, value.
+// A notification with the OVERFLOWED flag has no key: changes were dropped because the connection
+// read them too slowly, the watched keys must be read again.
+struct NotificationHeader {
+    bool overflow = false;
+    uint32_t key_size = 0;
+    uint32_t value_size = 0;
+};
+
+inline constexpr size_t NOTIFICATION_HEADER_SIZE = 2 + 2 * sizeof(uint32_t);
+inline constexpr uint8_t OVERFLOWED = 1;
+
+inline void append_uint32(std::string& out, uint32_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline uint32_t read_uint32(const char* data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+inline void append_int64(std::string& out, int64_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline int64_t read_int64(const char* data) {
+    int64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+inline void append_request(std::string& out, Opcode opcode, std::string_view key, std::string_view value) {
+    char header[REQUEST_HEADER_SIZE];
+    uint32_t key_size = key.size();
+    uint32_t value_size = value.size();
+    header[0] = static_cast<char>(opcode);
+    std::memcpy(header + 1, &key_size, sizeof(key_size));
+    std::memcpy(header + 5, &value_size, sizeof(value_size));
+    out.append(header, sizeof(header));
+    out.append(key);
+    out.append(value);
+}
+
+inline void append_batch_item(std::string& items, std::string_view key) {
+    append_uint32(items, key.size());
+    items.append(key);
+}
+
+inline void append_batch_item(std::string& items, std::string_view key, std::string_view value) {
+    append_uint32(items, key.size());
+    append_uint32(items, value.size());
+    items.append(key);
+    items.append(value);
+}
+
+inline void append_batch_request(std::string& out, Opcode opcode, uint32_t count, std::string_view items) {
+    char header[REQUEST_HEADER_SIZE];
+    uint32_t items_size = items.size();
+    header[0] = static_cast<char>(opcode);
+    std::memcpy(header + 1, &count, sizeof(count));
+    std::memcpy(header + 5, &items_size, sizeof(items_size));
+    out.append(header, sizeof(header));
+    out.append(items);
+}
+
+inline RequestHeader read_request_header(const char* data) {
+    RequestHeader header;
+    header.opcode = static_cast<Opcode>(data[0]);
+    std::memcpy(&header.key_size, data + 1, sizeof(header.key_size));
+    std::memcpy(&header.value_size, data + 5, sizeof(header.value_size));
+    return header;
+}
+
+// header.value_size is taken from value
+inline void append_response(std::string& out, const ResponseHeader& header, std::string_view value = {}) {
+    char buffer[RESPONSE_HEADER_SIZE];
+    uint32_t value_size = value.size();
+    buffer[0] = static_cast<char>(header.status);
+    buffer[1] = (header.found ? FOUND : 0) | (header.applied ? APPLIED : 0);
+    std::memcpy(buffer + 2, &header.get_count, sizeof(header.get_count));
+    std::memcpy(buffer + 10, &header.set_count, sizeof(header.set_count));
+    std::memcpy(buffer + 18, &value_size, sizeof(value_size));
+    out.append(buffer, sizeof(buffer));
+    out.append(value);
+}
+
+inline void append_notification(std::string& out, bool overflow, std::string_view key = {}, std::string_view value = {}) {
+    out.push_back(static_cast<char>(Status::NOTIFICATION));
+    out.push_back(overflow ? OVERFLOWED : 0);
+    append_uint32(out, key.size());
+    append_uint32(out, value.size());
+    out.append(key);
+    out.append(value);
+}
+
+inline bool is_notification(const char* data) {
+    return static_cast<Status>(data[0]) == Status::NOTIFICATION;
+}
+
+inline NotificationHeader read_notification_header(const char* data) {
+    NotificationHeader header;
+    header.overflow = data[1] & OVERFLOWED;
+    header.key_size = read_uint32(data + 2);
+    header.value_size = read_uint32(data + 6);
+    return header;
+}
+
+inline void append_batch_response_header(std::string& out, Status status, uint32_t count) {
+    out.push_back(static_cast<char>(status));
+    append_uint32(out, count);
+}
+
+inline ResponseHeader read_response_header(const char* data) {
+    ResponseHeader header;
+    header.status = static_cast<Status>(data[0]);
+    header.found = data[1] & FOUND;
+    header.applied = data[1] & APPLIED;
+    std::memcpy(&header.get_count, data + 2, sizeof(header.get_count));
+    std::memcpy(&header.set_count, data + 10, sizeof(header.set_count));
+    std::memcpy(&header.value_size, data + 18, sizeof(header.value_size));
+    return header;
+}
+
+}
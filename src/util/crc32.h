@@ -0,0 +1,32 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+namespace crc32_detail {
+
+constexpr std::array<uint32_t, 256> make_table() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        table[i] = c;
+    }
+    return table;
+}
+
+inline constexpr std::array<uint32_t, 256> TABLE = make_table();
+
+}
+
+// CRC-32 (IEEE), pass the previous result as crc to checksum data in parts
+inline uint32_t crc32(std::string_view data, uint32_t crc = 0) {
+    crc = ~crc;
+    for (unsigned char c : data) {
+        crc = crc32_detail::TABLE[(crc ^ c) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Consistent hashing of keys to shards. Every shard owns virtual_nodes points on a 64-bit ring, and a key
+// belongs to the shard of the first point at or after its hash. The points of shard i only depend on i,
+// so going from n to n + 1 shards moves about 1 / (n + 1) of the keys, all of them to the new shard.
+//
+// The hash is FNV-1a with a final mix, the same in every build, so that the clients, the servers and
+// the tool that splits a dictionary between the shards agree on where a key lives.
+class HashRing {
+public:
+    static constexpr size_t DEFAULT_VIRTUAL_NODES = 160;
+
+    explicit HashRing(size_t shards_count, size_t virtual_nodes = DEFAULT_VIRTUAL_NODES)
+        : shards_count_(shards_count) {
+        if (shards_count == 0 || virtual_nodes == 0) {
+            throw std::invalid_argument("Hash ring needs at least one shard and one virtual node");
+        }
+        points_.reserve(shards_count * virtual_nodes);
+        for (size_t shard = 0; shard < shards_count; ++shard) {
+            for (size_t node = 0; node < virtual_nodes; ++node) {
+                points_.emplace_back(hash("shard-" + std::to_string(shard) + "#" + std::to_string(node)), shard);
+            }
+        }
+        std::sort(points_.begin(), points_.end());
+    }
+
+    size_t shards_count() const {
+        return shards_count_;
+    }
+
+    size_t shard(std::string_view key) const {
+        if (shards_count_ == 1) {
+            return 0;
+        }
+        auto it = std::lower_bound(points_.begin(), points_.end(), std::pair<uint64_t, size_t>(hash(key), 0));
+        return it == points_.end() ? points_.front().second : it->second;
+    }
+
+    static uint64_t hash(std::string_view key) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (unsigned char c : key) {
+            h = (h ^ c) * 0x100000001b3ull;
+        }
+        // FNV-1a alone leaves similar keys close on the ring
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+private:
+    size_t shards_count_;
+    // (position, shard), sorted by position
+    std::vector<std::pair<uint64_t, size_t>> points_;
+};
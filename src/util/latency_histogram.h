@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+// Bucket layout of log-linear histograms in the spirit of HdrHistogram. Values below SUB_BUCKETS are counted exactly,
+// larger ones are grouped by their highest bit and every group is split into SUB_BUCKETS / 2 linear buckets,
+// so a bucket is narrower than 2 / SUB_BUCKETS of the values in it.
+template <int SubBucketBits>
+struct LogLinearBuckets {
+    static constexpr int SUB_BUCKET_BITS = SubBucketBits;
+    static constexpr uint64_t SUB_BUCKETS = uint64_t(1) << SUB_BUCKET_BITS;
+    static constexpr size_t COUNT = SUB_BUCKETS + (64 - SUB_BUCKET_BITS) * (SUB_BUCKETS / 2);
+
+    static size_t index(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return value;
+        }
+        int shift = std::bit_width(value) - SUB_BUCKET_BITS;
+        uint64_t mantissa = value >> shift;
+        return SUB_BUCKETS + (shift - 1) * (SUB_BUCKETS / 2) + (mantissa - SUB_BUCKETS / 2);
+    }
+
+    static uint64_t lowest_value(size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        size_t shift = (index - SUB_BUCKETS) / (SUB_BUCKETS / 2) + 1;
+        uint64_t mantissa = (index - SUB_BUCKETS) % (SUB_BUCKETS / 2) + SUB_BUCKETS / 2;
+        return mantissa << shift;
+    }
+
+    static uint64_t highest_value(size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        size_t shift = (index - SUB_BUCKETS) / (SUB_BUCKETS / 2) + 1;
+        return lowest_value(index) + ((uint64_t(1) << shift) - 1);
+    }
+};
+
+// Log-linear histogram with 256 sub-buckets, a reported value differs from the recorded one by less than 1%.
+// Recording is O(1) and doesn't allocate. Histograms with the same layout are merged by adding the counts of equal buckets.
+class LatencyHistogram {
+public:
+    using Buckets = LogLinearBuckets<8>;
+    static constexpr size_t BUCKETS_COUNT = Buckets::COUNT;
+
+public:
+    LatencyHistogram()
+        : counts_(BUCKETS_COUNT) {
+    }
+
+    void record(uint64_t value, uint64_t count = 1) {
+        counts_[bucket_index(value)] += count;
+        total_count_ += count;
+        sum_ += static_cast<double>(value) * count;
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < BUCKETS_COUNT; ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        total_count_ += other.total_count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    void reset() {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        total_count_ = 0;
+        sum_ = 0;
+        max_ = 0;
+    }
+
+    uint64_t count() const {
+        return total_count_;
+    }
+
+    uint64_t max() const {
+        return max_;
+    }
+
+    double mean() const {
+        return total_count_ > 0 ? sum_ / total_count_ : 0;
+    }
+
+    // Highest value of the bucket holding the percentile, percentile is in [0, 100]
+    uint64_t percentile(double percentile) const {
+        if (total_count_ == 0) {
+            return 0;
+        }
+        auto rank = static_cast<uint64_t>(percentile / 100 * total_count_ + 0.5);
+        rank = std::clamp<uint64_t>(rank, 1, total_count_);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS_COUNT; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return std::min(bucket_highest_value(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    // Calls f(lowest value of the bucket, count) for every non-empty bucket in the order of values
+    template <class F>
+    void for_each_bucket(F&& f) const {
+        for (size_t i = 0; i < BUCKETS_COUNT; ++i) {
+            if (counts_[i] > 0) {
+                f(bucket_lowest_value(i), counts_[i]);
+            }
+        }
+    }
+
+    static size_t bucket_index(uint64_t value) {
+        return Buckets::index(value);
+    }
+
+    static uint64_t bucket_lowest_value(size_t index) {
+        return Buckets::lowest_value(index);
+    }
+
+    static uint64_t bucket_highest_value(size_t index) {
+        return Buckets::highest_value(index);
+    }
+
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t total_count_ = 0;
+    double sum_ = 0;
+    uint64_t max_ = 0;
+};
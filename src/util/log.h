@@ -0,0 +1,326 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+// Logging that keeps stderr off the threads that serve requests. A message is formatted on the calling thread
+// and put into the queue of that thread, a background thread collects the queues and writes to stderr every few
+// milliseconds with one system call. Producers never take locks or wait: when the queue of a thread is full,
+// the message is dropped and counted.
+//
+// Every call site lets through at most RATE_LIMIT messages per second, the rest are counted and the number is
+// appended to the next message of the site that gets through, so a storm of identical errors costs a counter increment each.
+// LOG_DEBUG compiles to nothing unless DICTIONARY_WITH_DEBUG_LOGS is defined.
+//
+//     LOG_ERROR("Error reading data: " << error.message());
+namespace logging {
+
+enum class Level {
+    DEBUG,
+    INFO,
+    WARNING,
+    ERROR,
+};
+
+constexpr uint32_t RATE_LIMIT = 10;
+
+namespace detail {
+
+constexpr size_t QUEUE_CAPACITY = 4096;
+constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(10);
+
+struct Record {
+    std::chrono::system_clock::time_point time;
+    Level level;
+    uint64_t suppressed = 0;
+    std::string text;
+};
+
+// Single producer, single consumer ring of records
+class ThreadQueue {
+public:
+    ThreadQueue()
+        : records_(QUEUE_CAPACITY) {
+    }
+
+    bool push(Record&& record) {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == QUEUE_CAPACITY) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        records_[tail % QUEUE_CAPACITY] = std::move(record);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    template <class F>
+    void drain(F&& f) {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        uint64_t tail = tail_.load(std::memory_order_acquire);
+        for (; head != tail; ++head) {
+            auto& record = records_[head % QUEUE_CAPACITY];
+            f(record);
+            record.text.clear();
+        }
+        head_.store(head, std::memory_order_release);
+    }
+
+    uint64_t take_dropped() {
+        return dropped_.exchange(0, std::memory_order_relaxed);
+    }
+
+    // Set when the thread exits, the writer forgets the queue once it is drained
+    std::atomic_bool abandoned = false;
+
+private:
+    std::vector<Record> records_;
+    alignas(64) std::atomic<uint64_t> head_ = 0;
+    alignas(64) std::atomic<uint64_t> tail_ = 0;
+    std::atomic<uint64_t> dropped_ = 0;
+};
+
+class Logger {
+public:
+    Logger()
+        : thread_([this] {
+            run();
+        }) {
+    }
+
+    ~Logger() {
+        {
+            std::lock_guard lock(mutex_);
+            stopped_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+    }
+
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    std::atomic<Level> level = Level::INFO;
+
+    std::shared_ptr<ThreadQueue> register_thread() {
+        auto queue = std::make_shared<ThreadQueue>();
+        std::lock_guard lock(mutex_);
+        queues_.push_back(queue);
+        return queue;
+    }
+
+    // Waits until everything logged before the call is written
+    void flush() {
+        std::unique_lock lock(mutex_);
+        uint64_t target = ++flush_requested_;
+        cv_.notify_one();
+        flushed_cv_.wait(lock, [&] {
+            return flushed_ >= target || stopped_;
+        });
+    }
+
+private:
+    void run() {
+        std::string out;
+        std::unique_lock lock(mutex_);
+        while (true) {
+            cv_.wait_for(lock, FLUSH_INTERVAL, [this] {
+                return stopped_ || flush_requested_ > flushed_;
+            });
+            bool stopped = stopped_;
+            uint64_t flush_requested = flush_requested_;
+            // New threads register under the mutex, so the list is copied and drained without it
+            auto queues = queues_;
+            lock.unlock();
+
+            std::vector<ThreadQueue*> finished;
+            for (auto& queue : queues) {
+                // A queue abandoned before it is drained gets no more records
+                if (queue->abandoned.load()) {
+                    finished.push_back(queue.get());
+                }
+                queue->drain([&](const Record& record) {
+                    format(record, out);
+                });
+                if (uint64_t dropped = queue->take_dropped()) {
+                    out += "Log queue of a thread overflowed, " + std::to_string(dropped) + " messages dropped\n";
+                }
+            }
+            write_out(out);
+            out.clear();
+            queues.clear();
+
+            lock.lock();
+            std::erase_if(queues_, [&](const std::shared_ptr<ThreadQueue>& queue) {
+                return std::find(finished.begin(), finished.end(), queue.get()) != finished.end();
+            });
+            flushed_ = flush_requested;
+            flushed_cv_.notify_all();
+            if (stopped) {
+                return;
+            }
+        }
+    }
+
+    static void format(const Record& record, std::string& out) {
+        static const char* const LEVELS[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+        auto seconds = std::chrono::system_clock::to_time_t(record.time);
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(record.time.time_since_epoch()).count() % 1000;
+        std::tm tm;
+        localtime_r(&seconds, &tm);
+        char time[32];
+        size_t size = std::strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", &tm);
+        size += std::snprintf(time + size, sizeof(time) - size, ".%03d ", static_cast<int>(millis));
+        out.append(time, size);
+        out += LEVELS[static_cast<size_t>(record.level)];
+        out += ' ';
+        out += record.text;
+        if (record.suppressed > 0) {
+            out += " (" + std::to_string(record.suppressed) + " similar messages suppressed)";
+        }
+        out += '\n';
+    }
+
+    static void write_out(std::string_view out) {
+        while (!out.empty()) {
+            ssize_t written = ::write(STDERR_FILENO, out.data(), out.size());
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            out.remove_prefix(written);
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable flushed_cv_;
+    std::vector<std::shared_ptr<ThreadQueue>> queues_;
+    uint64_t flush_requested_ = 0;
+    uint64_t flushed_ = 0;
+    bool stopped_ = false;
+    std::thread thread_;
+};
+
+struct ThreadHandle {
+    ThreadHandle()
+        : queue(Logger::instance().register_thread()) {
+    }
+
+    ~ThreadHandle() {
+        queue->abandoned.store(true);
+    }
+
+    std::shared_ptr<ThreadQueue> queue;
+};
+
+inline ThreadQueue& local_queue() {
+    thread_local ThreadHandle handle;
+    return *handle.queue;
+}
+
+}
+
+inline void set_level(Level level) {
+    detail::Logger::instance().level.store(level, std::memory_order_relaxed);
+}
+
+inline bool enabled(Level level) {
+    return level >= detail::Logger::instance().level.load(std::memory_order_relaxed);
+}
+
+inline void flush() {
+    detail::Logger::instance().flush();
+}
+
+// Messages of a call site allowed in the current second. Only the threads that log touch it.
+class RateLimiter {
+public:
+    // Returns false if the message must be suppressed. Otherwise suppressed is set to the number of messages
+    // suppressed since the previous one that got through.
+    bool allow(uint64_t& suppressed) {
+        auto second = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        auto window = window_.load(std::memory_order_relaxed);
+        if (window != second && window_.compare_exchange_strong(window, second, std::memory_order_relaxed)) {
+            count_.store(0, std::memory_order_relaxed);
+        }
+        if (count_.fetch_add(1, std::memory_order_relaxed) >= RATE_LIMIT) {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    std::atomic<int64_t> window_ = 0;
+    std::atomic<uint32_t> count_ = 0;
+    std::atomic<uint64_t> suppressed_ = 0;
+};
+
+// Collects the text of a message and queues it when destroyed
+class Message {
+public:
+    Message(Level level, uint64_t suppressed)
+        : level_(level)
+        , suppressed_(suppressed) {
+        stream().str({});
+    }
+
+    ~Message() {
+        detail::local_queue().push({std::chrono::system_clock::now(), level_, suppressed_, stream().str()});
+    }
+
+    Message(const Message&) = delete;
+    Message& operator=(const Message&) = delete;
+
+    std::ostringstream& stream() {
+        thread_local std::ostringstream stream;
+        return stream;
+    }
+
+private:
+    Level level_;
+    uint64_t suppressed_;
+};
+
+}
+
+#define DICTIONARY_LOG(level, message) \
+    do { \
+        if (::logging::enabled(level)) { \
+            static ::logging::RateLimiter dictionary_log_limiter; \
+            uint64_t dictionary_log_suppressed = 0; \
+            if (dictionary_log_limiter.allow(dictionary_log_suppressed)) { \
+                ::logging::Message(level, dictionary_log_suppressed).stream() << message; \
+            } \
+        } \
+    } while (false)
+
+#ifdef DICTIONARY_WITH_DEBUG_LOGS
+#define LOG_DEBUG(message) DICTIONARY_LOG(::logging::Level::DEBUG, message)
+#else
+#define LOG_DEBUG(message) do {} while (false)
+#endif
+#define LOG_INFO(message) DICTIONARY_LOG(::logging::Level::INFO, message)
+#define LOG_WARNING(message) DICTIONARY_LOG(::logging::Level::WARNING, message)
+#define LOG_ERROR(message) DICTIONARY_LOG(::logging::Level::ERROR, message)
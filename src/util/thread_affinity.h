@@ -0,0 +1,19 @@
+#pragma once
+
+#include "log.h"
+
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+
+// Pins the calling thread to a CPU, failures are only reported
+inline void pin_current_thread(size_t cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (error != 0) {
+        LOG_WARNING("Failed to pin thread to CPU " << cpu << ": " << std::strerror(error));
+    }
+}